@@ -0,0 +1,2506 @@
+/*
+ * Created 261018
+ *
+ * Userspace microbenchmarks of emptyfs
+ *  kext data structures are header-only and portable  thus run on any POSIX system
+ *  the rest exercise a mounted volume through syscalls
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#ifdef __linux__
+/* sched_getcpu() */
+#define _GNU_SOURCE
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+#include "emptyfs_dirhash.h"
+#include "emptyfs_prof.h"
+#include "emptyfs_mag.h"
+#include "emptyfs_ref.h"
+#include "emptyfs_ram.h"
+#include "emptyfs_lz.h"
+#include "emptyfs_bcache.h"
+#include "emptyfs_ra.h"
+#include "emptyfs_vt.h"
+
+#define BENCH_EMPTYFS_VERSION   "0.1"
+
+#define LOG(fmt, ...)       printf("bench_emptyfs: " fmt "\n", ##__VA_ARGS__)
+#define LOG_ERR(fmt, ...)   fprintf(stderr, "bench_emptyfs: [ERR] " fmt "\n", ##__VA_ARGS__)
+
+#define ASSERT_NONNULL(p)   assert(p != NULL)
+
+static __attribute__((noreturn)) void usage(char *argv0)
+{
+    ASSERT_NONNULL(argv0);
+    fprintf(stderr,
+            "usage:\n\t"
+            "%s [-n n] [-r n] [-l] dirhash\n\t"
+            "%s [-n n] [-t n] stat path\n\t"
+            "%s [-n n] [-t n] prof\n\t"
+            "%s [-n n] [-t n] malloc\n\t"
+            "%s [-n n] [-t n] kcb\n\t"
+            "%s [-n n] [-t n] ram\n\t"
+            "%s [-n n] mmap path\n\t"
+            "%s [-n n] [-r n] [-t n] lz [path]\n\t"
+            "%s [-t n] [-L usec] [-B MB/s] ra\n\t"
+            "%s [-r n] vt\n\n\t"
+            "-n n       dirhash: entries per directory(default: 100000)\n\t"
+            "           stat  prof  malloc  kcb: calls per thread(default: 100000)\n\t"
+            "           ram: files in a directory  also reads per thread\n\t"
+            "           mmap: random page reads per pass\n\t"
+            "           lz: block reads per thread through the cache\n\t"
+            "-r n       rounds of lookups over all entries(default: 10)\n\t"
+            "           vt: passes over the image per mode\n\t"
+            "-l         also run linear scan baseline(slow for large -n)\n\t"
+            "-t n       stat  prof  malloc  kcb  ram: from 1 up to n threads(default: 8)\n\t"
+            "           lz: threads sharing the cache\n\t"
+            "           ra: queue depth of simulated device\n\t"
+            "-L usec    ra: latency of each device request(default: 100)\n\t"
+            "-B MB/s    ra: device transfer rate(default: 1000)\n\t"
+            "-v         print version\n\t"
+            "-h         print this help\n\n\t"
+            "dirhash    directory name hash lookups: hit  miss  long names\n\t"
+            "stat       stat(2) storm on a path  reports ns/call per thread count\n\t"
+            "prof       per-CPU latency histogram recording  checks percentiles\n\t"
+            "malloc     magazine caches(as behind util_malloc) vs plain malloc(3)\n\t"
+            "kcb        per-CPU kcb refcount vs a single CAS-looped one  and drain latency\n\t"
+            "ram        ramfs engine: create  write  lookup  read  rename  remove  checks\n\t"
+            "mmap       read(2) vs mmap(2) of a file  sequential and random passes\n\t"
+            "lz         image block codec: ratio  decode throughput  and hit rate of\n\t"
+            "           decompressed-block cache over a skewed workload\n\t"
+            "           of a file(default: synthetic text and binary mix)\n\t"
+            "ra         image file reads against a simulated device: 4K sync IO vs\n\t"
+            "           cluster IO vs cluster IO with read-ahead  sequential and random\n\t"
+            "vt         Merkle verification of image blocks: cost per MB of cold\n\t"
+            "           reads(scalar and multi-lane SHA-256) and of warm ones\n\n",
+            basename(argv0), basename(argv0), basename(argv0), basename(argv0),
+            basename(argv0), basename(argv0), basename(argv0), basename(argv0),
+            basename(argv0), basename(argv0));
+    exit(1);
+}
+
+static uint32_t parse_u32(char *argv0, const char *arg)
+{
+    unsigned long n;
+    char *end;
+
+    errno = 0;
+    n = strtoul(arg, &end, 0);
+    if (errno != 0 || end == arg || *end != '\0' || n > UINT32_MAX) {
+        LOG_ERR("bad numeric argument: %s", arg);
+        usage(argv0);
+    }
+
+    return (uint32_t) n;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+/* prevents lookups from being optimized out */
+static volatile uint64_t sink;
+
+/*
+ * A directory of n names laid out in a name blob  as a backend would do
+ */
+struct bench_dir {
+    char *names;
+    uint32_t *off;
+    uint32_t *len;
+    uint32_t n;
+    struct emptyfs_dirhash dh;
+};
+
+/* 200-byte prefix  long names are typical for downloads and caches */
+#define LONG_PREFIX \
+    "com.example.application.cache.0123456789abcdef0123456789abcdef." \
+    "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef." \
+    "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef-"
+
+static int format_name(char *buf, size_t sz, const char *prefix, int lng, uint32_t i)
+{
+    return snprintf(buf, sz, "%s%sfile-%u.txt", prefix, lng ? LONG_PREFIX : "", i);
+}
+
+static int bench_dir_init(struct bench_dir *d, uint32_t n, int lng)
+{
+    char name[512];
+    size_t cap = (size_t) n * (lng ? 256 : 24);
+    size_t used = 0;
+    uint32_t nslot = emptyfs_dirhash_nslot(n);
+    struct emptyfs_dirhash_slot *slot;
+    uint32_t i;
+    int len;
+
+    d->names = malloc(cap);
+    d->off = malloc(n * sizeof(*d->off));
+    d->len = malloc(n * sizeof(*d->len));
+    slot = calloc(nslot, sizeof(*slot));
+    if (d->names == NULL || d->off == NULL || d->len == NULL || slot == NULL) {
+        LOG_ERR("out of memory  n: %u", n);
+        return -1;
+    }
+    d->n = n;
+
+    for (i = 0; i < n; i++) {
+        len = format_name(name, sizeof(name), "", lng, i);
+        assert(len > 0 && used + (size_t) len <= cap);
+        memcpy(d->names + used, name, (size_t) len);
+        d->off[i] = (uint32_t) used;
+        d->len[i] = (uint32_t) len;
+        used += (size_t) len;
+    }
+
+    emptyfs_dirhash_init(&d->dh, slot, nslot, d->names);
+    for (i = 0; i < n; i++) {
+        if (emptyfs_dirhash_insert(&d->dh,
+                emptyfs_dirhash_name(d->names + d->off[i], d->len[i]),
+                d->len[i], d->off[i], i) != 0) {
+            LOG_ERR("emptyfs_dirhash_insert() fail  i: %u", i);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void bench_dir_fini(struct bench_dir *d)
+{
+    free(d->names);
+    free(d->off);
+    free(d->len);
+    free(d->dh.slot);
+}
+
+/*
+ * What vnop_lookup did before dirhash  compare every entry in turn
+ */
+static uint32_t linear_lookup(const struct bench_dir *d, const char *name, size_t len)
+{
+    uint32_t i;
+
+    for (i = 0; i < d->n; i++) {
+        if (d->len[i] == len && !memcmp(d->names + d->off[i], name, len)) return i;
+    }
+
+    return EMPTYFS_DIRHASH_NONE;
+}
+
+/*
+ * Query names are pre-formatted  so only lookups themselves are timed
+ */
+struct bench_query {
+    char *buf;
+    uint32_t *off;
+    uint32_t *len;
+};
+
+static int query_init(struct bench_query *q, uint32_t n, const char *prefix, int lng)
+{
+    char name[512];
+    size_t cap = (size_t) n * (lng ? 260 : 28);
+    size_t used = 0;
+    uint32_t i;
+    uint32_t k;
+    int len;
+
+    q->buf = malloc(cap);
+    q->off = malloc(n * sizeof(*q->off));
+    q->len = malloc(n * sizeof(*q->len));
+    if (q->buf == NULL || q->off == NULL || q->len == NULL) {
+        LOG_ERR("out of memory  n: %u", n);
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        /* a fixed odd stride visits entries out of insertion order */
+        k = (uint32_t) (((uint64_t) i * 2654435761U) % n);
+        len = format_name(name, sizeof(name), prefix, lng, k);
+        assert(len > 0 && used + (size_t) len <= cap);
+        memcpy(q->buf + used, name, (size_t) len);
+        q->off[i] = (uint32_t) used;
+        q->len[i] = (uint32_t) len;
+        used += (size_t) len;
+    }
+
+    return 0;
+}
+
+static void query_fini(struct bench_query *q)
+{
+    free(q->buf);
+    free(q->off);
+    free(q->len);
+}
+
+/**
+ * @expect_hit  1 if every query must be found  0 if none of them
+ * @return      number of wrong answers
+ */
+static unsigned long run_case(
+        const char *what,
+        const struct bench_dir *d,
+        const struct bench_query *q,
+        uint32_t rounds,
+        int linear,
+        int expect_hit)
+{
+    unsigned long err = 0;
+    uint64_t nop = 0;
+    uint32_t r, i, idx;
+    const char *name;
+    size_t len;
+    double t;
+
+    t = now_sec();
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < d->n; i++) {
+            name = q->buf + q->off[i];
+            len = q->len[i];
+            if (linear) {
+                idx = linear_lookup(d, name, len);
+            } else {
+                idx = emptyfs_dirhash_lookup(&d->dh, name, len,
+                                    emptyfs_dirhash_name(name, len));
+            }
+            if ((idx != EMPTYFS_DIRHASH_NONE) != expect_hit) err++;
+            sink += idx;
+            nop++;
+        }
+    }
+    t = now_sec() - t;
+
+    LOG("%-12s %-7s %10" PRIu64 " lookups in %.3fs  %6.1f ns/op  %.0f ops/sec",
+            what, linear ? "linear" : "dirhash", nop, t,
+            nop ? t * 1e9 / (double) nop : 0.0, t > 0 ? (double) nop / t : 0.0);
+
+    return err;
+}
+
+/**
+ * @return      number of errors
+ */
+static unsigned long do_dirhash(uint32_t n, uint32_t rounds, int linear)
+{
+    static const struct {
+        const char *what;
+        const char *prefix;
+        int lng;
+        int hit;
+    } cases[] = {
+        {"hit", "", 0, 1},
+        /* AppleDouble probes  the most common miss in practice */
+        {"miss", "._", 0, 0},
+        {"long-hit", "", 1, 1},
+        {"long-miss", "._", 1, 0},
+    };
+    unsigned long err = 0;
+    struct bench_dir d[2];
+    struct bench_query q;
+    size_t i;
+    int lng;
+
+    for (lng = 0; lng < 2; lng++) {
+        if (bench_dir_init(&d[lng], n, lng) != 0) return 1;
+    }
+
+    LOG("dirhash: %u entries  %u slots  %u round(s)", n, d[0].dh.mask + 1, rounds);
+
+    for (i = 0; i < sizeof(cases) / sizeof(*cases); i++) {
+        if (query_init(&q, n, cases[i].prefix, cases[i].lng) != 0) return err + 1;
+        err += run_case(cases[i].what, &d[cases[i].lng], &q, rounds, 0, cases[i].hit);
+        if (linear) err += run_case(cases[i].what, &d[cases[i].lng], &q, 1, 1, cases[i].hit);
+        query_fini(&q);
+    }
+
+    for (lng = 0; lng < 2; lng++) bench_dir_fini(&d[lng]);
+
+    if (err != 0) LOG_ERR("dirhash: %lu wrong answer(s)", err);
+    return err;
+}
+
+/*
+ * Start gate  so that all workers race at the same moment
+ *  pthread_barrier_t isn't available on macOS
+ */
+struct start_gate {
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    int open;
+};
+
+static void gate_wait(struct start_gate *g)
+{
+    (void) pthread_mutex_lock(&g->mtx);
+    while (!g->open) (void) pthread_cond_wait(&g->cond, &g->mtx);
+    (void) pthread_mutex_unlock(&g->mtx);
+}
+
+static void gate_open(struct start_gate *g)
+{
+    (void) pthread_mutex_lock(&g->mtx);
+    g->open = 1;
+    (void) pthread_cond_broadcast(&g->cond);
+    (void) pthread_mutex_unlock(&g->mtx);
+}
+
+struct stat_worker {
+    pthread_t thread;
+    const char *path;
+    uint32_t n;
+    struct start_gate *gate;
+    unsigned long err;
+    double t;       /* seconds spent by this thread */
+};
+
+static void *stat_worker_main(void *arg)
+{
+    struct stat_worker *w = arg;
+    struct stat st;
+    uint32_t i;
+    double t;
+
+    gate_wait(w->gate);
+
+    t = now_sec();
+    for (i = 0; i < w->n; i++) {
+        if (stat(w->path, &st) != 0) w->err++;
+        sink += (uint64_t) st.st_size;
+    }
+    w->t = now_sec() - t;
+
+    return NULL;
+}
+
+/**
+ * @return      number of errors
+ */
+static unsigned long do_stat(const char *path, uint32_t n, uint32_t nthread)
+{
+    unsigned long err = 0;
+    struct stat_worker *w;
+    struct start_gate gate = {
+        PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0,
+    };
+    struct stat st;
+    uint32_t t, i;
+    double sum, wall;
+    int e;
+
+    if (stat(path, &st) != 0) {
+        LOG_ERR("stat(2) fail  path: %s errno: %d", path, errno);
+        return 1;
+    }
+
+    w = calloc(nthread, sizeof(*w));
+    if (w == NULL) {
+        LOG_ERR("out of memory  nthread: %u", nthread);
+        return 1;
+    }
+
+    LOG("stat: %s  %u calls per thread", path, n);
+
+    for (t = 1; t <= nthread; t++) {
+        gate.open = 0;
+
+        for (i = 0; i < t; i++) {
+            memset(&w[i], 0, sizeof(w[i]));
+            w[i].path = path;
+            w[i].n = n;
+            w[i].gate = &gate;
+            e = pthread_create(&w[i].thread, NULL, stat_worker_main, &w[i]);
+            if (e != 0) {
+                LOG_ERR("pthread_create() fail  errno: %d", e);
+                exit(1);
+            }
+        }
+
+        wall = now_sec();
+        gate_open(&gate);
+        for (i = 0, sum = 0; i < t; i++) {
+            (void) pthread_join(w[i].thread, NULL);
+            sum += w[i].t;
+            err += w[i].err;
+        }
+        wall = now_sec() - wall;
+
+        /* per-call latency as seen by each thread  and aggregate throughput */
+        LOG("%3u thread(s)  %8.1f ns/call  %12.0f calls/sec",
+                t, sum * 1e9 / ((double) n * t),
+                wall > 0 ? (double) n * t / wall : 0.0);
+    }
+
+    free(w);
+    if (err != 0) LOG_ERR("stat: %lu failed call(s)", err);
+    return err;
+}
+
+/* emulated CPU slots  more threads than slots exercise contended recording */
+#define PROF_NSLOT      4
+
+struct prof_worker {
+    pthread_t thread;
+    struct emptyfs_prof_cpu *pc;
+    uint64_t *sample;   /* latencies this thread records */
+    uint32_t n;
+    struct start_gate *gate;
+    double t;
+};
+
+static void *prof_worker_main(void *arg)
+{
+    struct prof_worker *w = arg;
+    uint32_t i;
+    double t;
+
+    gate_wait(w->gate);
+
+    t = now_sec();
+    for (i = 0; i < w->n; i++)
+        emptyfs_prof_record(w->pc, EMPTYFS_PROF_VNOP_LOOKUP, w->sample[i]);
+    w->t = now_sec() - t;
+
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Generate a long-tailed latency distribution  i.e. mostly 100ns..1us
+ *  with occasional slow calls up to about a millisecond
+ */
+static void prof_gen(uint64_t *sample, uint32_t n, uint64_t seed)
+{
+    uint64_t x = seed | 1;
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        sample[i] = 100 + x % 900;
+        if (x % 1000 == 0) sample[i] += (x >> 20) % 1000000;
+    }
+}
+
+/**
+ * An estimate is only exact to its bucket  so it must land in the same
+ *  or an adjacent bucket as the exact percentile
+ * @return      number of errors
+ */
+static unsigned long prof_check(
+        const struct emptyfs_prof_cpu *pc,
+        const uint64_t *sorted,
+        uint64_t n,
+        uint32_t ppm,
+        const char *what)
+{
+    uint64_t rank = (n * ppm + 999999) / 1000000;
+    uint64_t exact = sorted[rank ? rank - 1 : 0];
+    uint64_t est = emptyfs_prof_percentile(pc, EMPTYFS_PROF_VNOP_LOOKUP, ppm);
+    uint32_t be = emptyfs_prof_bucket(exact);
+    uint32_t bs = emptyfs_prof_bucket(est);
+
+    LOG("  %-5s exact %8" PRIu64 " ns  estimate %8" PRIu64 " ns", what, exact, est);
+    if (bs + 1 < be || be + 1 < bs) {
+        LOG_ERR("prof: %s estimate off by more than a bucket", what);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @return      number of errors
+ */
+static unsigned long do_prof(uint32_t n, uint32_t nthread)
+{
+    unsigned long err = 0;
+    struct prof_worker *w;
+    struct emptyfs_prof_cpu *slot;
+    struct emptyfs_prof_cpu *total;
+    struct start_gate gate = {
+        PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0,
+    };
+    uint64_t *all;
+    uint64_t sum, nall;
+    uint32_t t, i;
+    double tsum;
+    int e;
+
+    w = calloc(nthread, sizeof(*w));
+    slot = calloc(PROF_NSLOT, sizeof(*slot));
+    total = calloc(1, sizeof(*total));
+    all = calloc((size_t) n * nthread, sizeof(*all));
+    if (w == NULL || slot == NULL || total == NULL || all == NULL) {
+        LOG_ERR("out of memory  n: %u nthread: %u", n, nthread);
+        exit(1);
+    }
+
+    for (i = 0; i < nthread; i++) prof_gen(all + (size_t) n * i, n, 0x9e3779b9 + i);
+
+    LOG("prof: %u records per thread  %u slot(s)", n, PROF_NSLOT);
+
+    for (t = 1; t <= nthread; t++) {
+        gate.open = 0;
+        memset(slot, 0, PROF_NSLOT * sizeof(*slot));
+        memset(total, 0, sizeof(*total));
+
+        for (i = 0; i < t; i++) {
+            memset(&w[i], 0, sizeof(w[i]));
+            w[i].pc = &slot[i % PROF_NSLOT];
+            w[i].sample = all + (size_t) n * i;
+            w[i].n = n;
+            w[i].gate = &gate;
+            e = pthread_create(&w[i].thread, NULL, prof_worker_main, &w[i]);
+            if (e != 0) {
+                LOG_ERR("pthread_create() fail  errno: %d", e);
+                exit(1);
+            }
+        }
+
+        gate_open(&gate);
+        for (i = 0, tsum = 0; i < t; i++) {
+            (void) pthread_join(w[i].thread, NULL);
+            tsum += w[i].t;
+        }
+
+        for (i = 0; i < PROF_NSLOT; i++) emptyfs_prof_merge(total, &slot[i]);
+
+        nall = (uint64_t) n * t;
+        for (i = 0, sum = 0; i < nall; i++) sum += all[i];
+        if (emptyfs_prof_calls(total, EMPTYFS_PROF_VNOP_LOOKUP) != nall ||
+                total->sum_ns[EMPTYFS_PROF_VNOP_LOOKUP] != sum) {
+            LOG_ERR("prof: lost record(s)  calls: %" PRIu64 " expected: %" PRIu64,
+                        emptyfs_prof_calls(total, EMPTYFS_PROF_VNOP_LOOKUP), nall);
+            err++;
+        }
+
+        LOG("%3u thread(s)  %8.1f ns/record", t, tsum * 1e9 / (double) nall);
+    }
+
+    /* samples of the last run  sorting them gives exact percentiles */
+    nall = (uint64_t) n * nthread;
+    qsort(all, nall, sizeof(*all), cmp_u64);
+    err += prof_check(total, all, nall, 500000, "p50");
+    err += prof_check(total, all, nall, 990000, "p99");
+    err += prof_check(total, all, nall, 999000, "p999");
+
+    free(all);
+    free(total);
+    free(slot);
+    free(w);
+    if (err != 0) LOG_ERR("prof: %lu error(s)", err);
+    return err;
+}
+
+/*
+ * Userspace rendition of util_malloc()/util_mfree()  see: kext/src/utils.c
+ *  same size classes and header  malloc(3) as system allocator
+ */
+#define MCACHE_MIN_SHIFT    4
+#define MCACHE_NCLASS       7
+#define MCACHE_LARGE        ((uint32_t) -1)
+#define MCACHE_NSLOT        64      /* emulated CPU slots */
+
+struct mhdr {
+    uint32_t cls;
+    uint32_t pad;
+    uint64_t size;
+};
+
+static struct emptyfs_mag_cache mcache[MCACHE_NCLASS];
+static struct emptyfs_mag_cpu *mcache_cpu;
+static volatile int64_t backend_live;   /* system allocations not yet freed */
+
+static void *mcache_backend_alloc(size_t size, int flags)
+{
+    void *p;
+    (void) flags;
+    p = malloc(size);
+    if (p != NULL) (void) __atomic_fetch_add(&backend_live, 1, __ATOMIC_RELAXED);
+    return p;
+}
+
+static void mcache_backend_free(void *addr, size_t size)
+{
+    (void) size;
+    (void) __atomic_fetch_sub(&backend_live, 1, __ATOMIC_RELAXED);
+    free(addr);
+}
+
+static uint32_t mcache_class(size_t sz)
+{
+    uint32_t cls = 0;
+
+    while (cls < MCACHE_NCLASS && ((size_t) 1 << (cls + MCACHE_MIN_SHIFT)) < sz) cls++;
+    return cls < MCACHE_NCLASS ? cls : MCACHE_LARGE;
+}
+
+static uint32_t mcache_cpu_hint(uint32_t self)
+{
+#ifdef __linux__
+    int cpu = sched_getcpu();
+    if (cpu >= 0) return (uint32_t) cpu;
+#endif
+    return self;
+}
+
+static void *mcache_malloc(size_t size, uint32_t self)
+{
+    struct mhdr *h;
+    uint32_t cls = mcache_class(size + sizeof(*h));
+
+    if (cls != MCACHE_LARGE) {
+        h = emptyfs_mag_alloc(&mcache[cls], mcache_cpu_hint(self), 0);
+    } else {
+        h = mcache_backend_alloc(size + sizeof(*h), 0);
+    }
+    if (h == NULL) return NULL;
+
+    h->cls = cls;
+    h->size = size;
+    return h + 1;
+}
+
+static void mcache_mfree(void *addr, uint32_t self)
+{
+    struct mhdr *h = (struct mhdr *) addr - 1;
+
+    if (h->cls != MCACHE_LARGE) {
+        emptyfs_mag_free(&mcache[h->cls], mcache_cpu_hint(self), h);
+    } else {
+        mcache_backend_free(h, h->size + sizeof(*h));
+    }
+}
+
+/* live objects per thread  a lookup-heavy workload keeps few of them */
+#define MALLOC_NLIVE    64
+
+struct malloc_worker {
+    pthread_t thread;
+    uint32_t self;
+    uint32_t n;
+    int cached;
+    struct start_gate *gate;
+    unsigned long err;
+    double t;
+};
+
+static void *malloc_worker_main(void *arg)
+{
+    struct malloc_worker *w = arg;
+    uint64_t *live[MALLOC_NLIVE] = {NULL};
+    uint64_t x = 0x9e3779b97f4a7c15ULL ^ w->self;
+    uint64_t tag;
+    uint32_t i, k;
+    size_t sz;
+    double t;
+
+    gate_wait(w->gate);
+
+    t = now_sec();
+    for (i = 0; i < w->n; i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        k = (uint32_t) (x % MALLOC_NLIVE);
+        if (live[k] != NULL) {
+            /* an object handed out twice would've been overwritten */
+            tag = ((uint64_t) w->self << 32) | k;
+            if (*live[k] != tag) w->err++;
+            if (w->cached) mcache_mfree(live[k], w->self); else free(live[k]);
+            live[k] = NULL;
+        } else {
+            /* fsnodes  names  small buffers  an occasional large one */
+            sz = (x >> 8) % 64 == 0 ? 4096 : 8 + (size_t) ((x >> 16) % 1000);
+            live[k] = w->cached ? mcache_malloc(sz, w->self) : malloc(sz);
+            if (live[k] == NULL) {
+                w->err++;
+                continue;
+            }
+            *live[k] = ((uint64_t) w->self << 32) | k;
+        }
+    }
+    w->t = now_sec() - t;
+
+    for (k = 0; k < MALLOC_NLIVE; k++) {
+        if (live[k] == NULL) continue;
+        if (w->cached) mcache_mfree(live[k], w->self); else free(live[k]);
+    }
+
+    return NULL;
+}
+
+/**
+ * @return      number of errors
+ */
+static unsigned long do_malloc(uint32_t n, uint32_t nthread)
+{
+    unsigned long err = 0;
+    struct malloc_worker *w;
+    struct start_gate gate = {
+        PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0,
+    };
+    uint32_t t, i;
+    int cached, e;
+    double sum, wall;
+
+    w = calloc(nthread, sizeof(*w));
+    mcache_cpu = calloc((size_t) MCACHE_NCLASS * MCACHE_NSLOT, sizeof(*mcache_cpu));
+    if (w == NULL || mcache_cpu == NULL) {
+        LOG_ERR("out of memory  nthread: %u", nthread);
+        exit(1);
+    }
+
+    for (i = 0; i < MCACHE_NCLASS; i++) {
+        e = emptyfs_mag_init(&mcache[i], (size_t) 1 << (i + MCACHE_MIN_SHIFT),
+                    mcache_cpu + (size_t) i * MCACHE_NSLOT, MCACHE_NSLOT,
+                    mcache_backend_alloc, mcache_backend_free, 0, NULL);
+        if (e != 0) {
+            LOG_ERR("emptyfs_mag_init() fail  class: %u", i);
+            exit(1);
+        }
+    }
+
+    LOG("malloc: %u calls per thread  %u live objects per thread", n, MALLOC_NLIVE);
+
+    for (t = 1; t <= nthread; t++) {
+        for (cached = 0; cached < 2; cached++) {
+            gate.open = 0;
+            for (i = 0; i < t; i++) {
+                memset(&w[i], 0, sizeof(w[i]));
+                w[i].self = i;
+                w[i].n = n;
+                w[i].cached = cached;
+                w[i].gate = &gate;
+                e = pthread_create(&w[i].thread, NULL, malloc_worker_main, &w[i]);
+                if (e != 0) {
+                    LOG_ERR("pthread_create() fail  errno: %d", e);
+                    exit(1);
+                }
+            }
+
+            wall = now_sec();
+            gate_open(&gate);
+            for (i = 0, sum = 0; i < t; i++) {
+                (void) pthread_join(w[i].thread, NULL);
+                sum += w[i].t;
+                err += w[i].err;
+            }
+            wall = now_sec() - wall;
+
+            LOG("%3u thread(s)  %-8s %8.1f ns/call  %12.0f calls/sec",
+                    t, cached ? "magazine" : "malloc", sum * 1e9 / ((double) n * t),
+                    wall > 0 ? (double) n * t / wall : 0.0);
+        }
+    }
+
+    for (i = 0; i < MCACHE_NCLASS; i++) emptyfs_mag_fini(&mcache[i], NULL);
+    if (backend_live != 0) {
+        LOG_ERR("malloc: %" PRId64 " system allocation(s) leaked", (int64_t) backend_live);
+        err++;
+    }
+
+    free(mcache_cpu);
+    free(w);
+    if (err != 0) LOG_ERR("malloc: %lu error(s)", err);
+    return err;
+}
+
+/*
+ * The kcb refcount before it went per-CPU  a single CAS-looped counter
+ *  drained by polling every millisecond
+ */
+static volatile int32_t legacy_kcb;
+
+static int legacy_get(void)
+{
+    int32_t rd;
+
+    do {
+        rd = __atomic_load_n(&legacy_kcb, __ATOMIC_RELAXED);
+        if (rd < 0) return -1;
+    } while (!__atomic_compare_exchange_n(&legacy_kcb, &rd, rd + 1, 0,
+                    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    return 0;
+}
+
+static void legacy_put(void)
+{
+    (void) __atomic_fetch_sub(&legacy_kcb, 1, __ATOMIC_SEQ_CST);
+}
+
+static void legacy_invalidate(void)
+{
+    struct timespec ts = {0, 1000000};   /* 1ms */
+    int32_t zero;
+
+    do {
+        while (__atomic_load_n(&legacy_kcb, __ATOMIC_RELAXED) > 0) (void) nanosleep(&ts, NULL);
+        zero = 0;
+    } while (!__atomic_compare_exchange_n(&legacy_kcb, &zero, -1, 0,
+                    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+}
+
+/*
+ * Userspace rendition of per-CPU kcb  see: kext/src/utils.c
+ *  a mutex-protected condvar stands in for assert_wait()/thread_wakeup()
+ */
+static struct emptyfs_ref kcb;
+static pthread_mutex_t kcb_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t kcb_cond = PTHREAD_COND_INITIALIZER;
+
+static void kcb_wakeup(void)
+{
+    (void) pthread_mutex_lock(&kcb_mtx);
+    (void) pthread_cond_signal(&kcb_cond);
+    (void) pthread_mutex_unlock(&kcb_mtx);
+}
+
+static int kcb_get(uint32_t self)
+{
+    if (emptyfs_ref_get(&kcb, mcache_cpu_hint(self)) == 0) return 0;
+    kcb_wakeup();
+    return -1;
+}
+
+static void kcb_put(uint32_t self)
+{
+    if (emptyfs_ref_put(&kcb, mcache_cpu_hint(self))) kcb_wakeup();
+}
+
+static void kcb_invalidate(void)
+{
+    emptyfs_ref_kill(&kcb);
+    (void) pthread_mutex_lock(&kcb_mtx);
+    while (emptyfs_ref_sum(&kcb) != 0) (void) pthread_cond_wait(&kcb_cond, &kcb_mtx);
+    (void) pthread_mutex_unlock(&kcb_mtx);
+}
+
+struct kcb_worker {
+    pthread_t thread;
+    uint32_t self;
+    uint32_t n;         /* get/put pairs  zero means until invalidated */
+    int percpu;
+    struct start_gate *gate;
+    double t;
+    double last_put;    /* when the last reference was dropped */
+};
+
+static void *kcb_worker_main(void *arg)
+{
+    struct kcb_worker *w = arg;
+    uint32_t i;
+    double t;
+
+    struct timespec ts = {0, 200000};   /* 200us */
+
+    gate_wait(w->gate);
+
+    t = now_sec();
+    for (i = 0; w->n == 0 || i < w->n; i++) {
+        if (w->percpu ? kcb_get(w->self) : legacy_get()) break;
+        if (w->n != 0) {
+            /* a callback that does a little work */
+            sink += i;
+        } else {
+            /* a callback that blocks  e.g. on I/O  unload must wait for it */
+            (void) nanosleep(&ts, NULL);
+            w->last_put = now_sec();
+        }
+        if (w->percpu) kcb_put(w->self); else legacy_put();
+        /*
+         * idle a while  o.w. CAS drain may starve
+         *  :. it needs to catch the refcount at zero between two polls
+         */
+        if (w->n == 0) (void) nanosleep(&ts, NULL);
+    }
+    w->t = now_sec() - t;
+
+    return NULL;
+}
+
+static void kcb_run(struct kcb_worker *w, uint32_t t, uint32_t n, int percpu, struct start_gate *gate)
+{
+    uint32_t i;
+    int e;
+
+    gate->open = 0;
+    for (i = 0; i < t; i++) {
+        memset(&w[i], 0, sizeof(w[i]));
+        w[i].self = i;
+        w[i].n = n;
+        w[i].percpu = percpu;
+        w[i].gate = gate;
+        e = pthread_create(&w[i].thread, NULL, kcb_worker_main, &w[i]);
+        if (e != 0) {
+            LOG_ERR("pthread_create() fail  errno: %d", e);
+            exit(1);
+        }
+    }
+    gate_open(gate);
+}
+
+/**
+ * @return      number of errors
+ */
+static unsigned long do_kcb(uint32_t n, uint32_t nthread)
+{
+    unsigned long err = 0;
+    struct kcb_worker *w;
+    struct start_gate gate = {
+        PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0,
+    };
+    struct timespec ts = {0, 20000000};     /* 20ms */
+    uint32_t t, i;
+    int percpu;
+    double sum, last, done;
+
+    w = calloc(nthread, sizeof(*w));
+    if (w == NULL) {
+        LOG_ERR("out of memory  nthread: %u", nthread);
+        exit(1);
+    }
+
+    LOG("kcb: %u get/put pairs per thread", n);
+
+    for (t = 1; t <= nthread; t++) {
+        for (percpu = 0; percpu < 2; percpu++) {
+            kcb_run(w, t, n, percpu, &gate);
+            for (i = 0, sum = 0; i < t; i++) {
+                (void) pthread_join(w[i].thread, NULL);
+                sum += w[i].t;
+            }
+            LOG("%3u thread(s)  %-7s %8.1f ns/pair", t,
+                    percpu ? "per-CPU" : "CAS", sum * 1e9 / ((double) n * t));
+        }
+    }
+
+    /* invalidate while callbacks keep coming  measure the drain */
+    for (percpu = 0; percpu < 2; percpu++) {
+        kcb_run(w, nthread, 0, percpu, &gate);
+        (void) nanosleep(&ts, NULL);
+
+        if (percpu) kcb_invalidate(); else legacy_invalidate();
+        done = now_sec();
+
+        for (i = 0, last = 0; i < nthread; i++) {
+            (void) pthread_join(w[i].thread, NULL);
+            if (w[i].last_put > last) last = w[i].last_put;
+        }
+
+        if (percpu ? emptyfs_ref_sum(&kcb) != 0 || kcb_get(0) == 0 :
+                    legacy_kcb != -1 || legacy_get() == 0) {
+            LOG_ERR("kcb: %s refcount not drained", percpu ? "per-CPU" : "CAS");
+            err++;
+        }
+
+        LOG("drain  %-7s %8.1f us after last put", percpu ? "per-CPU" : "CAS",
+                (done - last) * 1e6);
+    }
+
+    free(w);
+    if (err != 0) LOG_ERR("kcb: %lu error(s)", err);
+    return err;
+}
+
+/*
+ * ramfs engine over malloc(3)  see: kext/src/emptyfs_ram.h
+ *  guarded by a rwlock per volume  as the kext does
+ */
+static void *ram_alloc(size_t size)
+{
+    return malloc(size);
+}
+
+static void ram_free(void *addr, size_t size)
+{
+    (void) size;
+    free(addr);
+}
+
+static void ram_now(struct emptyfs_ram_ts *ts)
+{
+    struct timespec t;
+    (void) clock_gettime(CLOCK_REALTIME, &t);
+    ts->sec = t.tv_sec;
+    ts->nsec = t.tv_nsec;
+}
+
+static const struct emptyfs_ram_ops ram_ops = {ram_alloc, ram_free, ram_now};
+
+/* xfer callbacks  ctx is a cursor into a user buffer */
+static int ram_copyout(void *ctx, char *buf, size_t len)
+{
+    char **p = ctx;
+    memcpy(*p, buf, len);
+    *p += len;
+    return 0;
+}
+
+static int ram_copyin(void *ctx, char *buf, size_t len)
+{
+    char **p = ctx;
+    memcpy(buf, *p, len);
+    *p += len;
+    return 0;
+}
+
+/* not chunk-aligned on purpose  i.e. a partial tail chunk per file */
+#define RAM_FILESZ      3000
+#define RAM_BIGSZ       (4U << 20)
+
+static void ram_fill(char *buf, size_t len, uint32_t salt)
+{
+    size_t i;
+    for (i = 0; i < len; i++) buf[i] = (char) (i * 31 + salt);
+}
+
+static int ram_name(char *buf, size_t sz, char prefix, uint32_t i)
+{
+    return snprintf(buf, sz, "%c%u", prefix, i);
+}
+
+/**
+ * List a directory in two halves  removing every other remaining entry between
+ *  them  resumes by cookie as readdir does  each survivor must show up once
+ * @return      number of errors
+ */
+static unsigned long ram_check_readdir(struct emptyfs_ram *ram, uint64_t dino, uint32_t n)
+{
+    unsigned long err = 0;
+    struct emptyfs_ram_node *dn = emptyfs_ram_node(ram, dino);
+    const struct emptyfs_ram_dirent *de;
+    uint8_t *seen;
+    uint64_t cookie = 0;
+    uint64_t ino;
+    uint32_t i, k, got = 0;
+    char name[32];
+
+    seen = calloc(n, 1);
+    if (seen == NULL) return 1;
+
+    for (i = emptyfs_ram_dir_seek(&dn->u.dir, cookie); i < dn->u.dir.nent; ) {
+        de = &dn->u.dir.ent[i];
+        memcpy(name, dn->u.dir.names + de->off, de->len);
+        name[de->len] = '\0';
+        k = (uint32_t) strtoul(name + 1, NULL, 10);
+        if (k >= n || seen[k]++) err++;
+        got++;
+        /* cookie of next entry  as vnop_readdir hands out */
+        cookie = de->seq + 1;
+        i = emptyfs_ram_dir_seek(&dn->u.dir, cookie);
+
+        if (got == n / 2) {
+            /* remove every other name not yet listed  may compact entries */
+            for (k = 0; k < n; k += 2) {
+                if (seen[k]) continue;
+                (void) ram_name(name, sizeof(name), 'g', k);
+                if (emptyfs_ram_lookup(ram, dino, name, strlen(name), &ino) != 0 ||
+                        emptyfs_ram_unlink(ram, dino, name, strlen(name), ino, 0) != 0) {
+                    err++;
+                    continue;
+                }
+                emptyfs_ram_release(ram, ino);
+                seen[k] = 2;    /* removed */
+            }
+            i = emptyfs_ram_dir_seek(&dn->u.dir, cookie);
+        }
+    }
+
+    for (k = 0, i = 0; k < n; k++) {
+        if (seen[k] == 0) err++;
+        if (seen[k] == 1) i++;
+    }
+    if (i != got || dn->u.dir.nlive != got) err++;
+
+    free(seen);
+    if (err != 0) LOG_ERR("ram: readdir across removals  %lu error(s)", err);
+    return err;
+}
+
+/**
+ * Holes  sparse extension  truncation of a big file
+ * @return      number of errors
+ */
+/**
+ * @return      1 if emptyfs_ram_map() doesn't answer as expected  0 o.w.
+ */
+static unsigned long ram_check_map(
+        const struct emptyfs_ram_node *n,
+        uint64_t off,
+        uint64_t len,
+        int hole,
+        uint64_t run)
+{
+    uint64_t got;
+    int h;
+
+    got = emptyfs_ram_map(n, off, len, &h);
+    if (h == hole && got == run) return 0;
+
+    LOG_ERR("ram: map  off: %" PRIu64 " len: %" PRIu64 " hole: %d run: %" PRIu64
+            "  want hole: %d run: %" PRIu64, off, len, h, got, hole, run);
+    return 1;
+}
+
+static unsigned long ram_check_big(struct emptyfs_ram *ram, uint64_t dino)
+{
+    unsigned long err = 0;
+    struct emptyfs_ram_node *n;
+    char *src, *dst, *p;
+    uint64_t ino;
+    size_t done;
+    size_t i;
+
+    src = malloc(RAM_BIGSZ);
+    dst = malloc(RAM_BIGSZ);
+    if (src == NULL || dst == NULL) return 1;
+
+    if (emptyfs_ram_create(ram, dino, "big", 3, EMPTYFS_RAM_REG, 0644, 0, 0, &ino) != 0)
+        return 1;
+    n = emptyfs_ram_node(ram, ino);
+
+    /* a hole of 1M  then 1M of data at an unaligned offset */
+    ram_fill(src, RAM_BIGSZ, 7);
+    p = src;
+    if (emptyfs_ram_write(ram, n, (1U << 20) + 123, 1U << 20, ram_copyin, &p, &done) != 0 ||
+            done != 1U << 20 || n->size != (2U << 20) + 123) {
+        err++;
+    }
+    /* sparse  only data chunks allocated */
+    if (n->u.file.nalloc != (1U << 20) / EMPTYFS_RAM_CHUNK + 1) err++;
+
+    p = dst;
+    memset(dst, 0xff, RAM_BIGSZ);
+    if (emptyfs_ram_read(ram, n, 0, RAM_BIGSZ, ram_copyout, &p, &done) != 0 ||
+            done != (2U << 20) + 123) {
+        err++;
+    }
+    for (i = 0; i < (1U << 20) + 123; i++) {
+        if (dst[i] != 0) {
+            err++;
+            break;
+        }
+    }
+    if (memcmp(dst + (1U << 20) + 123, src, 1U << 20) != 0) err++;
+
+    /* block map as vnop_blockmap sees it  a hole run  a data run  past EOF */
+    err += ram_check_map(n, 0, RAM_BIGSZ, 1, 1U << 20);
+    err += ram_check_map(n, 1U << 20, RAM_BIGSZ, 0, (1U << 20) + EMPTYFS_RAM_CHUNK);
+    err += ram_check_map(n, (1U << 20) + 100, 8, 0, 8);
+    err += ram_check_map(n, (2U << 20) + 2 * EMPTYFS_RAM_CHUNK, EMPTYFS_RAM_CHUNK,
+                            1, EMPTYFS_RAM_CHUNK);
+
+    /* shrink into a chunk  then grow back  the tail must read as zeros */
+    if (emptyfs_ram_truncate(ram, n, (1U << 20) + 200) != 0 ||
+            emptyfs_ram_truncate(ram, n, RAM_BIGSZ) != 0) {
+        err++;
+    }
+    p = dst;
+    if (emptyfs_ram_read(ram, n, (1U << 20) + 123, RAM_BIGSZ, ram_copyout, &p, &done) != 0 ||
+            done != RAM_BIGSZ - (1U << 20) - 123) {
+        err++;
+    }
+    if (memcmp(dst, src, 77) != 0) err++;
+    for (i = 77; i < done; i++) {
+        if (dst[i] != 0) {
+            err++;
+            break;
+        }
+    }
+
+    if (emptyfs_ram_unlink(ram, dino, "big", 3, ino, 0) != 0) err++;
+    emptyfs_ram_release(ram, ino);
+
+    free(src);
+    free(dst);
+    if (err != 0) LOG_ERR("ram: big file  %lu error(s)", err);
+    return err;
+}
+
+struct ram_worker {
+    pthread_t thread;
+    struct emptyfs_ram *ram;
+    pthread_rwlock_t *lock;
+    uint64_t dino;
+    uint32_t self;
+    uint32_t nfile;
+    uint32_t n;         /* ops  zero means writer  runs until stop */
+    volatile int *stop;
+    struct start_gate *gate;
+    unsigned long err;
+    double t;
+};
+
+/*
+ * Readers look up a random file and read it  the writer churns files
+ *  each op takes the volume lock once  like a vnop does
+ */
+static void *ram_worker_main(void *arg)
+{
+    struct ram_worker *w = arg;
+    uint64_t x = 0x9e3779b97f4a7c15ULL ^ w->self;
+    char buf[RAM_FILESZ];
+    char name[32];
+    uint64_t ino;
+    size_t done;
+    uint32_t i;
+    char *p;
+    double t;
+
+    gate_wait(w->gate);
+
+    t = now_sec();
+    for (i = 0; w->n != 0 ? i < w->n : !*w->stop; i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        if (w->n != 0) {
+            (void) ram_name(name, sizeof(name), 'g', (uint32_t) (x % w->nfile));
+            (void) pthread_rwlock_rdlock(w->lock);
+            p = buf;
+            if (emptyfs_ram_lookup(w->ram, w->dino, name, strlen(name), &ino) != 0 ||
+                    emptyfs_ram_read(w->ram, emptyfs_ram_node(w->ram, ino), 0,
+                                    sizeof(buf), ram_copyout, &p, &done) != 0 ||
+                    done != RAM_FILESZ) {
+                w->err++;
+            }
+            (void) pthread_rwlock_unlock(w->lock);
+        } else {
+            (void) ram_name(name, sizeof(name), 'w', i);
+            (void) pthread_rwlock_wrlock(w->lock);
+            p = buf;
+            if (emptyfs_ram_create(w->ram, w->dino, name, strlen(name),
+                                    EMPTYFS_RAM_REG, 0644, 0, 0, &ino) != 0 ||
+                    emptyfs_ram_write(w->ram, emptyfs_ram_node(w->ram, ino), 0,
+                                    sizeof(buf), ram_copyin, &p, &done) != 0 ||
+                    emptyfs_ram_unlink(w->ram, w->dino, name, strlen(name), ino, 0) != 0) {
+                w->err++;
+            }
+            emptyfs_ram_release(w->ram, ino);
+            (void) pthread_rwlock_unlock(w->lock);
+        }
+    }
+    w->t = now_sec() - t;
+    if (w->n == 0) w->n = i;
+
+    return NULL;
+}
+
+static void ram_report(const char *what, double t, uint32_t n, double bytes)
+{
+    if (bytes > 0) {
+        LOG("%-10s %8.1f ns/op  %8.1f MB/s", what, t * 1e9 / n, bytes / t / 1e6);
+    } else {
+        LOG("%-10s %8.1f ns/op", what, t * 1e9 / n);
+    }
+}
+
+/**
+ * @return      number of errors
+ */
+static unsigned long do_ram(uint32_t n, uint32_t nthread)
+{
+    unsigned long err = 0;
+    struct emptyfs_ram ram;
+    struct emptyfs_ram_node *node;
+    pthread_rwlock_t lock = PTHREAD_RWLOCK_INITIALIZER;
+    struct start_gate gate = {
+        PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0,
+    };
+    struct ram_worker *w;
+    volatile int stop;
+    char buf[RAM_FILESZ];
+    char name[32];
+    char name2[32];
+    uint64_t *ino;
+    uint64_t dino, got = 0, x;
+    uint32_t i, t;
+    size_t done;
+    char *p;
+    double t0, sum, wall;
+    int e;
+
+    ino = calloc(n, sizeof(*ino));
+    w = calloc(nthread + 1, sizeof(*w));
+    if (ino == NULL || w == NULL) {
+        LOG_ERR("out of memory  n: %u", n);
+        exit(1);
+    }
+
+    /* enough chunks for all files plus the big one */
+    e = emptyfs_ram_init(&ram, &ram_ops, (uint64_t) n * 2 + (RAM_BIGSZ / EMPTYFS_RAM_CHUNK) * 2,
+                            0755, 0, 0);
+    if (e != 0) {
+        LOG_ERR("emptyfs_ram_init() fail  errno: %d", e);
+        exit(1);
+    }
+
+    LOG("ram: %u files of %u bytes in a directory", n, RAM_FILESZ);
+
+    e = emptyfs_ram_create(&ram, EMPTYFS_RAM_ROOT_INO, "d", 1, EMPTYFS_RAM_DIR,
+                            0755, 0, 0, &dino);
+    if (e != 0) err++;
+
+    t0 = now_sec();
+    for (i = 0; i < n; i++) {
+        (void) ram_name(name, sizeof(name), 'f', i);
+        if (emptyfs_ram_create(&ram, dino, name, strlen(name), EMPTYFS_RAM_REG,
+                                0644, 0, 0, &ino[i]) != 0) {
+            err++;
+        }
+    }
+    ram_report("create", now_sec() - t0, n, 0);
+
+    t0 = now_sec();
+    for (i = 0; i < n; i++) {
+        ram_fill(buf, sizeof(buf), i);
+        p = buf;
+        node = emptyfs_ram_node(&ram, ino[i]);
+        if (node == NULL || emptyfs_ram_write(&ram, node, 0, sizeof(buf),
+                                ram_copyin, &p, &done) != 0 || done != sizeof(buf)) {
+            err++;
+        }
+    }
+    ram_report("write", now_sec() - t0, n, (double) n * RAM_FILESZ);
+
+    t0 = now_sec();
+    for (i = 0, x = 1; i < n; i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        (void) ram_name(name, sizeof(name), 'f', (uint32_t) (x % n));
+        if (emptyfs_ram_lookup(&ram, dino, name, strlen(name), &got) != 0) err++;
+        sink += got;
+    }
+    ram_report("lookup", now_sec() - t0, n, 0);
+
+    t0 = now_sec();
+    for (i = 0; i < n; i++) {
+        p = buf;
+        node = emptyfs_ram_node(&ram, ino[i]);
+        if (node == NULL || emptyfs_ram_read(&ram, node, 0, sizeof(buf),
+                                ram_copyout, &p, &done) != 0 || done != sizeof(buf)) {
+            err++;
+            continue;
+        }
+        sink += (uint8_t) buf[i % sizeof(buf)];
+    }
+    ram_report("read", now_sec() - t0, n, (double) n * RAM_FILESZ);
+
+    /* content check out of timing */
+    for (i = 0; i < n; i++) {
+        char want[RAM_FILESZ];
+        ram_fill(want, sizeof(want), i);
+        p = buf;
+        (void) emptyfs_ram_read(&ram, emptyfs_ram_node(&ram, ino[i]), 0,
+                                sizeof(buf), ram_copyout, &p, &done);
+        if (memcmp(buf, want, sizeof(buf)) != 0) err++;
+    }
+
+    t0 = now_sec();
+    for (i = 0; i < n; i++) {
+        (void) ram_name(name, sizeof(name), 'f', i);
+        (void) ram_name(name2, sizeof(name2), 'g', i);
+        if (emptyfs_ram_rename(&ram, dino, name, strlen(name), ino[i],
+                        dino, name2, strlen(name2), EMPTYFS_RAM_INO_NONE) != 0) {
+            err++;
+        }
+    }
+    ram_report("rename", now_sec() - t0, n, 0);
+
+    err += ram_check_big(&ram, dino);
+
+    /* concurrent lookup+read against a writer churning files */
+    for (t = 1; t <= nthread; t++) {
+        gate.open = 0;
+        stop = 0;
+        for (i = 0; i <= t; i++) {
+            memset(&w[i], 0, sizeof(w[i]));
+            w[i].ram = &ram;
+            w[i].lock = &lock;
+            w[i].dino = dino;
+            w[i].self = i;
+            w[i].nfile = n;
+            w[i].n = i < t ? n : 0;
+            w[i].stop = &stop;
+            w[i].gate = &gate;
+            e = pthread_create(&w[i].thread, NULL, ram_worker_main, &w[i]);
+            if (e != 0) {
+                LOG_ERR("pthread_create() fail  errno: %d", e);
+                exit(1);
+            }
+        }
+
+        wall = now_sec();
+        gate_open(&gate);
+        for (i = 0, sum = 0; i < t; i++) {
+            (void) pthread_join(w[i].thread, NULL);
+            sum += w[i].t;
+            err += w[i].err;
+        }
+        wall = now_sec() - wall;
+        stop = 1;
+        (void) pthread_join(w[t].thread, NULL);
+        err += w[t].err;
+
+        LOG("%3u reader(s) + 1 writer  %8.1f ns/read  %12.0f reads/sec  %8u writes",
+                t, sum * 1e9 / ((double) n * t),
+                wall > 0 ? (double) n * t / wall : 0.0, w[t].n);
+    }
+
+    err += ram_check_readdir(&ram, dino, n);
+
+    t0 = now_sec();
+    for (i = 0; i < n; i++) {
+        (void) ram_name(name, sizeof(name), 'g', i);
+        e = emptyfs_ram_unlink(&ram, dino, name, strlen(name), EMPTYFS_RAM_INO_NONE, 0);
+        /* even ones are gone in readdir check */
+        if (e != 0 && !(e == ENOENT && i % 2 == 0)) err++;
+        emptyfs_ram_release(&ram, ino[i]);
+    }
+    ram_report("remove", now_sec() - t0, n, 0);
+
+    if (emptyfs_ram_unlink(&ram, EMPTYFS_RAM_ROOT_INO, "d", 1, dino, 1) != 0) err++;
+    emptyfs_ram_release(&ram, dino);
+
+    /* everything but root gone  all chunks back in arena */
+    if (ram.nfiles != 0 || ram.ndirs != 1 || ram.arena.nused != 0) {
+        LOG_ERR("ram: leaked  files: %" PRIu64 " dirs: %" PRIu64 " chunks: %" PRIu64,
+                    ram.nfiles, ram.ndirs, ram.arena.nused);
+        err++;
+    }
+    LOG("arena      %" PRIu64 " slab(s)  %" PRIu64 " KB peak", ram.arena.nslab,
+            ram.arena.nslab * EMPTYFS_RAM_SLAB_CHUNKS * EMPTYFS_RAM_CHUNK / 1024);
+
+    emptyfs_ram_fini(&ram);
+    free(w);
+    free(ino);
+    if (err != 0) LOG_ERR("ram: %lu error(s)", err);
+    return err;
+}
+
+/* bytes per op of a sequential pass  i.e. what cp(1) would use */
+#define MMAP_SEQ_BLK    (64 * 1024)
+/* bytes per op of a random pass */
+#define MMAP_RAND_BLK   4096
+
+/**
+ * One pass over a file  by pread(2)  or by memcpy() out of a mapping
+ *  both copy into buf  thus they're compared like for like
+ * @map         NULL for pread(2)
+ * @off         offsets of n blocks  NULL for a sequential pass of whole file
+ * @nop         (OUT) number of blocks read
+ * @return      checksum of first word of each block  to check passes agree
+ */
+static uint64_t mmap_pass(
+        int fd,
+        const char *map,
+        uint64_t size,
+        const uint64_t *off,
+        uint32_t n,
+        size_t blk,
+        char *buf,
+        uint32_t *nop,
+        unsigned long *err)
+{
+    uint64_t h = 0, w, o;
+    uint32_t i;
+    size_t k;
+
+    for (i = 0; ; i++) {
+        if (off != NULL) {
+            if (i == n) break;
+            o = off[i];
+        } else {
+            o = (uint64_t) i * blk;
+            if (o >= size) break;
+        }
+        k = size - o < blk ? (size_t) (size - o) : blk;
+
+        if (map != NULL) {
+            memcpy(buf, map + o, k);
+        } else if (pread(fd, buf, k, (off_t) o) != (ssize_t) k) {
+            (*err)++;
+            continue;
+        }
+
+        w = 0;
+        memcpy(&w, buf, k < sizeof(w) ? k : sizeof(w));
+        h = (h ^ w) * 0x100000001b3ULL;
+    }
+
+    *nop = i;
+    return h;
+}
+
+/**
+ * @return      number of errors
+ */
+static unsigned long do_mmap(const char *path, uint32_t n)
+{
+    static const struct {
+        const char *what;
+        int map;
+        int rand;
+    } passes[] = {
+        {"seq-read", 0, 0},
+        {"seq-mmap", 1, 0},
+        {"rand-read", 0, 1},
+        {"rand-mmap", 1, 1},
+    };
+    unsigned long err = 0;
+    uint64_t sum[2] = {0, 0};
+    uint64_t *off;
+    uint64_t size, h, x = 1;
+    uint32_t i, nop;
+    struct stat st;
+    char *map, *buf;
+    size_t blk;
+    double t;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        LOG_ERR("cannot open  path: %s errno: %d", path, errno);
+        return 1;
+    }
+    size = (uint64_t) st.st_size;
+    if (size == 0) {
+        LOG_ERR("empty file  path: %s", path);
+        (void) close(fd);
+        return 1;
+    }
+
+    map = mmap(NULL, (size_t) size, PROT_READ, MAP_SHARED, fd, 0);
+    off = calloc(n, sizeof(*off));
+    buf = malloc(MMAP_SEQ_BLK);
+    if (map == MAP_FAILED || off == NULL || buf == NULL) {
+        LOG_ERR("mmap(2) or malloc(3) fail  errno: %d", errno);
+        exit(1);
+    }
+
+    for (i = 0; i < n; i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        off[i] = x % size / MMAP_RAND_BLK * MMAP_RAND_BLK;
+    }
+
+    LOG("mmap: %s  %" PRIu64 " bytes  %u random reads per pass", path, size, n);
+
+    /* warm up  so that all passes are served from UBC rather than the first one */
+    (void) mmap_pass(fd, NULL, size, NULL, 0, MMAP_SEQ_BLK, buf, &nop, &err);
+
+    for (i = 0; i < sizeof(passes) / sizeof(*passes); i++) {
+        blk = passes[i].rand ? MMAP_RAND_BLK : MMAP_SEQ_BLK;
+        t = now_sec();
+        h = mmap_pass(fd, passes[i].map ? map : NULL, size, passes[i].rand ? off : NULL,
+                        n, blk, buf, &nop, &err);
+        t = now_sec() - t;
+
+        /* read(2) and mmap(2) must see the same data */
+        if (!passes[i].map) {
+            sum[passes[i].rand] = h;
+        } else if (sum[passes[i].rand] != h) {
+            LOG_ERR("mmap: %s disagrees with read(2)", passes[i].what);
+            err++;
+        }
+
+        ram_report(passes[i].what, t, nop,
+                    passes[i].rand ? (double) nop * MMAP_RAND_BLK : (double) size);
+    }
+
+    (void) munmap(map, (size_t) size);
+    (void) close(fd);
+    free(off);
+    free(buf);
+    if (err != 0) LOG_ERR("mmap: %lu error(s)", err);
+    return err;
+}
+
+/* synthetic corpus  16 MiB */
+#define LZ_SYNTH_BLOCKS     4096
+#define LZ_BSIZE            4096
+/* 80% of reads go to 10% of blocks */
+#define LZ_HOT_PCT          80
+#define LZ_HOT_DIV          10
+
+/*
+ * A corpus split into independently compressed blocks  as an image stores them
+ */
+struct lz_corpus {
+    uint8_t *raw;
+    uint32_t nb;
+    uint8_t *z;             /* compressed blocks back to back */
+    uint64_t *zoff;         /* nb + 1 offsets into z */
+    uint32_t nstored;       /* blocks which didn't compress */
+};
+
+static uint64_t lz_rand(uint64_t *x)
+{
+    *x ^= *x << 13; *x ^= *x >> 7; *x ^= *x << 17;
+    return *x;
+}
+
+/**
+ * Source text with a skewed vocabulary  little-endian tables  and some noise
+ *  about what a tree of sources and binaries looks like to a byte-level LZ
+ */
+static void lz_synth(uint8_t *buf, size_t size)
+{
+    static const char *kw[] = {
+        "static", "int", "return", "if", "else", "for", "struct", "const",
+        "uint64_t", "char", "void", "while", "sizeof", "NULL", "break", "case",
+    };
+    uint64_t x = 0x9e3779b97f4a7c15ULL, r;
+    size_t i = 0, j, n;
+    uint32_t v;
+
+    while (i < size) {
+        r = lz_rand(&x);
+        n = (size_t) (r >> 8) % 2048 + 64;
+        if (n > size - i) n = size - i;
+
+        switch (r % 8) {
+        case 0:
+            /* noise  i.e. already compressed data */
+            for (j = 0; j < n; j++) buf[i + j] = (uint8_t) lz_rand(&x);
+            break;
+        case 1:
+        case 2:
+            /* a table of small integers */
+            for (j = 0; j + 4 <= n; j += 4) {
+                v = (uint32_t) (lz_rand(&x) % 1000);
+                memcpy(buf + i + j, &v, 4);
+            }
+            for (; j < n; j++) buf[i + j] = 0;
+            break;
+        default:
+            /* text  low-index words are far more frequent */
+            for (j = 0; j < n; ) {
+                r = lz_rand(&x);
+                const char *w = kw[(r % 16) * (r % 16) / 16];
+                size_t k = strlen(w);
+                if (j + k + 1 > n) k = n - j - 1;
+                memcpy(buf + i + j, w, k);
+                j += k;
+                if (j < n) buf[i + j++] = r & 0x100 ? '\n' : ' ';
+            }
+            break;
+        }
+        i += n;
+    }
+}
+
+/**
+ * @return      number of errors
+ */
+static unsigned long lz_decode(const struct lz_corpus *c, uint32_t i, uint8_t *dst)
+{
+    size_t len = (size_t) (c->zoff[i + 1] - c->zoff[i]), out;
+
+    if (len == LZ_BSIZE) {
+        memcpy(dst, c->z + c->zoff[i], LZ_BSIZE);
+        return 0;
+    }
+    if (emptyfs_lz_decompress(c->z + c->zoff[i], len, dst, LZ_BSIZE, &out) != 0 || out != LZ_BSIZE)
+        return 1;
+    return 0;
+}
+
+static void *lz_alloc(size_t size)
+{
+    return malloc(size);
+}
+
+static void lz_free(void *p, size_t size)
+{
+    (void) size;
+    free(p);
+}
+
+static const struct emptyfs_bcache_ops lz_cache_ops = {lz_alloc, lz_free};
+
+struct lz_worker {
+    pthread_t thread;
+    const struct lz_corpus *c;
+    struct emptyfs_bcache *cache;   /* NULL to decode every read */
+    pthread_mutex_t *lock;
+    struct start_gate *gate;
+    uint32_t n;
+    uint64_t seed;
+    uint64_t zbytes;                /* compressed bytes "read from device" */
+    unsigned long err;
+    double t;
+};
+
+/*
+ * Mirrors img_cache_read() of the kext  decoding runs unlocked
+ */
+static void *lz_worker_main(void *arg)
+{
+    struct lz_worker *w = (struct lz_worker *) arg;
+    const struct lz_corpus *c = w->c;
+    uint8_t buf[LZ_BSIZE];
+    const char *hit;
+    uint64_t x = w->seed;
+    uint32_t i, blk, nhot = c->nb / LZ_HOT_DIV ? c->nb / LZ_HOT_DIV : 1;
+    double t;
+
+    gate_wait(w->gate);
+    t = now_sec();
+    for (i = 0; i < w->n; i++) {
+        /* hot blocks are scattered  as hot files are in an image */
+        blk = lz_rand(&x) % 100 < LZ_HOT_PCT ?
+                (uint32_t) (lz_rand(&x) % nhot) * LZ_HOT_DIV % c->nb :
+                (uint32_t) (lz_rand(&x) % c->nb);
+
+        if (w->cache != NULL) {
+            (void) pthread_mutex_lock(w->lock);
+            hit = emptyfs_bcache_get(w->cache, 2, blk);
+            if (hit != NULL) memcpy(buf, hit, LZ_BSIZE);
+            (void) pthread_mutex_unlock(w->lock);
+            if (hit != NULL) continue;
+        }
+
+        w->err += lz_decode(c, blk, buf);
+        w->zbytes += c->zoff[blk + 1] - c->zoff[blk];
+
+        if (w->cache != NULL) {
+            (void) pthread_mutex_lock(w->lock);
+            emptyfs_bcache_put(w->cache, 2, blk, (const char *) buf);
+            (void) pthread_mutex_unlock(w->lock);
+        }
+    }
+    w->t = now_sec() - t;
+    sink += buf[0];
+
+    return NULL;
+}
+
+/**
+ * @frac        cache holds 1/frac of corpus  0 for no cache
+ * @return      number of errors
+ */
+static unsigned long lz_cache_run(
+        const struct lz_corpus *c,
+        uint32_t frac,
+        uint32_t n,
+        uint32_t nthread)
+{
+    unsigned long err = 0;
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    struct start_gate gate = {
+        PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0,
+    };
+    struct emptyfs_bcache cache;
+    struct lz_worker *w;
+    uint64_t zbytes = 0;
+    double t = 0, reads = (double) n * nthread;
+    uint32_t nslot = frac != 0 ? c->nb / frac : 0, i;
+    int e;
+
+    if (nslot != 0 && emptyfs_bcache_init(&cache, &lz_cache_ops, nslot, LZ_BSIZE) != 0) {
+        LOG_ERR("emptyfs_bcache_init() fail  slots: %u", nslot);
+        exit(1);
+    }
+
+    w = calloc(nthread, sizeof(*w));
+    if (w == NULL) {
+        LOG_ERR("calloc(3) fail  nthread: %u", nthread);
+        exit(1);
+    }
+
+    for (i = 0; i < nthread; i++) {
+        w[i].c = c;
+        w[i].cache = nslot != 0 ? &cache : NULL;
+        w[i].lock = &lock;
+        w[i].gate = &gate;
+        w[i].n = n;
+        w[i].seed = 0x2545f4914f6cdd1dULL * (i + 1);
+        e = pthread_create(&w[i].thread, NULL, lz_worker_main, &w[i]);
+        if (e) {
+            LOG_ERR("pthread_create() fail  errno: %d", e);
+            exit(1);
+        }
+    }
+    gate_open(&gate);
+    for (i = 0; i < nthread; i++) {
+        (void) pthread_join(w[i].thread, NULL);
+        if (w[i].t > t) t = w[i].t;
+        zbytes += w[i].zbytes;
+        err += w[i].err;
+    }
+
+    if (nslot == 0) {
+        LOG("%-10s %8.1f ns/read  %8.1f MB/s  hit   0.0%%  device %6.0f B/read",
+                "no cache", t * 1e9 / reads, reads * LZ_BSIZE / t / 1e6, (double) zbytes / reads);
+    } else {
+        char what[32];
+        (void) snprintf(what, sizeof(what), "1/%u", frac);
+        LOG("%-10s %8.1f ns/read  %8.1f MB/s  hit %5.1f%%  device %6.0f B/read  evicts %" PRIu64,
+                what, t * 1e9 / reads, reads * LZ_BSIZE / t / 1e6,
+                100.0 * (double) cache.hits / (double) (cache.hits + cache.misses),
+                (double) zbytes / reads, cache.evicts);
+        emptyfs_bcache_fini(&cache);
+    }
+
+    free(w);
+    return err;
+}
+
+/**
+ * @return      number of errors
+ */
+static unsigned long do_lz(const char *path, uint32_t n, uint32_t rounds, uint32_t nthread)
+{
+    static const uint32_t frac[] = {32, 8, 2};
+    struct emptyfs_lz_enc enc;
+    struct lz_corpus c;
+    unsigned long err = 0;
+    uint8_t buf[LZ_BSIZE];
+    size_t size, len;
+    uint32_t i, r;
+    double t;
+    int fd;
+
+    memset(&c, 0, sizeof(c));
+
+    if (path != NULL) {
+        struct stat st;
+        fd = open(path, O_RDONLY);
+        if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < LZ_BSIZE) {
+            LOG_ERR("cannot open(or too small)  path: %s errno: %d", path, errno);
+            if (fd >= 0) (void) close(fd);
+            return 1;
+        }
+        /* whole blocks only  the tail is dropped */
+        c.nb = (uint32_t) (st.st_size / LZ_BSIZE);
+        size = (size_t) c.nb * LZ_BSIZE;
+        c.raw = malloc(size);
+        if (c.raw == NULL || pread(fd, c.raw, size, 0) != (ssize_t) size) {
+            LOG_ERR("cannot read  path: %s errno: %d", path, errno);
+            exit(1);
+        }
+        (void) close(fd);
+    } else {
+        c.nb = LZ_SYNTH_BLOCKS;
+        size = (size_t) c.nb * LZ_BSIZE;
+        c.raw = malloc(size);
+        if (c.raw == NULL) {
+            LOG_ERR("malloc(3) fail  size: %zu", size);
+            exit(1);
+        }
+        lz_synth(c.raw, size);
+    }
+
+    c.z = malloc(size);
+    c.zoff = calloc(c.nb + 1, sizeof(*c.zoff));
+    if (c.z == NULL || c.zoff == NULL) {
+        LOG_ERR("malloc(3) fail  size: %zu", size);
+        exit(1);
+    }
+
+    /* as mkfs_emptyfs -z does */
+    t = now_sec();
+    for (i = 0; i < c.nb; i++) {
+        len = emptyfs_lz_compress(&enc, c.raw + (size_t) i * LZ_BSIZE, LZ_BSIZE,
+                                    c.z + c.zoff[i], LZ_BSIZE - 1);
+        if (len == 0) {
+            memcpy(c.z + c.zoff[i], c.raw + (size_t) i * LZ_BSIZE, LZ_BSIZE);
+            len = LZ_BSIZE;
+            c.nstored++;
+        }
+        c.zoff[i + 1] = c.zoff[i] + len;
+    }
+    t = now_sec() - t;
+
+    LOG("lz: %s  %u blocks  %.2fx  %u stored  compress %.1f MB/s",
+            path != NULL ? path : "synthetic", c.nb, (double) size / (double) c.zoff[c.nb],
+            c.nstored, (double) size / t / 1e6);
+
+    for (i = 0; i < c.nb; i++) {
+        if (lz_decode(&c, i, buf) != 0 || memcmp(buf, c.raw + (size_t) i * LZ_BSIZE, LZ_BSIZE)) {
+            LOG_ERR("lz: block %u doesn't round-trip", i);
+            err++;
+        }
+    }
+
+    t = now_sec();
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < c.nb; i++) err += lz_decode(&c, i, buf);
+    }
+    t = now_sec() - t;
+    sink += buf[0];
+    LOG("lz: decode %.1f MB/s  %.1f ns/block", (double) size * rounds / t / 1e6,
+            t * 1e9 / ((double) c.nb * rounds));
+
+    LOG("lz: %u reads per thread  %u thread(s)  %d%% of reads to %d%% of blocks",
+            n, nthread, LZ_HOT_PCT, 100 / LZ_HOT_DIV);
+    err += lz_cache_run(&c, 0, n, nthread);
+    for (i = 0; i < sizeof(frac) / sizeof(*frac); i++) {
+        if (c.nb / frac[i] != 0) err += lz_cache_run(&c, frac[i], n, nthread);
+    }
+
+    free(c.raw);
+    free(c.z);
+    free(c.zoff);
+    if (err != 0) LOG_ERR("lz: %lu error(s)", err);
+    return err;
+}
+
+/* a simulated image file  and how it's read */
+#define RA_FILE_SIZE        (64ULL << 20)
+#define RA_PAGE             4096U
+/* preferred IO size of the device  i.e. f_iosize */
+#define RA_IOSIZE           (1U << 20)
+#define RA_RAND_READ        (16U << 10)
+#define RA_RAND_READS       256
+
+/* page states */
+#define RA_ABSENT           0
+#define RA_BUSY             1
+#define RA_RESIDENT         2
+
+struct ra_req {
+    struct ra_req *next;
+    uint64_t off;
+    uint64_t len;
+};
+
+/*
+ * A device serving up to nthr requests at once  each costs a fixed latency
+ *  (overlapped) plus transfer time(serialized  as on a single link)
+ *  page states stand in for UBC
+ */
+struct ra_dev {
+    pthread_mutex_t lock;
+    pthread_cond_t cv;              /* request queued  or pages became resident */
+    pthread_mutex_t bus;
+    struct ra_req *head;
+    struct ra_req **tail;
+    uint8_t *page;
+    uint64_t lat_ns;
+    uint64_t bw;                    /* bytes per second */
+    uint64_t nreq;
+    uint64_t bytes;
+    int stop;
+    pthread_t *thr;
+    uint32_t nthr;
+};
+
+static void ra_sleep_ns(uint64_t ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = (time_t) (ns / 1000000000ULL);
+    ts.tv_nsec = (long) (ns % 1000000000ULL);
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) continue;
+}
+
+static void *ra_dev_main(void *arg)
+{
+    struct ra_dev *d = (struct ra_dev *) arg;
+    struct ra_req *r;
+    uint64_t i;
+
+    (void) pthread_mutex_lock(&d->lock);
+    for (;;) {
+        while (d->head == NULL && !d->stop) (void) pthread_cond_wait(&d->cv, &d->lock);
+        if (d->head == NULL) break;
+        r = d->head;
+        d->head = r->next;
+        if (d->head == NULL) d->tail = &d->head;
+        (void) pthread_mutex_unlock(&d->lock);
+
+        ra_sleep_ns(d->lat_ns);
+        (void) pthread_mutex_lock(&d->bus);
+        ra_sleep_ns(r->len * 1000000000ULL / d->bw);
+        (void) pthread_mutex_unlock(&d->bus);
+
+        (void) pthread_mutex_lock(&d->lock);
+        for (i = r->off / RA_PAGE; i < (r->off + r->len) / RA_PAGE; i++) d->page[i] = RA_RESIDENT;
+        d->nreq++;
+        d->bytes += r->len;
+        (void) pthread_cond_broadcast(&d->cv);
+        free(r);
+    }
+    (void) pthread_mutex_unlock(&d->lock);
+
+    return NULL;
+}
+
+/**
+ * Queue IO for absent pages of a range  split at iosize  as cluster IO does
+ *  lock must be held
+ */
+static void ra_dev_submit_locked(struct ra_dev *d, uint64_t off, uint64_t len, uint32_t iosize)
+{
+    uint64_t i = off / RA_PAGE, end = (off + len + RA_PAGE - 1) / RA_PAGE, j;
+    struct ra_req *r;
+
+    while (i < end) {
+        if (d->page[i] != RA_ABSENT) {
+            i++;
+            continue;
+        }
+        for (j = i; j < end && d->page[j] == RA_ABSENT && (j - i + 1) * RA_PAGE <= iosize; j++)
+            d->page[j] = RA_BUSY;
+
+        r = malloc(sizeof(*r));
+        if (r == NULL) {
+            LOG_ERR("malloc(3) fail");
+            exit(1);
+        }
+        r->next = NULL;
+        r->off = i * RA_PAGE;
+        r->len = (j - i) * RA_PAGE;
+        *d->tail = r;
+        d->tail = &r->next;
+        i = j;
+    }
+    (void) pthread_cond_broadcast(&d->cv);
+}
+
+/*
+ * A read of a range  returns once all its pages are resident
+ */
+static void ra_dev_read(struct ra_dev *d, uint64_t off, uint64_t len, uint32_t iosize)
+{
+    uint64_t i = off / RA_PAGE, end = (off + len + RA_PAGE - 1) / RA_PAGE;
+
+    (void) pthread_mutex_lock(&d->lock);
+    ra_dev_submit_locked(d, off, len, iosize);
+    while (i < end) {
+        if (d->page[i] == RA_RESIDENT) i++;
+        else (void) pthread_cond_wait(&d->cv, &d->lock);
+    }
+    (void) pthread_mutex_unlock(&d->lock);
+}
+
+/*
+ * Like advisory_read()  queue and return
+ */
+static void ra_dev_prefetch(struct ra_dev *d, uint64_t off, uint64_t len, uint32_t iosize)
+{
+    (void) pthread_mutex_lock(&d->lock);
+    ra_dev_submit_locked(d, off, len, iosize);
+    (void) pthread_mutex_unlock(&d->lock);
+}
+
+static void ra_dev_start(struct ra_dev *d, uint32_t qdepth, uint64_t lat_ns, uint64_t bw)
+{
+    uint32_t i;
+    int e;
+
+    memset(d, 0, sizeof(*d));
+    (void) pthread_mutex_init(&d->lock, NULL);
+    (void) pthread_mutex_init(&d->bus, NULL);
+    (void) pthread_cond_init(&d->cv, NULL);
+    d->tail = &d->head;
+    d->lat_ns = lat_ns;
+    d->bw = bw;
+    d->page = calloc(RA_FILE_SIZE / RA_PAGE, 1);
+    d->thr = calloc(qdepth, sizeof(*d->thr));
+    if (d->page == NULL || d->thr == NULL) {
+        LOG_ERR("calloc(3) fail");
+        exit(1);
+    }
+
+    for (i = 0; i < qdepth; i++) {
+        e = pthread_create(&d->thr[i], NULL, ra_dev_main, d);
+        if (e) {
+            LOG_ERR("pthread_create() fail  errno: %d", e);
+            exit(1);
+        }
+    }
+    d->nthr = qdepth;
+}
+
+/**
+ * Drain queued read-ahead  and stop
+ * @return      pages left not resident
+ */
+static uint64_t ra_dev_stop(struct ra_dev *d, uint64_t off, uint64_t len)
+{
+    uint64_t i, n = 0;
+
+    (void) pthread_mutex_lock(&d->lock);
+    d->stop = 1;
+    (void) pthread_cond_broadcast(&d->cv);
+    (void) pthread_mutex_unlock(&d->lock);
+    for (i = 0; i < d->nthr; i++) (void) pthread_join(d->thr[i], NULL);
+
+    for (i = off / RA_PAGE; i < (off + len) / RA_PAGE; i++) n += d->page[i] != RA_RESIDENT;
+
+    free(d->page);
+    free(d->thr);
+    (void) pthread_mutex_destroy(&d->lock);
+    (void) pthread_mutex_destroy(&d->bus);
+    (void) pthread_cond_destroy(&d->cv);
+    return n;
+}
+
+enum ra_mode {
+    RA_4K,          /* a page at a time  synchronously */
+    RA_CLUSTER,     /* a read at once  split at preferred IO size */
+    RA_AHEAD,       /* plus read-ahead  as emptyfs_vnop_read() */
+};
+
+/**
+ * @rsize       size of each read  0 for random reads of RA_RAND_READ
+ * @return      number of errors
+ */
+static unsigned long ra_run(enum ra_mode mode, uint32_t rsize, uint32_t qdepth,
+                            uint64_t lat_ns, uint64_t bw)
+{
+    static const char *name[] = {"4K sync", "cluster", "read-ahead"};
+    struct emptyfs_ra ra;
+    struct ra_dev d;
+    uint64_t off, len, ra_off = 0, ra_len, total = 0, x = 0x9e3779b97f4a7c15ULL, left;
+    uint32_t i, nread = rsize != 0 ? (uint32_t) (RA_FILE_SIZE / rsize) : RA_RAND_READS;
+    uint32_t nbatch = 0;
+    char what[48];
+    double t;
+
+    emptyfs_ra_reset(&ra);
+    ra_dev_start(&d, qdepth, lat_ns, bw);
+
+    t = now_sec();
+    for (i = 0; i < nread; i++) {
+        if (rsize != 0) {
+            off = (uint64_t) i * rsize;
+            len = rsize;
+        } else {
+            off = lz_rand(&x) % (RA_FILE_SIZE / RA_RAND_READ) * RA_RAND_READ;
+            len = RA_RAND_READ;
+        }
+
+        if (mode == RA_4K) {
+            for (ra_len = 0; ra_len < len; ra_len += RA_PAGE)
+                ra_dev_read(&d, off + ra_len, RA_PAGE, RA_PAGE);
+        } else {
+            ra_dev_read(&d, off, len, RA_IOSIZE);
+        }
+        total += len;
+
+        if (mode == RA_AHEAD) {
+            ra_len = emptyfs_ra_advise(&ra, off, len, RA_FILE_SIZE, RA_IOSIZE,
+                                        EMPTYFS_RA_MAX, &ra_off);
+            if (ra_len != 0) {
+                ra_dev_prefetch(&d, ra_off, ra_len, RA_IOSIZE);
+                nbatch++;
+            }
+        }
+    }
+    t = now_sec() - t;
+
+    /* every page read must be resident */
+    left = rsize != 0 ? ra_dev_stop(&d, 0, RA_FILE_SIZE) : ra_dev_stop(&d, 0, 0);
+
+    (void) snprintf(what, sizeof(what), "%s %uK %s", name[mode],
+                    (rsize != 0 ? rsize : RA_RAND_READ) >> 10, rsize != 0 ? "seq" : "rand");
+    LOG("%-22s %8.1f MB/s  %7" PRIu64 " IOs  device %6.2fx of read  %u batches",
+            what, (double) total / t / 1e6, d.nreq, (double) d.bytes / (double) total, nbatch);
+
+    if (left != 0) LOG_ERR("ra: %" PRIu64 " pages never read", left);
+    return left != 0;
+}
+
+/**
+ * @return      number of errors
+ */
+static unsigned long do_ra(uint32_t qdepth, uint32_t lat_us, uint32_t mbps)
+{
+    static const uint32_t rsize[] = {RA_PAGE, 128U << 10, 0};
+    unsigned long err = 0;
+    uint64_t lat_ns = (uint64_t) lat_us * 1000, bw = (uint64_t) mbps * 1000000;
+    uint32_t i;
+    int m;
+
+#ifdef __linux__
+    /* o.w. each short sleep overshoots by ~50us */
+    (void) prctl(PR_SET_TIMERSLACK, 1UL);
+#endif
+
+    LOG("ra: %llu MiB file  device latency %u us  %u MB/s  queue depth %u  IO size %uK",
+            RA_FILE_SIZE >> 20, lat_us, mbps, qdepth, RA_IOSIZE >> 10);
+
+    for (i = 0; i < sizeof(rsize) / sizeof(*rsize); i++) {
+        for (m = RA_4K; m <= RA_AHEAD; m++) err += ra_run((enum ra_mode) m, rsize[i], qdepth, lat_ns, bw);
+    }
+
+    return err;
+}
+
+/* a simulated image  and how it's read */
+#define VT_IMAGE_SIZE       (32ULL << 20)
+/* a read  i.e. a cluster IO of a few blocks */
+#define VT_READ             (64U << 10)
+
+enum vt_mode {
+    VT_COPY = 0,            /* no tree  the baseline */
+    VT_SCALAR,              /* cold  one block hashed at a time */
+    VT_LANES,               /* cold  EMPTYFS_SHA256_LANES blocks at a time */
+    VT_WARM,                /* every block verified already */
+    VT_RANDOM,              /* cold  4K reads in random order */
+};
+
+static const char *vt_mode_name[] = {"copy", "cold scalar", "cold lanes", "warm", "cold random 4K"};
+
+/**
+ * emptyfs_img_read_t over the image in memory  ctx is the image
+ */
+static int vt_read(void *ctx, uint64_t off, void *buf, size_t len)
+{
+    memcpy(buf, (const char *) ctx + off, len);
+    return 0;
+}
+
+/**
+ * Lay a random image out  with its tree  as mkfs_emptyfs -M does
+ */
+static char *vt_build(struct emptyfs_vt *vt, uint64_t nb)
+{
+    char *img;
+    uint64_t x = 0x9e3779b97f4a7c15ULL, i;
+    uint32_t k;
+
+    if (emptyfs_vt_geom(vt, nb) != 0) abort();
+    img = calloc(vt->tree_blk + vt->nblk, EMPTYFS_IMG_BSIZE);
+    if (img == NULL) {
+        LOG_ERR("calloc(3) fail  blocks: %" PRIu64, vt->tree_blk + vt->nblk);
+        exit(1);
+    }
+
+    for (i = EMPTYFS_IMG_BSIZE / 8; i < (nb << EMPTYFS_IMG_BSHIFT) / 8; i++)
+        ((uint64_t *) img)[i] = lz_rand(&x);
+
+    /* block 0 has the root zeroed  it's zero here anyway */
+    for (i = 0; i < nb; i++)
+        emptyfs_sha256(img + (i << EMPTYFS_IMG_BSHIFT), EMPTYFS_IMG_BSIZE,
+                        (uint8_t *) img + (vt->lvl_blk[0] << EMPTYFS_IMG_BSHIFT) + i * EMPTYFS_SHA256_LEN);
+    for (k = 1; k < vt->levels; k++) {
+        for (i = 0; i < vt->lvl_n[k - 1]; i++)
+            emptyfs_sha256(img + ((vt->lvl_blk[k - 1] + i) << EMPTYFS_IMG_BSHIFT), EMPTYFS_IMG_BSIZE,
+                            (uint8_t *) img + (vt->lvl_blk[k] << EMPTYFS_IMG_BSHIFT) + i * EMPTYFS_SHA256_LEN);
+    }
+    emptyfs_sha256(img + (vt->lvl_blk[vt->levels - 1] << EMPTYFS_IMG_BSHIFT), EMPTYFS_IMG_BSIZE, vt->root);
+
+    vt->read = vt_read;
+    vt->ctx = img;
+    return img;
+}
+
+/**
+ * One pass over the image  as vnop_strategy would read it
+ * @perm        block order of VT_RANDOM
+ * @return      number of errors
+ */
+static unsigned long vt_pass(
+        struct emptyfs_vt *vt,
+        const char *img,
+        enum vt_mode m,
+        const uint32_t *perm,
+        char *dst,
+        char *scratch)
+{
+    const uint64_t per = VT_READ >> EMPTYFS_IMG_BSHIFT;
+    uint8_t h[EMPTYFS_SHA256_LEN];
+    uint64_t i, j, n, bad;
+    unsigned long err = 0;
+
+    if (m != VT_WARM) memset(vt->done, 0, emptyfs_vt_map_size(vt));
+
+    if (m == VT_RANDOM) {
+        for (i = 0; i < vt->tree_blk; i++) {
+            (void) vt_read((void *) img, (uint64_t) perm[i] << EMPTYFS_IMG_BSHIFT, dst, EMPTYFS_IMG_BSIZE);
+            err += emptyfs_vt_verify_run(vt, perm[i], 1, dst, scratch, &bad) != 0;
+        }
+        return err;
+    }
+
+    for (i = 0; i < vt->tree_blk; i += n) {
+        n = vt->tree_blk - i < per ? vt->tree_blk - i : per;
+        (void) vt_read((void *) img, i << EMPTYFS_IMG_BSHIFT, dst, (size_t) (n << EMPTYFS_IMG_BSHIFT));
+
+        switch (m) {
+        case VT_SCALAR:
+            for (j = 0; j < n; j++) {
+                if (emptyfs_vt_done(vt, i + j)) continue;
+                emptyfs_sha256(dst + (j << EMPTYFS_IMG_BSHIFT), EMPTYFS_IMG_BSIZE, h);
+                vt->nhashed++;
+                err += emptyfs_vt_verify(vt, i + j, h, scratch) != 0;
+            }
+            break;
+        case VT_LANES:
+        case VT_WARM:
+            err += emptyfs_vt_verify_run(vt, i, n, dst, scratch, &bad) != 0;
+            break;
+        default:
+            break;
+        }
+        sink += (uint64_t) dst[0];
+    }
+
+    return err;
+}
+
+/**
+ * @return      number of errors
+ */
+static unsigned long do_vt(uint32_t rounds)
+{
+    struct emptyfs_vt vt;
+    char *img, *dst, scratch[EMPTYFS_IMG_BSIZE];
+    uint64_t nb = VT_IMAGE_SIZE >> EMPTYFS_IMG_BSHIFT, i, x = 1, bad;
+    uint32_t *perm, t32;
+    unsigned long err = 0;
+    double t, mb = (double) VT_IMAGE_SIZE * rounds / 1e6, base = 0, us;
+    uint32_t r;
+    int m;
+
+    memset(&vt, 0, sizeof(vt));
+    img = vt_build(&vt, nb);
+    vt.done = calloc(emptyfs_vt_map_size(&vt), 1);
+    dst = malloc(VT_READ);
+    perm = malloc(nb * sizeof(*perm));
+    if (vt.done == NULL || dst == NULL || perm == NULL) {
+        LOG_ERR("malloc(3) fail  blocks: %" PRIu64, nb);
+        exit(1);
+    }
+    for (i = 0; i < nb; i++) perm[i] = (uint32_t) i;
+    for (i = nb - 1; i > 0; i--) {
+        uint64_t j = lz_rand(&x) % (i + 1);
+        t32 = perm[i]; perm[i] = perm[j]; perm[j] = t32;
+    }
+
+    LOG("vt: %llu MiB image  %u level(s) %" PRIu64 " tree block(s)  %u lane(s)  %uK reads  %u pass(es)",
+            VT_IMAGE_SIZE >> 20, vt.levels, vt.nblk, EMPTYFS_SHA256_LANES, VT_READ >> 10, rounds);
+
+    for (m = VT_COPY; m <= VT_RANDOM; m++) {
+        vt.nhashed = 0;
+        t = now_sec();
+        for (r = 0; r < rounds; r++) err += vt_pass(&vt, img, (enum vt_mode) m, perm, dst, scratch);
+        t = now_sec() - t;
+
+        us = t * 1e6 / mb;
+        if (m == VT_COPY) base = us;
+        LOG("vt: %-15s %8.1f MB/s  %8.1f us/MB  overhead %8.1f us/MB  %" PRIu64 " hashed",
+                vt_mode_name[m], mb / t, us, us - base, vt.nhashed);
+    }
+
+    /* a flipped bit must never verify */
+    memset(vt.done, 0, emptyfs_vt_map_size(&vt));
+    img[(nb / 2) << EMPTYFS_IMG_BSHIFT] ^= 1;
+    memcpy(dst, img + ((nb / 2) << EMPTYFS_IMG_BSHIFT), EMPTYFS_IMG_BSIZE);
+    if (emptyfs_vt_verify_run(&vt, nb / 2, 1, dst, scratch, &bad) != EIO || bad != nb / 2) {
+        LOG_ERR("vt: tampered block %" PRIu64 " verifies", nb / 2);
+        err++;
+    }
+    /* ditto a tree block */
+    img[(nb / 2) << EMPTYFS_IMG_BSHIFT] ^= 1;
+    img[(vt.lvl_blk[0] << EMPTYFS_IMG_BSHIFT) + 7] ^= 1;
+    memset(vt.done, 0, emptyfs_vt_map_size(&vt));
+    memcpy(dst, img + EMPTYFS_IMG_BSIZE, EMPTYFS_IMG_BSIZE);
+    if (emptyfs_vt_verify_run(&vt, 1, 1, dst, scratch, &bad) != EIO) {
+        LOG_ERR("vt: block 1 verifies under a tampered tree");
+        err++;
+    }
+
+    free(img);
+    free(vt.done);
+    free(dst);
+    free(perm);
+    if (err != 0) LOG_ERR("vt: %lu error(s)", err);
+    return err;
+}
+
+int main(int argc, char *argv[])
+{
+    int ch;
+    uint32_t n = 100000;
+    uint32_t rounds = 10;
+    uint32_t nthread = 8;
+    uint32_t lat_us = 100;
+    uint32_t mbps = 1000;
+    int linear = 0;
+    const char *cmd;
+
+    while ((ch = getopt(argc, argv, "n:r:lt:L:B:vh")) != -1) {
+        switch (ch) {
+        case 'n':
+            n = parse_u32(argv[0], optarg);
+            break;
+        case 'r':
+            rounds = parse_u32(argv[0], optarg);
+            break;
+        case 'l':
+            linear = 1;
+            break;
+        case 't':
+            nthread = parse_u32(argv[0], optarg);
+            break;
+        case 'L':
+            lat_us = parse_u32(argv[0], optarg);
+            break;
+        case 'B':
+            mbps = parse_u32(argv[0], optarg);
+            break;
+        case 'v':
+            fprintf(stderr, "%s version %s\nbuilt date %s %s\n\n",
+                    basename(argv[0]), BENCH_EMPTYFS_VERSION, __DATE__, __TIME__);
+            exit(0);
+        case 'h':
+        case '?':
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (argc - optind < 1 || n == 0) usage(argv[0]);
+    cmd = argv[optind];
+
+    if (!strcmp(cmd, "dirhash") && argc - optind == 1)
+        return do_dirhash(n, rounds, linear) != 0;
+    if (!strcmp(cmd, "stat") && argc - optind == 2 && nthread != 0)
+        return do_stat(argv[optind+1], n, nthread) != 0;
+    if (!strcmp(cmd, "prof") && argc - optind == 1 && nthread != 0)
+        return do_prof(n, nthread) != 0;
+    if (!strcmp(cmd, "malloc") && argc - optind == 1 && nthread != 0)
+        return do_malloc(n, nthread) != 0;
+    if (!strcmp(cmd, "kcb") && argc - optind == 1 && nthread != 0)
+        return do_kcb(n, nthread) != 0;
+    if (!strcmp(cmd, "ram") && argc - optind == 1 && nthread != 0)
+        return do_ram(n, nthread) != 0;
+    if (!strcmp(cmd, "mmap") && argc - optind == 2)
+        return do_mmap(argv[optind+1], n) != 0;
+    if (!strcmp(cmd, "lz") && argc - optind <= 2 && nthread != 0 && rounds != 0)
+        return do_lz(argc - optind == 2 ? argv[optind+1] : NULL, n, rounds, nthread) != 0;
+    if (!strcmp(cmd, "ra") && argc - optind == 1 && nthread != 0 && mbps != 0)
+        return do_ra(nthread, lat_us, mbps) != 0;
+    if (!strcmp(cmd, "vt") && argc - optind == 1 && rounds != 0)
+        return do_vt(rounds) != 0;
+
+    usage(argv[0]);
+}
@@ -0,0 +1,435 @@
+/*
+ * Created 261018
+ *
+ * Inspect a loaded emptyfs kext
+ *  everything is read via sysctl vfs.generic.emptyfs.*
+ */
+
+#define _DEFAULT_SOURCE
+#define _DARWIN_C_SOURCE
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <time.h>
+#include <sys/types.h>
+#ifdef __APPLE__
+#include <sys/sysctl.h>
+#endif
+
+#include "emptyfs_prof.h"
+#include "emptyfs_trace.h"
+
+#define EMPTYFSCTL_VERSION  "0.1"
+
+#define LOG(fmt, ...)       printf("emptyfsctl: " fmt "\n", ##__VA_ARGS__)
+#define LOG_ERR(fmt, ...)   fprintf(stderr, "emptyfsctl: [ERR] " fmt "\n", ##__VA_ARGS__)
+
+#define ASSERT_NONNULL(p)   assert(p != NULL)
+
+static __attribute__((noreturn)) void usage(char *argv0)
+{
+    ASSERT_NONNULL(argv0);
+    fprintf(stderr,
+            "usage:\n\t"
+            "%s stats\n\t"
+            "%s [-f] [-i ms] [-w file] trace\n\t"
+            "%s decode file\n\n\t"
+            "-f         trace: keep draining until interrupted\n\t"
+            "-i ms      trace: drain interval(default: 200)\n\t"
+            "-w file    trace: append raw records to file instead of decoding\n\t"
+            "-v         print version\n\t"
+            "-h         print this help\n\n\t"
+            "stats      per-op call counts and latency percentiles  lookup counters\n\t"
+            "trace      drain trace rings of mounts with -d(debug mode)  needs root\n\t"
+            "decode     decode raw records saved by trace -w\n\n",
+            basename(argv0), basename(argv0), basename(argv0));
+    exit(1);
+}
+
+/**
+ * @return      0 if success  -1 o.w.(errno set)
+ */
+static int read_sysctl(const char *name, void *buf, size_t *len)
+{
+#ifdef __APPLE__
+    return sysctlbyname(name, buf, len, NULL, 0);
+#else
+    (void) name, (void) buf, (void) len;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+static int read_u64(const char *name, uint64_t *v)
+{
+    size_t len = sizeof(*v);
+    return read_sysctl(name, v, &len);
+}
+
+static int do_stats(void)
+{
+    static const char * const counters[] = {
+        "lookup", "lookup_enoent", "cache_enter", "cache_enter_neg",
+        "mnt_pool_hit", "mnt_pool_miss",
+    };
+    struct emptyfs_prof_snap *snap;
+    const struct emptyfs_prof_cpu *pc;
+    char name[64];
+    size_t len = sizeof(*snap);
+    uint64_t n, v;
+    uint32_t op;
+    size_t i;
+
+    snap = malloc(sizeof(*snap));
+    if (snap == NULL) {
+        LOG_ERR("out of memory");
+        return 1;
+    }
+
+    if (read_sysctl("vfs.generic.emptyfs.prof", snap, &len) != 0) {
+        LOG_ERR("sysctl vfs.generic.emptyfs.prof fail  errno: %d(is kext loaded?)", errno);
+        free(snap);
+        return 1;
+    }
+
+    /* kext and us must agree on the layout  o.w. numbers are garbage */
+    if (len != sizeof(*snap) || snap->magic != EMPTYFS_PROF_MAGIC ||
+            snap->nop != EMPTYFS_PROF_NOP || snap->nbucket != EMPTYFS_PROF_NBUCKET) {
+        LOG_ERR("profile layout mismatch  len: %zu magic: %#x nop: %u nbucket: %u",
+                    len, snap->magic, snap->nop, snap->nbucket);
+        free(snap);
+        return 1;
+    }
+
+    pc = &snap->total;
+    printf("%-22s %12s %10s %10s %10s %10s\n",
+            "op", "calls", "mean(ns)", "p50(ns)", "p99(ns)", "p999(ns)");
+    for (op = 0; op < EMPTYFS_PROF_NOP; op++) {
+        n = emptyfs_prof_calls(pc, op);
+        if (n == 0) continue;
+        printf("%-22s %12" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n",
+                emptyfs_prof_name(op), n, pc->sum_ns[op] / n,
+                emptyfs_prof_percentile(pc, op, 500000),
+                emptyfs_prof_percentile(pc, op, 990000),
+                emptyfs_prof_percentile(pc, op, 999000));
+    }
+    printf("(%u CPU slot(s) merged)\n\n", snap->ncpu);
+
+    for (i = 0; i < sizeof(counters) / sizeof(*counters); i++) {
+        (void) snprintf(name, sizeof(name), "vfs.generic.emptyfs.%s", counters[i]);
+        if (read_u64(name, &v) != 0) continue;
+        printf("%-22s %12" PRIu64 "\n", counters[i], v);
+    }
+
+    free(snap);
+    return 0;
+}
+
+/*
+ * Decoder state  carried across frames(i.e. drains)
+ *  a frame is a trace header followed by its records  see: emptyfs_trace_hdr
+ */
+struct trace_dec {
+    uint64_t *last;         /* last seq seen per CPU */
+    uint32_t ncpu;
+    uint64_t ts0;           /* first timestamp seen  zero if none */
+    uint64_t dropped;       /* records overwritten before we drained them */
+    struct emptyfs_trace_rec **sorted;
+};
+
+static int trace_frame_check(const struct emptyfs_trace_hdr *h, size_t len)
+{
+    if (len < sizeof(*h) || h->magic != EMPTYFS_TRACE_MAGIC ||
+            h->recsz != sizeof(struct emptyfs_trace_rec) ||
+            h->nrec != EMPTYFS_TRACE_NREC || h->ncpu == 0 || h->denom == 0 ||
+            len != sizeof(*h) + (size_t) h->ncpu * h->nrec * h->recsz) {
+        LOG_ERR("trace layout mismatch  len: %zu magic: %#x recsz: %u nrec: %u ncpu: %u",
+                    len, len >= sizeof(*h) ? h->magic : 0,
+                    len >= sizeof(*h) ? h->recsz : 0,
+                    len >= sizeof(*h) ? h->nrec : 0,
+                    len >= sizeof(*h) ? h->ncpu : 0);
+        return -1;
+    }
+    return 0;
+}
+
+static int cmp_rec_ts(const void *a, const void *b)
+{
+    const struct emptyfs_trace_rec *x = *(const struct emptyfs_trace_rec * const *) a;
+    const struct emptyfs_trace_rec *y = *(const struct emptyfs_trace_rec * const *) b;
+    if (x->ts != y->ts) return x->ts < y->ts ? -1 : 1;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static void trace_print(
+        const struct trace_dec *d,
+        const struct emptyfs_trace_hdr *h,
+        const struct emptyfs_trace_rec *r)
+{
+    char name[9];
+    const char *an;
+    uint64_t ns;
+    uint32_t i;
+
+    ns = (uint64_t) ((double) (r->ts - d->ts0) * h->numer / h->denom);
+    printf("%12.3f us  cpu %3u  %-20s err %3d", (double) ns / 1e3,
+            r->cpu, emptyfs_trace_name(r->event), r->err);
+
+    for (i = 0; i < EMPTYFS_TRACE_NARG; i++) {
+        an = emptyfs_trace_argname(r->event, i);
+        if (*an == '\0') continue;
+        if (!strcmp(an, "name")) {
+            memcpy(name, &r->arg[i], 8);
+            name[8] = '\0';
+            printf("  %s: %s", an, name);
+        } else {
+            printf("  %s: %" PRIu64, an, r->arg[i]);
+        }
+    }
+    printf("\n");
+}
+
+/**
+ * Decode a frame  only records not yet seen in previous frames are printed
+ * @return      0 if success  -1 o.w.
+ */
+static int trace_decode(struct trace_dec *d, const void *frame, size_t len)
+{
+    const struct emptyfs_trace_hdr *h = frame;
+    struct emptyfs_trace_rec *rec;
+    struct emptyfs_trace_rec *r;
+    uint64_t lo, hi;
+    size_t n = 0, i;
+    uint32_t c, k;
+    void *p;
+
+    if (trace_frame_check(h, len) != 0) return -1;
+    rec = (struct emptyfs_trace_rec *) (h + 1);
+
+    if (h->ncpu != d->ncpu) {
+        p = realloc(d->last, h->ncpu * sizeof(*d->last));
+        if (p == NULL) goto out_oom;
+        d->last = p;
+        if (h->ncpu > d->ncpu)
+            memset(d->last + d->ncpu, 0, (h->ncpu - d->ncpu) * sizeof(*d->last));
+        p = realloc(d->sorted, (size_t) h->ncpu * h->nrec * sizeof(*d->sorted));
+        if (p == NULL) goto out_oom;
+        d->sorted = p;
+        d->ncpu = h->ncpu;
+    }
+
+    for (c = 0; c < h->ncpu; c++) {
+        lo = UINT64_MAX;
+        hi = d->last[c];
+        for (k = 0; k < h->nrec; k++) {
+            r = &rec[(size_t) c * h->nrec + k];
+            if (r->seq <= d->last[c] || r->event >= EMPTYFS_TRACE_NEVENT) continue;
+            d->sorted[n++] = r;
+            if (r->seq < lo) lo = r->seq;
+            if (r->seq > hi) hi = r->seq;
+        }
+        /* ring lapped since last drain */
+        if (lo != UINT64_MAX && lo > d->last[c] + 1) d->dropped += lo - d->last[c] - 1;
+        d->last[c] = hi;
+    }
+
+    qsort(d->sorted, n, sizeof(*d->sorted), cmp_rec_ts);
+    if (n != 0 && d->ts0 == 0) d->ts0 = d->sorted[0]->ts;
+    for (i = 0; i < n; i++) trace_print(d, h, d->sorted[i]);
+
+    return 0;
+
+out_oom:
+    LOG_ERR("out of memory  ncpu: %u", h->ncpu);
+    return -1;
+}
+
+static void trace_dec_fini(struct trace_dec *d)
+{
+    if (d->dropped != 0) LOG("%" PRIu64 " record(s) dropped  i.e. drain more often", d->dropped);
+    free(d->last);
+    free(d->sorted);
+}
+
+/**
+ * @return      a frame read from kernel  NULL if fail
+ */
+static void *trace_read(size_t *len)
+{
+    void *frame;
+
+    *len = 0;
+    if (read_sysctl("vfs.generic.emptyfs.trace", NULL, len) != 0) goto out_fail;
+
+    frame = malloc(*len);
+    if (frame == NULL) {
+        LOG_ERR("out of memory  size: %zu", *len);
+        return NULL;
+    }
+
+    if (read_sysctl("vfs.generic.emptyfs.trace", frame, len) != 0) {
+        free(frame);
+        goto out_fail;
+    }
+
+    return frame;
+
+out_fail:
+    LOG_ERR("sysctl vfs.generic.emptyfs.trace fail  errno: %d(is kext loaded? are you root?)", errno);
+    return NULL;
+}
+
+static int do_trace(int follow, uint32_t interval_ms, const char *path)
+{
+    int e = 0;
+    struct trace_dec d = {0};
+    struct timespec ts = {interval_ms / 1000, (long) (interval_ms % 1000) * 1000000L};
+    FILE *fp = NULL;
+    void *frame;
+    size_t len;
+
+    if (path != NULL) {
+        fp = fopen(path, "ab");
+        if (fp == NULL) {
+            LOG_ERR("fopen() fail  path: %s errno: %d", path, errno);
+            return 1;
+        }
+    }
+
+    do {
+        frame = trace_read(&len);
+        if (frame == NULL) {
+            e = 1;
+            break;
+        }
+
+        if (fp != NULL) {
+            /* raw frame is self-describing  decode later with `decode' */
+            if (trace_frame_check(frame, len) != 0 || fwrite(frame, len, 1, fp) != 1) e = 1;
+        } else {
+            if (trace_decode(&d, frame, len) != 0) e = 1;
+            (void) fflush(stdout);
+        }
+
+        free(frame);
+        if (follow && e == 0) (void) nanosleep(&ts, NULL);
+    } while (follow && e == 0);
+
+    if (fp != NULL && fclose(fp) != 0) e = 1;
+    trace_dec_fini(&d);
+    return e;
+}
+
+static int do_decode(const char *path)
+{
+    int e = 0;
+    struct trace_dec d = {0};
+    struct emptyfs_trace_hdr h;
+    void *frame = NULL;
+    size_t len;
+    FILE *fp;
+
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+        LOG_ERR("fopen() fail  path: %s errno: %d", path, errno);
+        return 1;
+    }
+
+    while (fread(&h, sizeof(h), 1, fp) == 1) {
+        if (trace_frame_check(&h, sizeof(h) + (size_t) h.ncpu * h.nrec * h.recsz) != 0) {
+            e = 1;
+            break;
+        }
+
+        len = sizeof(h) + (size_t) h.ncpu * h.nrec * h.recsz;
+        free(frame);
+        frame = malloc(len);
+        if (frame == NULL) {
+            LOG_ERR("out of memory  size: %zu", len);
+            e = 1;
+            break;
+        }
+
+        memcpy(frame, &h, sizeof(h));
+        if (fread((char *) frame + sizeof(h), len - sizeof(h), 1, fp) != 1) {
+            LOG_ERR("truncated frame  path: %s", path);
+            e = 1;
+            break;
+        }
+
+        if (trace_decode(&d, frame, len) != 0) {
+            e = 1;
+            break;
+        }
+    }
+
+    free(frame);
+    (void) fclose(fp);
+    trace_dec_fini(&d);
+    return e;
+}
+
+static uint32_t parse_u32(char *argv0, const char *arg)
+{
+    unsigned long n;
+    char *end;
+
+    errno = 0;
+    n = strtoul(arg, &end, 0);
+    if (errno != 0 || end == arg || *end != '\0' || n > UINT32_MAX) {
+        LOG_ERR("bad numeric argument: %s", arg);
+        usage(argv0);
+    }
+
+    return (uint32_t) n;
+}
+
+int main(int argc, char *argv[])
+{
+    int ch;
+    int follow = 0;
+    uint32_t interval_ms = 200;
+    const char *path = NULL;
+    const char *cmd;
+
+    while ((ch = getopt(argc, argv, "fi:w:vh")) != -1) {
+        switch (ch) {
+        case 'f':
+            follow = 1;
+            break;
+        case 'i':
+            interval_ms = parse_u32(argv[0], optarg);
+            break;
+        case 'w':
+            path = optarg;
+            break;
+        case 'v':
+            fprintf(stderr, "%s version %s\nbuilt date %s %s\n\n",
+                    basename(argv[0]), EMPTYFSCTL_VERSION, __DATE__, __TIME__);
+            exit(0);
+        case 'h':
+        case '?':
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (argc - optind < 1) usage(argv[0]);
+    cmd = argv[optind];
+
+    if (!strcmp(cmd, "stats") && argc - optind == 1)
+        return do_stats();
+    if (!strcmp(cmd, "trace") && argc - optind == 1)
+        return do_trace(follow, interval_ms, path);
+    if (!strcmp(cmd, "decode") && argc - optind == 2)
+        return do_decode(argv[optind+1]);
+
+    usage(argv[0]);
+}
@@ -0,0 +1,1005 @@
+/*
+ * Created 261018
+ *
+ * Micro-benchmarks of kext entry points  on the userspace stand-in
+ *  see: xnu_host.c
+ *
+ * vnops and vfsops are driven through the very code that runs in kernel
+ *  .: numbers are reproducible without macOS  and comparable across commits
+ *  as long as the host stays the same
+ *
+ * each case runs `-r' rounds for 1, 2, 4, ... up to `-t' threads
+ *  the best round is reported(least disturbed by the host)  median as well
+ *  results are written in JSON  `compare' flags regressions against a baseline
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <pthread.h>
+
+#include "emptyfs.h"
+#include "emptyfs_vfsops.h"
+#include "emptyfs_fsnode.h"
+#include "emptyfs_synth.h"
+#include "utils.h"
+
+#define KBENCH_EMPTYFS_VERSION  "0.1"
+
+/* stdout may carry JSON  .: human-readable lines go to stderr */
+#define KLOG(fmt, ...)      fprintf(stderr, "kbench_emptyfs: " fmt "\n", ##__VA_ARGS__)
+#define KLOG_ERR(fmt, ...)  fprintf(stderr, "kbench_emptyfs: [ERR] " fmt "\n", ##__VA_ARGS__)
+
+#define ASSERT_NONNULL(p)   assert(p != NULL)
+
+#define DEV_SIZE            (1024 * 1024)
+#define DEV_BSIZE_          512
+
+/* a mount/unmount cycle costs about a thousand lookups */
+#define MOUNT_DIV           1000
+
+/* largest case name  also bounds what `compare' parses */
+#define CASE_NAME_MAX       32
+
+/* regression threshold of `compare' in percent */
+#define DEFAULT_THRESHOLD   10
+
+extern kern_return_t emptyfs_start(kmod_info_t *, void *);
+extern kern_return_t emptyfs_stop(kmod_info_t *, void *);
+
+static __attribute__((noreturn)) void usage(char *argv0)
+{
+    ASSERT_NONNULL(argv0);
+    fprintf(stderr,
+            "usage:\n\t"
+            "%s [-n n] [-r n] [-t n] [-f n] [-P] [-o file] run [case ...]\n\t"
+            "%s [-T pct] compare baseline.json current.json\n\t"
+            "%s list\n\n\t"
+            "-n n       calls per thread per round(default: 100000)\n\t"
+            "           mount  mount_churn: n/%u cycles\n\t"
+            "-r n       rounds  best and median are reported(default: 5)\n\t"
+            "-t n       1, 2, 4, ... up to n threads(default: 8)\n\t"
+            "-f n       files in root directory(default: 1000)\n\t"
+            "-P         mount with root vnode pinned\n\t"
+            "-o file    write JSON to file(default: stdout)\n\t"
+            "-T pct     slowdown of best ns/op considered a regression(default: %u)\n\t"
+            "-v         print version\n\t"
+            "-h         print this help\n\n\t"
+            "run        run cases(default: all)  see `list'\n\t"
+            "compare    exits non-zero if any case regressed\n\t"
+            "list       print cases\n\n",
+            basename(argv0), basename(argv0), basename(argv0),
+            MOUNT_DIV, DEFAULT_THRESHOLD);
+    exit(1);
+}
+
+static uint32_t parse_u32(char *argv0, const char *arg)
+{
+    unsigned long n;
+    char *end;
+
+    errno = 0;
+    n = strtoul(arg, &end, 0);
+    if (errno != 0 || end == arg || *end != '\0' || n > UINT32_MAX) {
+        KLOG_ERR("bad numeric argument: %s", arg);
+        usage(argv0);
+    }
+
+    return (uint32_t) n;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+struct start_gate {
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    int open;
+};
+
+static void gate_wait(struct start_gate *g)
+{
+    (void) pthread_mutex_lock(&g->mtx);
+    while (!g->open) (void) pthread_cond_wait(&g->cond, &g->mtx);
+    (void) pthread_mutex_unlock(&g->mtx);
+}
+
+static void gate_open(struct start_gate *g)
+{
+    (void) pthread_mutex_lock(&g->mtx);
+    g->open = 1;
+    (void) pthread_cond_broadcast(&g->cond);
+    (void) pthread_mutex_unlock(&g->mtx);
+}
+
+/*
+ * Shared by all cases  set up once
+ */
+struct kbench_env {
+    struct emptyfs_mnt_args args;
+    struct emptyfs_synth sy;
+    vnode_t devvp;
+    mount_t mp;
+    /* names of root entries  as lookups would be given */
+    char (*names)[EMPTYFS_SYNTH_NAME_MAX];
+    uint64_t *inos;
+    uint32_t nnames;
+    /* root_mtx only  see: run_root_mtx() */
+    lck_grp_t *lck_grp;
+    lck_mtx_t *mtx_root;
+    vnode_t rootvp;
+    uint32_t rootvid;
+};
+
+struct kbench_worker {
+    pthread_t thread;
+    const struct kbench_case *kc;
+    struct kbench_env *env;
+    struct start_gate *gate;
+    uint32_t id;
+    uint32_t n;
+    /* held through a round  see: kbench_case.setup */
+    vnode_t dvp;
+    vnode_t vp;
+    vnode_t devvp;
+    char *buf;
+    /* results */
+    double t;
+    uint64_t ops;
+    uint64_t err;
+};
+
+struct kbench_case {
+    const char *name;
+    const char *desc;
+    /* readdir buffer size */
+    uint32_t bufsz;
+    /* calls per thread are divided by this */
+    uint32_t div;
+    int (*setup)(struct kbench_worker *);
+    void (*run)(struct kbench_worker *);
+};
+
+static void cn_init(struct componentname *cn, char *name, size_t len, uint32_t flags)
+{
+    memset(cn, 0, sizeof(*cn));
+    cn->cn_nameiop = LOOKUP;
+    cn->cn_flags = ISLASTCN | MAKEENTRY | flags;
+    cn->cn_context = vfs_context_current();
+    cn->cn_pnbuf = name;
+    cn->cn_pnlen = (int) len + 1;
+    cn->cn_nameptr = name;
+    cn->cn_namelen = (int) len;
+}
+
+/**
+ * @return      vnode with an iocount  NULLVP if failed
+ */
+static vnode_t lookup1(vnode_t dvp, const char *name, uint32_t flags)
+{
+    char buf[EMPTYFS_SYNTH_NAME_MAX + 1];
+    struct componentname cn;
+    vnode_t vp = NULLVP;
+    size_t len = strlen(name);
+
+    kassert(len < sizeof(buf));
+    memcpy(buf, name, len + 1);
+    cn_init(&cn, buf, len, flags);
+    if (VNOP_LOOKUP(dvp, &vp, &cn, vfs_context_current()) != 0) return NULLVP;
+    return vp;
+}
+
+static void put_all(struct kbench_worker *w)
+{
+    if (w->vp != NULLVP) (void) vnode_put(w->vp);
+    if (w->dvp != NULLVP) (void) vnode_put(w->dvp);
+    w->vp = w->dvp = NULLVP;
+    free(w->buf);
+    w->buf = NULL;
+    if (w->devvp != NULLVP) xnu_host_dev_destroy(w->devvp);
+    w->devvp = NULLVP;
+}
+
+static int setup_root(struct kbench_worker *w)
+{
+    return xnu_host_root(w->env->mp, &w->dvp);
+}
+
+/* a sub-directory as dvp  so that ".." leads somewhere else */
+static int setup_subdir(struct kbench_worker *w)
+{
+    vnode_t rvp;
+    int e;
+
+    e = xnu_host_root(w->env->mp, &rvp);
+    if (e != 0) return e;
+    w->dvp = lookup1(rvp, "d0", 0);
+    (void) vnode_put(rvp);
+    return w->dvp != NULLVP ? 0 : ENOENT;
+}
+
+/* a regular file  each thread has its own */
+static int setup_file(struct kbench_worker *w)
+{
+    struct kbench_env *env = w->env;
+    uint32_t nsub = emptyfs_synth_nsubdirs(&env->sy, EMPTYFS_ROOT_INO);
+    int e;
+
+    e = setup_root(w);
+    if (e != 0) return e;
+    if (nsub >= env->nnames) return ENOENT;
+    w->vp = lookup1(w->dvp, env->names[nsub + w->id % (env->nnames - nsub)], 0);
+    return w->vp != NULLVP ? 0 : ENOENT;
+}
+
+static int setup_readdir(struct kbench_worker *w)
+{
+    int e = setup_root(w);
+    if (e != 0) return e;
+    w->buf = malloc(w->kc->bufsz);
+    return w->buf != NULL ? 0 : ENOMEM;
+}
+
+static int setup_dev(struct kbench_worker *w)
+{
+    w->devvp = xnu_host_dev_create(NULL, DEV_SIZE, DEV_BSIZE_);
+    return w->devvp != NULLVP ? 0 : ENOMEM;
+}
+
+static void run_root(struct kbench_worker *w)
+{
+    vnode_t vp;
+    uint32_t i;
+
+    for (i = 0; i < w->n; i++) {
+        if (xnu_host_root(w->env->mp, &vp) != 0) {
+            w->err++;
+            continue;
+        }
+        (void) vnode_put(vp);
+    }
+    w->ops = w->n;
+}
+
+/*
+ * root plus the mtx_root round trip each get_root_vnode() paid before the
+ *  lock-free fast path  i.e. (rootvp, vid) read under the lock
+ * the very same VFS path runs after  .: the difference is the lock alone
+ */
+static void run_root_mtx(struct kbench_worker *w)
+{
+    struct kbench_env *env = w->env;
+    vnode_t vp;
+    uint32_t i;
+
+    for (i = 0; i < w->n; i++) {
+        lck_mtx_lock(env->mtx_root);
+        env->rootvid = vnode_vid(env->rootvp);
+        lck_mtx_unlock(env->mtx_root);
+
+        if (xnu_host_root(env->mp, &vp) != 0) {
+            w->err++;
+            continue;
+        }
+        (void) vnode_put(vp);
+    }
+    w->ops = w->n;
+}
+
+static void run_lookup_hit(struct kbench_worker *w)
+{
+    struct kbench_env *env = w->env;
+    struct componentname cn;
+    char buf[EMPTYFS_SYNTH_NAME_MAX];
+    uint32_t j = w->id * 7919;
+    uint32_t i;
+    size_t len;
+    vnode_t vp;
+
+    for (i = 0; i < w->n; i++, j++) {
+        j %= env->nnames;
+        len = strlen(env->names[j]);
+        memcpy(buf, env->names[j], len + 1);
+        cn_init(&cn, buf, len, 0);
+        vp = NULLVP;
+        if (VNOP_LOOKUP(w->dvp, &vp, &cn, vfs_context_current()) != 0) {
+            w->err++;
+            continue;
+        }
+        if (((struct emptyfs_fsnode *) vnode_fsnode(vp))->ino != env->inos[j]) w->err++;
+        (void) vnode_put(vp);
+    }
+    w->ops = w->n;
+}
+
+static void run_lookup_miss(struct kbench_worker *w)
+{
+    struct componentname cn;
+    char buf[EMPTYFS_SYNTH_NAME_MAX];
+    uint32_t i;
+    vnode_t vp;
+    int len;
+    int e;
+
+    for (i = 0; i < w->n; i++) {
+        /* "f" followed by an index out of range  found by neither name nor hash */
+        len = snprintf(buf, sizeof(buf), "f%u", 0x80000000U | (w->id << 20) | (i & 0xfffff));
+        cn_init(&cn, buf, (size_t) len, 0);
+        vp = NULLVP;
+        e = VNOP_LOOKUP(w->dvp, &vp, &cn, vfs_context_current());
+        if (e != ENOENT) {
+            w->err++;
+            if (e == 0) (void) vnode_put(vp);
+        }
+    }
+    w->ops = w->n;
+}
+
+static void run_lookup_dots(struct kbench_worker *w, const char *name, uint32_t flags)
+{
+    struct componentname cn;
+    char buf[3];
+    size_t len = strlen(name);
+    uint32_t i;
+    vnode_t vp;
+
+    for (i = 0; i < w->n; i++) {
+        memcpy(buf, name, len + 1);
+        cn_init(&cn, buf, len, flags);
+        vp = NULLVP;
+        if (VNOP_LOOKUP(w->dvp, &vp, &cn, vfs_context_current()) != 0) {
+            w->err++;
+            continue;
+        }
+        (void) vnode_put(vp);
+    }
+    w->ops = w->n;
+}
+
+static void run_lookup_dot(struct kbench_worker *w)
+{
+    run_lookup_dots(w, ".", 0);
+}
+
+static void run_lookup_dotdot(struct kbench_worker *w)
+{
+    run_lookup_dots(w, "..", ISDOTDOT);
+}
+
+static void run_getattr(struct kbench_worker *w)
+{
+    struct vnode_attr va;
+    uint32_t i;
+
+    for (i = 0; i < w->n; i++) {
+        /* what stat(2) asks for */
+        VATTR_INIT(&va);
+        VATTR_WANTED(&va, va_type);
+        VATTR_WANTED(&va, va_mode);
+        VATTR_WANTED(&va, va_nlink);
+        VATTR_WANTED(&va, va_uid);
+        VATTR_WANTED(&va, va_gid);
+        VATTR_WANTED(&va, va_fsid);
+        VATTR_WANTED(&va, va_fileid);
+        VATTR_WANTED(&va, va_data_size);
+        VATTR_WANTED(&va, va_data_alloc);
+        VATTR_WANTED(&va, va_iosize);
+        VATTR_WANTED(&va, va_access_time);
+        VATTR_WANTED(&va, va_modify_time);
+        VATTR_WANTED(&va, va_change_time);
+        VATTR_WANTED(&va, va_create_time);
+        VATTR_WANTED(&va, va_flags);
+        VATTR_WANTED(&va, va_gen);
+        if (VNOP_GETATTR(w->vp, &va, vfs_context_current()) != 0 ||
+                !VATTR_IS_SUPPORTED(&va, va_fileid)) {
+            w->err++;
+        }
+    }
+    w->ops = w->n;
+}
+
+/*
+ * Walks root directory over and over  an op is an entry returned
+ */
+static void run_readdir(struct kbench_worker *w)
+{
+    uint32_t bufsz = w->kc->bufsz;
+    uint64_t want = (uint64_t) w->n;
+    uint64_t ops = 0;
+    off_t off = 0;
+    uio_t uio;
+    int eof;
+    int num;
+
+    while (ops < want) {
+        uio = uio_create(1, off, UIO_SYSSPACE, UIO_READ);
+        if (uio == NULL) {
+            w->err++;
+            break;
+        }
+        (void) uio_addiov(uio, CAST_USER_ADDR_T(w->buf), bufsz);
+
+        eof = num = 0;
+        if (VNOP_READDIR(w->dvp, uio, (w->id & 1) ? VNODE_READDIR_EXTENDED : 0,
+                            &eof, &num, vfs_context_current()) != 0 || (num == 0 && !eof)) {
+            uio_free(uio);
+            w->err++;
+            break;
+        }
+        ops += (uint64_t) num;
+        off = eof ? 0 : uio_offset(uio);
+        uio_free(uio);
+    }
+    w->ops = ops;
+}
+
+static void run_mount(struct kbench_worker *w)
+{
+    mount_t mp;
+    uint32_t i;
+
+    for (i = 0; i < w->n; i++) {
+        if (xnu_host_mount(EMPTYFS_NAME, w->devvp, &w->env->args, &mp) != 0) {
+            w->err++;
+            continue;
+        }
+        if (xnu_host_unmount(mp, 0) != 0) w->err++;
+    }
+    w->ops = w->n;
+}
+
+/*
+ * Lifecycle of a placeholder volume: mounted  root looked at once  unmounted
+ */
+static void run_mount_churn(struct kbench_worker *w)
+{
+    mount_t mp;
+    vnode_t vp;
+    uint32_t i;
+
+    for (i = 0; i < w->n; i++) {
+        if (xnu_host_mount(EMPTYFS_NAME, w->devvp, &w->env->args, &mp) != 0) {
+            w->err++;
+            continue;
+        }
+        if (xnu_host_root(mp, &vp) == 0) {
+            (void) vnode_put(vp);
+        } else {
+            w->err++;
+        }
+        if (xnu_host_unmount(mp, 0) != 0) w->err++;
+    }
+    w->ops = w->n;
+}
+
+static const struct kbench_case kbench_cases[] = {
+    {"root", "vfs_root() then vnode_put()", 0, 1, NULL, run_root},
+    {"root_mtx", "root plus the mtx_root held before the lock-free fast path", 0, 1, NULL, run_root_mtx},
+    {"lookup_hit", "lookup of root entries  vnode cached", 0, 1, setup_root, run_lookup_hit},
+    {"lookup_miss", "lookup of absent names in root", 0, 1, setup_root, run_lookup_miss},
+    {"lookup_dot", "lookup of \".\" in a sub-directory", 0, 1, setup_subdir, run_lookup_dot},
+    {"lookup_dotdot", "lookup of \"..\" in a sub-directory", 0, 1, setup_subdir, run_lookup_dotdot},
+    {"getattr", "getattr of a regular file  as stat(2)", 0, 1, setup_file, run_getattr},
+    {"readdir_256", "root walked with 256-byte buffers  per entry", 256, 1, setup_readdir, run_readdir},
+    {"readdir_4k", "root walked with 4 KiB buffers  per entry", 4096, 1, setup_readdir, run_readdir},
+    {"readdir_64k", "root walked with 64 KiB buffers  per entry", 65536, 1, setup_readdir, run_readdir},
+    {"mount", "mount then unmount of a synthetic volume", 0, MOUNT_DIV, setup_dev, run_mount},
+    {"mount_churn", "mount  root vnode  unmount  as placeholder volumes", 0, MOUNT_DIV, setup_dev, run_mount_churn},
+};
+
+static void *kbench_worker_main(void *arg)
+{
+    struct kbench_worker *w = arg;
+    double t;
+
+    gate_wait(w->gate);
+    t = now_sec();
+    w->kc->run(w);
+    w->t = now_sec() - t;
+
+    return NULL;
+}
+
+struct kbench_result {
+    char name[CASE_NAME_MAX];
+    uint32_t threads;
+    double ns_best;
+    double ns_median;
+    double ops_sec;
+};
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Run a case with `nthread' threads for `rounds' rounds
+ * @return      number of failed calls
+ */
+static uint64_t kbench_run_case(
+        struct kbench_env *env,
+        const struct kbench_case *kc,
+        uint32_t n,
+        uint32_t rounds,
+        uint32_t nthread,
+        struct kbench_result *res)
+{
+    struct start_gate gate = {
+        PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0,
+    };
+    struct kbench_worker *w;
+    double *ns;
+    double *tput;
+    double sum, wall;
+    uint64_t ops, err = 0;
+    uint32_t r, i;
+    int e;
+
+    w = calloc(nthread, sizeof(*w));
+    ns = calloc(rounds, sizeof(*ns));
+    tput = calloc(rounds, sizeof(*tput));
+    if (w == NULL || ns == NULL || tput == NULL) {
+        KLOG_ERR("out of memory  nthread: %u", nthread);
+        exit(1);
+    }
+
+    for (r = 0; r < rounds; r++) {
+        gate.open = 0;
+
+        for (i = 0; i < nthread; i++) {
+            memset(&w[i], 0, sizeof(w[i]));
+            w[i].kc = kc;
+            w[i].env = env;
+            w[i].gate = &gate;
+            w[i].id = i;
+            w[i].n = GMAX(n / kc->div, 1U);
+            e = kc->setup != NULL ? kc->setup(&w[i]) : 0;
+            if (e != 0) {
+                KLOG_ERR("%s: setup fail  errno: %d", kc->name, e);
+                exit(1);
+            }
+        }
+
+        for (i = 0; i < nthread; i++) {
+            e = pthread_create(&w[i].thread, NULL, kbench_worker_main, &w[i]);
+            if (e != 0) {
+                KLOG_ERR("pthread_create() fail  errno: %d", e);
+                exit(1);
+            }
+        }
+
+        wall = now_sec();
+        gate_open(&gate);
+        for (i = 0, sum = 0, ops = 0; i < nthread; i++) {
+            (void) pthread_join(w[i].thread, NULL);
+            sum += w[i].t;
+            ops += w[i].ops;
+            err += w[i].err;
+        }
+        wall = now_sec() - wall;
+
+        for (i = 0; i < nthread; i++) put_all(&w[i]);
+
+        /* per-op latency as seen by each thread  and aggregate throughput */
+        ns[r] = ops != 0 ? sum * 1e9 / (double) ops : 0.0;
+        tput[r] = wall > 0 ? (double) ops / wall : 0.0;
+    }
+
+    qsort(ns, rounds, sizeof(*ns), cmp_double);
+    qsort(tput, rounds, sizeof(*tput), cmp_double);
+
+    (void) strlcpy(res->name, kc->name, sizeof(res->name));
+    res->threads = nthread;
+    res->ns_best = ns[0];
+    res->ns_median = ns[rounds / 2];
+    res->ops_sec = tput[rounds - 1];
+
+    free(tput);
+    free(ns);
+    free(w);
+    return err;
+}
+
+static int kbench_env_init(struct kbench_env *env, uint32_t files, uint32_t flags)
+{
+    struct componentname cn;
+    vnode_t rvp;
+    vnode_t vp;
+    uint32_t i;
+    size_t len;
+    int e;
+
+    memset(env, 0, sizeof(*env));
+    env->args.magic = EMPTYFS_MNTARG_MAGIC;
+    env->args.fanout = 4;
+    env->args.depth = 2;
+    env->args.files = files;
+    env->args.seed = 1;
+    env->args.flags = flags;
+
+    if (emptyfs_synth_init(&env->sy, env->args.fanout, env->args.depth,
+                            env->args.files, env->args.seed) != 0) {
+        KLOG_ERR("synthetic namespace too large");
+        return -1;
+    }
+
+    env->nnames = (uint32_t) emptyfs_synth_nentries(&env->sy, EMPTYFS_ROOT_INO);
+    env->names = calloc(env->nnames, sizeof(*env->names));
+    env->inos = calloc(env->nnames, sizeof(*env->inos));
+    if (env->names == NULL || env->inos == NULL) return -1;
+    for (i = 0; i < env->nnames; i++) {
+        env->inos[i] = emptyfs_synth_child(&env->sy, EMPTYFS_ROOT_INO, i);
+        (void) emptyfs_synth_name(&env->sy, env->inos[i], env->names[i]);
+    }
+
+    e = emptyfs_start(xnu_host_kmod_info(), NULL);
+    if (e != KERN_SUCCESS) {
+        KLOG_ERR("emptyfs_start() fail  errno: %d", e);
+        return -1;
+    }
+
+    env->devvp = xnu_host_dev_create(NULL, DEV_SIZE, DEV_BSIZE_);
+    if (env->devvp == NULLVP) return -1;
+
+    e = xnu_host_mount(EMPTYFS_NAME, env->devvp, &env->args, &env->mp);
+    if (e != 0) {
+        KLOG_ERR("mount fail  errno: %d", e);
+        return -1;
+    }
+
+    /* warm up  so that lookup_hit does hit */
+    e = xnu_host_root(env->mp, &rvp);
+    if (e != 0) return -1;
+    for (i = 0; i < env->nnames; i++) {
+        char buf[EMPTYFS_SYNTH_NAME_MAX];
+        len = strlen(env->names[i]);
+        memcpy(buf, env->names[i], len + 1);
+        cn_init(&cn, buf, len, 0);
+        vp = NULLVP;
+        if (VNOP_LOOKUP(rvp, &vp, &cn, vfs_context_current()) != 0) {
+            KLOG_ERR("warm up lookup fail  name: %s", env->names[i]);
+            (void) vnode_put(rvp);
+            return -1;
+        }
+        (void) vnode_put(vp);
+    }
+    env->rootvp = rvp;
+    (void) vnode_put(rvp);
+
+    env->lck_grp = lck_grp_alloc_init("kbench_emptyfs", NULL);
+    if (env->lck_grp == NULL) return -1;
+    env->mtx_root = lck_mtx_alloc_init(env->lck_grp, NULL);
+    if (env->mtx_root == NULL) return -1;
+
+    return 0;
+}
+
+static int kbench_env_fini(struct kbench_env *env)
+{
+    int e = 0;
+
+    if (env->mp != NULL && xnu_host_unmount(env->mp, 0) != 0) e = -1;
+    if (env->devvp != NULLVP) xnu_host_dev_destroy(env->devvp);
+    if (emptyfs_stop(xnu_host_kmod_info(), NULL) != KERN_SUCCESS) e = -1;
+    if (env->mtx_root != NULL) lck_mtx_free(env->mtx_root, env->lck_grp);
+    if (env->lck_grp != NULL) lck_grp_free(env->lck_grp);
+    free(env->names);
+    free(env->inos);
+    return e;
+}
+
+static int read_u64(const char *name, uint64_t *v)
+{
+    size_t len = sizeof(*v);
+    return sysctlbyname(name, v, &len, NULL, 0);
+}
+
+static const struct kbench_case *kbench_case_find(const char *name)
+{
+    size_t i;
+    for (i = 0; i < ARRAY_SIZE(kbench_cases); i++) {
+        if (!strcmp(kbench_cases[i].name, name)) return &kbench_cases[i];
+    }
+    return NULL;
+}
+
+/*
+ * One result per line  so that `compare' gets away with sscanf(3)
+ */
+#define RESULT_FMT  "    {\"case\": \"%s\", \"threads\": %u, " \
+                    "\"ns_per_op\": %.2f, \"ns_per_op_median\": %.2f, \"ops_per_sec\": %.0f}"
+#define RESULT_SCN  " {\"case\": \"%31[^\"]\", \"threads\": %u, " \
+                    "\"ns_per_op\": %lf, \"ns_per_op_median\": %lf, \"ops_per_sec\": %lf}"
+
+static void kbench_write_json(
+        FILE *fp,
+        const struct kbench_result *res,
+        uint32_t nres,
+        uint32_t n,
+        uint32_t rounds,
+        uint32_t files,
+        uint32_t flags)
+{
+    uint32_t ncpu = 0;
+    uint32_t i;
+
+    (void) util_ncpu(&ncpu);
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"tool\": \"kbench_emptyfs\",\n");
+    fprintf(fp, "  \"version\": \"%s\",\n", KBENCH_EMPTYFS_VERSION);
+    fprintf(fp, "  \"kext_version\": \"%s\",\n", KEXTVERSION_S);
+    fprintf(fp, "  \"calls\": %u,\n", n);
+    fprintf(fp, "  \"rounds\": %u,\n", rounds);
+    fprintf(fp, "  \"files\": %u,\n", files);
+    fprintf(fp, "  \"mount_flags\": %u,\n", flags);
+    fprintf(fp, "  \"ncpu\": %u,\n", ncpu);
+    fprintf(fp, "  \"results\": [\n");
+    for (i = 0; i < nres; i++) {
+        fprintf(fp, RESULT_FMT "%s\n", res[i].name, res[i].threads,
+                res[i].ns_best, res[i].ns_median, res[i].ops_sec, i + 1 < nres ? "," : "");
+    }
+    fprintf(fp, "  ]\n");
+    fprintf(fp, "}\n");
+}
+
+static int do_run(uint32_t n, uint32_t rounds, uint32_t maxthread, uint32_t files,
+                    uint32_t flags, const char *out, char **names, int nnames)
+{
+    const struct kbench_case *cases[ARRAY_SIZE(kbench_cases)];
+    struct kbench_result *res;
+    struct kbench_env env;
+    uint32_t ncase = 0;
+    uint32_t nres = 0;
+    uint32_t nstep = 0;
+    uint32_t t, i;
+    uint64_t err = 0;
+    uint64_t hit, miss;
+    FILE *fp = stdout;
+    int j;
+
+    if (nnames == 0) {
+        for (i = 0; i < ARRAY_SIZE(kbench_cases); i++) cases[ncase++] = &kbench_cases[i];
+    } else {
+        for (j = 0; j < nnames; j++) {
+            if (ncase == ARRAY_SIZE(cases)) break;
+            cases[ncase] = kbench_case_find(names[j]);
+            if (cases[ncase] == NULL) {
+                KLOG_ERR("unknown case: %s", names[j]);
+                return 1;
+            }
+            ncase++;
+        }
+    }
+
+    for (t = 1; t <= maxthread; t <<= 1) nstep++;
+    res = calloc((size_t) ncase * nstep, sizeof(*res));
+    ASSERT_NONNULL(res);
+
+    if (out != NULL && strcmp(out, "-")) {
+        fp = fopen(out, "w");
+        if (fp == NULL) {
+            KLOG_ERR("fopen() fail  path: %s errno: %d", out, errno);
+            return 1;
+        }
+    }
+
+    /* kext log would disturb timing */
+    xnu_host_log(NULL);
+
+    if (kbench_env_init(&env, files, flags) != 0) {
+        KLOG_ERR("environment setup fail");
+        return 1;
+    }
+
+    KLOG("%u calls per thread  %u round(s)  root has %u entries", n, rounds, env.nnames);
+
+    for (i = 0; i < ncase; i++) {
+        for (t = 1; t <= maxthread; t <<= 1) {
+            err += kbench_run_case(&env, cases[i], n, rounds, t, &res[nres]);
+            KLOG("%-14s %3u thread(s)  %10.1f ns/op  (median %10.1f)  %12.0f ops/sec",
+                    res[nres].name, t, res[nres].ns_best, res[nres].ns_median, res[nres].ops_sec);
+            nres++;
+        }
+    }
+
+    if (read_u64("vfs.generic.emptyfs.mnt_pool_hit", &hit) == 0 &&
+            read_u64("vfs.generic.emptyfs.mnt_pool_miss", &miss) == 0 && hit + miss > 1) {
+        KLOG("mount pool: %llu hit(s)  %llu miss(es)",
+                (unsigned long long) hit, (unsigned long long) miss);
+    }
+
+    if (kbench_env_fini(&env) != 0) {
+        KLOG_ERR("environment teardown fail");
+        err++;
+    }
+
+    kbench_write_json(fp, res, nres, n, rounds, files, flags);
+    if (fp != stdout) (void) fclose(fp);
+    free(res);
+
+    if (xnu_host_violations() != 0) {
+        KLOG_ERR("%llu KPI violation(s)", (unsigned long long) xnu_host_violations());
+        err++;
+    }
+    if (err != 0) KLOG_ERR("%llu failed call(s)", (unsigned long long) err);
+    return err != 0;
+}
+
+/**
+ * Load results from JSON written by `run'
+ * @return      number of results  -1 if failed
+ */
+static int kbench_load(const char *path, struct kbench_result **resp)
+{
+    struct kbench_result *res = NULL;
+    struct kbench_result *p;
+    struct kbench_result r;
+    char line[512];
+    size_t cap = 0;
+    int nres = 0;
+    FILE *fp;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        KLOG_ERR("fopen() fail  path: %s errno: %d", path, errno);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (strstr(line, "\"case\"") == NULL) continue;
+        if (sscanf(line, RESULT_SCN, r.name, &r.threads, &r.ns_best, &r.ns_median, &r.ops_sec) != 5) {
+            KLOG_ERR("malformed result  path: %s line: %s", path, line);
+            goto out_fail;
+        }
+        if ((size_t) nres == cap) {
+            cap = cap != 0 ? cap << 1 : 64;
+            p = realloc(res, cap * sizeof(*res));
+            if (p == NULL) goto out_fail;
+            res = p;
+        }
+        res[nres++] = r;
+    }
+
+    (void) fclose(fp);
+    *resp = res;
+    return nres;
+
+out_fail:
+    (void) fclose(fp);
+    free(res);
+    return -1;
+}
+
+static int do_compare(const char *base_path, const char *cur_path, uint32_t threshold)
+{
+    struct kbench_result *base = NULL;
+    struct kbench_result *cur = NULL;
+    const struct kbench_result *c;
+    int nbase, ncur, i, j;
+    uint32_t nreg = 0;
+    uint32_t nimp = 0;
+    uint32_t nmiss = 0;
+    double delta;
+    const char *verdict;
+
+    nbase = kbench_load(base_path, &base);
+    ncur = kbench_load(cur_path, &cur);
+    if (nbase < 0 || ncur < 0) {
+        free(base);
+        free(cur);
+        return 2;
+    }
+
+    KLOG("%-14s %7s %12s %12s %8s", "case", "threads", "base ns/op", "cur ns/op", "delta");
+    for (i = 0; i < nbase; i++) {
+        for (j = 0, c = NULL; j < ncur; j++) {
+            if (!strcmp(cur[j].name, base[i].name) && cur[j].threads == base[i].threads) {
+                c = &cur[j];
+                break;
+            }
+        }
+        if (c == NULL) {
+            KLOG("%-14s %7u %12.1f %12s %8s  missing", base[i].name, base[i].threads, base[i].ns_best, "-", "-");
+            nmiss++;
+            continue;
+        }
+
+        /* best-of-rounds on both sides  least noisy figure there is */
+        delta = base[i].ns_best > 0 ? (c->ns_best / base[i].ns_best - 1.0) * 100.0 : 0.0;
+        if (delta > (double) threshold) {
+            verdict = "REGRESSED";
+            nreg++;
+        } else if (delta < -(double) threshold) {
+            verdict = "improved";
+            nimp++;
+        } else {
+            verdict = "";
+        }
+        KLOG("%-14s %7u %12.1f %12.1f %+7.1f%%  %s",
+                base[i].name, base[i].threads, base[i].ns_best, c->ns_best, delta, verdict);
+    }
+
+    KLOG("%u regressed  %u improved  %u missing  threshold %u%%", nreg, nimp, nmiss, threshold);
+
+    free(base);
+    free(cur);
+    return nreg != 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int ch;
+    uint32_t n = 100000;
+    uint32_t rounds = 5;
+    uint32_t nthread = 8;
+    uint32_t files = 1000;
+    uint32_t threshold = DEFAULT_THRESHOLD;
+    uint32_t flags = 0;
+    const char *out = NULL;
+    size_t i;
+
+    while ((ch = getopt(argc, argv, "n:r:t:f:Po:T:vh")) != -1) {
+        switch (ch) {
+        case 'n':
+            n = parse_u32(argv[0], optarg);
+            break;
+        case 'r':
+            rounds = parse_u32(argv[0], optarg);
+            break;
+        case 't':
+            nthread = parse_u32(argv[0], optarg);
+            break;
+        case 'f':
+            files = parse_u32(argv[0], optarg);
+            break;
+        case 'P':
+            flags |= EMPTYFS_MNT_PINROOT;
+            break;
+        case 'o':
+            out = optarg;
+            break;
+        case 'T':
+            threshold = parse_u32(argv[0], optarg);
+            break;
+        case 'v':
+            fprintf(stderr, "%s version %s\nbuilt date %s %s\n\n",
+                    basename(argv[0]), KBENCH_EMPTYFS_VERSION, __DATE__, __TIME__);
+            exit(0);
+        case 'h':
+        case '?':
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (argc == optind) usage(argv[0]);
+
+    if (!strcmp(argv[optind], "run")) {
+        if (n == 0 || rounds == 0 || nthread == 0 || files == 0) usage(argv[0]);
+        return do_run(n, rounds, nthread, files, flags, out, argv + optind + 1, argc - optind - 1);
+    }
+
+    if (!strcmp(argv[optind], "compare")) {
+        if (argc - optind != 3) usage(argv[0]);
+        return do_compare(argv[optind + 1], argv[optind + 2], threshold);
+    }
+
+    if (!strcmp(argv[optind], "list")) {
+        if (argc - optind != 1) usage(argv[0]);
+        for (i = 0; i < ARRAY_SIZE(kbench_cases); i++) {
+            fprintf(stdout, "%-14s %s\n", kbench_cases[i].name, kbench_cases[i].desc);
+        }
+        return 0;
+    }
+
+    usage(argv[0]);
+}
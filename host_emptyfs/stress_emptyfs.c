@@ -0,0 +1,703 @@
+/*
+ * Created 261018
+ *
+ * Concurrency stress of kext sources running on the userspace stand-in
+ *  see: xnu_host.c
+ *
+ * thousands of threads take the root vnode through vfs_root  each checks
+ *  the vnode it got is the live root  readdir threads walk root with
+ *  assorted buffer sizes and look up what they read  reclaimer threads
+ *  recycle vnodes under them  on top of reclaims injected at KPI boundaries
+ *
+ * kcb is stressed afterwards  as invalidation can't be undone
+ *
+ * exits non-zero if the stand-in or a checker caught any violation
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "emptyfs.h"
+#include "emptyfs_vfsops.h"
+#include "emptyfs_fsnode.h"
+#include "emptyfs_synth.h"
+#include "utils.h"
+
+#define STRESS_EMPTYFS_VERSION  "0.1"
+
+#define SLOG(fmt, ...)      fprintf(stdout, "stress_emptyfs: " fmt "\n", ##__VA_ARGS__)
+#define SLOG_ERR(fmt, ...)  fprintf(stderr, "stress_emptyfs: [ERR] " fmt "\n", ##__VA_ARGS__)
+
+#define ASSERT_NONNULL(p)   assert(p != NULL)
+
+/* thousands of threads  keep their stacks small */
+#define WORKER_STACK        (256 * 1024)
+
+/* device of a synthetic volume is never read  but must be there */
+#define DEV_SIZE            (1024 * 1024)
+#define DEV_BSIZE_          512
+
+extern kern_return_t emptyfs_start(kmod_info_t *, void *);
+extern kern_return_t emptyfs_stop(kmod_info_t *, void *);
+
+static __attribute__((noreturn)) void usage(char *argv0)
+{
+    ASSERT_NONNULL(argv0);
+    fprintf(stderr,
+            "usage:\n\t"
+            "%s [-t n] [-d n] [-r n] [-k n] [-i n] [-s sec] [-F n] [-D n] [-f n] [-P] [-q]\n\n\t"
+            "-t n       root lookup threads(default: 2048)\n\t"
+            "-d n       readdir threads(default: 8)\n\t"
+            "-r n       reclaimer threads(default: 2)\n\t"
+            "-k n       kcb threads(default: 64)\n\t"
+            "-i n       inject a reclaim one in n KPI calls  0 to disable(default: 64)\n\t"
+            "-s sec     seconds each phase runs(default: 3)\n\t"
+            "-F n       synthetic fanout(default: 4)\n\t"
+            "-D n       synthetic depth(default: 2)\n\t"
+            "-f n       synthetic files per directory(default: 32)\n\t"
+            "-P         mount with root vnode pinned\n\t"
+            "-q         silence kernel log\n\t"
+            "-v         print version\n\t"
+            "-h         print this help\n\n",
+            basename(argv0));
+    exit(1);
+}
+
+static uint32_t parse_u32(char *argv0, const char *arg)
+{
+    unsigned long n;
+    char *end;
+
+    errno = 0;
+    n = strtoul(arg, &end, 0);
+    if (errno != 0 || end == arg || *end != '\0' || n > UINT32_MAX) {
+        SLOG_ERR("bad numeric argument: %s", arg);
+        usage(argv0);
+    }
+
+    return (uint32_t) n;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+/*
+ * Start gate  so that all workers race at the same moment
+ */
+struct start_gate {
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    int open;
+};
+
+static void gate_wait(struct start_gate *g)
+{
+    (void) pthread_mutex_lock(&g->mtx);
+    while (!g->open) (void) pthread_cond_wait(&g->cond, &g->mtx);
+    (void) pthread_mutex_unlock(&g->mtx);
+}
+
+static void gate_open(struct start_gate *g)
+{
+    (void) pthread_mutex_lock(&g->mtx);
+    g->open = 1;
+    (void) pthread_cond_broadcast(&g->cond);
+    (void) pthread_mutex_unlock(&g->mtx);
+}
+
+enum worker_kind {
+    W_ROOT,
+    W_READDIR,
+    W_RECLAIM,
+    W_KCB,
+    W_NR,
+};
+
+static const char *worker_name[W_NR] = {
+    "root", "readdir", "reclaim", "kcb",
+};
+
+struct worker {
+    pthread_t thread;
+    enum worker_kind kind;
+    uint32_t id;
+    mount_t mp;
+    const struct emptyfs_synth *sy;
+    /* root vnode pinned by mount  NULLVP if not EMPTYFS_MNT_PINROOT */
+    vnode_t pinned;
+    struct start_gate *gate;
+    volatile int *stop;
+    uint64_t ops;
+    /* readdir: lookups done on entries read */
+    uint64_t lookups;
+    /* kcb: gets succeeded  puts done */
+    uint64_t gets;
+    uint64_t puts;
+};
+
+static volatile uint64_t nfail = 0;
+
+#define CHECK(w, ex, fmt, ...) do {                                         \
+    if (!(ex)) {                                                            \
+        __atomic_fetch_add(&nfail, 1, __ATOMIC_RELAXED);                    \
+        xnu_host_violation("%s#%u `%s' failed  " fmt,                       \
+                worker_name[(w)->kind], (w)->id, #ex, ##__VA_ARGS__);       \
+    }                                                                       \
+} while (0)
+
+/**
+ * Take root vnode as VFS does  and check it's the live root
+ * @return      the root with an iocount  NULL if failed
+ */
+static vnode_t root_get_check(struct worker *w)
+{
+    vnode_t vp = NULLVP;
+    struct emptyfs_fsnode *fn;
+    int e;
+
+    e = xnu_host_root(w->mp, &vp);
+    CHECK(w, e == 0, "errno: %d", e);
+    if (e != 0) return NULLVP;
+
+    CHECK(w, vp != NULLVP, "");
+    if (vp == NULLVP) return NULLVP;
+
+    CHECK(w, vnode_isvroot(vp), "vp: %p", vp);
+    CHECK(w, vnode_isdir(vp), "vp: %p", vp);
+    CHECK(w, vnode_mount(vp) == w->mp, "vp: %p", vp);
+
+    /* an iocount pins vp  and thus its fsnode */
+    fn = vnode_fsnode(vp);
+    CHECK(w, fn != NULL, "vp: %p", vp);
+    if (fn != NULL) {
+        CHECK(w, fn->ino == EMPTYFS_ROOT_INO, "vp: %p ino: %llu", vp, (unsigned long long) fn->ino);
+        CHECK(w, fn->vp == vp, "vp: %p fn->vp: %p", vp, fn->vp);
+        CHECK(w, fn->vid == vnode_vid(vp), "vp: %p vid: %#x %#x", vp, fn->vid, vnode_vid(vp));
+    }
+
+    /* pinned root is never reclaimed  .: always the very same vnode */
+    if (w->pinned != NULLVP) CHECK(w, vp == w->pinned, "vp: %p pinned: %p", vp, w->pinned);
+
+    return vp;
+}
+
+static void *root_worker_main(void *arg)
+{
+    struct worker *w = arg;
+    vnode_t vp;
+
+    gate_wait(w->gate);
+
+    while (!__atomic_load_n(w->stop, __ATOMIC_RELAXED)) {
+        vp = root_get_check(w);
+        if (vp != NULLVP) (void) vnode_put(vp);
+        w->ops++;
+        /* there are way more threads than CPUs  let them interleave */
+        if ((w->ops & 7) == 0) sched_yield();
+    }
+
+    return NULL;
+}
+
+/* assorted buffer sizes  from room for a single "." up to many pages */
+static const uint32_t readdir_bufsz[] = {
+    16, 24, 40, 64, 100, 256, 1000, 4096, 65536,
+};
+
+/**
+ * Look up a name in root  and check the vnode names the inode readdir told
+ */
+static void readdir_lookup(struct worker *w, vnode_t dvp, const char *name, size_t len, uint64_t ino)
+{
+    struct componentname cn;
+    struct emptyfs_fsnode *fn;
+    char buf[EMPTYFS_SYNTH_NAME_MAX];
+    vnode_t vp = NULLVP;
+    int e;
+
+    memset(&cn, 0, sizeof(cn));
+    memcpy(buf, name, len);
+    cn.cn_nameiop = LOOKUP;
+    cn.cn_flags = ISLASTCN | MAKEENTRY;
+    cn.cn_context = vfs_context_current();
+    cn.cn_pnbuf = buf;
+    cn.cn_pnlen = (int) sizeof(buf);
+    cn.cn_nameptr = buf;
+    cn.cn_namelen = (int) len;
+
+    e = VNOP_LOOKUP(dvp, &vp, &cn, vfs_context_current());
+    CHECK(w, e == 0, "name: %.*s errno: %d", (int) len, name, e);
+    if (e != 0) return;
+
+    fn = vnode_fsnode(vp);
+    CHECK(w, fn != NULL, "vp: %p", vp);
+    if (fn != NULL) {
+        CHECK(w, fn->ino == ino, "name: %.*s ino: %llu %llu",
+                (int) len, name, (unsigned long long) fn->ino, (unsigned long long) ino);
+        CHECK(w, fn->vp == vp, "vp: %p fn->vp: %p", vp, fn->vp);
+    }
+    (void) vnode_put(vp);
+    w->lookups++;
+}
+
+/**
+ * Walk root from cookie zero till EOF  every entry is checked against
+ *  what the synthetic namespace says
+ */
+static void readdir_walk(struct worker *w, vnode_t dvp, uint32_t bufsz, int extended)
+{
+    static const uint64_t dot[2] = {EMPTYFS_ROOT_INO, EMPTYFS_ROOT_INO};
+    char *buf;
+    char name[EMPTYFS_SYNTH_NAME_MAX];
+    uint64_t nent = emptyfs_synth_nentries(w->sy, EMPTYFS_ROOT_INO);
+    uint64_t idx = 0;
+    uint64_t ino;
+    const char *dname;
+    size_t dnamlen;
+    uint16_t reclen;
+    uio_t uio;
+    size_t off;
+    size_t used;
+    int eof = 0;
+    int num;
+    int e;
+
+    buf = malloc(bufsz);
+    if (buf == NULL) return;
+
+    uio = uio_create(1, 0, UIO_SYSSPACE, UIO_READ);
+    ASSERT_NONNULL(uio);
+
+    while (!eof) {
+        /* iovec is consumed by uiomove()  renew it on each call */
+        off = (size_t) uio_offset(uio);
+        uio_free(uio);
+        uio = uio_create(1, (off_t) off, UIO_SYSSPACE, UIO_READ);
+        ASSERT_NONNULL(uio);
+        (void) uio_addiov(uio, CAST_USER_ADDR_T(buf), bufsz);
+
+        num = 0;
+        e = VNOP_READDIR(dvp, uio, extended ? VNODE_READDIR_EXTENDED : 0, &eof, &num,
+                            vfs_context_current());
+        CHECK(w, e == 0, "bufsz: %u errno: %d", bufsz, e);
+        if (e != 0) break;
+
+        used = bufsz - (size_t) uio_resid(uio);
+        /* a buffer too small for the next entry yields nothing  that's legal */
+        if (num == 0) {
+            CHECK(w, used == 0, "bufsz: %u used: %zu", bufsz, used);
+            if (!eof) CHECK(w, idx != 0 || bufsz < 24, "bufsz: %u no progress", bufsz);
+            break;
+        }
+
+        for (off = 0; num > 0; num--, idx++, off += reclen) {
+            if (extended) {
+                struct direntry *xdp = (struct direntry *) (buf + off);
+                reclen = xdp->d_reclen;
+                ino = xdp->d_ino;
+                dname = xdp->d_name;
+                dnamlen = xdp->d_namlen;
+            } else {
+                struct dirent *dp = (struct dirent *) (buf + off);
+                reclen = dp->d_reclen;
+                ino = dp->d_fileno;
+                dname = dp->d_name;
+                dnamlen = dp->d_namlen;
+            }
+
+            CHECK(w, reclen != 0 && off + reclen <= used, "bufsz: %u off: %zu reclen: %u", bufsz, off, reclen);
+            if (reclen == 0 || off + reclen > used) goto out_free;
+            CHECK(w, dname[dnamlen] == '\0', "bufsz: %u idx: %llu", bufsz, (unsigned long long) idx);
+
+            if (idx < 2) {
+                CHECK(w, dnamlen == idx + 1 && !memcmp(dname, "..", dnamlen),
+                        "idx: %llu name: %.*s", (unsigned long long) idx, (int) dnamlen, dname);
+                CHECK(w, ino == dot[idx], "idx: %llu ino: %llu", (unsigned long long) idx, (unsigned long long) ino);
+                continue;
+            }
+
+            CHECK(w, idx - 2 < nent, "idx: %llu nent: %llu", (unsigned long long) idx, (unsigned long long) nent);
+            if (idx - 2 >= nent) goto out_free;
+            CHECK(w, ino == emptyfs_synth_child(w->sy, EMPTYFS_ROOT_INO, idx - 2),
+                    "idx: %llu ino: %llu", (unsigned long long) idx, (unsigned long long) ino);
+            CHECK(w, dnamlen == emptyfs_synth_name(w->sy, ino, name) && !memcmp(dname, name, dnamlen),
+                    "idx: %llu name: %.*s", (unsigned long long) idx, (int) dnamlen, dname);
+
+            /* every few entries  as ls -l would */
+            if ((idx & 3) == 0) readdir_lookup(w, dvp, dname, dnamlen, ino);
+        }
+        CHECK(w, off == used, "bufsz: %u off: %zu used: %zu", bufsz, off, used);
+    }
+
+    if (eof) CHECK(w, idx == nent + 2, "bufsz: %u entries: %llu %llu",
+                    bufsz, (unsigned long long) idx, (unsigned long long) nent + 2);
+
+out_free:
+    uio_free(uio);
+    free(buf);
+}
+
+static void *readdir_worker_main(void *arg)
+{
+    struct worker *w = arg;
+    uint32_t bufsz;
+    vnode_t vp;
+
+    gate_wait(w->gate);
+
+    while (!__atomic_load_n(w->stop, __ATOMIC_RELAXED)) {
+        vp = root_get_check(w);
+        if (vp == NULLVP) continue;
+
+        bufsz = readdir_bufsz[(w->ops + w->id) % ARRAY_SIZE(readdir_bufsz)];
+        readdir_walk(w, vp, bufsz, (int) ((w->ops >> 1) & 1));
+        (void) vnode_put(vp);
+        w->ops++;
+    }
+
+    return NULL;
+}
+
+static void *reclaim_worker_main(void *arg)
+{
+    struct worker *w = arg;
+    int e;
+
+    gate_wait(w->gate);
+
+    while (!__atomic_load_n(w->stop, __ATOMIC_RELAXED)) {
+        (void) xnu_host_reclaim_any(w->mp);
+        w->ops++;
+
+        /* now and then purge the whole volume  as memory pressure does */
+        if (w->id == 0 && (w->ops & 1023) == 0) {
+            e = vflush(w->mp, NULLVP, 0);
+            /* our usecount on a pinned root makes it busy */
+            CHECK(w, e == 0 || (e == EBUSY && w->pinned != NULLVP), "vflush() errno: %d", e);
+        }
+        if ((w->ops & 15) == 0) sched_yield();
+    }
+
+    return NULL;
+}
+
+static void *kcb_worker_main(void *arg)
+{
+    struct worker *w = arg;
+
+    gate_wait(w->gate);
+
+    /* runs till util_invalidate_kcb()  the stop flag isn't checked */
+    for (;;) {
+        if (util_get_kcb() != 0) break;
+        w->gets++;
+        if ((w->gets & 63) == 0) sched_yield();
+        (void) util_put_kcb();
+        w->puts++;
+        w->ops++;
+    }
+
+    return NULL;
+}
+
+static void *(*worker_main[W_NR])(void *) = {
+    root_worker_main, readdir_worker_main, reclaim_worker_main, kcb_worker_main,
+};
+
+/**
+ * Run a phase: start workers  let them race for `secs'  then stop and join
+ * @kcb         if set  util_invalidate_kcb() is what stops the workers
+ * @return      elapsed seconds
+ */
+static double run_phase(struct worker *w, uint32_t n, uint32_t secs, int kcb)
+{
+    struct start_gate gate = {
+        PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0,
+    };
+    volatile int stop = 0;
+    pthread_attr_t attr;
+    double t;
+    uint32_t i;
+    int e;
+
+    (void) pthread_attr_init(&attr);
+    (void) pthread_attr_setstacksize(&attr, WORKER_STACK);
+
+    for (i = 0; i < n; i++) {
+        w[i].gate = &gate;
+        w[i].stop = &stop;
+        e = pthread_create(&w[i].thread, &attr, worker_main[w[i].kind], &w[i]);
+        if (e != 0) {
+            SLOG_ERR("pthread_create() fail  errno: %d thread: %u", e, i);
+            exit(1);
+        }
+    }
+    (void) pthread_attr_destroy(&attr);
+
+    t = now_sec();
+    gate_open(&gate);
+    (void) sleep(secs);
+    if (kcb) {
+        util_invalidate_kcb();
+    } else {
+        __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    }
+    for (i = 0; i < n; i++) (void) pthread_join(w[i].thread, NULL);
+
+    return now_sec() - t;
+}
+
+static void report(const struct worker *w, uint32_t n, enum worker_kind kind, double t)
+{
+    uint64_t ops = 0;
+    uint64_t lookups = 0;
+    uint32_t cnt = 0;
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        if (w[i].kind != kind) continue;
+        ops += w[i].ops;
+        lookups += w[i].lookups;
+        cnt++;
+    }
+    if (cnt == 0) return;
+
+    SLOG("%-8s %5u thread(s)  %10llu ops  %12.0f ops/sec",
+            worker_name[kind], cnt, (unsigned long long) ops, t > 0 ? (double) ops / t : 0.0);
+    if (lookups != 0) {
+        SLOG("%-8s %5s            %10llu ops  %12.0f ops/sec",
+                "lookup", "", (unsigned long long) lookups, t > 0 ? (double) lookups / t : 0.0);
+    }
+}
+
+/**
+ * Unmount while someone else holds the pinned root
+ *  it must fail and leave the root pinned as before
+ * @return      0 if still mounted
+ */
+static int busy_unmount(mount_t mp, vnode_t pinned)
+{
+    vnode_t vp;
+    int e;
+
+    e = xnu_host_root(mp, &vp);
+    if (e != 0) {
+        xnu_host_violation("vfs_root() fail  errno: %d", e);
+        return 0;
+    }
+    if (vp != pinned) xnu_host_violation("vp: %p pinned: %p", vp, pinned);
+
+    e = vnode_ref(vp);
+    if (e != 0) {
+        xnu_host_violation("vnode_ref() fail  errno: %d", e);
+        (void) vnode_put(vp);
+        return 0;
+    }
+
+    e = xnu_host_unmount(mp, 0);
+    if (e != EBUSY) xnu_host_violation("busy unmount  errno: %d", e);
+    /* XXX: vp is gone along with mp  nothing to release */
+    if (e == 0) return 1;
+
+    if (emptyfs_mount_from_mp(mp)->root_pin != pinned) {
+        xnu_host_violation("root unpinned by failed unmount  root_pin: %p pinned: %p",
+                emptyfs_mount_from_mp(mp)->root_pin, pinned);
+    } else {
+        SLOG("busy unmount refused  root still pinned");
+    }
+
+    vnode_rele(vp);
+    (void) vnode_put(vp);
+    return 0;
+}
+
+/**
+ * @return      0 if no violation
+ */
+static int do_stress(uint32_t nroot, uint32_t nreaddir, uint32_t nreclaim, uint32_t nkcb,
+                        uint32_t inject, uint32_t secs, struct emptyfs_mnt_args *args)
+{
+    struct emptyfs_synth sy;
+    struct worker *w;
+    vnode_t pinned = NULLVP;
+    vnode_t devvp;
+    mount_t mp;
+    uint64_t reclaims;
+    uint32_t n = nroot + nreaddir + nreclaim;
+    uint32_t i;
+    double t;
+    int e;
+
+    if (emptyfs_synth_init(&sy, args->fanout, args->depth, args->files, args->seed) != 0) {
+        SLOG_ERR("synthetic namespace too large");
+        return 1;
+    }
+
+    w = calloc(GMAX(n, nkcb), sizeof(*w));
+    ASSERT_NONNULL(w);
+
+    e = emptyfs_start(xnu_host_kmod_info(), NULL);
+    if (e != KERN_SUCCESS) {
+        SLOG_ERR("emptyfs_start() fail  errno: %d", e);
+        return 1;
+    }
+
+    devvp = xnu_host_dev_create(NULL, DEV_SIZE, DEV_BSIZE_);
+    ASSERT_NONNULL(devvp);
+
+    e = xnu_host_mount(EMPTYFS_NAME, devvp, args, &mp);
+    if (e != 0) {
+        SLOG_ERR("mount fail  errno: %d", e);
+        return 1;
+    }
+
+    SLOG("mounted  fanout: %u depth: %u files: %u  root has %llu entries%s",
+            args->fanout, args->depth, args->files,
+            (unsigned long long) emptyfs_synth_nentries(&sy, EMPTYFS_ROOT_INO),
+            (args->flags & EMPTYFS_MNT_PINROOT) ? "  root pinned" : "");
+
+    if (args->flags & EMPTYFS_MNT_PINROOT) {
+        pinned = emptyfs_mount_from_mp(mp)->root_pin;
+        if (pinned == NULLVP) xnu_host_violation("root not pinned by mount");
+    }
+
+    for (i = 0; i < n; i++) {
+        w[i].kind = i < nroot ? W_ROOT : (i < nroot + nreaddir ? W_READDIR : W_RECLAIM);
+        w[i].id = i < nroot ? i : (i < nroot + nreaddir ? i - nroot : i - nroot - nreaddir);
+        w[i].mp = mp;
+        w[i].sy = &sy;
+        w[i].pinned = pinned;
+    }
+
+    SLOG("storm: %u second(s)  inject one in %u", secs, inject);
+    reclaims = xnu_host_nreclaims();
+    xnu_host_inject(inject);
+    t = run_phase(w, n, secs, 0);
+    xnu_host_inject(0);
+    reclaims = xnu_host_nreclaims() - reclaims;
+
+    report(w, n, W_ROOT, t);
+    report(w, n, W_READDIR, t);
+    report(w, n, W_RECLAIM, t);
+    SLOG("%-8s %5s            %10llu ops  %12.0f ops/sec", "reclaimed", "",
+            (unsigned long long) reclaims, t > 0 ? (double) reclaims / t : 0.0);
+    for (i = 0; i < XNU_INJ_NR; i++) {
+        SLOG("injected at %-18s %10llu", xnu_host_inject_name(i),
+                (unsigned long long) xnu_host_injected(i));
+    }
+    SLOG("%u vnode(s) alive after storm", xnu_host_nvnodes(mp));
+
+    e = pinned != NULLVP && busy_unmount(mp, pinned) ? 0 : xnu_host_unmount(mp, 0);
+    if (e != 0) {
+        xnu_host_violation("unmount fail  errno: %d", e);
+    } else {
+        xnu_host_dev_destroy(devvp);
+    }
+
+    memset(w, 0, GMAX(n, nkcb) * sizeof(*w));
+    for (i = 0; i < nkcb; i++) {
+        w[i].kind = W_KCB;
+        w[i].id = i;
+    }
+
+    if (nkcb != 0) {
+        SLOG("kcb: %u second(s) then invalidate", secs);
+        t = run_phase(w, nkcb, secs, 1);
+        report(w, nkcb, W_KCB, t);
+
+        for (i = 0; i < nkcb; i++) {
+            CHECK(&w[i], w[i].gets == w[i].puts, "gets: %llu puts: %llu",
+                    (unsigned long long) w[i].gets, (unsigned long long) w[i].puts);
+        }
+        CHECK(&w[0], util_read_kcb() == -1, "kcb: %d", util_read_kcb());
+        CHECK(&w[0], util_get_kcb() != 0, "");
+    }
+
+    e = emptyfs_stop(xnu_host_kmod_info(), NULL);
+    if (e != KERN_SUCCESS) xnu_host_violation("emptyfs_stop() fail  errno: %d", e);
+
+    free(w);
+
+    SLOG("%llu violation(s)  %llu by checkers",
+            (unsigned long long) xnu_host_violations(), (unsigned long long) nfail);
+    return xnu_host_violations() != 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int ch;
+    uint32_t nroot = 2048;
+    uint32_t nreaddir = 8;
+    uint32_t nreclaim = 2;
+    uint32_t nkcb = 64;
+    uint32_t inject = 64;
+    uint32_t secs = 3;
+    struct emptyfs_mnt_args args;
+
+    memset(&args, 0, sizeof(args));
+    args.magic = EMPTYFS_MNTARG_MAGIC;
+    args.fanout = 4;
+    args.depth = 2;
+    args.files = 32;
+    args.seed = 1;
+
+    while ((ch = getopt(argc, argv, "t:d:r:k:i:s:F:D:f:Pqvh")) != -1) {
+        switch (ch) {
+        case 't':
+            nroot = parse_u32(argv[0], optarg);
+            break;
+        case 'd':
+            nreaddir = parse_u32(argv[0], optarg);
+            break;
+        case 'r':
+            nreclaim = parse_u32(argv[0], optarg);
+            break;
+        case 'k':
+            nkcb = parse_u32(argv[0], optarg);
+            break;
+        case 'i':
+            inject = parse_u32(argv[0], optarg);
+            break;
+        case 's':
+            secs = parse_u32(argv[0], optarg);
+            break;
+        case 'F':
+            args.fanout = parse_u32(argv[0], optarg);
+            break;
+        case 'D':
+            args.depth = parse_u32(argv[0], optarg);
+            break;
+        case 'f':
+            args.files = parse_u32(argv[0], optarg);
+            break;
+        case 'P':
+            args.flags |= EMPTYFS_MNT_PINROOT;
+            break;
+        case 'q':
+            xnu_host_log(NULL);
+            break;
+        case 'v':
+            fprintf(stderr, "%s version %s\nbuilt date %s %s\n\n",
+                    basename(argv[0]), STRESS_EMPTYFS_VERSION, __DATE__, __TIME__);
+            exit(0);
+        case 'h':
+        case '?':
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (argc != optind || secs == 0) usage(argv[0]);
+    /* an empty root directory would make readdir checks moot */
+    if ((args.fanout | args.files) == 0) usage(argv[0]);
+
+    return do_stress(nroot, nreaddir, nreclaim, nkcb, inject, secs, &args);
+}
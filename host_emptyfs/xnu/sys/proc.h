@@ -0,0 +1,5 @@
+/*
+ * Created 261018
+ * see: xnu_host.h
+ */
+#include <xnu_host.h>
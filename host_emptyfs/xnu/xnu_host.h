@@ -0,0 +1,910 @@
+/*
+ * Created 261018
+ *
+ * Userspace stand-in of xnu KPIs used by kext/src  see: xnu_host.c
+ *  kext sources are compiled unmodified against headers in this directory
+ *  each of them(<sys/vnode.h>  <kern/locks.h>  ...) merely includes this one
+ *  headers libc already has(<sys/types.h>  <string.h>  ...) are libc's
+ *
+ *  only what kext/src uses is declared  names and layouts follow xnu
+ *  yet nothing here is binary compatible with it
+ *
+ * XXX:
+ *  uint64_t is unsigned long on LP64 Linux  not unsigned long long
+ *  .: kext format strings(%llu) mismatch  build them with -Wno-format
+ */
+
+#ifndef __XNU_HOST_H
+#define __XNU_HOST_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/ioctl.h>
+
+/*
+ * libc types whose xnu layout differs  renamed past this point
+ */
+#define fsid_t              xnu_fsid_t
+typedef struct { int32_t val[2]; } xnu_fsid_t;
+
+#undef __nonnull
+#define __nonnull
+#define __nullable
+#ifndef __unused
+#define __unused            __attribute__((unused))
+#endif
+#define __private_extern__  __attribute__((visibility("hidden")))
+#ifndef __clang_version__
+#define __clang_version__   __VERSION__
+#endif
+/* what a 10.12 SDK predefines */
+#ifndef __ENVIRONMENT_MAC_OS_X_VERSION_MIN_REQUIRED__
+#define __ENVIRONMENT_MAC_OS_X_VERSION_MIN_REQUIRED__   101200
+#endif
+#define __MAC_10_10         101000
+#define __MAC_10_12         101200
+
+typedef int errno_t;
+typedef int kern_return_t;
+#define KERN_SUCCESS        0
+#define KERN_FAILURE        5
+
+typedef int32_t SInt32;
+typedef uint32_t UInt32;
+typedef int64_t SInt64;
+typedef uint64_t UInt64;
+typedef uint8_t UInt8;
+typedef int boolean_t;
+
+typedef uint64_t user_addr_t;
+typedef uint64_t user_size_t;
+typedef int64_t user_ssize_t;
+typedef uintptr_t vm_address_t;
+typedef uintptr_t vm_offset_t;
+typedef uintptr_t vm_size_t;
+typedef int64_t daddr64_t;
+typedef uint64_t ino64_t;
+
+typedef unsigned char uuid_t[16];
+typedef char uuid_string_t[37];
+
+/* errno values xnu has and Linux doesn't */
+#define EAUTH               201
+#define EBADMACHO           202
+/* never leaves kernel */
+#define EJUSTRETURN         (-2)
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE           4096
+#endif
+#define PAGE_MASK           (PAGE_SIZE - 1)
+#define trunc_page_64(x)    ((x) & ~((uint64_t) PAGE_MASK))
+#ifndef MAXNAMLEN
+#define MAXNAMLEN           255
+#endif
+
+/*
+ * kmod
+ */
+typedef struct kmod_info {
+    vm_address_t address;
+    vm_size_t size;
+} kmod_info_t;
+typedef kern_return_t kmod_start_func_t(kmod_info_t *, void *);
+typedef kern_return_t kmod_stop_func_t(kmod_info_t *, void *);
+
+/* Mach-O header of a kext  only what util_vma_uuid() walks */
+struct mach_header { uint32_t magic; int32_t cputype, cpusubtype; uint32_t filetype, ncmds, sizeofcmds, flags; };
+struct mach_header_64 { uint32_t magic; int32_t cputype, cpusubtype; uint32_t filetype, ncmds, sizeofcmds, flags, reserved; };
+struct load_command { uint32_t cmd, cmdsize; };
+struct uuid_command { uint32_t cmd, cmdsize; uint8_t uuid[16]; };
+#define MH_MAGIC            0xfeedface
+#define MH_CIGAM            0xcefaedfe
+#define MH_MAGIC_64         0xfeedfacf
+#define MH_CIGAM_64         0xcffaedfe
+#define MH_KEXT_BUNDLE      0xb
+#define LC_UUID             0x1b
+
+/*
+ * libkern
+ */
+/* kernel log  see: xnu_host_log() */
+int xnu_host_printf(const char *, ...) __attribute__((format(printf, 1, 2)));
+#define printf(...)         xnu_host_printf(__VA_ARGS__)
+__attribute__((noreturn, format(printf, 1, 2))) void panic(const char *, ...);
+#if !defined(__GLIBC__) || !__GLIBC_PREREQ(2, 38)
+size_t strlcpy(char *, const char *, size_t);
+#endif
+extern int cpu_number(void);
+
+SInt32 OSAddAtomic(SInt32, volatile SInt32 *);
+SInt64 OSAddAtomic64(SInt64, volatile SInt64 *);
+SInt64 OSIncrementAtomic64(volatile SInt64 *);
+SInt64 OSDecrementAtomic64(volatile SInt64 *);
+boolean_t OSCompareAndSwap(UInt32, UInt32, volatile UInt32 *);
+boolean_t OSCompareAndSwapPtr(void *, void *, void * volatile *);
+void OSMemoryBarrier(void);
+
+void uuid_generate_random(uuid_t);
+
+/*
+ * Memory  <sys/malloc.h>  <IOKit/IOLib.h>
+ */
+#define M_TEMP              80
+#define M_WAITOK            0x0000
+#define M_NOWAIT            0x0001
+#define M_ZERO              0x0004
+void *_MALLOC(size_t, int, int);
+void _FREE(void *, int);
+
+/*
+ * Locks  <kern/locks.h>
+ */
+typedef struct lck_grp lck_grp_t;
+typedef struct lck_grp_attr lck_grp_attr_t;
+typedef struct lck_attr lck_attr_t;
+typedef struct lck_mtx lck_mtx_t;
+typedef struct lck_rw lck_rw_t;
+typedef struct lck_spin lck_spin_t;
+#define LCK_GRP_ATTR_NULL           ((lck_grp_attr_t *) 0)
+#define LCK_ATTR_NULL               ((lck_attr_t *) 0)
+#define LCK_MTX_ASSERT_OWNED        1
+#define LCK_MTX_ASSERT_NOTOWNED     2
+
+lck_grp_t *lck_grp_alloc_init(const char *, lck_grp_attr_t *);
+void lck_grp_free(lck_grp_t *);
+lck_mtx_t *lck_mtx_alloc_init(lck_grp_t *, lck_attr_t *);
+void lck_mtx_free(lck_mtx_t *, lck_grp_t *);
+void lck_mtx_lock(lck_mtx_t *);
+void lck_mtx_unlock(lck_mtx_t *);
+void lck_mtx_assert(lck_mtx_t *, unsigned int);
+lck_rw_t *lck_rw_alloc_init(lck_grp_t *, lck_attr_t *);
+void lck_rw_free(lck_rw_t *, lck_grp_t *);
+void lck_rw_lock_shared(lck_rw_t *);
+void lck_rw_lock_exclusive(lck_rw_t *);
+void lck_rw_done(lck_rw_t *);
+lck_spin_t *lck_spin_alloc_init(lck_grp_t *, lck_attr_t *);
+void lck_spin_free(lck_spin_t *, lck_grp_t *);
+void lck_spin_lock(lck_spin_t *);
+void lck_spin_unlock(lck_spin_t *);
+
+/*
+ * Wait queues  <kern/sched_prim.h>  <sys/systm.h>
+ */
+typedef struct thread *thread_t;
+typedef void *event_t;
+typedef int wait_result_t;
+typedef int wait_interrupt_t;
+typedef void (*thread_continue_t)(void *, wait_result_t);
+#define THREAD_CONTINUE_NULL    ((thread_continue_t) 0)
+#define THREAD_UNINT            0
+#define THREAD_WAITING          (-1)
+#define THREAD_AWAKENED         0
+#define THREAD_TIMED_OUT        1
+
+wait_result_t assert_wait(event_t, wait_interrupt_t);
+wait_result_t thread_block(thread_continue_t);
+kern_return_t clear_wait(thread_t, wait_result_t);
+thread_t current_thread(void);
+kern_return_t thread_wakeup_prim(event_t, boolean_t, wait_result_t);
+#define thread_wakeup(x)        thread_wakeup_prim((x), 0, THREAD_AWAKENED)
+
+#define PINOD                   8
+#define PDROP                   0x400
+int msleep(void *, lck_mtx_t *, int, const char *, struct timespec *);
+void wakeup(void *);
+
+/*
+ * Time  <kern/clock.h>
+ */
+struct mach_timebase_info { uint32_t numer; uint32_t denom; };
+typedef struct mach_timebase_info mach_timebase_info_data_t;
+typedef struct mach_timebase_info *mach_timebase_info_t;
+void nanotime(struct timespec *);
+uint64_t mach_absolute_time(void);
+void absolutetime_to_nanoseconds(uint64_t, uint64_t *);
+void clock_timebase_info(mach_timebase_info_t);
+
+/*
+ * Credentials and contexts  <sys/kauth.h>  <sys/proc.h>
+ */
+typedef struct vfs_context *vfs_context_t;
+typedef struct ucred *kauth_cred_t;
+#define NOCRED                  ((kauth_cred_t) 0)
+kauth_cred_t kauth_cred_get(void);
+uid_t kauth_cred_getuid(kauth_cred_t);
+gid_t kauth_cred_getgid(kauth_cred_t);
+int kauth_cred_issuser(kauth_cred_t);
+vfs_context_t vfs_context_current(void);
+kauth_cred_t vfs_context_ucred(vfs_context_t);
+int vfs_context_issuser(vfs_context_t);
+
+/*
+ * uio  <sys/uio.h>
+ *  user and kernel share one address space here  thus copyin() is memcpy()
+ */
+typedef struct uio *uio_t;
+enum uio_rw { UIO_READ, UIO_WRITE };
+enum uio_seg { UIO_USERSPACE, UIO_SYSSPACE, UIO_USERSPACE32, UIO_USERSPACE64, UIO_SYSSPACE32 };
+uio_t uio_create(int, off_t, int, int);
+int uio_addiov(uio_t, user_addr_t, user_size_t);
+void uio_free(uio_t);
+user_ssize_t uio_resid(uio_t);
+void uio_setresid(uio_t, user_ssize_t);
+off_t uio_offset(uio_t);
+void uio_setoffset(uio_t, off_t);
+int uiomove(const char *, int, struct uio *);
+int copyin(user_addr_t, void *, size_t);
+int copyout(const void *, user_addr_t, size_t);
+#define CAST_USER_ADDR_T(p)     ((user_addr_t) (uintptr_t) (p))
+
+/*
+ * Directory entries  <sys/dirent.h>
+ */
+#define DT_UNKNOWN              0
+#define DT_DIR                  4
+#define DT_REG                  8
+/* kernel dirent has a 32-bit inode number  i.e. !__DARWIN_64_BIT_INO_T */
+struct dirent {
+    uint32_t d_fileno;
+    uint16_t d_reclen;
+    uint8_t d_type;
+    uint8_t d_namlen;
+    char d_name[MAXNAMLEN + 1];
+};
+struct direntry {
+    uint64_t d_ino;
+    uint64_t d_seekoff;
+    uint16_t d_reclen;
+    uint16_t d_namlen;
+    uint8_t d_type;
+    char d_name[MAXPATHLEN];
+};
+
+/*
+ * Vnodes and mounts  <sys/vnode.h>  <sys/mount.h>
+ */
+typedef struct vnode *vnode_t;
+typedef struct mount *mount_t;
+typedef struct vfstable *vfstable_t;
+#define NULLVP                  ((vnode_t) 0)
+
+enum vtype { VNON, VREG, VDIR, VBLK, VCHR, VLNK, VSOCK, VFIFO, VBAD, VSTR, VCPLX };
+
+struct componentname {
+    uint32_t cn_nameiop;
+    uint32_t cn_flags;
+    vfs_context_t cn_context;
+    char *cn_pnbuf;
+    int cn_pnlen;
+    char *cn_nameptr;
+    int cn_namelen;
+    uint32_t cn_hash;
+    uint32_t cn_consume;
+};
+#define LOOKUP                  0
+#define CREATE                  1
+#define DELETE                  2
+#define RENAME                  3
+#define ISDOTDOT                0x00002000
+#define MAKEENTRY               0x00004000
+#define ISLASTCN                0x00008000
+
+struct vnode_fsparam {
+    struct mount *vnfs_mp;
+    enum vtype vnfs_vtype;
+    const char *vnfs_str;
+    struct vnode *vnfs_dvp;
+    void *vnfs_fsnode;
+    int (**vnfs_vops)(void *);
+    int vnfs_markroot;
+    int vnfs_marksystem;
+    dev_t vnfs_rdev;
+    off_t vnfs_filesize;
+    struct componentname *vnfs_cnp;
+    uint32_t vnfs_flags;
+};
+#define VNFS_NOCACHE            0x01
+#define VNFS_CANTCACHE          0x02
+#define VNFS_ADDFSREF           0x04
+#define VNCREATE_FLAVOR         0
+
+errno_t vnode_create(uint32_t, uint32_t, void *, vnode_t *);
+int vnode_addfsref(vnode_t);
+int vnode_removefsref(vnode_t);
+int vnode_get(vnode_t);
+int vnode_getwithvid(vnode_t, uint32_t);
+int vnode_put(vnode_t);
+int vnode_ref(vnode_t);
+void vnode_rele(vnode_t);
+int vnode_recycle(vnode_t);
+int vnode_isinuse(vnode_t, int);
+uint32_t vnode_vid(vnode_t);
+enum vtype vnode_vtype(vnode_t);
+int vnode_isdir(vnode_t);
+int vnode_isreg(vnode_t);
+int vnode_isvroot(vnode_t);
+mount_t vnode_mount(vnode_t);
+void *vnode_fsnode(vnode_t);
+void vnode_clearfsnode(vnode_t);
+dev_t vnode_specrdev(vnode_t);
+int vflush(struct mount *, struct vnode *, int);
+#define SKIPSYSTEM              0x0001
+#define FORCECLOSE              0x0002
+#define WRITECLOSE              0x0004
+
+#define VNODE_REMOVE_NODELETEBUSY   0x0001
+#define VNODE_READ              0x01
+#define VNODE_WRITE             0x02
+
+void cache_enter(vnode_t, vnode_t, struct componentname *);
+int cache_lookup(vnode_t, vnode_t *, struct componentname *);
+void cache_purge(vnode_t);
+void cache_purge_negatives(vnode_t);
+
+/* vnode attributes */
+struct vnode_attr {
+    uint64_t va_supported;
+    uint64_t va_active;
+    int va_vaflags;
+    dev_t va_rdev;
+    uint64_t va_nlink;
+    uint64_t va_total_size;
+    uint64_t va_total_alloc;
+    uint64_t va_data_size;
+    uint64_t va_data_alloc;
+    uint32_t va_iosize;
+    uid_t va_uid;
+    gid_t va_gid;
+    mode_t va_mode;
+    uint32_t va_flags;
+    void *va_acl;
+    struct timespec va_create_time;
+    struct timespec va_access_time;
+    struct timespec va_modify_time;
+    struct timespec va_change_time;
+    struct timespec va_backup_time;
+    uint64_t va_fileid;
+    uint64_t va_linkid;
+    uint64_t va_parentid;
+    uint32_t va_fsid;
+    uint64_t va_filerev;
+    uint32_t va_gen;
+    uint32_t va_encoding;
+    enum vtype va_type;
+    char *va_name;
+    uint64_t va_nchildren;
+    uint64_t va_dirlinkcount;
+    uint32_t va_devid;
+    enum vtype va_objtype;
+    uint32_t va_user_access;
+};
+#define VNODE_ATTR_va_rdev              (1ULL << 0)
+#define VNODE_ATTR_va_nlink             (1ULL << 1)
+#define VNODE_ATTR_va_total_size        (1ULL << 2)
+#define VNODE_ATTR_va_total_alloc       (1ULL << 3)
+#define VNODE_ATTR_va_data_size         (1ULL << 4)
+#define VNODE_ATTR_va_data_alloc        (1ULL << 5)
+#define VNODE_ATTR_va_iosize            (1ULL << 6)
+#define VNODE_ATTR_va_uid               (1ULL << 7)
+#define VNODE_ATTR_va_gid               (1ULL << 8)
+#define VNODE_ATTR_va_mode              (1ULL << 9)
+#define VNODE_ATTR_va_flags             (1ULL << 10)
+#define VNODE_ATTR_va_acl               (1ULL << 11)
+#define VNODE_ATTR_va_create_time       (1ULL << 12)
+#define VNODE_ATTR_va_access_time       (1ULL << 13)
+#define VNODE_ATTR_va_modify_time       (1ULL << 14)
+#define VNODE_ATTR_va_change_time       (1ULL << 15)
+#define VNODE_ATTR_va_backup_time       (1ULL << 16)
+#define VNODE_ATTR_va_fileid            (1ULL << 17)
+#define VNODE_ATTR_va_linkid            (1ULL << 18)
+#define VNODE_ATTR_va_parentid          (1ULL << 19)
+#define VNODE_ATTR_va_fsid              (1ULL << 20)
+#define VNODE_ATTR_va_filerev           (1ULL << 21)
+#define VNODE_ATTR_va_gen               (1ULL << 22)
+#define VNODE_ATTR_va_encoding          (1ULL << 23)
+#define VNODE_ATTR_va_type              (1ULL << 24)
+#define VNODE_ATTR_va_name              (1ULL << 25)
+#define VNODE_ATTR_va_nchildren         (1ULL << 28)
+#define VNODE_ATTR_va_dirlinkcount      (1ULL << 29)
+#define VNODE_ATTR_va_devid             (1ULL << 34)
+#define VNODE_ATTR_va_objtype           (1ULL << 35)
+#define VNODE_ATTR_va_user_access       (1ULL << 37)
+#define VATTR_INIT(v)               do { (v)->va_supported = (v)->va_active = 0ULL; (v)->va_vaflags = 0; } while (0)
+#define VATTR_SET_ACTIVE(v, a)      ((v)->va_active |= VNODE_ATTR_ ## a)
+#define VATTR_SET_SUPPORTED(v, a)   ((v)->va_supported |= VNODE_ATTR_ ## a)
+#define VATTR_IS_SUPPORTED(v, a)    ((v)->va_supported & VNODE_ATTR_ ## a)
+#define VATTR_IS_ACTIVE(v, a)       ((v)->va_active & VNODE_ATTR_ ## a)
+#define VATTR_WANTED(v, a)          VATTR_SET_ACTIVE(v, a)
+#define VATTR_RETURN(v, a, x)       do { (v)->a = (x); VATTR_SET_SUPPORTED(v, a); } while (0)
+#define VATTR_IS(v, a, x)           (VATTR_IS_SUPPORTED(v, a) && (v)->a == (x))
+#define VNOVAL                      (-1)
+
+/* getattrlist(2) bits the volume advertises  <sys/attr.h> */
+typedef uint32_t attrgroup_t;
+typedef struct attribute_set {
+    attrgroup_t commonattr, volattr, dirattr, fileattr, forkattr;
+} attribute_set_t;
+typedef struct vol_capabilities_attr {
+    uint32_t capabilities[4];
+    uint32_t valid[4];
+} vol_capabilities_attr_t;
+typedef struct vol_attributes_attr {
+    attribute_set_t validattr;
+    attribute_set_t nativeattr;
+} vol_attributes_attr_t;
+struct attrlist {
+    unsigned short bitmapcount;
+    uint16_t reserved;
+    attrgroup_t commonattr, volattr, dirattr, fileattr, forkattr;
+};
+#define VOL_CAPABILITIES_FORMAT         0
+#define VOL_CAPABILITIES_INTERFACES     1
+#define VOL_CAP_FMT_NO_ROOT_TIMES       0x00000020
+#define VOL_CAP_FMT_CASE_SENSITIVE      0x00000100
+#define VOL_CAP_FMT_CASE_PRESERVING     0x00000200
+#define VOL_CAP_FMT_FAST_STATFS         0x00000400
+#define VOL_CAP_FMT_2TB_FILESIZE        0x00000800
+#define VOL_CAP_FMT_NO_PERMISSIONS      0x00800000
+#define VOL_CAP_INT_ATTRLIST            0x00000002
+#define ATTR_CMN_NAME                   0x00000001
+#define ATTR_CMN_DEVID                  0x00000002
+#define ATTR_CMN_FSID                   0x00000004
+#define ATTR_CMN_OBJTYPE                0x00000008
+#define ATTR_CMN_OBJID                  0x00000020
+#define ATTR_CMN_PAROBJID               0x00000080
+#define ATTR_CMN_CRTIME                 0x00000200
+#define ATTR_CMN_MODTIME                0x00000400
+#define ATTR_CMN_CHGTIME                0x00000800
+#define ATTR_CMN_ACCTIME                0x00001000
+#define ATTR_CMN_OWNERID                0x00008000
+#define ATTR_CMN_GRPID                  0x00010000
+#define ATTR_CMN_ACCESSMASK             0x00020000
+#define ATTR_CMN_FLAGS                  0x00040000
+#define ATTR_CMN_FILEID                 0x02000000
+#define ATTR_CMN_PARENTID               0x04000000
+#define ATTR_CMN_RETURNED_ATTRS         0x80000000
+#define ATTR_DIR_LINKCOUNT              0x00000001
+#define ATTR_DIR_ENTRYCOUNT             0x00000002
+#define ATTR_FILE_LINKCOUNT             0x00000001
+#define ATTR_FILE_TOTALSIZE             0x00000002
+#define ATTR_FILE_ALLOCSIZE             0x00000004
+#define ATTR_FILE_IOBLOCKSIZE           0x00000008
+#define ATTR_FILE_DATALENGTH            0x00000200
+#define ATTR_FILE_DATAALLOCSIZE         0x00000400
+#define ATTR_VOL_FSTYPE                 0x00000001
+#define ATTR_VOL_SIZE                   0x00000004
+#define ATTR_VOL_SPACEFREE              0x00000008
+#define ATTR_VOL_SPACEAVAIL             0x00000010
+#define ATTR_VOL_IOBLOCKSIZE            0x00000080
+#define ATTR_VOL_OBJCOUNT               0x00000100
+#define ATTR_VOL_FILECOUNT              0x00000200
+#define ATTR_VOL_DIRCOUNT               0x00000400
+#define ATTR_VOL_MAXOBJCOUNT            0x00000800
+#define ATTR_VOL_MOUNTPOINT             0x00001000
+#define ATTR_VOL_NAME                   0x00002000
+#define ATTR_VOL_MOUNTFLAGS             0x00004000
+#define ATTR_VOL_MOUNTEDDEVICE          0x00008000
+#define ATTR_VOL_CAPABILITIES           0x00020000
+#define ATTR_VOL_UUID                   0x00040000
+#define ATTR_VOL_ATTRIBUTES             0x40000000
+#define FSOPT_PACK_INVAL_ATTRS          0x00000008
+int vfs_attr_pack(vnode_t, uio_t, struct attrlist *, uint64_t,
+                    struct vnode_attr *, void *, vfs_context_t);
+
+/* file system attributes */
+struct vfs_attr {
+    uint64_t f_supported;
+    uint64_t f_active;
+    uint64_t f_objcount;
+    uint64_t f_filecount;
+    uint64_t f_dircount;
+    uint64_t f_maxobjcount;
+    uint32_t f_bsize;
+    size_t f_iosize;
+    uint64_t f_blocks;
+    uint64_t f_bfree;
+    uint64_t f_bavail;
+    uint64_t f_bused;
+    uint64_t f_files;
+    uint64_t f_ffree;
+    fsid_t f_fsid;
+    uid_t f_owner;
+    vol_capabilities_attr_t f_capabilities;
+    vol_attributes_attr_t f_attributes;
+    struct timespec f_create_time;
+    struct timespec f_modify_time;
+    struct timespec f_access_time;
+    struct timespec f_backup_time;
+    uint32_t f_fssubtype;
+    char *f_vol_name;
+    uint16_t f_signature;
+    uint16_t f_carbon_fsid;
+    uuid_t f_uuid;
+};
+#define VFSATTR_f_objcount          (1ULL << 0)
+#define VFSATTR_f_filecount         (1ULL << 1)
+#define VFSATTR_f_dircount          (1ULL << 2)
+#define VFSATTR_f_maxobjcount       (1ULL << 3)
+#define VFSATTR_f_bsize             (1ULL << 4)
+#define VFSATTR_f_iosize            (1ULL << 5)
+#define VFSATTR_f_blocks            (1ULL << 6)
+#define VFSATTR_f_bfree             (1ULL << 7)
+#define VFSATTR_f_bavail            (1ULL << 8)
+#define VFSATTR_f_bused             (1ULL << 9)
+#define VFSATTR_f_files             (1ULL << 10)
+#define VFSATTR_f_ffree             (1ULL << 11)
+#define VFSATTR_f_fsid              (1ULL << 12)
+#define VFSATTR_f_owner             (1ULL << 13)
+#define VFSATTR_f_capabilities      (1ULL << 14)
+#define VFSATTR_f_attributes        (1ULL << 15)
+#define VFSATTR_f_create_time       (1ULL << 16)
+#define VFSATTR_f_modify_time       (1ULL << 17)
+#define VFSATTR_f_access_time       (1ULL << 18)
+#define VFSATTR_f_backup_time       (1ULL << 19)
+#define VFSATTR_f_fssubtype         (1ULL << 20)
+#define VFSATTR_f_vol_name          (1ULL << 21)
+#define VFSATTR_f_signature         (1ULL << 22)
+#define VFSATTR_f_carbon_fsid       (1ULL << 23)
+#define VFSATTR_f_uuid              (1ULL << 24)
+#define VFSATTR_INIT(s)             ((s)->f_supported = (s)->f_active = 0ULL)
+#define VFSATTR_SET_SUPPORTED(s, a) ((s)->f_supported |= VFSATTR_ ## a)
+#define VFSATTR_IS_SUPPORTED(s, a)  ((s)->f_supported & VFSATTR_ ## a)
+#define VFSATTR_IS_ACTIVE(s, a)     ((s)->f_active & VFSATTR_ ## a)
+#define VFSATTR_WANTED(s, a)        ((s)->f_active |= VFSATTR_ ## a)
+#define VFSATTR_RETURN(s, a, x)     do { (s)->a = (x); VFSATTR_SET_SUPPORTED(s, a); } while (0)
+
+#define MFSNAMELEN                  15
+#define MFSTYPENAMELEN              16
+struct vfsstatfs {
+    uint32_t f_bsize;
+    size_t f_iosize;
+    uint64_t f_blocks;
+    uint64_t f_bfree;
+    uint64_t f_bavail;
+    uint64_t f_bused;
+    uint64_t f_files;
+    uint64_t f_ffree;
+    fsid_t f_fsid;
+    uid_t f_owner;
+    uint64_t f_flags;
+    char f_fstypename[MFSTYPENAMELEN];
+    char f_mntonname[MAXPATHLEN];
+    char f_mntfromname[MAXPATHLEN];
+};
+
+#define MNT_RDONLY                  0x00000001
+#define MNT_NOEXEC                  0x00000004
+#define MNT_NOSUID                  0x00000008
+#define MNT_NODEV                   0x00000010
+#define MNT_IGNORE_OWNERSHIP        0x00200000
+#define MNT_FORCE                   0x00080000
+#define MNT_WAIT                    1
+#define MNT_NOWAIT                  2
+
+void *vfs_fsprivate(mount_t);
+void vfs_setfsprivate(mount_t, void *);
+int vfs_isupdate(mount_t);
+int vfs_iswriteupgrade(mount_t);
+int vfs_typenum(mount_t);
+void vfs_setflags(mount_t, uint64_t);
+struct vfsstatfs *vfs_statfs(mount_t);
+int vfs_devblocksize(mount_t);
+
+/* file system registration */
+struct vfsops {
+    int (*vfs_mount)(struct mount *, vnode_t, user_addr_t, vfs_context_t);
+    int (*vfs_start)(struct mount *, int, vfs_context_t);
+    int (*vfs_unmount)(struct mount *, int, vfs_context_t);
+    int (*vfs_root)(struct mount *, struct vnode **, vfs_context_t);
+    int (*vfs_quotactl)(struct mount *, int, uid_t, caddr_t, vfs_context_t);
+    int (*vfs_getattr)(struct mount *, struct vfs_attr *, vfs_context_t);
+    int (*vfs_sync)(struct mount *, int, vfs_context_t);
+    int (*vfs_vget)(struct mount *, ino64_t, struct vnode **, vfs_context_t);
+};
+
+struct vnodeop_desc {
+    int vdesc_offset;
+    const char *vdesc_name;
+};
+struct vnodeopv_entry_desc {
+    struct vnodeop_desc *opve_op;
+    int (*opve_impl)(void *);
+};
+struct vnodeopv_desc {
+    int (***opv_desc_vector_p)(void *);
+    struct vnodeopv_entry_desc *opv_desc_ops;
+};
+
+struct vfs_fsentry {
+    struct vfsops *vfe_vfsops;
+    int vfe_vopcnt;
+    struct vnodeopv_desc **vfe_opvdescs;
+    int vfe_fstypenum;
+    char vfe_fsname[MFSNAMELEN];
+    uint32_t vfe_flags;
+    void *vfe_reserv[2];
+};
+#define VFS_TBLTHREADSAFE           0x0001
+#define VFS_TBLFSNODELOCK           0x0002
+#define VFS_TBLNOTYPENUM            0x0008
+#define VFS_TBLLOCALVOL             0x0010
+#define VFS_TBL64BITREADY           0x0020
+#define VFS_TBLNATIVEXATTR          0x0040
+#define VFS_TBLUNMOUNT_PREFLIGHT    0x0080
+#define VFS_TBLREADDIR_EXTENDED     0x0200
+#define VFS_TBLNOMACLABEL           0x1000
+#define VFS_TBLVNOP_PAGEINV2        0x2000
+#define VFS_TBLVNOP_PAGEOUTV2       0x4000
+#define VFS_TBLVNOP_NOUPDATEID_RENAME   0x8000
+int vfs_fsadd(struct vfs_fsentry *, vfstable_t *);
+int vfs_fsremove(vfstable_t);
+
+/*
+ * Vnode operations  <sys/vnode_if.h>
+ */
+extern struct vnodeop_desc vnop_default_desc;
+extern struct vnodeop_desc vnop_lookup_desc;
+extern struct vnodeop_desc vnop_open_desc;
+extern struct vnodeop_desc vnop_close_desc;
+extern struct vnodeop_desc vnop_getattr_desc;
+extern struct vnodeop_desc vnop_setattr_desc;
+extern struct vnodeop_desc vnop_readdir_desc;
+extern struct vnodeop_desc vnop_getattrlistbulk_desc;
+extern struct vnodeop_desc vnop_reclaim_desc;
+extern struct vnodeop_desc vnop_create_desc;
+extern struct vnodeop_desc vnop_mkdir_desc;
+extern struct vnodeop_desc vnop_remove_desc;
+extern struct vnodeop_desc vnop_rmdir_desc;
+extern struct vnodeop_desc vnop_rename_desc;
+extern struct vnodeop_desc vnop_read_desc;
+extern struct vnodeop_desc vnop_write_desc;
+extern struct vnodeop_desc vnop_fsync_desc;
+extern struct vnodeop_desc vnop_pagein_desc;
+extern struct vnodeop_desc vnop_pageout_desc;
+extern struct vnodeop_desc vnop_blockmap_desc;
+extern struct vnodeop_desc vnop_strategy_desc;
+extern struct vnodeop_desc vnop_blktooff_desc;
+extern struct vnodeop_desc vnop_offtoblk_desc;
+extern struct vnodeop_desc vnop_ioctl_desc;
+
+typedef struct upl *upl_t;
+typedef uint32_t upl_offset_t;
+typedef struct buf *buf_t;
+
+struct vnop_generic_args { struct vnodeop_desc *a_desc; };
+struct vnop_lookup_args { struct vnodeop_desc *a_desc; vnode_t a_dvp; vnode_t *a_vpp; struct componentname *a_cnp; vfs_context_t a_context; };
+struct vnop_open_args { struct vnodeop_desc *a_desc; vnode_t a_vp; int a_mode; vfs_context_t a_context; };
+struct vnop_close_args { struct vnodeop_desc *a_desc; vnode_t a_vp; int a_fflag; vfs_context_t a_context; };
+struct vnop_getattr_args { struct vnodeop_desc *a_desc; vnode_t a_vp; struct vnode_attr *a_vap; vfs_context_t a_context; };
+struct vnop_setattr_args { struct vnodeop_desc *a_desc; vnode_t a_vp; struct vnode_attr *a_vap; vfs_context_t a_context; };
+struct vnop_readdir_args { struct vnodeop_desc *a_desc; vnode_t a_vp; struct uio *a_uio; int a_flags; int *a_eofflag; int *a_numdirent; vfs_context_t a_context; };
+struct vnop_getattrlistbulk_args { struct vnodeop_desc *a_desc; vnode_t a_vp; struct attrlist *a_alist; struct vnode_attr *a_vap; struct uio *a_uio; void *a_private; uint64_t a_options; int32_t *a_eofflag; int32_t *a_actualcount; vfs_context_t a_context; };
+struct vnop_reclaim_args { struct vnodeop_desc *a_desc; vnode_t a_vp; vfs_context_t a_context; };
+struct vnop_create_args { struct vnodeop_desc *a_desc; vnode_t a_dvp; vnode_t *a_vpp; struct componentname *a_cnp; struct vnode_attr *a_vap; vfs_context_t a_context; };
+struct vnop_mkdir_args { struct vnodeop_desc *a_desc; vnode_t a_dvp; vnode_t *a_vpp; struct componentname *a_cnp; struct vnode_attr *a_vap; vfs_context_t a_context; };
+struct vnop_remove_args { struct vnodeop_desc *a_desc; vnode_t a_dvp; vnode_t a_vp; struct componentname *a_cnp; int a_flags; vfs_context_t a_context; };
+struct vnop_rmdir_args { struct vnodeop_desc *a_desc; vnode_t a_dvp; vnode_t a_vp; struct componentname *a_cnp; vfs_context_t a_context; };
+struct vnop_rename_args { struct vnodeop_desc *a_desc; vnode_t a_fdvp; vnode_t a_fvp; struct componentname *a_fcnp; vnode_t a_tdvp; vnode_t a_tvp; struct componentname *a_tcnp; vfs_context_t a_context; };
+struct vnop_read_args { struct vnodeop_desc *a_desc; vnode_t a_vp; struct uio *a_uio; int a_ioflag; vfs_context_t a_context; };
+struct vnop_write_args { struct vnodeop_desc *a_desc; vnode_t a_vp; struct uio *a_uio; int a_ioflag; vfs_context_t a_context; };
+struct vnop_fsync_args { struct vnodeop_desc *a_desc; vnode_t a_vp; int a_waitfor; vfs_context_t a_context; };
+struct vnop_pagein_args { struct vnodeop_desc *a_desc; vnode_t a_vp; upl_t a_pl; upl_offset_t a_pl_offset; off_t a_f_offset; size_t a_size; int a_flags; vfs_context_t a_context; };
+struct vnop_pageout_args { struct vnodeop_desc *a_desc; vnode_t a_vp; upl_t a_pl; upl_offset_t a_pl_offset; off_t a_f_offset; size_t a_size; int a_flags; vfs_context_t a_context; };
+struct vnop_blockmap_args { struct vnodeop_desc *a_desc; vnode_t a_vp; off_t a_foffset; size_t a_size; daddr64_t *a_bpn; size_t *a_run; void *a_poff; int a_flags; vfs_context_t a_context; };
+struct vnop_strategy_args { struct vnodeop_desc *a_desc; struct buf *a_bp; };
+struct vnop_blktooff_args { struct vnodeop_desc *a_desc; vnode_t a_vp; daddr64_t a_lblkno; off_t *a_offset; };
+struct vnop_offtoblk_args { struct vnodeop_desc *a_desc; vnode_t a_vp; off_t a_offset; daddr64_t *a_lblkno; };
+
+int VNOP_LOOKUP(vnode_t, vnode_t *, struct componentname *, vfs_context_t);
+int VNOP_GETATTR(vnode_t, struct vnode_attr *, vfs_context_t);
+int VNOP_READDIR(vnode_t, struct uio *, int, int *, int *, vfs_context_t);
+int VNOP_IOCTL(vnode_t, u_long, caddr_t, int, vfs_context_t);
+
+#define VNODE_READDIR_EXTENDED      0x0001
+#define VNODE_READDIR_REQSEEKOFF    0x0002
+#define VNODE_READDIR_SEEKOFF32     0x0004
+#define VNODE_READDIR_NAMEMAX       0x0008
+
+/* <sys/fcntl.h> bits of the kernel */
+#define O_SHLOCK                    0x00000010
+#define O_EXLOCK                    0x00000020
+#define O_EVTONLY                   0x00008000
+#define FREAD                       0x0001
+#define FWRITE                      0x0002
+#define IO_UNIT                     0x0001
+#define IO_APPEND                   0x0002
+#define IO_SYNC                     0x0004
+#define IO_NOZEROFILL               0x0100
+#define IO_TAILZEROFILL             0x0200
+#define IO_HEADZEROFILL             0x0400
+#define IO_NOZERODIRTY              0x0800
+#define IO_NOCACHE                  0x10000
+#define IO_RAOFF                    0x40000
+
+/*
+ * Buffer cache  UBC and cluster IO  <sys/buf.h>  <sys/ubc.h>
+ *  backed by memory of a device vnode  see: xnu_host_dev_create()
+ *  file data goes nowhere  i.e. cluster and UPL calls fail with ENOTSUP
+ */
+#define B_READ                      0x00000001
+#define B_ASYNC                     0x00000002
+int buf_meta_bread(vnode_t, daddr64_t, int, kauth_cred_t, buf_t *);
+void buf_brelse(buf_t);
+uintptr_t buf_dataptr(buf_t);
+errno_t buf_map(buf_t, caddr_t *);
+errno_t buf_unmap(buf_t);
+uint32_t buf_count(buf_t);
+void buf_setresid(buf_t, uint32_t);
+daddr64_t buf_blkno(buf_t);
+vnode_t buf_vnode(buf_t);
+int32_t buf_flags(buf_t);
+void buf_seterror(buf_t, errno_t);
+void buf_biodone(buf_t);
+errno_t buf_strategy(vnode_t, void *);
+int buf_invalidateblks(vnode_t, int, int, int);
+
+#define UPL_ABORT_FREE_ON_EMPTY     0x0002
+#define UPL_ABORT_ERROR             0x0004
+#define UPL_NOCOMMIT                0x0001
+#define UBC_PUSHDIRTY               0x01
+#define UBC_PUSHALL                 0x02
+#define UBC_INVALIDATE              0x04
+#define UBC_SYNC                    0x08
+int ubc_setsize(vnode_t, off_t);
+off_t ubc_getsize(vnode_t);
+errno_t ubc_msync(vnode_t, off_t, off_t, off_t *, int);
+kern_return_t ubc_upl_abort_range(upl_t, upl_offset_t, uint32_t, int);
+int cluster_read(vnode_t, struct uio *, off_t, int);
+int cluster_write(vnode_t, struct uio *, off_t, off_t, off_t, off_t, int);
+int cluster_pagein(vnode_t, upl_t, upl_offset_t, off_t, int, off_t, int);
+int cluster_pageout(vnode_t, upl_t, upl_offset_t, off_t, int, off_t, int);
+int advisory_read(vnode_t, off_t, off_t, int);
+uint32_t cluster_max_io_size(mount_t, int);
+
+/*
+ * <sys/disk.h>
+ */
+#define DKIOCGETBLOCKSIZE           _IOR('d', 24, uint32_t)
+#define DKIOCGETBLOCKCOUNT          _IOR('d', 25, uint64_t)
+
+/*
+ * sysctl  <sys/sysctl.h>
+ *  registered oids are reachable by sysctlbyname()  as from userspace
+ */
+struct sysctl_req {
+    void *p;
+    int lock;
+    user_addr_t oldptr;
+    size_t oldlen;
+    size_t oldidx;
+    int (*oldfunc)(struct sysctl_req *, const void *, size_t);
+    user_addr_t newptr;
+    size_t newlen;
+    size_t newidx;
+    int (*newfunc)(struct sysctl_req *, void *, size_t);
+};
+struct sysctl_oid;
+struct sysctl_oid_list { struct sysctl_oid *slh_first; };
+#define SYSCTL_HANDLER_ARGS \
+    struct sysctl_oid *oidp __unused, void *arg1 __unused, int arg2 __unused, struct sysctl_req *req
+struct sysctl_oid {
+    struct sysctl_oid_list *oid_parent;
+    struct sysctl_oid *oid_link;
+    int oid_number;
+    int oid_kind;
+    void *oid_arg1;
+    int oid_arg2;
+    const char *oid_name;
+    int (*oid_handler)(SYSCTL_HANDLER_ARGS);
+    const char *oid_fmt;
+};
+#define SYSCTL_IN(r, p, l)          (r->newfunc)(r, p, l)
+#define SYSCTL_OUT(r, p, l)         (r->oldfunc)(r, p, l)
+int sysctl_handle_quad(SYSCTL_HANDLER_ARGS);
+void sysctl_register_oid(struct sysctl_oid *);
+void sysctl_unregister_oid(struct sysctl_oid *);
+int sysctlbyname(const char *, void *, size_t *, void *, size_t);
+
+#define OID_AUTO                    (-1)
+#define CTLTYPE_NODE                1
+#define CTLTYPE_QUAD                4
+#define CTLTYPE_OPAQUE              5
+#define CTLTYPE_STRUCT              CTLTYPE_OPAQUE
+#define CTLFLAG_RD                  0x80000000
+#define CTLFLAG_WR                  0x40000000
+#define CTLFLAG_RW                  (CTLFLAG_RD | CTLFLAG_WR)
+#define CTLFLAG_ANYBODY             0x10000000
+#define CTLFLAG_LOCKED              0x00800000
+
+#define SYSCTL_DECL(name)           extern struct sysctl_oid_list sysctl_ ## name ## _children
+#define SYSCTL_OID(parent, nbr, name, kind, a1, a2, handler, fmt, descr)            \
+    struct sysctl_oid sysctl_ ## parent ## _ ## name = {                            \
+        &sysctl_ ## parent ## _children, NULL, nbr, kind, a1, a2, #name, handler, fmt }
+#define SYSCTL_NODE(parent, nbr, name, access, handler, descr)                      \
+    struct sysctl_oid_list sysctl_ ## parent ## _ ## name ## _children;             \
+    SYSCTL_OID(parent, nbr, name, CTLTYPE_NODE | access,                            \
+        (void *) &sysctl_ ## parent ## _ ## name ## _children, 0, handler, "N", descr)
+#define SYSCTL_QUAD(parent, nbr, name, access, ptr, descr)                          \
+    SYSCTL_OID(parent, nbr, name, CTLTYPE_QUAD | access,                            \
+        ptr, 0, sysctl_handle_quad, "Q", descr)
+#define SYSCTL_PROC(parent, nbr, name, access, ptr, arg, handler, fmt, descr)       \
+    SYSCTL_OID(parent, nbr, name, access, ptr, arg, handler, fmt, descr)
+
+/*
+ * Entry points of the stand-in itself  called by drivers  never by kext
+ */
+
+/* where kernel printf() goes  NULL to silence  stderr by default */
+void xnu_host_log(FILE *);
+
+/* a kmod_info whose address is a Mach-O header with an LC_UUID */
+kmod_info_t *xnu_host_kmod_info(void);
+
+/* memory-backed block device  data is copied  NULL for zeros */
+vnode_t xnu_host_dev_create(const void *, size_t, uint32_t);
+void xnu_host_dev_destroy(vnode_t);
+
+/* mount(2) and unmount(2)  i.e. mount_common() and dounmount() */
+int xnu_host_mount(const char *, vnode_t, void *, mount_t *);
+int xnu_host_unmount(mount_t, int);
+int xnu_host_root(mount_t, vnode_t *);
+
+/*
+ * Reclaim of an idle vnode  as vnlru or new_vnode() would do
+ *  a busy one is marked  and reclaimed by its last vnode_put()
+ * @return      1 if reclaimed(or marked) here  0 if it was dead already
+ */
+int xnu_host_reclaim(vnode_t, uint32_t);
+/* reclaim a random vnode of the mount  returns like above */
+int xnu_host_reclaim_any(mount_t);
+
+/*
+ * Reclaim injection
+ *  each named KPI below is a point  when hit one in `every' times
+ *  the vnode it concerns(or a random one of the mount) is reclaimed
+ *  synchronously if the thread holds no lock  by a reaper thread o.w.
+ *  zero turns injection off
+ */
+enum xnu_host_inject {
+    XNU_INJ_GETWITHVID,     /* before vid is checked */
+    XNU_INJ_CREATE,         /* before vnode_create() returns  as new_vnode() */
+    XNU_INJ_ADDFSREF,       /* right after fs published the vnode */
+    XNU_INJ_PUT,            /* after an iocount is dropped */
+    XNU_INJ_UNLOCK,         /* after lck_mtx_unlock() */
+    XNU_INJ_MSLEEP,         /* before msleep() blocks */
+    XNU_INJ_UIOMOVE,        /* before uiomove() copies */
+    XNU_INJ_NR,
+};
+void xnu_host_inject(uint32_t every);
+uint64_t xnu_host_injected(enum xnu_host_inject);
+const char *xnu_host_inject_name(enum xnu_host_inject);
+
+/*
+ * Invariant violations the stand-in detects  each is logged once
+ *  e.g. a vnode reclaimed with fsnode still set  iocount underflow
+ *  two vnodes carrying fsref of a fsnode  two live root vnodes of a mount
+ */
+uint64_t xnu_host_violations(void);
+void xnu_host_violation(const char *, ...) __attribute__((format(printf, 1, 2)));
+
+/* live(i.e. not reclaimed) vnodes of a mount  and reclaims done so far */
+uint32_t xnu_host_nvnodes(mount_t);
+uint64_t xnu_host_nreclaims(void);
+
+#endif /* __XNU_HOST_H */
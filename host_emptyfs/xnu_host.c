@@ -0,0 +1,2160 @@
+/*
+ * Created 261018
+ *
+ * Userspace stand-in of xnu KPIs  see: xnu/xnu_host.h
+ *
+ * [design]
+ *  locks are pthread ones  wait queues are hashed events each thread sleeps
+ *  on its own condition variable  like waitq of xnu
+ *
+ *  vnodes come from a type-stable pool  never freed  only recycled with
+ *  vid bumped  so vnode_getwithvid() over a stale pointer is as safe as
+ *  in xnu  iocount/usecount/VL_* flags follow vnode_getiocount()
+ *  vnode_put_locked() and vnode_reclaim_internal() closely enough that
+ *  a file system sees the same interleavings
+ *
+ *  on top of that the stand-in checks what xnu only trusts
+ *  e.g. a reclaimed vnode must have its fsnode cleared and fsref dropped
+ *  see: xnu_host_violation()
+ *
+ *  reclaims can be injected at KPI boundaries  see: xnu_host_inject()
+ *
+ * XXX: libc headers must go before xnu_host.h  which redefines __nonnull
+ */
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <sys/sysinfo.h>
+
+#include "xnu_host.h"
+
+#define VL_DEAD             0x0001      /* reclaimed  sits in free list */
+#define VL_TERMINATE        0x0002      /* being reclaimed */
+#define VL_MARKTERM         0x0004      /* reclaim on last iocount/usecount */
+
+#define LIKELY(x)           __builtin_expect(!!(x), 1)
+#define UNLIKELY(x)         __builtin_expect(!!(x), 0)
+
+static FILE *host_log = NULL;
+static int host_log_off = 0;
+
+int xnu_host_printf(const char *fmt, ...)
+{
+    int n;
+    va_list ap;
+
+    if (host_log_off) return 0;
+    va_start(ap, fmt);
+    n = vfprintf(host_log != NULL ? host_log : stderr, fmt, ap);
+    va_end(ap);
+    return n;
+}
+
+void xnu_host_log(FILE *fp)
+{
+    host_log = fp;
+    host_log_off = fp == NULL;
+}
+
+void panic(const char *fmt, ...)
+{
+    va_list ap;
+
+    fflush(stdout);
+    fprintf(stderr, "panic: ");
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    abort();
+}
+
+#if !defined(__GLIBC__) || !__GLIBC_PREREQ(2, 38)
+size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t n = strlen(src);
+
+    if (size != 0) {
+        size_t m = n < size - 1 ? n : size - 1;
+        memcpy(dst, src, m);
+        dst[m] = '\0';
+    }
+    return n;
+}
+#endif
+
+int cpu_number(void)
+{
+    int c = sched_getcpu();
+    return c < 0 ? 0 : c;
+}
+
+/*
+ * Invariant violations
+ */
+
+static volatile uint64_t host_nviolation = 0;
+
+void xnu_host_violation(const char *fmt, ...)
+{
+    va_list ap;
+
+    if (__atomic_fetch_add(&host_nviolation, 1, __ATOMIC_RELAXED) >= 16) return;
+
+    fprintf(stderr, "violation: ");
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+}
+
+uint64_t xnu_host_violations(void)
+{
+    return __atomic_load_n(&host_nviolation, __ATOMIC_RELAXED);
+}
+
+/*
+ * Atomics  all full barriers as in xnu
+ */
+
+SInt32 OSAddAtomic(SInt32 v, volatile SInt32 *p)
+{
+    return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST);
+}
+
+SInt64 OSAddAtomic64(SInt64 v, volatile SInt64 *p)
+{
+    return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST);
+}
+
+SInt64 OSIncrementAtomic64(volatile SInt64 *p)
+{
+    return __atomic_fetch_add(p, 1, __ATOMIC_SEQ_CST);
+}
+
+SInt64 OSDecrementAtomic64(volatile SInt64 *p)
+{
+    return __atomic_fetch_sub(p, 1, __ATOMIC_SEQ_CST);
+}
+
+boolean_t OSCompareAndSwap(UInt32 o, UInt32 n, volatile UInt32 *p)
+{
+    return __atomic_compare_exchange_n(p, &o, n, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+boolean_t OSCompareAndSwapPtr(void *o, void *n, void * volatile *p)
+{
+    return __atomic_compare_exchange_n(p, &o, n, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+void OSMemoryBarrier(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void uuid_generate_random(uuid_t u)
+{
+    size_t i;
+
+    if (getrandom(u, sizeof(uuid_t), 0) != (ssize_t) sizeof(uuid_t)) {
+        for (i = 0; i < sizeof(uuid_t); i++) u[i] = (unsigned char) rand();
+    }
+    u[6] = (u[6] & 0x0f) | 0x40;
+    u[8] = (u[8] & 0x3f) | 0x80;
+}
+
+/*
+ * Memory
+ */
+
+void *_MALLOC(size_t size, int type __unused, int flags)
+{
+    return (flags & M_ZERO) ? calloc(1, size) : malloc(size);
+}
+
+void _FREE(void *addr, int type __unused)
+{
+    free(addr);
+}
+
+/*
+ * Time  absolute time is in nanoseconds  i.e. timebase 1/1
+ */
+
+void nanotime(struct timespec *ts)
+{
+    (void) clock_gettime(CLOCK_REALTIME, ts);
+}
+
+uint64_t mach_absolute_time(void)
+{
+    struct timespec ts;
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+void absolutetime_to_nanoseconds(uint64_t abstime, uint64_t *ns)
+{
+    *ns = abstime;
+}
+
+void clock_timebase_info(mach_timebase_info_t info)
+{
+    info->numer = 1;
+    info->denom = 1;
+}
+
+/*
+ * Threads and wait queues
+ */
+
+struct thread {
+    pthread_cond_t cv;
+    /* event asserted  NULL if none */
+    event_t ev;
+    /* non-zero if linked in a wait queue bucket */
+    int queued;
+    wait_result_t res;
+    struct thread *next;
+};
+
+#define WQ_NBUCKET          64
+
+static struct wq_bucket {
+    pthread_mutex_t m;
+    struct thread *head;
+} __attribute__((aligned(64))) host_wq[WQ_NBUCKET] = {
+    [0 ... WQ_NBUCKET - 1] = { PTHREAD_MUTEX_INITIALIZER, NULL },
+};
+
+static pthread_key_t host_thread_key;
+static pthread_once_t host_thread_once = PTHREAD_ONCE_INIT;
+static __thread struct thread *host_self = NULL;
+/* stand-in locks held by current thread */
+static __thread int host_nlocks = 0;
+/* non-zero while current thread is reclaiming on behalf of injection */
+static __thread int host_in_inject = 0;
+
+static void host_thread_free(void *arg)
+{
+    struct thread *th = arg;
+    pthread_cond_destroy(&th->cv);
+    free(th);
+}
+
+static void host_thread_init(void)
+{
+    (void) pthread_key_create(&host_thread_key, host_thread_free);
+}
+
+thread_t current_thread(void)
+{
+    struct thread *th = host_self;
+    pthread_condattr_t attr;
+
+    if (LIKELY(th != NULL)) return th;
+
+    (void) pthread_once(&host_thread_once, host_thread_init);
+    th = calloc(1, sizeof(*th));
+    if (th == NULL) panic("current_thread() out of memory");
+    (void) pthread_condattr_init(&attr);
+    (void) pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    (void) pthread_cond_init(&th->cv, &attr);
+    (void) pthread_condattr_destroy(&attr);
+    (void) pthread_setspecific(host_thread_key, th);
+    host_self = th;
+    return th;
+}
+
+static inline struct wq_bucket *wq_bucket(event_t ev)
+{
+    uint64_t h = (uint64_t) (uintptr_t) ev * 0x9e3779b97f4a7c15ULL;
+    return &host_wq[h >> 58];
+}
+
+static void wq_unlink_locked(struct wq_bucket *b, struct thread *th)
+{
+    struct thread **pp = &b->head;
+
+    while (*pp != th) pp = &(*pp)->next;
+    *pp = th->next;
+    th->next = NULL;
+    th->queued = 0;
+}
+
+wait_result_t assert_wait(event_t ev, wait_interrupt_t intr __unused)
+{
+    struct thread *th = current_thread();
+    struct wq_bucket *b = wq_bucket(ev);
+
+    pthread_mutex_lock(&b->m);
+    if (th->queued) panic("assert_wait() %p while waiting on %p", ev, th->ev);
+    th->ev = ev;
+    th->queued = 1;
+    th->res = THREAD_WAITING;
+    th->next = b->head;
+    b->head = th;
+    pthread_mutex_unlock(&b->m);
+
+    return THREAD_WAITING;
+}
+
+/**
+ * Block on the asserted event  deadline is in CLOCK_MONOTONIC  NULL for none
+ */
+static wait_result_t thread_block_deadline(const struct timespec *deadline)
+{
+    struct thread *th = current_thread();
+    struct wq_bucket *b;
+    wait_result_t res;
+    int e;
+
+    /* no event asserted  or it's been cleared already */
+    if (th->ev == NULL) return THREAD_AWAKENED;
+
+    b = wq_bucket(th->ev);
+    pthread_mutex_lock(&b->m);
+    while (th->queued) {
+        if (deadline == NULL) {
+            (void) pthread_cond_wait(&th->cv, &b->m);
+            continue;
+        }
+        e = pthread_cond_timedwait(&th->cv, &b->m, deadline);
+        if (e == ETIMEDOUT && th->queued) {
+            wq_unlink_locked(b, th);
+            th->res = THREAD_TIMED_OUT;
+        }
+    }
+    res = th->res;
+    th->ev = NULL;
+    pthread_mutex_unlock(&b->m);
+
+    return res;
+}
+
+wait_result_t thread_block(thread_continue_t cont)
+{
+    if (cont != THREAD_CONTINUE_NULL) panic("thread_block() continuation unsupported");
+    return thread_block_deadline(NULL);
+}
+
+kern_return_t clear_wait(thread_t th, wait_result_t res)
+{
+    struct wq_bucket *b;
+    kern_return_t kr = KERN_FAILURE;
+
+    if (th->ev == NULL) return kr;
+
+    b = wq_bucket(th->ev);
+    pthread_mutex_lock(&b->m);
+    if (th->queued) {
+        wq_unlink_locked(b, th);
+        th->res = res;
+        (void) pthread_cond_signal(&th->cv);
+        kr = KERN_SUCCESS;
+    }
+    pthread_mutex_unlock(&b->m);
+
+    return kr;
+}
+
+kern_return_t thread_wakeup_prim(event_t ev, boolean_t one, wait_result_t res)
+{
+    struct wq_bucket *b = wq_bucket(ev);
+    struct thread **pp;
+    struct thread *th;
+    kern_return_t kr = KERN_FAILURE;
+
+    pthread_mutex_lock(&b->m);
+    pp = &b->head;
+    while ((th = *pp) != NULL) {
+        if (th->ev != ev) {
+            pp = &th->next;
+            continue;
+        }
+        *pp = th->next;
+        th->next = NULL;
+        th->queued = 0;
+        th->res = res;
+        (void) pthread_cond_signal(&th->cv);
+        kr = KERN_SUCCESS;
+        if (one) break;
+    }
+    pthread_mutex_unlock(&b->m);
+
+    return kr;
+}
+
+static void host_inject_at(enum xnu_host_inject, vnode_t);
+
+int msleep(void *chan, lck_mtx_t *mtx, int pri, const char *wmesg __unused, struct timespec *ts)
+{
+    struct timespec deadline;
+    wait_result_t res;
+
+    if (ts != NULL) {
+        (void) clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += ts->tv_sec;
+        deadline.tv_nsec += ts->tv_nsec;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    (void) assert_wait(chan, THREAD_UNINT);
+    host_inject_at(XNU_INJ_MSLEEP, NULLVP);
+    lck_mtx_unlock(mtx);
+    res = thread_block_deadline(ts != NULL ? &deadline : NULL);
+    if (!(pri & PDROP)) lck_mtx_lock(mtx);
+
+    return res == THREAD_TIMED_OUT ? EWOULDBLOCK : 0;
+}
+
+void wakeup(void *chan)
+{
+    (void) thread_wakeup_prim(chan, 0, THREAD_AWAKENED);
+}
+
+/*
+ * Locks
+ */
+
+struct lck_grp {
+    char name[64];
+};
+
+struct lck_mtx {
+    pthread_mutex_t m;
+    pthread_t owner;
+    int owned;
+};
+
+struct lck_rw {
+    pthread_rwlock_t l;
+};
+
+struct lck_spin {
+    pthread_spinlock_t s;
+};
+
+lck_grp_t *lck_grp_alloc_init(const char *name, lck_grp_attr_t *attr __unused)
+{
+    lck_grp_t *grp = calloc(1, sizeof(*grp));
+    if (grp != NULL) (void) strlcpy(grp->name, name, sizeof(grp->name));
+    return grp;
+}
+
+void lck_grp_free(lck_grp_t *grp)
+{
+    free(grp);
+}
+
+lck_mtx_t *lck_mtx_alloc_init(lck_grp_t *grp __unused, lck_attr_t *attr __unused)
+{
+    lck_mtx_t *mtx = calloc(1, sizeof(*mtx));
+    if (mtx != NULL) (void) pthread_mutex_init(&mtx->m, NULL);
+    return mtx;
+}
+
+void lck_mtx_free(lck_mtx_t *mtx, lck_grp_t *grp __unused)
+{
+    if (__atomic_load_n(&mtx->owned, __ATOMIC_RELAXED))
+        panic("lck_mtx_free() %p still owned", mtx);
+    (void) pthread_mutex_destroy(&mtx->m);
+    free(mtx);
+}
+
+static inline int lck_mtx_owned_by_self(lck_mtx_t *mtx)
+{
+    return __atomic_load_n(&mtx->owned, __ATOMIC_RELAXED) &&
+            pthread_equal(mtx->owner, pthread_self());
+}
+
+void lck_mtx_lock(lck_mtx_t *mtx)
+{
+    if (lck_mtx_owned_by_self(mtx)) panic("lck_mtx_lock() %p recursively", mtx);
+    (void) pthread_mutex_lock(&mtx->m);
+    mtx->owner = pthread_self();
+    __atomic_store_n(&mtx->owned, 1, __ATOMIC_RELAXED);
+    host_nlocks++;
+}
+
+void lck_mtx_unlock(lck_mtx_t *mtx)
+{
+    if (!lck_mtx_owned_by_self(mtx)) panic("lck_mtx_unlock() %p not owned", mtx);
+    __atomic_store_n(&mtx->owned, 0, __ATOMIC_RELAXED);
+    (void) pthread_mutex_unlock(&mtx->m);
+    host_nlocks--;
+    host_inject_at(XNU_INJ_UNLOCK, NULLVP);
+}
+
+void lck_mtx_assert(lck_mtx_t *mtx, unsigned int type)
+{
+    int own = lck_mtx_owned_by_self(mtx);
+
+    if (type == LCK_MTX_ASSERT_OWNED && !own) panic("lck_mtx_assert() %p not owned", mtx);
+    if (type == LCK_MTX_ASSERT_NOTOWNED && own) panic("lck_mtx_assert() %p owned", mtx);
+}
+
+lck_rw_t *lck_rw_alloc_init(lck_grp_t *grp __unused, lck_attr_t *attr __unused)
+{
+    lck_rw_t *rw = calloc(1, sizeof(*rw));
+    if (rw != NULL) (void) pthread_rwlock_init(&rw->l, NULL);
+    return rw;
+}
+
+void lck_rw_free(lck_rw_t *rw, lck_grp_t *grp __unused)
+{
+    (void) pthread_rwlock_destroy(&rw->l);
+    free(rw);
+}
+
+void lck_rw_lock_shared(lck_rw_t *rw)
+{
+    (void) pthread_rwlock_rdlock(&rw->l);
+    host_nlocks++;
+}
+
+void lck_rw_lock_exclusive(lck_rw_t *rw)
+{
+    (void) pthread_rwlock_wrlock(&rw->l);
+    host_nlocks++;
+}
+
+void lck_rw_done(lck_rw_t *rw)
+{
+    (void) pthread_rwlock_unlock(&rw->l);
+    host_nlocks--;
+}
+
+lck_spin_t *lck_spin_alloc_init(lck_grp_t *grp __unused, lck_attr_t *attr __unused)
+{
+    lck_spin_t *sl = calloc(1, sizeof(*sl));
+    if (sl != NULL) (void) pthread_spin_init(&sl->s, PTHREAD_PROCESS_PRIVATE);
+    return sl;
+}
+
+void lck_spin_free(lck_spin_t *sl, lck_grp_t *grp __unused)
+{
+    (void) pthread_spin_destroy(&sl->s);
+    free(sl);
+}
+
+void lck_spin_lock(lck_spin_t *sl)
+{
+    (void) pthread_spin_lock(&sl->s);
+    host_nlocks++;
+}
+
+void lck_spin_unlock(lck_spin_t *sl)
+{
+    (void) pthread_spin_unlock(&sl->s);
+    host_nlocks--;
+}
+
+/*
+ * Credentials and contexts  every caller is the process itself
+ */
+
+struct ucred {
+    uid_t uid;
+    gid_t gid;
+};
+
+struct vfs_context {
+    kauth_cred_t cred;
+};
+
+static struct ucred host_cred;
+static struct vfs_context host_ctx = { &host_cred };
+static pthread_once_t host_cred_once = PTHREAD_ONCE_INIT;
+
+static void host_cred_init(void)
+{
+    host_cred.uid = getuid();
+    host_cred.gid = getgid();
+}
+
+kauth_cred_t kauth_cred_get(void)
+{
+    (void) pthread_once(&host_cred_once, host_cred_init);
+    return &host_cred;
+}
+
+uid_t kauth_cred_getuid(kauth_cred_t cred)
+{
+    return cred->uid;
+}
+
+gid_t kauth_cred_getgid(kauth_cred_t cred)
+{
+    return cred->gid;
+}
+
+int kauth_cred_issuser(kauth_cred_t cred)
+{
+    return cred->uid == 0;
+}
+
+vfs_context_t vfs_context_current(void)
+{
+    (void) pthread_once(&host_cred_once, host_cred_init);
+    return &host_ctx;
+}
+
+kauth_cred_t vfs_context_ucred(vfs_context_t ctx)
+{
+    (void) pthread_once(&host_cred_once, host_cred_init);
+    return ctx->cred;
+}
+
+int vfs_context_issuser(vfs_context_t ctx)
+{
+    return kauth_cred_issuser(vfs_context_ucred(ctx));
+}
+
+/*
+ * uio  a single address space  all segments look alike
+ */
+
+struct host_iov {
+    user_addr_t base;
+    user_size_t len;
+};
+
+struct uio {
+    int rw;
+    off_t offset;
+    user_ssize_t resid;
+    int niov;
+    int maxiov;
+    int cur;
+    struct host_iov iov[];
+};
+
+uio_t uio_create(int iovcount, off_t offset, int spacetype __unused, int iodirection)
+{
+    uio_t uio;
+
+    if (iovcount <= 0) return NULL;
+    uio = calloc(1, sizeof(*uio) + (size_t) iovcount * sizeof(uio->iov[0]));
+    if (uio == NULL) return NULL;
+    uio->rw = iodirection;
+    uio->offset = offset;
+    uio->maxiov = iovcount;
+    return uio;
+}
+
+int uio_addiov(uio_t uio, user_addr_t base, user_size_t len)
+{
+    if (uio->niov >= uio->maxiov) return -1;
+    uio->iov[uio->niov].base = base;
+    uio->iov[uio->niov].len = len;
+    uio->niov++;
+    uio->resid += (user_ssize_t) len;
+    return 0;
+}
+
+void uio_free(uio_t uio)
+{
+    free(uio);
+}
+
+user_ssize_t uio_resid(uio_t uio)
+{
+    return uio->resid;
+}
+
+/* as xnu  only the total moves  iovecs are left alone */
+void uio_setresid(uio_t uio, user_ssize_t resid)
+{
+    uio->resid = resid;
+}
+
+off_t uio_offset(uio_t uio)
+{
+    return uio->offset;
+}
+
+void uio_setoffset(uio_t uio, off_t off)
+{
+    uio->offset = off;
+}
+
+int uiomove(const char *cp, int n, struct uio *uio)
+{
+    struct host_iov *iov;
+    size_t cnt;
+
+    host_inject_at(XNU_INJ_UIOMOVE, NULLVP);
+
+    while (n > 0 && uio->resid > 0 && uio->cur < uio->niov) {
+        iov = &uio->iov[uio->cur];
+        if (iov->len == 0) {
+            uio->cur++;
+            continue;
+        }
+
+        cnt = (size_t) n;
+        if (cnt > iov->len) cnt = (size_t) iov->len;
+        if (cnt > (size_t) uio->resid) cnt = (size_t) uio->resid;
+
+        if (uio->rw == UIO_READ) {
+            memcpy((void *) (uintptr_t) iov->base, cp, cnt);
+        } else {
+            memcpy((void *) (uintptr_t) cp, (const void *) (uintptr_t) iov->base, cnt);
+        }
+
+        iov->base += cnt;
+        iov->len -= cnt;
+        uio->resid -= (user_ssize_t) cnt;
+        uio->offset += (off_t) cnt;
+        cp += cnt;
+        n -= (int) cnt;
+    }
+
+    return 0;
+}
+
+int copyin(user_addr_t uaddr, void *kaddr, size_t len)
+{
+    if (uaddr == 0) return EFAULT;
+    memcpy(kaddr, (const void *) (uintptr_t) uaddr, len);
+    return 0;
+}
+
+int copyout(const void *kaddr, user_addr_t uaddr, size_t len)
+{
+    if (uaddr == 0) return EFAULT;
+    memcpy((void *) (uintptr_t) uaddr, kaddr, len);
+    return 0;
+}
+
+/*
+ * Mounts and registered file systems
+ */
+
+struct host_vfs {
+    struct host_vfs *next;
+    struct vfs_fsentry *fe;
+    int typenum;
+    uint32_t nmount;
+};
+
+struct host_dev {
+    uint8_t *data;
+    size_t size;
+    uint32_t bsize;
+};
+
+struct mount {
+    struct host_vfs *vfs;
+    void *fsprivate;
+    struct vfsstatfs st;
+    vnode_t devvp;
+    /* root vnode carrying fsref  guarded by host_fsref_mtx */
+    vnode_t rootvp;
+    volatile uint32_t nvnodes;
+    /* live vnodes of this mount  as mnt_vnodelist  walked by vflush() */
+    pthread_mutex_t vlist_mtx;
+    struct vnode *vlist;
+};
+
+struct vnode {
+    pthread_mutex_t lock;
+    /* signalled on drain and end of termination */
+    pthread_cond_t cv;
+    uint32_t vid;
+    int32_t iocount;
+    int32_t usecount;
+    uint32_t lflag;
+    enum vtype type;
+    mount_t mp;
+    void *fsnode;
+    int (**vops)(void *);
+    int isroot;
+    int fsref;
+    dev_t rdev;
+    off_t size;
+    struct host_dev *dev;
+    /* fsref registry chain  keyed by fsnode at the time of vnode_addfsref() */
+    void *fsref_key;
+    struct vnode *fsref_next;
+    struct vnode *free_next;
+    /* mount vnode list  guarded by mp->vlist_mtx */
+    struct vnode *mnt_next;
+    struct vnode *mnt_prev;
+};
+
+static pthread_mutex_t host_vfs_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct host_vfs *host_vfs_list = NULL;
+static int host_next_typenum = 32;
+
+/*
+ * Vnode pool  vnodes are never freed  i.e. pointers stay valid forever
+ */
+static pthread_mutex_t host_pool_mtx = PTHREAD_MUTEX_INITIALIZER;
+static vnode_t *host_pool = NULL;
+static uint32_t host_pool_n = 0;
+static uint32_t host_pool_cap = 0;
+static vnode_t host_pool_free = NULL;
+static volatile uint64_t host_nreclaim = 0;
+
+#define FSREF_NBUCKET       4096
+static pthread_mutex_t host_fsref_mtx = PTHREAD_MUTEX_INITIALIZER;
+static vnode_t host_fsref[FSREF_NBUCKET];
+
+static vnode_t vnode_alloc(void)
+{
+    vnode_t vp;
+    vnode_t *pool;
+    uint32_t cap;
+    pthread_condattr_t attr;
+
+    pthread_mutex_lock(&host_pool_mtx);
+    vp = host_pool_free;
+    if (vp != NULL) {
+        host_pool_free = vp->free_next;
+        vp->free_next = NULL;
+        pthread_mutex_unlock(&host_pool_mtx);
+        return vp;
+    }
+
+    if (host_pool_n == host_pool_cap) {
+        cap = host_pool_cap != 0 ? host_pool_cap * 2 : 1024;
+        pool = realloc(host_pool, cap * sizeof(*pool));
+        if (pool == NULL) {
+            pthread_mutex_unlock(&host_pool_mtx);
+            return NULL;
+        }
+        host_pool = pool;
+        host_pool_cap = cap;
+    }
+
+    vp = calloc(1, sizeof(*vp));
+    if (vp != NULL) {
+        (void) pthread_mutex_init(&vp->lock, NULL);
+        (void) pthread_condattr_init(&attr);
+        (void) pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        (void) pthread_cond_init(&vp->cv, &attr);
+        (void) pthread_condattr_destroy(&attr);
+        vp->vid = (uint32_t) host_pool_n << 16;
+        vp->lflag = VL_DEAD;
+        host_pool[host_pool_n++] = vp;
+    }
+    pthread_mutex_unlock(&host_pool_mtx);
+
+    return vp;
+}
+
+static void vnode_free(vnode_t vp)
+{
+    pthread_mutex_lock(&host_pool_mtx);
+    vp->free_next = host_pool_free;
+    host_pool_free = vp;
+    pthread_mutex_unlock(&host_pool_mtx);
+}
+
+static inline struct vnode **fsref_bucket(void *key)
+{
+    uint64_t h = (uint64_t) (uintptr_t) key * 0x9e3779b97f4a7c15ULL;
+    return &host_fsref[h >> 52];
+}
+
+static void fsref_insert(vnode_t vp, void *key, mount_t mp, int isroot)
+{
+    struct vnode **b = fsref_bucket(key);
+    vnode_t p;
+
+    pthread_mutex_lock(&host_fsref_mtx);
+    for (p = *b; p != NULL; p = p->fsref_next) {
+        if (p->fsref_key == key) {
+            xnu_host_violation("fsnode %p carried by both vnode %p and %p", key, p, vp);
+        }
+    }
+    if (isroot) {
+        if (mp->rootvp != NULLVP) {
+            xnu_host_violation("mount %p has two live root vnodes %p and %p", mp, mp->rootvp, vp);
+        }
+        mp->rootvp = vp;
+    }
+    vp->fsref_key = key;
+    vp->fsref_next = *b;
+    *b = vp;
+    pthread_mutex_unlock(&host_fsref_mtx);
+}
+
+static void fsref_remove(vnode_t vp, mount_t mp)
+{
+    struct vnode **pp = fsref_bucket(vp->fsref_key);
+
+    pthread_mutex_lock(&host_fsref_mtx);
+    while (*pp != NULL && *pp != vp) pp = &(*pp)->fsref_next;
+    if (*pp == vp) *pp = vp->fsref_next;
+    vp->fsref_next = NULL;
+    vp->fsref_key = NULL;
+    if (mp != NULL && mp->rootvp == vp) mp->rootvp = NULLVP;
+    pthread_mutex_unlock(&host_fsref_mtx);
+}
+
+/*
+ * vnode_reclaim_internal()  VL_TERMINATE set and no iocount left
+ *  called without vnode lock
+ */
+static void vnode_reclaim(vnode_t vp)
+{
+    int e;
+    mount_t mp = vp->mp;
+    struct vnop_reclaim_args a;
+
+    a.a_desc = &vnop_reclaim_desc;
+    a.a_vp = vp;
+    a.a_context = vfs_context_current();
+    e = vp->vops[vnop_reclaim_desc.vdesc_offset](&a);
+    if (e != 0) xnu_host_violation("VNOP_RECLAIM() of vnode %p fail  errno: %d", vp, e);
+
+    pthread_mutex_lock(&vp->lock);
+    if (vp->fsnode != NULL) {
+        xnu_host_violation("vnode %p reclaimed with fsnode %p attached", vp, vp->fsnode);
+        vp->fsnode = NULL;
+    }
+    if (vp->fsref) {
+        xnu_host_violation("vnode %p reclaimed with fsref held", vp);
+        vp->fsref = 0;
+        fsref_remove(vp, mp);
+    }
+    if (vp->iocount != 0) {
+        xnu_host_violation("vnode %p reclaimed with iocount %d", vp, vp->iocount);
+    }
+    vp->vid++;
+    vp->lflag = VL_DEAD;
+    vp->vops = NULL;
+    vp->mp = NULL;
+    vp->isroot = 0;
+    vp->usecount = 0;
+    (void) pthread_cond_broadcast(&vp->cv);
+    pthread_mutex_unlock(&vp->lock);
+
+    pthread_mutex_lock(&mp->vlist_mtx);
+    if (vp->mnt_prev != NULL) vp->mnt_prev->mnt_next = vp->mnt_next;
+    else mp->vlist = vp->mnt_next;
+    if (vp->mnt_next != NULL) vp->mnt_next->mnt_prev = vp->mnt_prev;
+    vp->mnt_next = vp->mnt_prev = NULL;
+    pthread_mutex_unlock(&mp->vlist_mtx);
+
+    (void) __atomic_fetch_sub(&mp->nvnodes, 1, __ATOMIC_RELAXED);
+    (void) __atomic_fetch_add(&host_nreclaim, 1, __ATOMIC_RELAXED);
+    vnode_free(vp);
+}
+
+/**
+ * Start reclaim of a vnode  with its lock held(dropped on return)
+ * @return      1 if reclaimed  0 if only marked
+ */
+static int vnode_reclaim_or_mark_locked(vnode_t vp)
+{
+    if (vp->iocount == 0 && vp->usecount == 0) {
+        vp->lflag |= VL_TERMINATE;
+        pthread_mutex_unlock(&vp->lock);
+        vnode_reclaim(vp);
+        return 1;
+    }
+    vp->lflag |= VL_MARKTERM;
+    pthread_mutex_unlock(&vp->lock);
+    return 0;
+}
+
+errno_t vnode_create(uint32_t flavor, uint32_t size, void *data, vnode_t *vpp)
+{
+    struct vnode_fsparam *param = data;
+    vnode_t vp;
+
+    if (flavor != VNCREATE_FLAVOR || size != sizeof(*param)) return EINVAL;
+    if (param->vnfs_mp == NULL || param->vnfs_vops == NULL) return EINVAL;
+
+    vp = vnode_alloc();
+    if (vp == NULL) return ENOMEM;
+
+    pthread_mutex_lock(&vp->lock);
+    vp->type = param->vnfs_vtype;
+    vp->mp = param->vnfs_mp;
+    vp->fsnode = param->vnfs_fsnode;
+    vp->vops = param->vnfs_vops;
+    vp->isroot = !!param->vnfs_markroot;
+    vp->rdev = param->vnfs_rdev;
+    vp->size = param->vnfs_filesize;
+    vp->iocount = 1;
+    vp->usecount = 0;
+    vp->fsref = 0;
+    vp->lflag = 0;
+    pthread_mutex_unlock(&vp->lock);
+
+    pthread_mutex_lock(&vp->mp->vlist_mtx);
+    vp->mnt_prev = NULL;
+    vp->mnt_next = vp->mp->vlist;
+    if (vp->mnt_next != NULL) vp->mnt_next->mnt_prev = vp;
+    vp->mp->vlist = vp;
+    pthread_mutex_unlock(&vp->mp->vlist_mtx);
+
+    (void) __atomic_fetch_add(&vp->mp->nvnodes, 1, __ATOMIC_RELAXED);
+    if (param->vnfs_flags & VNFS_ADDFSREF) (void) vnode_addfsref(vp);
+
+    *vpp = vp;
+    host_inject_at(XNU_INJ_CREATE, vp);
+    return 0;
+}
+
+int vnode_addfsref(vnode_t vp)
+{
+    void *key;
+    mount_t mp;
+    int isroot;
+
+    pthread_mutex_lock(&vp->lock);
+    if (vp->fsref) {
+        pthread_mutex_unlock(&vp->lock);
+        xnu_host_violation("vnode %p already has fsref", vp);
+        return EINVAL;
+    }
+    vp->fsref = 1;
+    key = vp->fsnode;
+    mp = vp->mp;
+    isroot = vp->isroot;
+    pthread_mutex_unlock(&vp->lock);
+
+    fsref_insert(vp, key, mp, isroot);
+    host_inject_at(XNU_INJ_ADDFSREF, vp);
+    return 0;
+}
+
+int vnode_removefsref(vnode_t vp)
+{
+    mount_t mp;
+
+    pthread_mutex_lock(&vp->lock);
+    if (!vp->fsref) {
+        pthread_mutex_unlock(&vp->lock);
+        xnu_host_violation("vnode %p has no fsref to remove", vp);
+        return EINVAL;
+    }
+    vp->fsref = 0;
+    mp = vp->mp;
+    pthread_mutex_unlock(&vp->lock);
+
+    fsref_remove(vp, mp);
+    return 0;
+}
+
+/*
+ * vnode_getiocount()  a vnode being terminated is waited out
+ *  then the vid check fails(or it's dead)
+ */
+static int vnode_getiocount(vnode_t vp, uint32_t vid, int withvid)
+{
+    pthread_mutex_lock(&vp->lock);
+    for (;;) {
+        if ((vp->lflag & VL_DEAD) || (withvid && vp->vid != vid)) {
+            pthread_mutex_unlock(&vp->lock);
+            return ENOENT;
+        }
+        if (!(vp->lflag & VL_TERMINATE)) break;
+        (void) pthread_cond_wait(&vp->cv, &vp->lock);
+    }
+    vp->iocount++;
+    pthread_mutex_unlock(&vp->lock);
+    return 0;
+}
+
+int vnode_get(vnode_t vp)
+{
+    return vnode_getiocount(vp, 0, 0);
+}
+
+int vnode_getwithvid(vnode_t vp, uint32_t vid)
+{
+    host_inject_at(XNU_INJ_GETWITHVID, vp);
+    return vnode_getiocount(vp, vid, 1);
+}
+
+int vnode_put(vnode_t vp)
+{
+    pthread_mutex_lock(&vp->lock);
+    if (vp->iocount <= 0) {
+        pthread_mutex_unlock(&vp->lock);
+        xnu_host_violation("vnode_put() vnode %p iocount underflow", vp);
+        return EINVAL;
+    }
+
+    if (--vp->iocount == 0) {
+        if (vp->lflag & VL_TERMINATE) {
+            /* a drainer is waiting */
+            (void) pthread_cond_broadcast(&vp->cv);
+        } else if ((vp->lflag & VL_MARKTERM) && vp->usecount == 0) {
+            /* see: xnu/bsd/vfs/vfs_subr.c#vnode_put_locked */
+            (void) vnode_reclaim_or_mark_locked(vp);
+            goto out_put;
+        }
+    }
+    pthread_mutex_unlock(&vp->lock);
+
+out_put:
+    host_inject_at(XNU_INJ_PUT, vp);
+    return 0;
+}
+
+int vnode_ref(vnode_t vp)
+{
+    int e = 0;
+
+    pthread_mutex_lock(&vp->lock);
+    if (vp->lflag & (VL_DEAD | VL_TERMINATE)) {
+        e = ENOENT;
+    } else {
+        vp->usecount++;
+    }
+    pthread_mutex_unlock(&vp->lock);
+
+    return e;
+}
+
+void vnode_rele(vnode_t vp)
+{
+    pthread_mutex_lock(&vp->lock);
+    if (vp->usecount <= 0) {
+        pthread_mutex_unlock(&vp->lock);
+        xnu_host_violation("vnode_rele() vnode %p usecount underflow", vp);
+        return;
+    }
+    if (--vp->usecount == 0 && vp->iocount == 0 && (vp->lflag & VL_MARKTERM) &&
+            !(vp->lflag & (VL_TERMINATE | VL_DEAD))) {
+        (void) vnode_reclaim_or_mark_locked(vp);
+        return;
+    }
+    pthread_mutex_unlock(&vp->lock);
+}
+
+/* callers hold an iocount  .: the vnode goes on the last vnode_put() */
+int vnode_recycle(vnode_t vp)
+{
+    pthread_mutex_lock(&vp->lock);
+    if (vp->lflag & (VL_DEAD | VL_TERMINATE)) {
+        pthread_mutex_unlock(&vp->lock);
+        return 0;
+    }
+    return vnode_reclaim_or_mark_locked(vp);
+}
+
+int vnode_isinuse(vnode_t vp, int refcnt)
+{
+    return __atomic_load_n(&vp->usecount, __ATOMIC_RELAXED) > refcnt;
+}
+
+uint32_t vnode_vid(vnode_t vp)
+{
+    return __atomic_load_n(&vp->vid, __ATOMIC_RELAXED);
+}
+
+enum vtype vnode_vtype(vnode_t vp)
+{
+    return vp->type;
+}
+
+int vnode_isdir(vnode_t vp)
+{
+    return vp->type == VDIR;
+}
+
+int vnode_isreg(vnode_t vp)
+{
+    return vp->type == VREG;
+}
+
+int vnode_isvroot(vnode_t vp)
+{
+    return vp->isroot;
+}
+
+mount_t vnode_mount(vnode_t vp)
+{
+    return vp->mp;
+}
+
+void *vnode_fsnode(vnode_t vp)
+{
+    return vp->fsnode;
+}
+
+void vnode_clearfsnode(vnode_t vp)
+{
+    pthread_mutex_lock(&vp->lock);
+    vp->fsnode = NULL;
+    pthread_mutex_unlock(&vp->lock);
+}
+
+dev_t vnode_specrdev(vnode_t vp)
+{
+    return vp->rdev;
+}
+
+/*
+ * vflush()  vnodes without usecount are drained and reclaimed
+ *  busy ones fail the flush unless FORCECLOSE
+ */
+int vflush(struct mount *mp, struct vnode *skipvp, int flags)
+{
+    struct {
+        vnode_t vp;
+        uint32_t vid;
+    } *snap = NULL, *p;
+    uint32_t cap = 0;
+    uint32_t i;
+    uint32_t n = 0;
+    int busy = 0;
+    vnode_t vp;
+
+    /*
+     * as vflush() walks mnt_vnodelist  only vnodes of this mount are visited
+     *  a snapshot  .: vnodes may come and go while we reclaim
+     *  a vnode recycled meanwhile is told by its vid
+     */
+    pthread_mutex_lock(&mp->vlist_mtx);
+    for (vp = mp->vlist; vp != NULL; vp = vp->mnt_next) {
+        if (n == cap) {
+            cap = cap != 0 ? cap << 1 : 64;
+            p = realloc(snap, cap * sizeof(*snap));
+            if (p == NULL) panic("vflush() out of memory  %u vnodes", n);
+            snap = p;
+        }
+        snap[n].vp = vp;
+        snap[n].vid = vp->vid;
+        n++;
+    }
+    pthread_mutex_unlock(&mp->vlist_mtx);
+
+    for (i = 0; i < n; i++) {
+        vp = snap[i].vp;
+
+        pthread_mutex_lock(&vp->lock);
+        while (vp->mp == mp && vp->vid == snap[i].vid && (vp->lflag & VL_TERMINATE)) {
+            (void) pthread_cond_wait(&vp->cv, &vp->lock);
+        }
+        if (vp->mp != mp || vp->vid != snap[i].vid || (vp->lflag & VL_DEAD) || vp == skipvp) {
+            pthread_mutex_unlock(&vp->lock);
+            continue;
+        }
+        if (vp->usecount != 0 && !(flags & FORCECLOSE)) {
+            busy++;
+            pthread_mutex_unlock(&vp->lock);
+            continue;
+        }
+
+        vp->lflag |= VL_TERMINATE;
+        while (vp->iocount != 0) (void) pthread_cond_wait(&vp->cv, &vp->lock);
+        pthread_mutex_unlock(&vp->lock);
+        vnode_reclaim(vp);
+    }
+
+    free(snap);
+    return busy ? EBUSY : 0;
+}
+
+int xnu_host_reclaim(vnode_t vp, uint32_t vid)
+{
+    pthread_mutex_lock(&vp->lock);
+    if (vp->vid != vid || vp->mp == NULL ||
+            (vp->lflag & (VL_DEAD | VL_TERMINATE | VL_MARKTERM))) {
+        pthread_mutex_unlock(&vp->lock);
+        return 0;
+    }
+    (void) vnode_reclaim_or_mark_locked(vp);
+    return 1;
+}
+
+static uint64_t host_rand(void)
+{
+    static __thread uint64_t s = 0;
+
+    if (UNLIKELY(s == 0)) s = (uint64_t) (uintptr_t) &s ^ mach_absolute_time() ^ 1;
+    /* xorshift64*  see: Vigna  An experimental exploration of Marsaglia's xorshift generators */
+    s ^= s >> 12;
+    s ^= s << 25;
+    s ^= s >> 27;
+    return s * 0x2545f4914f6cdd1dULL;
+}
+
+/**
+ * @return      a random vnode of a mount(any mount if NULL)  along with its vid
+ *              NULL if the pool is empty
+ */
+static vnode_t host_pick(mount_t mp, uint32_t *vid)
+{
+    vnode_t vp = NULLVP;
+    uint32_t n;
+    int tries;
+
+    for (tries = 0; tries < 8; tries++) {
+        pthread_mutex_lock(&host_pool_mtx);
+        n = host_pool_n;
+        vp = n != 0 ? host_pool[host_rand() % n] : NULLVP;
+        pthread_mutex_unlock(&host_pool_mtx);
+        if (vp == NULLVP) break;
+
+        *vid = vnode_vid(vp);
+        if (vp->mp != NULL && (mp == NULL || vp->mp == mp)) return vp;
+    }
+
+    return NULLVP;
+}
+
+int xnu_host_reclaim_any(mount_t mp)
+{
+    uint32_t vid = 0;
+    vnode_t vp = host_pick(mp, &vid);
+    return vp != NULLVP ? xnu_host_reclaim(vp, vid) : 0;
+}
+
+uint32_t xnu_host_nvnodes(mount_t mp)
+{
+    return __atomic_load_n(&mp->nvnodes, __ATOMIC_RELAXED);
+}
+
+uint64_t xnu_host_nreclaims(void)
+{
+    return __atomic_load_n(&host_nreclaim, __ATOMIC_RELAXED);
+}
+
+/*
+ * Reclaim injection
+ *  a thread holding any lock can't reclaim by itself  the fs may take the
+ *  same lock in VNOP_RECLAIM  such reclaims go to the reaper thread
+ */
+
+#define REAP_QLEN           1024
+
+static volatile uint32_t host_inj_every = 0;
+static volatile uint64_t host_inj_cnt[XNU_INJ_NR];
+
+static pthread_mutex_t host_reap_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t host_reap_cv = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t host_reap_idle = PTHREAD_COND_INITIALIZER;
+static pthread_once_t host_reap_once = PTHREAD_ONCE_INIT;
+static struct {
+    vnode_t vp;
+    uint32_t vid;
+} host_reap_q[REAP_QLEN];
+static uint32_t host_reap_head = 0;
+static uint32_t host_reap_len = 0;
+static int host_reap_busy = 0;
+
+static void *host_reaper(void *arg __unused)
+{
+    vnode_t vp;
+    uint32_t vid;
+
+    host_in_inject = 1;
+
+    pthread_mutex_lock(&host_reap_mtx);
+    for (;;) {
+        while (host_reap_len == 0) {
+            host_reap_busy = 0;
+            (void) pthread_cond_broadcast(&host_reap_idle);
+            (void) pthread_cond_wait(&host_reap_cv, &host_reap_mtx);
+        }
+        host_reap_busy = 1;
+        vp = host_reap_q[host_reap_head].vp;
+        vid = host_reap_q[host_reap_head].vid;
+        host_reap_head = (host_reap_head + 1) % REAP_QLEN;
+        host_reap_len--;
+        pthread_mutex_unlock(&host_reap_mtx);
+
+        (void) xnu_host_reclaim(vp, vid);
+
+        pthread_mutex_lock(&host_reap_mtx);
+    }
+
+    return NULL;
+}
+
+static void host_reaper_start(void)
+{
+    pthread_t t;
+
+    if (pthread_create(&t, NULL, host_reaper, NULL) != 0) panic("reaper pthread_create() fail");
+    (void) pthread_detach(t);
+}
+
+static void host_reaper_post(vnode_t vp, uint32_t vid)
+{
+    (void) pthread_once(&host_reap_once, host_reaper_start);
+
+    pthread_mutex_lock(&host_reap_mtx);
+    /* a full queue just drops  injection is best-effort */
+    if (host_reap_len < REAP_QLEN) {
+        host_reap_q[(host_reap_head + host_reap_len) % REAP_QLEN].vp = vp;
+        host_reap_q[(host_reap_head + host_reap_len) % REAP_QLEN].vid = vid;
+        host_reap_len++;
+        (void) pthread_cond_signal(&host_reap_cv);
+    }
+    pthread_mutex_unlock(&host_reap_mtx);
+}
+
+static void host_reaper_drain(void)
+{
+    pthread_mutex_lock(&host_reap_mtx);
+    while (host_reap_len != 0 || host_reap_busy) {
+        (void) pthread_cond_wait(&host_reap_idle, &host_reap_mtx);
+    }
+    pthread_mutex_unlock(&host_reap_mtx);
+}
+
+static void host_inject_at(enum xnu_host_inject pt, vnode_t vp)
+{
+    uint32_t every = __atomic_load_n(&host_inj_every, __ATOMIC_RELAXED);
+    uint32_t vid;
+
+    if (LIKELY(every == 0) || host_in_inject) return;
+    if (host_rand() % every != 0) return;
+
+    if (vp != NULLVP && vp->mp != NULL) {
+        vid = vnode_vid(vp);
+    } else {
+        vp = host_pick(NULL, &vid);
+        if (vp == NULLVP) return;
+    }
+
+    (void) __atomic_fetch_add(&host_inj_cnt[pt], 1, __ATOMIC_RELAXED);
+
+    if (host_nlocks != 0 || (host_self != NULL && host_self->queued)) {
+        host_reaper_post(vp, vid);
+        return;
+    }
+
+    host_in_inject = 1;
+    (void) xnu_host_reclaim(vp, vid);
+    host_in_inject = 0;
+}
+
+void xnu_host_inject(uint32_t every)
+{
+    __atomic_store_n(&host_inj_every, every, __ATOMIC_RELAXED);
+    if (every == 0) host_reaper_drain();
+}
+
+uint64_t xnu_host_injected(enum xnu_host_inject pt)
+{
+    return __atomic_load_n(&host_inj_cnt[pt], __ATOMIC_RELAXED);
+}
+
+const char *xnu_host_inject_name(enum xnu_host_inject pt)
+{
+    static const char *names[XNU_INJ_NR] = {
+        "vnode_getwithvid",
+        "vnode_create",
+        "vnode_addfsref",
+        "vnode_put",
+        "lck_mtx_unlock",
+        "msleep",
+        "uiomove",
+    };
+    return pt < XNU_INJ_NR ? names[pt] : "?";
+}
+
+/*
+ * Name cache  no lookup ever hits  i.e. every lookup reaches the fs
+ */
+
+void cache_enter(vnode_t dvp __unused, vnode_t vp __unused, struct componentname *cnp __unused)
+{
+}
+
+int cache_lookup(vnode_t dvp __unused, vnode_t *vpp __unused, struct componentname *cnp __unused)
+{
+    return 0;
+}
+
+void cache_purge(vnode_t vp __unused)
+{
+}
+
+void cache_purge_negatives(vnode_t vp __unused)
+{
+}
+
+/*
+ * Vnode operations
+ */
+
+struct vnodeop_desc vnop_default_desc = { 0, "default" };
+struct vnodeop_desc vnop_lookup_desc = { 1, "vnop_lookup" };
+struct vnodeop_desc vnop_open_desc = { 2, "vnop_open" };
+struct vnodeop_desc vnop_close_desc = { 3, "vnop_close" };
+struct vnodeop_desc vnop_getattr_desc = { 4, "vnop_getattr" };
+struct vnodeop_desc vnop_setattr_desc = { 5, "vnop_setattr" };
+struct vnodeop_desc vnop_readdir_desc = { 6, "vnop_readdir" };
+struct vnodeop_desc vnop_getattrlistbulk_desc = { 7, "vnop_getattrlistbulk" };
+struct vnodeop_desc vnop_reclaim_desc = { 8, "vnop_reclaim" };
+struct vnodeop_desc vnop_create_desc = { 9, "vnop_create" };
+struct vnodeop_desc vnop_mkdir_desc = { 10, "vnop_mkdir" };
+struct vnodeop_desc vnop_remove_desc = { 11, "vnop_remove" };
+struct vnodeop_desc vnop_rmdir_desc = { 12, "vnop_rmdir" };
+struct vnodeop_desc vnop_rename_desc = { 13, "vnop_rename" };
+struct vnodeop_desc vnop_read_desc = { 14, "vnop_read" };
+struct vnodeop_desc vnop_write_desc = { 15, "vnop_write" };
+struct vnodeop_desc vnop_fsync_desc = { 16, "vnop_fsync" };
+struct vnodeop_desc vnop_pagein_desc = { 17, "vnop_pagein" };
+struct vnodeop_desc vnop_pageout_desc = { 18, "vnop_pageout" };
+struct vnodeop_desc vnop_blockmap_desc = { 19, "vnop_blockmap" };
+struct vnodeop_desc vnop_strategy_desc = { 20, "vnop_strategy" };
+struct vnodeop_desc vnop_blktooff_desc = { 21, "vnop_blktooff" };
+struct vnodeop_desc vnop_offtoblk_desc = { 22, "vnop_offtoblk" };
+struct vnodeop_desc vnop_ioctl_desc = { 23, "vnop_ioctl" };
+#define VNOP_NDESC          24
+
+static int host_vnop_enotsup(void *arg __unused)
+{
+    return ENOTSUP;
+}
+
+static inline int vnop_call(vnode_t vp, struct vnodeop_desc *desc, void *ap)
+{
+    if (vp->vops == NULL) return EBADF;
+    return vp->vops[desc->vdesc_offset](ap);
+}
+
+int VNOP_LOOKUP(vnode_t dvp, vnode_t *vpp, struct componentname *cnp, vfs_context_t ctx)
+{
+    struct vnop_lookup_args a = { &vnop_lookup_desc, dvp, vpp, cnp, ctx };
+    return vnop_call(dvp, &vnop_lookup_desc, &a);
+}
+
+int VNOP_GETATTR(vnode_t vp, struct vnode_attr *vap, vfs_context_t ctx)
+{
+    struct vnop_getattr_args a = { &vnop_getattr_desc, vp, vap, ctx };
+    return vnop_call(vp, &vnop_getattr_desc, &a);
+}
+
+int VNOP_READDIR(vnode_t vp, struct uio *uio, int flags, int *eofflag, int *numdirent, vfs_context_t ctx)
+{
+    struct vnop_readdir_args a = { &vnop_readdir_desc, vp, uio, flags, eofflag, numdirent, ctx };
+    return vnop_call(vp, &vnop_readdir_desc, &a);
+}
+
+/* only device vnodes answer ioctls */
+int VNOP_IOCTL(vnode_t vp, u_long cmd, caddr_t data, int fflag __unused, vfs_context_t ctx __unused)
+{
+    if (vp->dev == NULL) return ENOTTY;
+
+    switch (cmd) {
+    case DKIOCGETBLOCKSIZE:
+        *(uint32_t *) data = vp->dev->bsize;
+        return 0;
+    case DKIOCGETBLOCKCOUNT:
+        *(uint64_t *) data = vp->dev->size / vp->dev->bsize;
+        return 0;
+    default:
+        return ENOTTY;
+    }
+}
+
+int vfs_fsadd(struct vfs_fsentry *fe, vfstable_t *handle)
+{
+    struct host_vfs *v;
+    struct vnodeopv_desc *opv;
+    struct vnodeopv_entry_desc *ent;
+    int (**vec)(void *);
+    int (*dflt)(void *);
+    int i, j;
+
+    if (fe == NULL || handle == NULL || fe->vfe_vfsops == NULL) return EINVAL;
+
+    v = calloc(1, sizeof(*v));
+    if (v == NULL) return ENOMEM;
+    v->fe = fe;
+
+    for (i = 0; i < fe->vfe_vopcnt; i++) {
+        opv = fe->vfe_opvdescs[i];
+        vec = calloc(VNOP_NDESC, sizeof(*vec));
+        if (vec == NULL) {
+            while (--i >= 0) {
+                free(*fe->vfe_opvdescs[i]->opv_desc_vector_p);
+                *fe->vfe_opvdescs[i]->opv_desc_vector_p = NULL;
+            }
+            free(v);
+            return ENOMEM;
+        }
+
+        dflt = host_vnop_enotsup;
+        for (ent = opv->opv_desc_ops; ent->opve_op != NULL; ent++) {
+            if (ent->opve_op->vdesc_offset >= VNOP_NDESC) continue;
+            vec[ent->opve_op->vdesc_offset] = ent->opve_impl;
+            if (ent->opve_op == &vnop_default_desc) dflt = ent->opve_impl;
+        }
+        for (j = 0; j < VNOP_NDESC; j++) {
+            if (vec[j] == NULL) vec[j] = dflt;
+        }
+        *opv->opv_desc_vector_p = vec;
+    }
+
+    pthread_mutex_lock(&host_vfs_mtx);
+    v->typenum = (fe->vfe_flags & VFS_TBLNOTYPENUM) ? host_next_typenum++ : fe->vfe_fstypenum;
+    v->next = host_vfs_list;
+    host_vfs_list = v;
+    pthread_mutex_unlock(&host_vfs_mtx);
+
+    *handle = (vfstable_t) v;
+    return 0;
+}
+
+int vfs_fsremove(vfstable_t handle)
+{
+    struct host_vfs *v = (struct host_vfs *) handle;
+    struct host_vfs **pp;
+    int i;
+
+    pthread_mutex_lock(&host_vfs_mtx);
+    if (v->nmount != 0) {
+        pthread_mutex_unlock(&host_vfs_mtx);
+        return EBUSY;
+    }
+    for (pp = &host_vfs_list; *pp != v; pp = &(*pp)->next) continue;
+    *pp = v->next;
+    pthread_mutex_unlock(&host_vfs_mtx);
+
+    for (i = 0; i < v->fe->vfe_vopcnt; i++) {
+        free(*v->fe->vfe_opvdescs[i]->opv_desc_vector_p);
+        *v->fe->vfe_opvdescs[i]->opv_desc_vector_p = NULL;
+    }
+    free(v);
+    return 0;
+}
+
+void *vfs_fsprivate(mount_t mp)
+{
+    return mp->fsprivate;
+}
+
+void vfs_setfsprivate(mount_t mp, void *data)
+{
+    mp->fsprivate = data;
+}
+
+int vfs_isupdate(mount_t mp __unused)
+{
+    return 0;
+}
+
+int vfs_iswriteupgrade(mount_t mp __unused)
+{
+    return 0;
+}
+
+int vfs_typenum(mount_t mp)
+{
+    return mp->vfs->typenum;
+}
+
+void vfs_setflags(mount_t mp, uint64_t flags)
+{
+    mp->st.f_flags |= flags;
+}
+
+struct vfsstatfs *vfs_statfs(mount_t mp)
+{
+    return &mp->st;
+}
+
+int vfs_devblocksize(mount_t mp)
+{
+    if (mp->devvp == NULLVP || mp->devvp->dev == NULL) return 512;
+    return (int) mp->devvp->dev->bsize;
+}
+
+int vfs_attr_pack(vnode_t vp __unused, uio_t uio __unused, struct attrlist *alp __unused,
+                    uint64_t options __unused, struct vnode_attr *vap __unused,
+                    void *fndesc __unused, vfs_context_t ctx __unused)
+{
+    return ENOTSUP;
+}
+
+int xnu_host_mount(const char *fsname, vnode_t devvp, void *data, mount_t *mpp)
+{
+    int e;
+    struct host_vfs *v;
+    mount_t mp;
+    static volatile uint32_t seq = 0;
+
+    pthread_mutex_lock(&host_vfs_mtx);
+    for (v = host_vfs_list; v != NULL; v = v->next) {
+        if (!strcmp(v->fe->vfe_fsname, fsname)) break;
+    }
+    if (v != NULL) v->nmount++;
+    pthread_mutex_unlock(&host_vfs_mtx);
+    if (v == NULL) return ENODEV;
+
+    mp = calloc(1, sizeof(*mp));
+    if (mp == NULL) {
+        e = ENOMEM;
+        goto out_fail;
+    }
+    mp->vfs = v;
+    mp->devvp = devvp;
+    (void) pthread_mutex_init(&mp->vlist_mtx, NULL);
+    (void) strlcpy(mp->st.f_fstypename, fsname, sizeof(mp->st.f_fstypename));
+    (void) snprintf(mp->st.f_mntonname, sizeof(mp->st.f_mntonname),
+                    "/Volumes/%s%u", fsname, __atomic_fetch_add(&seq, 1, __ATOMIC_RELAXED));
+    (void) snprintf(mp->st.f_mntfromname, sizeof(mp->st.f_mntfromname),
+                    "/dev/disk%p", (void *) devvp);
+
+    /* as mount_common()  a failed vfs_mount is expected to clean up by itself */
+    e = v->fe->vfe_vfsops->vfs_mount(mp, devvp, CAST_USER_ADDR_T(data), vfs_context_current());
+    if (e != 0) goto out_fail;
+
+    /* return value ignored  see: VFS_START */
+    if (v->fe->vfe_vfsops->vfs_start != NULL) {
+        (void) v->fe->vfe_vfsops->vfs_start(mp, 0, vfs_context_current());
+    }
+
+    *mpp = mp;
+    return 0;
+
+out_fail:
+    if (mp != NULL && __atomic_load_n(&mp->nvnodes, __ATOMIC_RELAXED) != 0) {
+        xnu_host_violation("failed mount %p left %u vnodes", mp, mp->nvnodes);
+    }
+    if (mp != NULL) (void) pthread_mutex_destroy(&mp->vlist_mtx);
+    free(mp);
+    pthread_mutex_lock(&host_vfs_mtx);
+    v->nmount--;
+    pthread_mutex_unlock(&host_vfs_mtx);
+    return e;
+}
+
+int xnu_host_unmount(mount_t mp, int flags)
+{
+    int e;
+    struct host_vfs *v = mp->vfs;
+
+    /* queued reclaims may name vnodes of this mount */
+    host_reaper_drain();
+
+    e = v->fe->vfe_vfsops->vfs_unmount(mp, flags, vfs_context_current());
+    if (e != 0) return e;
+
+    if (__atomic_load_n(&mp->nvnodes, __ATOMIC_RELAXED) != 0) {
+        xnu_host_violation("unmount %p left %u vnodes", mp, mp->nvnodes);
+    }
+    if (mp->rootvp != NULLVP) {
+        xnu_host_violation("unmount %p left root vnode %p with fsref", mp, mp->rootvp);
+    }
+
+    pthread_mutex_lock(&host_vfs_mtx);
+    v->nmount--;
+    pthread_mutex_unlock(&host_vfs_mtx);
+    (void) pthread_mutex_destroy(&mp->vlist_mtx);
+    free(mp);
+    return 0;
+}
+
+int xnu_host_root(mount_t mp, vnode_t *vpp)
+{
+    *vpp = NULLVP;
+    return mp->vfs->fe->vfe_vfsops->vfs_root(mp, vpp, vfs_context_current());
+}
+
+/*
+ * Device vnodes and buffer cache
+ *  each buf_meta_bread() reads a private copy  nothing is cached
+ */
+
+struct buf {
+    vnode_t vp;
+    daddr64_t blkno;
+    uint32_t count;
+    uint32_t resid;
+    int32_t flags;
+    errno_t error;
+    uint8_t data[];
+};
+
+vnode_t xnu_host_dev_create(const void *data, size_t size, uint32_t bsize)
+{
+    static volatile uint32_t minor = 0;
+    struct host_dev *dev;
+    vnode_t vp;
+
+    if (bsize == 0 || (bsize & (bsize - 1)) != 0) return NULLVP;
+
+    dev = calloc(1, sizeof(*dev));
+    if (dev == NULL) return NULLVP;
+    dev->size = size;
+    dev->bsize = bsize;
+    dev->data = calloc(1, size != 0 ? size : 1);
+    if (dev->data == NULL) {
+        free(dev);
+        return NULLVP;
+    }
+    if (data != NULL) memcpy(dev->data, data, size);
+
+    vp = vnode_alloc();
+    if (vp == NULLVP) {
+        free(dev->data);
+        free(dev);
+        return NULLVP;
+    }
+
+    pthread_mutex_lock(&vp->lock);
+    vp->type = VBLK;
+    vp->mp = NULL;
+    vp->dev = dev;
+    vp->rdev = (dev_t) ((1u << 24) | __atomic_fetch_add(&minor, 1, __ATOMIC_RELAXED));
+    vp->size = (off_t) size;
+    vp->iocount = 0;
+    vp->usecount = 0;
+    vp->lflag = 0;
+    pthread_mutex_unlock(&vp->lock);
+
+    return vp;
+}
+
+void xnu_host_dev_destroy(vnode_t vp)
+{
+    struct host_dev *dev;
+
+    pthread_mutex_lock(&vp->lock);
+    if (vp->usecount != 0) xnu_host_violation("device vnode %p still referenced", vp);
+    dev = vp->dev;
+    vp->dev = NULL;
+    vp->vid++;
+    vp->lflag = VL_DEAD;
+    pthread_mutex_unlock(&vp->lock);
+
+    if (dev != NULL) {
+        free(dev->data);
+        free(dev);
+    }
+    vnode_free(vp);
+}
+
+int buf_meta_bread(vnode_t vp, daddr64_t blkno, int size, kauth_cred_t cred __unused, buf_t *bpp)
+{
+    struct host_dev *dev = vp->dev;
+    struct buf *bp;
+    uint64_t off;
+
+    *bpp = NULL;
+    if (dev == NULL || size <= 0 || blkno < 0) return EINVAL;
+
+    bp = calloc(1, sizeof(*bp) + (size_t) size);
+    if (bp == NULL) return ENOMEM;
+    bp->vp = vp;
+    bp->blkno = blkno;
+    bp->count = (uint32_t) size;
+    bp->flags = B_READ;
+    *bpp = bp;
+
+    off = (uint64_t) blkno * dev->bsize;
+    if (off + (uint64_t) size > dev->size) {
+        bp->error = EIO;
+        return EIO;
+    }
+    memcpy(bp->data, dev->data + off, (size_t) size);
+    return 0;
+}
+
+void buf_brelse(buf_t bp)
+{
+    free(bp);
+}
+
+uintptr_t buf_dataptr(buf_t bp)
+{
+    return (uintptr_t) bp->data;
+}
+
+errno_t buf_map(buf_t bp, caddr_t *io_addr)
+{
+    *io_addr = (caddr_t) bp->data;
+    return 0;
+}
+
+errno_t buf_unmap(buf_t bp __unused)
+{
+    return 0;
+}
+
+uint32_t buf_count(buf_t bp)
+{
+    return bp->count;
+}
+
+void buf_setresid(buf_t bp, uint32_t resid)
+{
+    bp->resid = resid;
+}
+
+daddr64_t buf_blkno(buf_t bp)
+{
+    return bp->blkno;
+}
+
+vnode_t buf_vnode(buf_t bp)
+{
+    return bp->vp;
+}
+
+int32_t buf_flags(buf_t bp)
+{
+    return bp->flags;
+}
+
+void buf_seterror(buf_t bp, errno_t e)
+{
+    bp->error = e;
+}
+
+void buf_biodone(buf_t bp __unused)
+{
+}
+
+/* strategy bufs only come from cluster IO  which isn't there */
+errno_t buf_strategy(vnode_t devvp __unused, void *ap __unused)
+{
+    return ENOTSUP;
+}
+
+int buf_invalidateblks(vnode_t vp __unused, int flags __unused, int slpflag __unused, int slptimeo __unused)
+{
+    return 0;
+}
+
+/*
+ * UBC and cluster IO  file data isn't modelled
+ */
+
+int ubc_setsize(vnode_t vp, off_t size)
+{
+    vp->size = size;
+    return 1;
+}
+
+off_t ubc_getsize(vnode_t vp)
+{
+    return vp->size;
+}
+
+errno_t ubc_msync(vnode_t vp __unused, off_t beg __unused, off_t end __unused,
+                    off_t *resid_off __unused, int flags __unused)
+{
+    return 0;
+}
+
+kern_return_t ubc_upl_abort_range(upl_t upl __unused, upl_offset_t off __unused,
+                                    uint32_t size __unused, int flags __unused)
+{
+    return KERN_SUCCESS;
+}
+
+int cluster_read(vnode_t vp __unused, struct uio *uio __unused,
+                    off_t filesize __unused, int flags __unused)
+{
+    return ENOTSUP;
+}
+
+int cluster_write(vnode_t vp __unused, struct uio *uio __unused, off_t oldEOF __unused,
+                    off_t newEOF __unused, off_t headOff __unused, off_t tailOff __unused,
+                    int flags __unused)
+{
+    return ENOTSUP;
+}
+
+int cluster_pagein(vnode_t vp __unused, upl_t upl __unused, upl_offset_t upl_offset __unused,
+                    off_t f_offset __unused, int size __unused, off_t filesize __unused,
+                    int flags __unused)
+{
+    return ENOTSUP;
+}
+
+int cluster_pageout(vnode_t vp __unused, upl_t upl __unused, upl_offset_t upl_offset __unused,
+                    off_t f_offset __unused, int size __unused, off_t filesize __unused,
+                    int flags __unused)
+{
+    return ENOTSUP;
+}
+
+int advisory_read(vnode_t vp __unused, off_t filesize __unused, off_t f_offset __unused,
+                    int resid __unused)
+{
+    return 0;
+}
+
+/* MAX_UPL_TRANSFER_BYTES of xnu */
+uint32_t cluster_max_io_size(mount_t mp __unused, int type __unused)
+{
+    return 256u * 1024u;
+}
+
+/*
+ * sysctl  oids are kept in a flat list  reachable by dotted names
+ *  see: sysctlbyname()
+ */
+
+struct sysctl_oid_list sysctl__vfs_generic_children;
+
+#define SYSCTL_MAXOID       64
+static pthread_mutex_t host_sysctl_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct sysctl_oid *host_sysctl[SYSCTL_MAXOID];
+
+void sysctl_register_oid(struct sysctl_oid *oidp)
+{
+    int i;
+
+    pthread_mutex_lock(&host_sysctl_mtx);
+    for (i = 0; i < SYSCTL_MAXOID; i++) {
+        if (host_sysctl[i] == NULL) {
+            host_sysctl[i] = oidp;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&host_sysctl_mtx);
+}
+
+void sysctl_unregister_oid(struct sysctl_oid *oidp)
+{
+    int i;
+
+    pthread_mutex_lock(&host_sysctl_mtx);
+    for (i = 0; i < SYSCTL_MAXOID; i++) {
+        if (host_sysctl[i] == oidp) host_sysctl[i] = NULL;
+    }
+    pthread_mutex_unlock(&host_sysctl_mtx);
+}
+
+/**
+ * Build dotted name of an oid by walking parent nodes
+ * @return      0 if success  -1 if a parent isn't registered(or too long)
+ */
+static int sysctl_name_locked(const struct sysctl_oid *oidp, char *buf, size_t size)
+{
+    const struct sysctl_oid *p = NULL;
+    char tmp[128];
+    int i;
+
+    if (oidp->oid_parent == &sysctl__vfs_generic_children) {
+        return (size_t) snprintf(buf, size, "vfs.generic.%s", oidp->oid_name) < size ? 0 : -1;
+    }
+
+    for (i = 0; i < SYSCTL_MAXOID; i++) {
+        p = host_sysctl[i];
+        if (p != NULL && p->oid_arg1 == (void *) oidp->oid_parent) break;
+    }
+    if (i == SYSCTL_MAXOID || sysctl_name_locked(p, tmp, sizeof(tmp)) != 0) return -1;
+    return (size_t) snprintf(buf, size, "%s.%s", tmp, oidp->oid_name) < size ? 0 : -1;
+}
+
+static int sysctl_old_kernel(struct sysctl_req *req, const void *p, size_t l)
+{
+    size_t n = l;
+
+    if (req->oldptr != 0) {
+        if (req->oldidx >= req->oldlen) {
+            n = 0;
+        } else if (n > req->oldlen - req->oldidx) {
+            n = req->oldlen - req->oldidx;
+        }
+        if (n != 0) memcpy((char *) (uintptr_t) req->oldptr + req->oldidx, p, n);
+    }
+    req->oldidx += l;
+    return req->oldptr != 0 && n != l ? ENOMEM : 0;
+}
+
+static int sysctl_new_kernel(struct sysctl_req *req, void *p, size_t l)
+{
+    if (req->newptr == 0) return 0;
+    if (req->newlen - req->newidx < l) return EINVAL;
+    memcpy(p, (const char *) (uintptr_t) req->newptr + req->newidx, l);
+    req->newidx += l;
+    return 0;
+}
+
+int sysctl_handle_quad(SYSCTL_HANDLER_ARGS)
+{
+    int e = SYSCTL_OUT(req, arg1, sizeof(int64_t));
+    if (e == 0 && req->newptr != 0) e = SYSCTL_IN(req, arg1, sizeof(int64_t));
+    return e;
+}
+
+/*
+ * As sysctlbyname(3)  for oids the kext registered
+ *  besides hw.logicalcpu_max  which the kext itself asks for
+ */
+int sysctlbyname(const char *name, void *oldp, size_t *oldlenp, void *newp, size_t newlen)
+{
+    struct sysctl_oid *oidp = NULL;
+    struct sysctl_req req;
+    char buf[128];
+    int n;
+    int e;
+    int i;
+
+    if (!strcmp(name, "hw.logicalcpu_max")) {
+        n = get_nprocs_conf();
+        if (oldp == NULL || oldlenp == NULL || *oldlenp < sizeof(n)) return ENOMEM;
+        memcpy(oldp, &n, sizeof(n));
+        *oldlenp = sizeof(n);
+        return 0;
+    }
+
+    pthread_mutex_lock(&host_sysctl_mtx);
+    for (i = 0; i < SYSCTL_MAXOID; i++) {
+        if (host_sysctl[i] == NULL || host_sysctl[i]->oid_handler == NULL) continue;
+        if (sysctl_name_locked(host_sysctl[i], buf, sizeof(buf)) == 0 && !strcmp(buf, name)) {
+            oidp = host_sysctl[i];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&host_sysctl_mtx);
+    if (oidp == NULL) return ENOENT;
+
+    memset(&req, 0, sizeof(req));
+    req.oldptr = CAST_USER_ADDR_T(oldp);
+    req.oldlen = oldlenp != NULL ? *oldlenp : 0;
+    req.oldfunc = sysctl_old_kernel;
+    req.newptr = CAST_USER_ADDR_T(newp);
+    req.newlen = newlen;
+    req.newfunc = sysctl_new_kernel;
+
+    e = oidp->oid_handler(oidp, oidp->oid_arg1, oidp->oid_arg2, &req);
+    if (oldlenp != NULL) *oldlenp = req.oldidx;
+    return e;
+}
+
+/*
+ * A Mach-O header carrying nothing but LC_UUID  for util_vma_uuid()
+ */
+kmod_info_t *xnu_host_kmod_info(void)
+{
+    static struct {
+        struct mach_header_64 h;
+        struct uuid_command uc;
+    } image;
+    static kmod_info_t ki;
+
+    if (ki.address == 0) {
+        image.h.magic = MH_MAGIC_64;
+        image.h.filetype = MH_KEXT_BUNDLE;
+        image.h.ncmds = 1;
+        image.h.sizeofcmds = sizeof(image.uc);
+        image.uc.cmd = LC_UUID;
+        image.uc.cmdsize = sizeof(image.uc);
+        uuid_generate_random(image.uc.uuid);
+        ki.address = (vm_address_t) &image;
+        ki.size = sizeof(image);
+    }
+
+    return &ki;
+}
@@ -0,0 +1,675 @@
+/*
+ * Created 261018
+ *
+ * Userspace reader/checker of emptyfs images
+ *  it shares emptyfs_img.h with the kext  thus an image can be inspected
+ *  by the very same parser on any POSIX system  no mount needed
+ */
+
+#define _XOPEN_SOURCE   700
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/types.h>
+
+#include "emptyfs_img.h"
+#include "emptyfs_vt.h"
+
+#define IMG_EMPTYFS_VERSION     "0.1"
+
+#define LOG(fmt, ...)       printf("img_emptyfs: " fmt "\n", ##__VA_ARGS__)
+#define LOG_ERR(fmt, ...)   fprintf(stderr, "img_emptyfs: [ERR] " fmt "\n", ##__VA_ARGS__)
+
+#define ASSERT_NONNULL(p)   assert(p != NULL)
+
+#ifndef PATH_MAX
+#define PATH_MAX            1024
+#endif
+
+/* cat(1) buffer  a run longer than this is read in pieces */
+#define CAT_BUFSZ           (1024 * 1024)
+
+static __attribute__((noreturn)) void usage(char *argv0)
+{
+    ASSERT_NONNULL(argv0);
+    fprintf(stderr,
+            "usage:\n\t"
+            "%s info image\n\t"
+            "%s ls image [path]\n\t"
+            "%s find image\n\t"
+            "%s cat image path\n\t"
+            "%s check image\n\n\t"
+            "-v         print version\n\t"
+            "-h         print this help\n\n\t"
+            "info       print superblock\n\t"
+            "ls         list a directory(default: root)\n\t"
+            "find       list the whole tree\n\t"
+            "cat        write a file to stdout\n\t"
+            "check      verify every inode  directory table and extent\n\t"
+            "           and every block against the Merkle tree if any\n\n\t"
+            "image      an image file  or a device carrying one\n\n",
+            basename(argv0), basename(argv0), basename(argv0),
+            basename(argv0), basename(argv0));
+    exit(1);
+}
+
+/**
+ * emptyfs_img_read_t over pread(2)  ctx is the fd
+ */
+static int img_pread(void *ctx, uint64_t off, void *buf, size_t len)
+{
+    int fd = *(int *) ctx;
+    ssize_t n;
+
+    while (len != 0) {
+        n = pread(fd, buf, len, (off_t) off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return errno;
+        /* a truncated image */
+        if (n == 0) return EIO;
+        buf = (char *) buf + n;
+        off += (uint64_t) n;
+        len -= (size_t) n;
+    }
+
+    return 0;
+}
+
+static int img_open(const char *path, int *fd, struct emptyfs_img *img)
+{
+    int e;
+
+    *fd = open(path, O_RDONLY);
+    if (*fd < 0) {
+        LOG_ERR("open(2) fail  path: %s errno: %d", path, errno);
+        return -1;
+    }
+
+    e = emptyfs_img_open(img, img_pread, fd);
+    if (e) {
+        LOG_ERR("not a valid image  path: %s errno: %d(%s)", path, e, strerror(e));
+        (void) close(*fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Resolve a slash-separated path from root
+ * @return      0 if success  errno o.w.
+ */
+static int resolve(const struct emptyfs_img *img, const char *path, uint64_t *inop)
+{
+    struct emptyfs_img_inode ip;
+    struct emptyfs_img_dir d;
+    uint64_t ino = EMPTYFS_IMG_ROOT_INO;
+    const char *p = path;
+    size_t len;
+    int e;
+
+    for (;;) {
+        while (*p == '/') p++;
+        if (*p == '\0') break;
+        len = strcspn(p, "/");
+
+        e = emptyfs_img_iget(img, ino, &ip);
+        if (e) return e;
+
+        if (len == 1 && p[0] == '.') {
+            /* stays */
+        } else if (len == 2 && p[0] == '.' && p[1] == '.') {
+            ino = ip.parent;
+        } else {
+            e = emptyfs_img_opendir(img, &ip, &d);
+            if (e == 0) e = emptyfs_img_lookup(img, &d, p, len, &ino);
+            if (e) return e;
+        }
+
+        p += len;
+    }
+
+    *inop = ino;
+    return 0;
+}
+
+static void print_inode(uint64_t ino, const struct emptyfs_img_inode *ip, const char *name)
+{
+    printf("%" PRIu64 " %c %04o %u %u %u %" PRIu64 " %" PRId64 " %s\n",
+            ino, ip->type == EMPTYFS_IMG_DIR ? 'd' : 'f', ip->perm & 07777,
+            ip->nlink, ip->uid, ip->gid, ip->size, ip->mtime, name);
+}
+
+/**
+ * @buf         (OUT) 2 * EMPTYFS_SHA256_LEN + 1 bytes
+ */
+static const char *hash_str(const uint8_t *h, char *buf)
+{
+    int i;
+    for (i = 0; i < EMPTYFS_SHA256_LEN; i++) (void) snprintf(buf + 2 * i, 3, "%02x", h[i]);
+    return buf;
+}
+
+static int do_info(const struct emptyfs_img *img)
+{
+    const struct emptyfs_img_sb *sb = &img->sb;
+    int i;
+
+    printf("version:    %u\n", sb->version);
+    printf("features:   %#x\n", sb->features);
+    printf("bsize:      %u\n", 1U << sb->bshift);
+    printf("blocks:     %" PRIu64 "\n", sb->nblocks);
+    printf("inodes:     %" PRIu64 "\n", sb->ninodes);
+    printf("dirs:       %" PRIu64 "\n", sb->ndirs);
+    printf("files:      %" PRIu64 "\n", sb->nfiles);
+    printf("extents:    %" PRIu64 "\n", sb->nextents);
+    printf("itab:       %" PRIu64 "\n", sb->itab_blk);
+    printf("xtab:       %" PRIu64 "\n", sb->xtab_blk);
+    printf("mtime:      %" PRId64 "\n", sb->mtime);
+    printf("volname:    %s\n", sb->volname);
+    printf("uuid:       ");
+    for (i = 0; i < 16; i++) {
+        printf("%02X%s", sb->uuid[i], i == 3 || i == 5 || i == 7 || i == 9 ? "-" : "");
+    }
+    printf("\n");
+
+    if (sb->features & EMPTYFS_IMG_F_VERITY) {
+        char root[2 * EMPTYFS_SHA256_LEN + 1];
+        struct emptyfs_vt vt;
+        int e = emptyfs_vt_open(&vt, img);
+
+        if (e) {
+            LOG_ERR("bad verity descriptor  errno: %d", e);
+            return e;
+        }
+        printf("tree:       %" PRIu64 "\n", vt.tree_blk);
+        printf("levels:     %u\n", vt.levels);
+        printf("root:       %s\n", hash_str(vt.root, root));
+    }
+
+    return 0;
+}
+
+static int do_ls(const struct emptyfs_img *img, const char *path)
+{
+    struct emptyfs_img_inode dip, ip;
+    struct emptyfs_img_dir d;
+    struct emptyfs_img_dirent de;
+    char name[EMPTYFS_IMG_NAME_MAX + 1];
+    uint32_t namlen, type;
+    uint64_t dino;
+    uint32_t i;
+    int e;
+
+    e = resolve(img, path, &dino);
+    if (e == 0) e = emptyfs_img_iget(img, dino, &dip);
+    if (e) {
+        LOG_ERR("cannot resolve %s  errno: %d(%s)", path, e, strerror(e));
+        return -1;
+    }
+
+    if (dip.type != EMPTYFS_IMG_DIR) {
+        print_inode(dino, &dip, path);
+        return 0;
+    }
+
+    e = emptyfs_img_opendir(img, &dip, &d);
+    for (i = 0; e == 0 && i < d.nent; i++) {
+        e = emptyfs_img_dirent_get(img, &d, i, &de);
+        if (e == 0) e = emptyfs_img_name_get(img, &d, &de, name, &namlen, &type);
+        if (e == 0) e = emptyfs_img_iget(img, de.ino, &ip);
+        if (e == 0) print_inode(de.ino, &ip, name);
+    }
+    if (e) {
+        LOG_ERR("readdir fail  path: %s errno: %d(%s)", path, e, strerror(e));
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @return      number of errors
+ */
+static unsigned long do_find(const struct emptyfs_img *img, uint64_t dino, const char *path)
+{
+    unsigned long err = 0;
+    struct emptyfs_img_inode dip, ip;
+    struct emptyfs_img_dir d;
+    struct emptyfs_img_dirent de;
+    char name[EMPTYFS_IMG_NAME_MAX + 1];
+    char sub[PATH_MAX];
+    uint32_t namlen, type;
+    uint32_t i;
+    int e;
+
+    e = emptyfs_img_iget(img, dino, &dip);
+    if (e == 0) e = emptyfs_img_opendir(img, &dip, &d);
+    if (e) {
+        LOG_ERR("cannot open %s  errno: %d", path, e);
+        return 1;
+    }
+
+    for (i = 0; i < d.nent; i++) {
+        e = emptyfs_img_dirent_get(img, &d, i, &de);
+        if (e == 0) e = emptyfs_img_name_get(img, &d, &de, name, &namlen, &type);
+        if (e == 0) e = emptyfs_img_iget(img, de.ino, &ip);
+        if (e) {
+            LOG_ERR("bad entry %u of %s  errno: %d", i, path, e);
+            err++;
+            continue;
+        }
+
+        if (snprintf(sub, sizeof(sub), "%s/%s", path, name) >= (int) sizeof(sub)) {
+            LOG_ERR("path too long: %s/%s", path, name);
+            err++;
+            continue;
+        }
+
+        printf("%" PRIu64 " %c %" PRIu64 " %" PRId64 " %s\n",
+                de.ino, ip.type == EMPTYFS_IMG_DIR ? 'd' : 'f',
+                ip.size, ip.mtime, sub);
+
+        if (ip.type == EMPTYFS_IMG_DIR) err += do_find(img, de.ino, sub);
+    }
+
+    return err;
+}
+
+static int do_cat(const struct emptyfs_img *img, const char *path)
+{
+    struct emptyfs_img_inode ip;
+    uint64_t ino, lblk, pblk, nblk, nb, left, n;
+    char *buf;
+    int e;
+
+    e = resolve(img, path, &ino);
+    if (e == 0) e = emptyfs_img_iget(img, ino, &ip);
+    if (e == 0 && ip.type != EMPTYFS_IMG_REG) e = EISDIR;
+    if (e) {
+        LOG_ERR("cannot cat %s  errno: %d(%s)", path, e, strerror(e));
+        return -1;
+    }
+
+    buf = malloc(CAT_BUFSZ);
+    if (buf == NULL) {
+        LOG_ERR("malloc(3) fail  size: %d", CAT_BUFSZ);
+        return -1;
+    }
+
+    nb = emptyfs_img_blocks(ip.size);
+    left = ip.size;
+
+    /* block by block  buf is large enough for a block and its scratch */
+    if (ip.iflags & EMPTYFS_IMG_I_LZ) {
+        for (lblk = 0; e == 0 && lblk < nb; lblk++) {
+            n = left > EMPTYFS_IMG_BSIZE ? EMPTYFS_IMG_BSIZE : left;
+            e = emptyfs_img_zread(img, &ip, lblk, buf, buf + EMPTYFS_IMG_BSIZE);
+            if (e == 0 && fwrite(buf, 1, n, stdout) != n) e = errno;
+            left -= n;
+        }
+        nb = 0;
+    }
+
+    for (lblk = 0; e == 0 && lblk < nb; lblk += nblk) {
+        e = emptyfs_img_bmap(img, &ip, lblk, &pblk, &nblk);
+        if (e) break;
+
+        /* a run is contiguous in image  read it in big pieces */
+        n = nblk << EMPTYFS_IMG_BSHIFT;
+        if (n > left) n = left;
+        while (e == 0 && n != 0) {
+            size_t len = n > CAT_BUFSZ ? CAT_BUFSZ : (size_t) n;
+            e = img->read(img->ctx, pblk << EMPTYFS_IMG_BSHIFT, buf, len);
+            if (e == 0 && fwrite(buf, 1, len, stdout) != len) e = errno;
+            pblk += len >> EMPTYFS_IMG_BSHIFT;
+            n -= len;
+            left -= len;
+        }
+    }
+
+    free(buf);
+    if (e) {
+        LOG_ERR("read fail  path: %s errno: %d(%s)", path, e, strerror(e));
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * What check has seen so far
+ *  blocks are claimed by whatever references them  so overlaps show up
+ *  but file data claimed twice with EMPTYFS_IMG_F_DEDUP  which is sharing
+ */
+struct check {
+    const struct emptyfs_img *img;
+    uint32_t *visits;           /* per inode */
+    uint8_t *used;              /* per block bitmap */
+    uint8_t *data;              /* ditto  claimed as file data */
+    uint64_t ndirs;
+    uint64_t nfiles;
+    uint64_t nblocks;           /* blocks claimed */
+    uint64_t nshared;           /* further claims of shared data blocks */
+    uint64_t nzfiles;           /* compressed ones */
+    unsigned long err;
+};
+
+#define CHECK_ERR(ck, fmt, ...) do {    \
+    LOG_ERR(fmt, ##__VA_ARGS__);        \
+    (ck)->err++;                        \
+} while (0)
+
+/**
+ * @data        1 if file data  0 if metadata
+ */
+static void claim(struct check *ck, uint64_t blk, uint64_t n, uint64_t ino, int data)
+{
+    int dedup = (ck->img->sb.features & EMPTYFS_IMG_F_DEDUP) != 0;
+    uint8_t bit;
+    uint64_t i;
+
+    for (i = blk; i < blk + n; i++) {
+        bit = (uint8_t) (1U << (i & 7));
+        if (ck->used[i >> 3] & bit) {
+            if (data && dedup && (ck->data[i >> 3] & bit)) {
+                ck->nshared++;
+                continue;
+            }
+            CHECK_ERR(ck, "block %" PRIu64 " of inode %" PRIu64 " claimed twice", i, ino);
+            return;
+        }
+        ck->used[i >> 3] |= bit;
+        if (data) ck->data[i >> 3] |= bit;
+        ck->nblocks++;
+    }
+}
+
+/**
+ * Decode every block of a compressed file  and claim its run
+ */
+static void check_zfile(struct check *ck, uint64_t ino, const struct emptyfs_img_inode *ip)
+{
+    char blk[EMPTYFS_IMG_BSIZE], zbuf[EMPTYFS_IMG_BSIZE];
+    uint64_t nb = emptyfs_img_blocks(ip->size);
+    uint64_t lblk, end;
+    int e;
+
+    for (lblk = 0; lblk < nb; lblk++) {
+        e = emptyfs_img_zread(ck->img, ip, lblk, blk, zbuf);
+        if (e) {
+            CHECK_ERR(ck, "inode %" PRIu64 " block %" PRIu64 " undecodable  errno: %d",
+                        ino, lblk, e);
+            return;
+        }
+    }
+
+    /* the last index entry is where the run ends */
+    e = ck->img->read(ck->img->ctx, (ip->xt << EMPTYFS_IMG_BSHIFT) + nb * 8, &end, sizeof(end));
+    if (e) {
+        CHECK_ERR(ck, "inode %" PRIu64 " index unreadable  errno: %d", ino, e);
+        return;
+    }
+    claim(ck, ip->xt, emptyfs_img_blocks(EMPTYFS_IMG_LE64(end)), ino, 1);
+    ck->nzfiles++;
+}
+
+static void check_file(struct check *ck, uint64_t ino, const struct emptyfs_img_inode *ip)
+{
+    uint64_t lblk, pblk, nblk;
+    uint64_t nb = emptyfs_img_blocks(ip->size);
+    int e;
+
+    if (ip->iflags & EMPTYFS_IMG_I_LZ) {
+        check_zfile(ck, ino, ip);
+        return;
+    }
+
+    for (lblk = 0; lblk < nb; lblk += nblk) {
+        e = emptyfs_img_bmap(ck->img, ip, lblk, &pblk, &nblk);
+        if (e) {
+            CHECK_ERR(ck, "inode %" PRIu64 " block %" PRIu64 " unmapped  errno: %d",
+                        ino, lblk, e);
+            return;
+        }
+        claim(ck, pblk, nblk, ino, 1);
+    }
+}
+
+static void check_dir(struct check *ck, uint64_t dino, const char *path)
+{
+    const struct emptyfs_img *img = ck->img;
+    struct emptyfs_img_inode dip, ip;
+    struct emptyfs_img_dir d;
+    struct emptyfs_img_dirent de;
+    char name[EMPTYFS_IMG_NAME_MAX + 1];
+    char sub[PATH_MAX];
+    uint32_t namlen, type, fence;
+    uint32_t prev = 0;
+    uint64_t found;
+    uint32_t i;
+    int e;
+
+    e = emptyfs_img_iget(img, dino, &dip);
+    if (e == 0) e = emptyfs_img_opendir(img, &dip, &d);
+    if (e) {
+        CHECK_ERR(ck, "cannot open directory %s  errno: %d", path, e);
+        return;
+    }
+
+    ck->ndirs++;
+    claim(ck, dip.xt, emptyfs_img_blocks(dip.size), dino, 0);
+
+    for (i = 0; i < d.nent; i++) {
+        e = emptyfs_img_dirent_get(img, &d, i, &de);
+        if (e == 0) e = emptyfs_img_name_get(img, &d, &de, name, &namlen, &type);
+        if (e == 0) e = emptyfs_img_iget(img, de.ino, &ip);
+        if (e) {
+            CHECK_ERR(ck, "bad entry %u of %s  errno: %d", i, path, e);
+            continue;
+        }
+
+        (void) snprintf(sub, sizeof(sub), "%s/%s", path, name);
+
+        if (de.hash != emptyfs_dirhash_name(name, namlen))
+            CHECK_ERR(ck, "%s: stale hash %#x", sub, de.hash);
+        if (i != 0 && de.hash < prev)
+            CHECK_ERR(ck, "%s: out of hash order", sub);
+        prev = de.hash;
+
+        if (i % EMPTYFS_IMG_DGRP == 0) {
+            e = emptyfs_img_fence_get(img, &d, i / EMPTYFS_IMG_DGRP, &fence);
+            if (e || fence != de.hash)
+                CHECK_ERR(ck, "%s: bad fence of group %u", path, i / EMPTYFS_IMG_DGRP);
+        }
+
+        if (memchr(name, '/', namlen) != NULL || !strcmp(name, ".") || !strcmp(name, ".."))
+            CHECK_ERR(ck, "%s: illegal name", sub);
+        if (type != ip.type)
+            CHECK_ERR(ck, "%s: type %u mismatches inode type %u", sub, type, ip.type);
+        if (ip.parent != dino && ip.type == EMPTYFS_IMG_DIR)
+            CHECK_ERR(ck, "%s: parent %" PRIu64 " isn't %" PRIu64, sub, ip.parent, dino);
+
+        /* the kext resolves names this way  make sure it finds this very entry */
+        e = emptyfs_img_lookup(img, &d, name, namlen, &found);
+        if (e || found != de.ino)
+            CHECK_ERR(ck, "%s: lookup gives %" PRIu64 "  errno: %d", sub, found, e);
+
+        if (ck->visits[de.ino - EMPTYFS_IMG_ROOT_INO]++ != 0) {
+            /* hard links  only for regular files */
+            if (ip.type == EMPTYFS_IMG_DIR) CHECK_ERR(ck, "%s: directory linked twice", sub);
+            continue;
+        }
+
+        if (ip.type == EMPTYFS_IMG_DIR) {
+            check_dir(ck, de.ino, sub);
+        } else {
+            ck->nfiles++;
+            check_file(ck, de.ino, &ip);
+        }
+    }
+}
+
+/**
+ * Verify every block against the tree  i.e. what the kext does lazily
+ */
+static void check_tree(const struct emptyfs_img *img, struct check *ck)
+{
+    char *buf = malloc(CAT_BUFSZ), scratch[EMPTYFS_IMG_BSIZE];
+    char root[2 * EMPTYFS_SHA256_LEN + 1];
+    const uint64_t chunk = CAT_BUFSZ >> EMPTYFS_IMG_BSHIFT;
+    struct emptyfs_vt vt;
+    uint64_t blk, n, bad, nbad = 0;
+    int e;
+
+    e = emptyfs_vt_open(&vt, img);
+    if (e) {
+        CHECK_ERR(ck, "bad verity descriptor  errno: %d", e);
+        free(buf);
+        return;
+    }
+    vt.done = calloc(emptyfs_vt_map_size(&vt), 1);
+    if (buf == NULL || vt.done == NULL) {
+        LOG_ERR("malloc(3) fail  blocks: %" PRIu64, img->sb.nblocks);
+        exit(1);
+    }
+    claim(ck, vt.tree_blk, vt.nblk, 0, 0);
+
+    e = emptyfs_vt_verify_sb(&vt, img, scratch);
+    if (e) CHECK_ERR(ck, "superblock fails verification  errno: %d", e);
+
+    /* a bad block is reported  and skipped */
+    for (blk = 1; e == 0 && blk < vt.tree_blk; blk += n) {
+        n = vt.tree_blk - blk < chunk ? vt.tree_blk - blk : chunk;
+        e = img->read(img->ctx, blk << EMPTYFS_IMG_BSHIFT, buf, (size_t) (n << EMPTYFS_IMG_BSHIFT));
+        while (e == 0) {
+            e = emptyfs_vt_verify_run(&vt, blk, n, buf, scratch, &bad);
+            if (e != EIO) break;
+            CHECK_ERR(ck, "block %" PRIu64 " fails verification", bad);
+            nbad++;
+            emptyfs_vt_mark(&vt, bad);
+            e = 0;
+        }
+        if (e) CHECK_ERR(ck, "blocks %" PRIu64 "+%" PRIu64 " unreadable  errno: %d", blk, n, e);
+    }
+
+    /* every tree block is on the path of some block */
+    for (blk = vt.tree_blk; e == 0 && nbad == 0 && blk < vt.tree_blk + vt.nblk; blk++) {
+        if (!emptyfs_vt_done(&vt, blk)) CHECK_ERR(ck, "tree block %" PRIu64 " unreferenced", blk);
+    }
+
+    LOG("tree:  %" PRIu64 " blocks hashed  %u level(s)  root %s",
+            vt.nhashed, vt.levels, hash_str(vt.root, root));
+
+    free(vt.done);
+    free(buf);
+}
+
+/**
+ * @return      number of errors
+ */
+static unsigned long do_check(const struct emptyfs_img *img)
+{
+    const struct emptyfs_img_sb *sb = &img->sb;
+    struct emptyfs_img_inode ip;
+    struct check ck;
+    uint64_t i;
+
+    memset(&ck, 0, sizeof(ck));
+    ck.img = img;
+    ck.visits = calloc(sb->ninodes, sizeof(*ck.visits));
+    ck.used = calloc((sb->nblocks + 7) / 8, 1);
+    ck.data = calloc((sb->nblocks + 7) / 8, 1);
+    if (ck.visits == NULL || ck.used == NULL || ck.data == NULL) {
+        LOG_ERR("calloc(3) fail  inodes: %" PRIu64 " blocks: %" PRIu64,
+                    sb->ninodes, sb->nblocks);
+        exit(1);
+    }
+
+    claim(&ck, 0, 1, 0, 0);
+    claim(&ck, sb->itab_blk, emptyfs_img_blocks(sb->ninodes * EMPTYFS_IMG_INODE_SIZE), 0, 0);
+    claim(&ck, sb->xtab_blk,
+            emptyfs_img_blocks(sb->nextents * sizeof(struct emptyfs_img_extent)), 0, 0);
+
+    if (sb->features & EMPTYFS_IMG_F_VERITY) check_tree(img, &ck);
+
+    ck.visits[0] = 1;
+    check_dir(&ck, EMPTYFS_IMG_ROOT_INO, "");
+
+    for (i = 0; i < sb->ninodes; i++) {
+        if (ck.visits[i] == 0) {
+            CHECK_ERR(&ck, "inode %" PRIu64 " unreachable", i + EMPTYFS_IMG_ROOT_INO);
+        } else if (i != 0 && emptyfs_img_iget(img, i + EMPTYFS_IMG_ROOT_INO, &ip) == 0 &&
+                    ip.type == EMPTYFS_IMG_REG && ip.nlink != ck.visits[i]) {
+            CHECK_ERR(&ck, "inode %" PRIu64 " nlink %u  yet %u link(s)",
+                        i + EMPTYFS_IMG_ROOT_INO, ip.nlink, ck.visits[i]);
+        }
+    }
+
+    if (ck.ndirs != sb->ndirs || ck.nfiles != sb->nfiles) {
+        CHECK_ERR(&ck, "superblock says %" PRIu64 " dirs %" PRIu64 " files  "
+                    "found %" PRIu64 " dirs %" PRIu64 " files",
+                    sb->ndirs, sb->nfiles, ck.ndirs, ck.nfiles);
+    }
+
+    LOG("check: %" PRIu64 " dirs %" PRIu64 " files(%" PRIu64 " compressed) "
+            "%" PRIu64 "/%" PRIu64 " blocks(%" PRIu64 " shared refs)  %lu error(s)",
+            ck.ndirs, ck.nfiles, ck.nzfiles, ck.nblocks, sb->nblocks, ck.nshared, ck.err);
+
+    free(ck.visits);
+    free(ck.used);
+    free(ck.data);
+    return ck.err;
+}
+
+int main(int argc, char *argv[])
+{
+    int ch;
+    int fd;
+    int e;
+    const char *cmd;
+    struct emptyfs_img img;
+
+    while ((ch = getopt(argc, argv, "vh")) != -1) {
+        switch (ch) {
+        case 'v':
+            fprintf(stderr, "%s version %s\nbuilt date %s %s\n\n",
+                    basename(argv[0]), IMG_EMPTYFS_VERSION, __DATE__, __TIME__);
+            exit(0);
+        case 'h':
+        case '?':
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (argc - optind < 2) usage(argv[0]);
+    cmd = argv[optind];
+
+    if (img_open(argv[optind+1], &fd, &img) != 0) exit(1);
+
+    if (!strcmp(cmd, "info") && argc - optind == 2) {
+        e = do_info(&img);
+    } else if (!strcmp(cmd, "ls") && argc - optind <= 3) {
+        e = do_ls(&img, argc - optind == 3 ? argv[optind+2] : "/");
+    } else if (!strcmp(cmd, "find") && argc - optind == 2) {
+        e = do_find(&img, EMPTYFS_IMG_ROOT_INO, ".") != 0;
+    } else if (!strcmp(cmd, "cat") && argc - optind == 3) {
+        e = do_cat(&img, argv[optind+2]);
+    } else if (!strcmp(cmd, "check") && argc - optind == 2) {
+        e = do_check(&img) != 0;
+    } else {
+        usage(argv[0]);
+    }
+
+    (void) close(fd);
+    return e != 0;
+}
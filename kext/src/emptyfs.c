@@ -10,6 +10,9 @@
 #include "utils.h"
 #include "emptyfs_vfsops.h"
 #include "emptyfs_vnops.h"
+#include "emptyfs_stat.h"
+#include "emptyfs_prof.h"
+#include "emptyfs_trace.h"
 
 /*
  * this struct describe overall VFS plugin
@@ -53,6 +56,15 @@ kern_return_t emptyfs_start(kmod_info_t *ki, void *d __unused)
     }
     LOG_DBG("lock group(%s) allocated", LCKGRP_NAME);
 
+    /* not fatal  allocations just go to _MALLOC() directly */
+    (void) util_mcache_init(lckgrp);
+    emptyfs_stat_init();
+    /* not fatal  mounts just bypass the pool */
+    (void) emptyfs_mount_pool_init();
+    /* not fatal  only profiling/tracing is disabled */
+    (void) emptyfs_prof_init();
+    (void) emptyfs_trace_init();
+
     e = vfs_fsadd(&emptyfs_vfsentry, &emptyfs_vfstbl_ref);
     if (e != 0) {
         LOG_ERR("vfs_fsadd() failure  errno: %d", e);
@@ -67,6 +79,11 @@ out_exit:
     return e;
 
 out_vfsadd:
+    emptyfs_trace_fini();
+    emptyfs_prof_fini();
+    emptyfs_mount_pool_fini();
+    emptyfs_stat_fini();
+    util_mcache_fini();
     lck_grp_free(lckgrp);
 
 out_lckgrp:
@@ -85,6 +102,11 @@ kern_return_t emptyfs_stop(kmod_info_t *ki __unused, void *d __unused)
         goto out_vfs_rm;
     }
 
+    emptyfs_trace_fini();
+    emptyfs_prof_fini();
+    emptyfs_mount_pool_fini();
+    emptyfs_stat_fini();
+    util_mcache_fini();
     lck_grp_free(lckgrp);
 
     util_massert();
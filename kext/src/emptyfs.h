@@ -53,6 +53,23 @@ readonly_extern lck_grp_t *lckgrp;
 /* The largest 32-bit De Bruijn constant */
 #define EMPTYFS_MNTARG_MAGIC        0x0fb9ac52
 
+/*
+ * Mount options(emptyfs_mnt_args.flags)
+ *  EMPTYFS_MNT_NAMECACHE: let VFS name cache serve lookups(negative ones too)
+ *  EMPTYFS_MNT_RAMFS: writable in-memory volume instead of synthetic namespace
+ *  EMPTYFS_MNT_PINROOT: create root vnode at mount and keep it till unmount
+ */
+#define EMPTYFS_MNT_NAMECACHE       0x00000001
+#define EMPTYFS_MNT_RAMFS           0x00000002
+#define EMPTYFS_MNT_PINROOT         0x00000004
+#define EMPTYFS_MNT_KNOWN_FLAGS     (EMPTYFS_MNT_NAMECACHE | EMPTYFS_MNT_RAMFS | EMPTYFS_MNT_PINROOT)
+
+/* ramfs capacity if emptyfs_mnt_args.ram_mb is zero */
+#define EMPTYFS_RAM_MB_DEFAULT      1024
+
+/* decompressed-block cache of an image if emptyfs_mnt_args.cache_mb is zero */
+#define EMPTYFS_IMG_CACHE_MB_DEFAULT    16
+
 /*
  * This structure is passed from userspace mount(2)
  *  tells the kernel and our VFS plugin what and how to mount
@@ -73,8 +90,21 @@ struct emptyfs_mnt_args {
     const char *dev_node_path;
 #endif
     uint32_t magic;         /* must be EMPTYFS_MNTARG_MAGIC */
-    uint32_t dbg_mode;      /* enable debug for verbose output */
+    uint32_t dbg_mode;      /* enable debug  i.e. binary tracing of vnops */
     uint32_t force_fail;    /* if non-zero  mount(2) will always fail */
+    /*
+     * synthetic namespace  all zeros gives an empty root directory
+     * see: emptyfs_synth.h
+     */
+    uint32_t fanout;        /* sub-directories per directory */
+    uint32_t depth;         /* levels of sub-directories */
+    uint32_t files;         /* regular files per directory */
+    uint32_t seed;          /* perturbs file sizes and times */
+    uint32_t flags;         /* mount options  see EMPTYFS_MNT_* */
+    uint32_t ram_mb;        /* ramfs capacity in MiB  zero for default */
+    uint32_t cache_mb;      /* decompressed-block cache of an image in MiB  zero for default */
+    /* Merkle root an image must carry  all zeros accepts any(or none) */
+    uint8_t root[32];
 };
 
 #endif /* __EMPTYFS_H */
@@ -0,0 +1,95 @@
+/*
+ * Created 261018
+ */
+
+#include <sys/types.h>
+#include <sys/vnode.h>
+#include <string.h>
+
+#include "emptyfs_attr.h"
+
+/*
+ * Where a template field lives in both structures
+ */
+struct attr_field {
+    uint64_t bit;
+    uint16_t va_off;
+    uint16_t tmpl_off;
+    uint16_t size;
+};
+
+#define ATTR_FIELD(f) {                                     \
+    VNODE_ATTR_ ## f,                                       \
+    (uint16_t) __builtin_offsetof(struct vnode_attr, f),    \
+    (uint16_t) __builtin_offsetof(struct emptyfs_attr, f),  \
+    (uint16_t) sizeof(((struct emptyfs_attr *) 0)->f),      \
+}
+
+static const struct attr_field attr_fields[] = {
+    ATTR_FIELD(va_rdev),
+    ATTR_FIELD(va_nlink),
+    ATTR_FIELD(va_total_size),
+    ATTR_FIELD(va_total_alloc),
+    ATTR_FIELD(va_data_size),
+    ATTR_FIELD(va_data_alloc),
+    ATTR_FIELD(va_iosize),
+    ATTR_FIELD(va_uid),
+    ATTR_FIELD(va_gid),
+    ATTR_FIELD(va_mode),
+    ATTR_FIELD(va_flags),
+    ATTR_FIELD(va_create_time),
+    ATTR_FIELD(va_access_time),
+    ATTR_FIELD(va_modify_time),
+    ATTR_FIELD(va_change_time),
+    ATTR_FIELD(va_fileid),
+    ATTR_FIELD(va_parentid),
+    ATTR_FIELD(va_fsid),
+};
+
+/**
+ * Copy attributes requested in va_active out of a template
+ *  fields not requested are left untouched  as VFS never looks at them
+ * all attributes in the template are marked supported  like VATTR_RETURN()
+ */
+void emptyfs_attr_fill(
+        const struct emptyfs_attr * __nonnull tmpl,
+        struct vnode_attr * __nonnull vap)
+{
+    uint64_t want;
+    const struct attr_field *f;
+    const char *src;
+    char *dst;
+
+    kassert_nonnull(tmpl);
+    kassert_nonnull(vap);
+
+    want = vap->va_active & tmpl->supported;
+
+    for (f = attr_fields; want != 0 && f < attr_fields + ARRAY_SIZE(attr_fields); f++) {
+        if (!(want & f->bit)) continue;
+        want &= ~f->bit;
+
+        src = (const char *) tmpl + f->tmpl_off;
+        dst = (char *) vap + f->va_off;
+        /* constant sizes let the compiler emit plain loads and stores */
+        switch (f->size) {
+        case 2:
+            memcpy(dst, src, 2);
+            break;
+        case 4:
+            memcpy(dst, src, 4);
+            break;
+        case 8:
+            memcpy(dst, src, 8);
+            break;
+        case 16:
+            memcpy(dst, src, 16);
+            break;
+        default:
+            memcpy(dst, src, f->size);
+            break;
+        }
+    }
+
+    vap->va_supported |= tmpl->supported;
+}
@@ -0,0 +1,55 @@
+/*
+ * Created 261018
+ *
+ * Prebuilt vnode attribute templates
+ *  attributes of an inode are computed once  when its vnode is attached
+ *  vnop_getattr then merely copies fields requested in va_active
+ */
+
+#ifndef __EMPTYFS_ATTR_H
+#define __EMPTYFS_ATTR_H
+
+#include <sys/vnode.h>
+#include "utils.h"
+
+#define EMPTYFS_ATTR_FIELD(f)   __typeof(((struct vnode_attr *) 0)->f) f
+
+/*
+ * Each field has exactly the same name and type as in struct vnode_attr
+ *  add a field here  and an entry in emptyfs_attr.c#attr_fields
+ */
+struct emptyfs_attr {
+    /* VNODE_ATTR_* bits the template holds */
+    uint64_t supported;
+
+    EMPTYFS_ATTR_FIELD(va_rdev);
+    EMPTYFS_ATTR_FIELD(va_nlink);
+    EMPTYFS_ATTR_FIELD(va_total_size);
+    EMPTYFS_ATTR_FIELD(va_total_alloc);
+    EMPTYFS_ATTR_FIELD(va_data_size);
+    EMPTYFS_ATTR_FIELD(va_data_alloc);
+    EMPTYFS_ATTR_FIELD(va_iosize);
+    EMPTYFS_ATTR_FIELD(va_uid);
+    EMPTYFS_ATTR_FIELD(va_gid);
+    EMPTYFS_ATTR_FIELD(va_mode);
+    EMPTYFS_ATTR_FIELD(va_flags);
+    EMPTYFS_ATTR_FIELD(va_create_time);
+    EMPTYFS_ATTR_FIELD(va_access_time);
+    EMPTYFS_ATTR_FIELD(va_modify_time);
+    EMPTYFS_ATTR_FIELD(va_change_time);
+    EMPTYFS_ATTR_FIELD(va_fileid);
+    EMPTYFS_ATTR_FIELD(va_parentid);
+    EMPTYFS_ATTR_FIELD(va_fsid);
+};
+
+/*
+ * Counterpart of VATTR_RETURN() for templates
+ */
+#define EMPTYFS_ATTR_SET(t, f, x) do {      \
+    (t)->f = (x);                           \
+    (t)->supported |= VNODE_ATTR_ ## f;     \
+} while (0)
+
+void emptyfs_attr_fill(const struct emptyfs_attr *, struct vnode_attr *);
+
+#endif /* __EMPTYFS_ATTR_H */
@@ -0,0 +1,193 @@
+/*
+ * Created 261018
+ *
+ * Bounded cache of decoded(e.g. decompressed) file blocks  CLOCK eviction
+ *  keyed by (id, lblk)  id names whatever blocks are numbered in(e.g. a file
+ *  or a compressed run)  slots are chained off a power-of-two bucket array
+ *  a hit sets the reference bit  the hand clears them on its way to a victim
+ *  i.e. a block survives as long as it's read once per revolution
+ *
+ * XXX:
+ *  this header is shared with userspace(see: bench_emptyfs/)
+ *  .: it must only depend on plain integer types
+ *  it does no locking  callers serialize every call  a hit's data stays
+ *  valid only until the next put  thus copy it out before unlocking
+ */
+
+#ifndef __EMPTYFS_BCACHE_H
+#define __EMPTYFS_BCACHE_H
+
+#ifdef KERNEL
+#include <sys/types.h>
+#include <string.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#endif
+
+#define EMPTYFS_BCACHE_NONE     0xffffffffU
+
+struct emptyfs_bcache_ops {
+    void *(*alloc)(size_t);
+    void (*free)(void *, size_t);
+};
+
+struct emptyfs_bcache_slot {
+    uint64_t id;            /* zero if free  .: callers never use it */
+    uint64_t lblk;
+    uint32_t next;          /* hash chain */
+    uint32_t ref;           /* CLOCK reference bit */
+};
+
+struct emptyfs_bcache {
+    struct emptyfs_bcache_ops ops;
+    struct emptyfs_bcache_slot *slot;
+    uint32_t *bucket;
+    char *data;             /* nslot blocks */
+    uint32_t nslot;
+    uint32_t mask;          /* buckets minus one */
+    uint32_t hand;
+    uint32_t bsize;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evicts;
+};
+
+static inline uint32_t emptyfs_bcache_hash(const struct emptyfs_bcache *c, uint64_t id, uint64_t lblk)
+{
+    uint64_t k = (id * 0x9e3779b97f4a7c15ULL) ^ lblk;
+    k ^= k >> 31;
+    k *= 0xbf58476d1ce4e5b9ULL;
+    return (uint32_t) (k >> 32) & c->mask;
+}
+
+static inline void emptyfs_bcache_fini(struct emptyfs_bcache *c)
+{
+    if (c->slot != NULL) c->ops.free(c->slot, (size_t) c->nslot * sizeof(*c->slot));
+    if (c->bucket != NULL) c->ops.free(c->bucket, ((size_t) c->mask + 1) * sizeof(*c->bucket));
+    if (c->data != NULL) c->ops.free(c->data, (size_t) c->nslot * c->bsize);
+    c->slot = NULL;
+    c->bucket = NULL;
+    c->data = NULL;
+}
+
+/**
+ * @nslot       blocks to cache  at least one
+ * @return      0 if success  -1 if out of memory(nothing to fini then)
+ */
+static inline int emptyfs_bcache_init(
+        struct emptyfs_bcache *c,
+        const struct emptyfs_bcache_ops *ops,
+        uint32_t nslot,
+        uint32_t bsize)
+{
+    uint32_t nb = 1, i;
+
+    memset(c, 0, sizeof(*c));
+    c->ops = *ops;
+    c->nslot = nslot != 0 ? nslot : 1;
+    c->bsize = bsize;
+
+    /* about one slot per bucket */
+    while (nb < c->nslot && nb < 0x80000000U) nb <<= 1;
+    c->mask = nb - 1;
+
+    c->slot = ops->alloc((size_t) c->nslot * sizeof(*c->slot));
+    c->bucket = ops->alloc((size_t) nb * sizeof(*c->bucket));
+    c->data = ops->alloc((size_t) c->nslot * bsize);
+    if (c->slot == NULL || c->bucket == NULL || c->data == NULL) {
+        emptyfs_bcache_fini(c);
+        return -1;
+    }
+
+    for (i = 0; i < nb; i++) c->bucket[i] = EMPTYFS_BCACHE_NONE;
+    for (i = 0; i < c->nslot; i++) {
+        c->slot[i].id = 0;
+        c->slot[i].next = EMPTYFS_BCACHE_NONE;
+        c->slot[i].ref = 0;
+    }
+
+    return 0;
+}
+
+static inline uint32_t emptyfs_bcache_find(
+        const struct emptyfs_bcache *c,
+        uint32_t b,
+        uint64_t id,
+        uint64_t lblk)
+{
+    uint32_t i;
+
+    for (i = c->bucket[b]; i != EMPTYFS_BCACHE_NONE; i = c->slot[i].next) {
+        if (c->slot[i].id == id && c->slot[i].lblk == lblk) break;
+    }
+    return i;
+}
+
+/**
+ * @return      data of the block  NULL if not cached
+ */
+static inline const char *emptyfs_bcache_get(struct emptyfs_bcache *c, uint64_t id, uint64_t lblk)
+{
+    uint32_t i = emptyfs_bcache_find(c, emptyfs_bcache_hash(c, id, lblk), id, lblk);
+
+    if (i == EMPTYFS_BCACHE_NONE) {
+        c->misses++;
+        return NULL;
+    }
+
+    c->hits++;
+    c->slot[i].ref = 1;
+    return c->data + (size_t) i * c->bsize;
+}
+
+static inline void emptyfs_bcache_unlink(struct emptyfs_bcache *c, uint32_t victim)
+{
+    const struct emptyfs_bcache_slot *v = &c->slot[victim];
+    uint32_t *pp = &c->bucket[emptyfs_bcache_hash(c, v->id, v->lblk)];
+
+    while (*pp != victim) pp = &c->slot[*pp].next;
+    *pp = v->next;
+}
+
+/**
+ * Cache a block  evicts one if full
+ * @src         bsize bytes  copied in
+ *
+ * a new block comes in unreferenced  .: a block read only once(e.g. by a
+ * sequential scan) goes before the hot ones
+ */
+static inline void emptyfs_bcache_put(
+        struct emptyfs_bcache *c,
+        uint64_t id,
+        uint64_t lblk,
+        const char *src)
+{
+    uint32_t b = emptyfs_bcache_hash(c, id, lblk);
+    uint32_t i;
+
+    /* raced with another reader of the same block */
+    if (emptyfs_bcache_find(c, b, id, lblk) != EMPTYFS_BCACHE_NONE) return;
+
+    while (c->slot[c->hand].ref) {
+        c->slot[c->hand].ref = 0;
+        if (++c->hand == c->nslot) c->hand = 0;
+    }
+    i = c->hand;
+    if (++c->hand == c->nslot) c->hand = 0;
+
+    if (c->slot[i].id != 0) {
+        emptyfs_bcache_unlink(c, i);
+        c->evicts++;
+    }
+
+    c->slot[i].id = id;
+    c->slot[i].lblk = lblk;
+    c->slot[i].ref = 0;
+    c->slot[i].next = c->bucket[b];
+    c->bucket[b] = i;
+    memcpy(c->data + (size_t) i * c->bsize, src, c->bsize);
+}
+
+#endif /* __EMPTYFS_BCACHE_H */
@@ -0,0 +1,251 @@
+/*
+ * Created 261018
+ *
+ * Directory name hash
+ *  an open-addressing(linear probing) table of (hash, len, name offset)
+ *  tuples  names themselves live in a separate contiguous name blob
+ *  a lookup hashes the name once  then only touches candidates whose
+ *  hash and length both match  thus no more linear scan of directory
+ *
+ * XXX:
+ *  this header is shared with userspace(see: bench_emptyfs/)
+ *  .: it must only depend on plain integer types
+ *
+ * Q: why not use cn_hash supplied by VFS?
+ *  the function behind cn_hash is private to VFS and isn't part of KPI
+ *  tables built ahead of time(e.g. by a userspace image builder)
+ *  can never agree with it  so we hash cn_nameptr/cn_namelen ourselves
+ */
+
+#ifndef __EMPTYFS_DIRHASH_H
+#define __EMPTYFS_DIRHASH_H
+
+#ifdef KERNEL
+#include <sys/types.h>
+#include <string.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#endif
+
+/* returned by emptyfs_dirhash_lookup() if name not found */
+#define EMPTYFS_DIRHASH_NONE        0xffffffffU
+
+/* table is at most half full  so probe sequences stay short */
+#define EMPTYFS_DIRHASH_LOAD_SHIFT  1
+
+/*
+ * an empty slot has zero length  :. names are never empty
+ */
+struct emptyfs_dirhash_slot {
+    uint32_t hash;
+    uint32_t len;
+    uint32_t off;       /* name offset in name blob */
+    uint32_t idx;       /* caller-defined entry index */
+};
+
+struct emptyfs_dirhash {
+    struct emptyfs_dirhash_slot *slot;
+    uint32_t mask;      /* number of slots minus one */
+    uint32_t count;     /* occupied slots */
+    const char *names;  /* name blob */
+};
+
+/**
+ * Load 8 bytes(unaligned) as a little-endian word
+ *  hash values must be identical between hosts :. they may be persisted
+ */
+static inline uint64_t emptyfs_dirhash_load64(const char *p)
+{
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    w = __builtin_bswap64(w);
+#endif
+    return w;
+}
+
+/**
+ * Load at most 7 trailing bytes as a little-endian word  zero padded
+ */
+static inline uint64_t emptyfs_dirhash_load_tail(const char *p, size_t n)
+{
+    uint64_t w = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) w |= (uint64_t) (uint8_t) p[i] << (i * 8);
+    return w;
+}
+
+/**
+ * Word-at-a-time hash of a name  the name needn't be NUL-terminated
+ * @return      32-bit hash value
+ */
+static inline uint32_t emptyfs_dirhash_name(const char *name, size_t len)
+{
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ ((uint64_t) len * 0xff51afd7ed558ccdULL);
+    size_t i;
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        h ^= emptyfs_dirhash_load64(name + i);
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 29;
+    }
+
+    if (i < len) {
+        h ^= emptyfs_dirhash_load_tail(name + i, len - i);
+        h *= 0xc4ceb9fe1a85ec53ULL;
+    }
+
+    h ^= h >> 32;
+    h *= 0xff51afd7ed558ccdULL;
+    return (uint32_t) (h ^ (h >> 29));
+}
+
+/**
+ * Length-bounded word-at-a-time name comparison
+ * @return      1 if equal  0 o.w.
+ */
+static inline int emptyfs_dirhash_equal(const char *a, const char *b, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        if (emptyfs_dirhash_load64(a + i) != emptyfs_dirhash_load64(b + i))
+            return 0;
+    }
+
+    return emptyfs_dirhash_load_tail(a + i, len - i) ==
+            emptyfs_dirhash_load_tail(b + i, len - i);
+}
+
+/**
+ * @return      number of slots needed for n names(always a power of 2)
+ */
+static inline uint32_t emptyfs_dirhash_nslot(uint32_t n)
+{
+    uint64_t want = (uint64_t) n << EMPTYFS_DIRHASH_LOAD_SHIFT;
+    uint32_t sz = 8;
+
+    while (sz < want && sz < (1U << 31)) sz <<= 1;
+    return sz;
+}
+
+/**
+ * Initialize a table over caller-allocated(zeroed) slots
+ * @nslot       must be a power of 2  see emptyfs_dirhash_nslot()
+ */
+static inline void emptyfs_dirhash_init(
+        struct emptyfs_dirhash *dh,
+        struct emptyfs_dirhash_slot *slot,
+        uint32_t nslot,
+        const char *names)
+{
+    dh->slot = slot;
+    dh->mask = nslot - 1;
+    dh->count = 0;
+    dh->names = names;
+}
+
+/**
+ * Insert a name  duplicates are NOT detected
+ * @return      0 if success  -1 if table is full(per load factor)
+ */
+static inline int emptyfs_dirhash_insert(
+        struct emptyfs_dirhash *dh,
+        uint32_t hash,
+        uint32_t len,
+        uint32_t off,
+        uint32_t idx)
+{
+    uint32_t i;
+
+    if (len == 0) return -1;
+    if (((uint64_t) dh->count + 1) << EMPTYFS_DIRHASH_LOAD_SHIFT >
+            (uint64_t) dh->mask + 1) {
+        return -1;
+    }
+
+    for (i = hash & dh->mask; dh->slot[i].len != 0; i = (i + 1) & dh->mask)
+        continue;
+
+    dh->slot[i].hash = hash;
+    dh->slot[i].len = len;
+    dh->slot[i].off = off;
+    dh->slot[i].idx = idx;
+    dh->count++;
+    return 0;
+}
+
+/**
+ * Look up a name  the name needn't be NUL-terminated
+ * @hash        emptyfs_dirhash_name(name, len)
+ * @return      entry index  EMPTYFS_DIRHASH_NONE if not found
+ */
+static inline uint32_t emptyfs_dirhash_lookup(
+        const struct emptyfs_dirhash *dh,
+        const char *name,
+        size_t len,
+        uint32_t hash)
+{
+    const struct emptyfs_dirhash_slot *s;
+    uint32_t i;
+
+    for (i = hash & dh->mask; ; i = (i + 1) & dh->mask) {
+        s = &dh->slot[i];
+        /* an empty slot terminates the probe sequence */
+        if (s->len == 0) break;
+        if (s->hash == hash && s->len == len &&
+                emptyfs_dirhash_equal(dh->names + s->off, name, len)) {
+            return s->idx;
+        }
+    }
+
+    return EMPTYFS_DIRHASH_NONE;
+}
+
+/**
+ * Remove a name  slots after it are shifted back(no tombstones)
+ *  so that probe sequences never grow with churn
+ * @hash        emptyfs_dirhash_name(name, len)
+ * @return      entry index of the removed name  EMPTYFS_DIRHASH_NONE if not found
+ *
+ * see: Knuth TAOCP Vol. 3  6.4 Algorithm R
+ */
+static inline uint32_t emptyfs_dirhash_remove(
+        struct emptyfs_dirhash *dh,
+        const char *name,
+        size_t len,
+        uint32_t hash)
+{
+    struct emptyfs_dirhash_slot *s;
+    uint32_t idx;
+    uint32_t i, j, k;
+
+    for (i = hash & dh->mask; ; i = (i + 1) & dh->mask) {
+        s = &dh->slot[i];
+        if (s->len == 0) return EMPTYFS_DIRHASH_NONE;
+        if (s->hash == hash && s->len == len &&
+                emptyfs_dirhash_equal(dh->names + s->off, name, len)) {
+            break;
+        }
+    }
+
+    idx = dh->slot[i].idx;
+    dh->count--;
+
+    for (j = i; ; ) {
+        dh->slot[i].len = 0;
+        do {
+            j = (j + 1) & dh->mask;
+            if (dh->slot[j].len == 0) return idx;
+            k = dh->slot[j].hash & dh->mask;
+            /* slot j stays if its home k lies cyclically in (i, j] */
+        } while (i <= j ? (i < k && k <= j) : (i < k || k <= j));
+        dh->slot[i] = dh->slot[j];
+        i = j;
+    }
+}
+
+#endif /* __EMPTYFS_DIRHASH_H */
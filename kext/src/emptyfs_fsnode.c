@@ -0,0 +1,590 @@
+/*
+ * Created 261018
+ *
+ * Sharded fsnode hash
+ *
+ * [design]
+ *  the hash is split into FSNODE_NSHARD shards  each with its own mutex
+ *  and sequence counter  the shard and bucket are both picked from inode hash
+ *
+ *  lookups are lock-free: readers walk a chain under the shard's sequence
+ *  counter and take the vnode with vnode_getwithvid()  falling back to
+ *  the locked slow path only if the snapshot is inconsistent  or the vnode
+ *  is missing(or being attached)
+ *
+ *  inserts are single-flight: the first thread missing an inode inserts an
+ *  attaching fsnode  others sleep on it until the vnode is created
+ *
+ *  fsnodes and bucket arrays are type-stable: once allocated they're never
+ *  given back to the system until unmount  thus a reader racing a removal
+ *  or a resize never dereferences freed memory
+ */
+
+#include <sys/vnode.h>
+#include <sys/mount.h>
+#include <libkern/OSAtomic.h>
+
+#include "emptyfs_fsnode.h"
+#include "emptyfs_vfsops.h"
+#include "emptyfs_vnops.h"
+#include "emptyfs.h"
+#include "utils.h"
+
+#define FSNODE_SHARD_BITS       6
+#define FSNODE_NSHARD           (1u << FSNODE_SHARD_BITS)
+#define FSNODE_BUCKETS_INIT     16u
+/* grow a shard if average length of its chains exceeds this */
+#define FSNODE_LOAD_MAX         2u
+
+struct fsnode_buckets {
+    /* previous bucket arrays  kept until unmount for lock-free readers */
+    struct fsnode_buckets *retired;
+    uint32_t mask;
+    struct emptyfs_fsnode *slot[];
+};
+
+struct emptyfs_fsnode_shard {
+    /* mutex lock used to serialize writers of this shard */
+    lck_mtx_t *mtx;
+    /* bumped around each modification of the chains */
+    util_seq_t seq;
+    /* number of fsnodes in the chains */
+    uint32_t count;
+    struct fsnode_buckets * volatile tbl;
+    /* unused fsnodes */
+    struct emptyfs_fsnode *freelist;
+} __attribute__((aligned(64)));     /* avoid false sharing */
+
+/*
+ * Fibonacci hashing  see: Knuth TAOCP vol.3 section 6.4
+ */
+static inline uint32_t fsnode_hash(uint64_t ino)
+{
+    return (uint32_t) ((ino * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+static inline struct emptyfs_fsnode_shard *fsnode_shard(
+        struct emptyfs_mount * __nonnull mntp,
+        uint32_t h)
+{
+    return &mntp->fsnode_shards[h & (FSNODE_NSHARD - 1)];
+}
+
+static inline struct emptyfs_fsnode **fsnode_bucket(
+        struct fsnode_buckets * __nonnull tbl,
+        uint32_t h)
+{
+    return &tbl->slot[(h >> FSNODE_SHARD_BITS) & tbl->mask];
+}
+
+static struct fsnode_buckets *fsnode_buckets_alloc(uint32_t n)
+{
+    struct fsnode_buckets *tbl;
+
+    kassert(n != 0);
+    kassert((n & (n - 1)) == 0);
+
+    tbl = util_malloc(sizeof(*tbl) + n * sizeof(tbl->slot[0]), M_ZERO);
+    if (tbl != NULL) tbl->mask = n - 1;
+    return tbl;
+}
+
+int emptyfs_fsnode_init(struct emptyfs_mount * __nonnull mntp)
+{
+    int e = 0;
+    uint32_t i;
+    struct emptyfs_fsnode_shard *sh;
+
+    kassert_nonnull(mntp);
+    kassert_null(mntp->fsnode_shards);
+
+    mntp->fsnode_shards = util_malloc(
+            FSNODE_NSHARD * sizeof(*mntp->fsnode_shards), M_ZERO);
+    if (mntp->fsnode_shards == NULL) {
+        e = ENOMEM;
+        goto out_exit;
+    }
+
+    for (i = 0; i < FSNODE_NSHARD; i++) {
+        sh = &mntp->fsnode_shards[i];
+
+        sh->mtx = lck_mtx_alloc_init(lckgrp, NULL);
+        if (sh->mtx == NULL) {
+            e = ENOMEM;
+            goto out_exit;
+        }
+
+        sh->tbl = fsnode_buckets_alloc(FSNODE_BUCKETS_INIT);
+        if (sh->tbl == NULL) {
+            e = ENOMEM;
+            goto out_exit;
+        }
+    }
+
+out_exit:
+    if (e) emptyfs_fsnode_fini(mntp);
+    return e;
+}
+
+/*
+ * XXX: call after vflush()  all vnodes must have been reclaimed
+ */
+void emptyfs_fsnode_fini(struct emptyfs_mount * __nonnull mntp)
+{
+    uint32_t i;
+    struct emptyfs_fsnode_shard *sh;
+    struct emptyfs_fsnode *fn;
+    struct fsnode_buckets *tbl;
+
+    kassert_nonnull(mntp);
+
+    if (mntp->fsnode_shards == NULL) return;
+
+    for (i = 0; i < FSNODE_NSHARD; i++) {
+        sh = &mntp->fsnode_shards[i];
+
+        kassertf(sh->count == 0, "shard %u has %u fsnodes left", i, sh->count);
+
+        while ((fn = sh->freelist) != NULL) {
+            sh->freelist = fn->next;
+            fn->magic = 0;
+            util_mfree(fn);
+        }
+
+        while ((tbl = sh->tbl) != NULL) {
+            sh->tbl = tbl->retired;
+            util_mfree(tbl);
+        }
+
+        if (sh->mtx != NULL) lck_mtx_free(sh->mtx, lckgrp);
+    }
+
+    util_mfree(mntp->fsnode_shards);
+    mntp->fsnode_shards = NULL;
+}
+
+/*
+ * Bring an fsnode hash back to what emptyfs_fsnode_init() left
+ *  so that a pooled mount skips lock and bucket allocations
+ * XXX: call after vflush()  all vnodes must have been reclaimed
+ * @return      0 if success  errno o.w.(hash must then be emptyfs_fsnode_fini()ed)
+ */
+int emptyfs_fsnode_reset(struct emptyfs_mount * __nonnull mntp)
+{
+    uint32_t i;
+    struct emptyfs_fsnode_shard *sh;
+    struct emptyfs_fsnode *fn;
+    struct fsnode_buckets *tbl;
+
+    kassert_nonnull(mntp);
+    kassert_nonnull(mntp->fsnode_shards);
+
+    for (i = 0; i < FSNODE_NSHARD; i++) {
+        sh = &mntp->fsnode_shards[i];
+
+        kassertf(sh->count == 0, "shard %u has %u fsnodes left", i, sh->count);
+
+        /* fsnodes of an idle mount are dead weight */
+        while ((fn = sh->freelist) != NULL) {
+            sh->freelist = fn->next;
+            fn->magic = 0;
+            util_mfree(fn);
+        }
+
+        /* no reader left  retired arrays can go */
+        while ((tbl = sh->tbl->retired) != NULL) {
+            sh->tbl->retired = tbl->retired;
+            util_mfree(tbl);
+        }
+
+        /* chains are all empty  yet a grown array is too large to keep */
+        if (sh->tbl->mask + 1 != FSNODE_BUCKETS_INIT) {
+            tbl = fsnode_buckets_alloc(FSNODE_BUCKETS_INIT);
+            if (tbl == NULL) return ENOMEM;
+            util_mfree(sh->tbl);
+            sh->tbl = tbl;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Double buckets of a shard  readers see either the old or new array
+ * failure is harmless  the chains merely grow longer
+ */
+static void fsnode_grow_locked(struct emptyfs_fsnode_shard * __nonnull sh)
+{
+    struct fsnode_buckets *old;
+    struct fsnode_buckets *tbl;
+    struct emptyfs_fsnode *fn;
+    struct emptyfs_fsnode **b;
+    uint32_t i;
+
+    lck_mtx_assert(sh->mtx, LCK_MTX_ASSERT_OWNED);
+
+    old = sh->tbl;
+    if (old->mask >= (UINT32_MAX >> (FSNODE_SHARD_BITS + 1))) return;
+
+    tbl = fsnode_buckets_alloc((old->mask + 1) << 1);
+    if (tbl == NULL) return;
+
+    util_seq_write_begin(&sh->seq);
+    for (i = 0; i <= old->mask; i++) {
+        while ((fn = old->slot[i]) != NULL) {
+            old->slot[i] = fn->next;
+            b = fsnode_bucket(tbl, fsnode_hash(fn->ino));
+            fn->next = *b;
+            *b = fn;
+        }
+    }
+    tbl->retired = old;
+    sh->tbl = tbl;
+    util_seq_write_end(&sh->seq);
+}
+
+static struct emptyfs_fsnode *fsnode_find_locked(
+        struct emptyfs_fsnode_shard * __nonnull sh,
+        uint32_t h,
+        uint64_t ino)
+{
+    struct emptyfs_fsnode *fn;
+
+    lck_mtx_assert(sh->mtx, LCK_MTX_ASSERT_OWNED);
+
+    for (fn = *fsnode_bucket(sh->tbl, h); fn != NULL; fn = fn->next) {
+        if (fn->ino == ino) break;
+    }
+
+    return fn;
+}
+
+/**
+ * Allocate an attaching fsnode and link it into the shard
+ * @return      NULL if out of memory
+ */
+static struct emptyfs_fsnode *fsnode_insert_locked(
+        struct emptyfs_mount * __nonnull mntp,
+        struct emptyfs_fsnode_shard * __nonnull sh,
+        uint32_t h,
+        uint64_t ino)
+{
+    struct emptyfs_fsnode *fn;
+    struct emptyfs_fsnode **b;
+
+    lck_mtx_assert(sh->mtx, LCK_MTX_ASSERT_OWNED);
+
+    fn = sh->freelist;
+    if (fn != NULL) {
+        kassert(fn->magic == EMPTYFS_FSNODE_MAGIC);
+        kassert(fn->ino == EMPTYFS_INO_NONE);
+        sh->freelist = fn->next;
+    } else {
+        fn = util_malloc(sizeof(*fn), M_ZERO);
+        if (fn == NULL) return NULL;
+        fn->magic = EMPTYFS_FSNODE_MAGIC;
+    }
+
+    fn->is_attaching = 1;
+    fn->is_waiting = 0;
+    fn->mntp = mntp;
+    fn->vp = NULLVP;
+    fn->vid = 0;
+    emptyfs_ra_reset(&fn->ra);
+
+    b = fsnode_bucket(sh->tbl, h);
+    util_seq_write_begin(&sh->seq);
+    fn->ino = ino;
+    fn->next = *b;
+    *b = fn;
+    util_seq_write_end(&sh->seq);
+
+    if (++sh->count > FSNODE_LOAD_MAX * (sh->tbl->mask + 1))
+        fsnode_grow_locked(sh);
+
+    return fn;
+}
+
+/*
+ * Unlink a fsnode from the shard and put it into the free list
+ */
+static void fsnode_remove_locked(
+        struct emptyfs_fsnode_shard * __nonnull sh,
+        struct emptyfs_fsnode * __nonnull fn)
+{
+    struct emptyfs_fsnode **pp;
+
+    lck_mtx_assert(sh->mtx, LCK_MTX_ASSERT_OWNED);
+
+    pp = fsnode_bucket(sh->tbl, fsnode_hash(fn->ino));
+    while (*pp != fn) {
+        kassert_nonnull(*pp);
+        pp = &(*pp)->next;
+    }
+
+    util_seq_write_begin(&sh->seq);
+    *pp = fn->next;
+    fn->ino = EMPTYFS_INO_NONE;
+    fn->vp = NULLVP;
+    fn->vid = 0;
+    fn->next = sh->freelist;
+    util_seq_write_end(&sh->seq);
+
+    sh->freelist = fn;
+    kassert(sh->count > 0);
+    sh->count--;
+}
+
+/**
+ * Lock-free fast path of emptyfs_fsnode_get()
+ * @return      0 if we got an io refcnt. on an attached vnode
+ *              EAGAIN o.w.  caller should fall back to the slow path
+ *
+ * vnodes are never freed back to the system  only recycled  and vid
+ *  changes on each recycle  .: vnode_getwithvid() over a stale snapshot
+ *  merely fails
+ */
+static int fsnode_get_fast(
+        struct emptyfs_fsnode_shard * __nonnull sh,
+        uint32_t h,
+        uint64_t ino,
+        vnode_t * __nonnull vpp)
+{
+    uint32_t seq;
+    struct emptyfs_fsnode *fn;
+    vnode_t vp = NULLVP;
+    uint32_t vid = 0;
+
+    seq = util_seq_read_begin(&sh->seq);
+    if (seq & 1) return EAGAIN;
+
+    for (fn = *fsnode_bucket(sh->tbl, h); fn != NULL; fn = fn->next) {
+        /* a concurrently recycled fsnode may lead us astray  bail out */
+        if (sh->seq != seq) return EAGAIN;
+        if (fn->ino == ino) {
+            vp = fn->vp;
+            vid = fn->vid;
+            break;
+        }
+    }
+
+    if (util_seq_read_retry(&sh->seq, seq) || vp == NULLVP)
+        return EAGAIN;
+
+    if (vnode_getwithvid(vp, vid) != 0)
+        return EAGAIN;
+
+    *vpp = vp;
+    return 0;
+}
+
+static int fsnode_create_vnode(
+        struct emptyfs_mount * __nonnull mntp,
+        struct emptyfs_fsnode * __nonnull fn,
+        const struct emptyfs_fsnode_args * __nonnull args,
+        vnode_t * __nonnull vpp)
+{
+    int e;
+    struct vnode_fsparam param;
+
+    param.vnfs_mp = mntp->mp;
+    param.vnfs_vtype = args->vtype;
+    param.vnfs_str = NULL;
+    param.vnfs_dvp = args->dvp;
+    param.vnfs_fsnode = fn;
+    param.vnfs_vops = emptyfs_vnop_p;
+    param.vnfs_markroot = args->ino == EMPTYFS_ROOT_INO;
+    param.vnfs_marksystem = 0;
+    param.vnfs_rdev = 0;        /* we don't support VBLK and VCHR */
+    param.vnfs_filesize = args->vtype == VDIR ? 0 : (off_t) fn->attr.va_data_size;
+    param.vnfs_cnp = args->cnp;
+    /*
+     * VNFS_NOCACHE: vnode_create() never enters the name  vnop_lookup() does
+     * VNFS_CANTCACHE: VFS name cache won't hold this vnode at all
+     */
+    param.vnfs_flags = VNFS_NOCACHE;
+    if (!(mntp->flags & EMPTYFS_MNT_NAMECACHE)) param.vnfs_flags |= VNFS_CANTCACHE;
+
+    e = vnode_create(VNCREATE_FLAVOR, sizeof(param), &param, vpp);
+    if (e == 0) {
+        kassert_nonnull(*vpp);
+        LOG_DBG("vnode_create() ok  ino: %llu vp: %p vid: %#x",
+                    args->ino, *vpp, vnode_vid(*vpp));
+    } else {
+        kassert_null(*vpp);
+        LOG_ERR("vnode_create() fail  ino: %llu errno: %d", args->ino, e);
+    }
+
+    return e;
+}
+
+/**
+ * Get vnode of an inode(will create if necessary)
+ * @return      0 if success  errno o.w.
+ *              resulting vnode has an io refcnt. which the caller is
+ *              responsible to release it via vnode_put()
+ */
+int emptyfs_fsnode_get(
+        struct emptyfs_mount * __nonnull mntp,
+        const struct emptyfs_fsnode_args * __nonnull args,
+        vnode_t * __nonnull vpp)
+{
+    int e;
+    int e2;
+    uint32_t h;
+    struct emptyfs_fsnode_shard *sh;
+    struct emptyfs_fsnode *fn;
+    vnode_t vp = NULLVP;
+    uint32_t vid;
+
+    kassert_nonnull(mntp);
+    kassert_nonnull(args);
+    kassert(args->ino != EMPTYFS_INO_NONE);
+    kassert_nonnull(args->make_attr);
+    kassert_nonnull(vpp);
+    kassert_null(*vpp);
+
+    h = fsnode_hash(args->ino);
+    sh = fsnode_shard(mntp, h);
+
+    e = fsnode_get_fast(sh, h, args->ino, &vp);
+    if (e == 0) goto out_exit;
+
+    /* slow path  the vnode is missing or being attached/reclaimed */
+    lck_mtx_lock(sh->mtx);
+
+    do {
+        kassert_null(vp);
+        lck_mtx_assert(sh->mtx, LCK_MTX_ASSERT_OWNED);
+
+        fn = fsnode_find_locked(sh, h, args->ino);
+        if (fn == NULL) {
+            fn = fsnode_insert_locked(mntp, sh, h, args->ino);
+            if (fn == NULL) {
+                e = ENOMEM;
+                break;
+            }
+            lck_mtx_unlock(sh->mtx);
+
+            /* nobody reads the template until fn->vp published */
+            e = args->make_attr(mntp, args->ino, &fn->attr);
+            if (e == 0) e = fsnode_create_vnode(mntp, fn, args, &vp);
+
+            lck_mtx_lock(sh->mtx);
+            kassert(fn->is_attaching);
+            fn->is_attaching = 0;
+            if (fn->is_waiting) {
+                fn->is_waiting = 0;     /* reset beforehand */
+                wakeup(fn);
+            }
+
+            if (e == 0) {
+                util_seq_write_begin(&sh->seq);
+                fn->vp = vp;
+                fn->vid = vnode_vid(vp);
+                util_seq_write_end(&sh->seq);
+                e2 = vnode_addfsref(vp);
+                kassertf(e2 == 0, "vnode_addfsref() fail  errno: %d", e2);
+            } else {
+                /* waiters(if any) will retry the attach by themselves */
+                fsnode_remove_locked(sh, fn);
+            }
+        } else if (fn->is_attaching) {
+            fn->is_waiting = 1;
+            (void) msleep(fn, sh->mtx, PINOD, NULL, NULL);
+            e = EAGAIN;
+        } else {
+            /* we already have a vnode  try get with vnode vid */
+            vp = fn->vp;
+            kassert_nonnull(vp);
+            vid = fn->vid;
+            lck_mtx_unlock(sh->mtx);
+
+            e = vnode_getwithvid(vp, vid);
+            if (e != 0) {
+                /*
+                 * the vnode has been reclaimed  likely between dropping
+                 *  the lock and calling the vnode_getwithvid()
+                 * .: we loop again to get updated vnode(hopefully)
+                 */
+                LOG_DBG("vnode_getwithvid() fail  errno: %d", e);
+                vp = NULLVP;                    /* loop invariant */
+                e = EAGAIN;
+            }
+
+            lck_mtx_lock(sh->mtx);              /* loop invariant */
+        }
+    } while (e == EAGAIN);
+
+    lck_mtx_unlock(sh->mtx);
+
+out_exit:
+    if (e == 0) {
+        kassert_nonnull(vp);
+        *vpp = vp;
+    } else {
+        kassert_null(vp);
+    }
+
+    return e;
+}
+
+/*
+ * Disassociate a vnode from its fsnode  called on reclaim
+ */
+void emptyfs_fsnode_detach(
+        struct emptyfs_mount * __nonnull mntp,
+        vnode_t __nonnull vp)
+{
+    int e;
+    struct emptyfs_fsnode *fn;
+    struct emptyfs_fsnode_shard *sh;
+
+    kassert_nonnull(mntp);
+    kassert_nonnull(vp);
+
+    fn = emptyfs_fsnode_from_vp(vp);
+    sh = fsnode_shard(mntp, fsnode_hash(fn->ino));
+
+    lck_mtx_lock(sh->mtx);
+
+    /*
+     * [sic]
+     * if `is_attaching' is set  vp of the fsnode will and must be NULL
+     *  if in such case  we just leave it alone
+     * that's expected behaviour if the system tries to reclaim the vnode
+     *  while other thread is in process of attaching it
+     */
+    if (fn->is_attaching) {
+        kassert_null(fn->vp);
+    }
+
+    if (fn->vp != NULLVP) {
+        kassert(fn->vp == vp);
+
+        e = vnode_removefsref(vp);
+        kassertf(e == 0, "vnode_removefsref() fail  errno: %d", e);
+
+        fsnode_remove_locked(sh, fn);
+    } else {
+        /* Do nothing  someone else beat this reclaim */
+    }
+
+    lck_mtx_unlock(sh->mtx);
+
+    vnode_clearfsnode(vp);
+}
+
+/*
+ * Get fsnode from a vnode of our file system
+ */
+struct emptyfs_fsnode *emptyfs_fsnode_from_vp(vnode_t __nonnull vp)
+{
+    struct emptyfs_fsnode *fn;
+    kassert_nonnull(vp);
+    fn = vnode_fsnode(vp);
+    kassert_nonnull(fn);
+    kassert(fn->magic == EMPTYFS_FSNODE_MAGIC);
+    kassert(fn->mntp == vfs_fsprivate(vnode_mount(vp)));
+    return fn;
+}
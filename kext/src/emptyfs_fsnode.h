@@ -0,0 +1,82 @@
+/*
+ * Created 261018
+ *
+ * Per-mount fsnode hash layer
+ *  maps inode numbers to (at most one) vnode per volume
+ */
+
+#ifndef __EMPTYFS_FSNODE_H
+#define __EMPTYFS_FSNODE_H
+
+#include <sys/mount.h>
+#include <sys/vnode.h>
+#include "emptyfs_attr.h"
+#include "emptyfs_ra.h"
+#include "utils.h"
+
+/* The third largest 32-bit De Bruijn constant */
+#define EMPTYFS_FSNODE_MAGIC    0x0fb9ac4b
+
+/* inode number zero never names a fsnode */
+#define EMPTYFS_INO_NONE        0
+/* traditionally inode number of root directory is 2 */
+#define EMPTYFS_ROOT_INO        2
+
+struct emptyfs_mount;
+struct emptyfs_fsnode_shard;
+
+struct emptyfs_fsnode {
+    /* must be EMPTYFS_FSNODE_MAGIC */
+    uint32_t magic;
+    /* true if someone is attaching a vnode to this fsnode */
+    uint8_t is_attaching;
+    /* true if someone is waiting for such an attach to complete */
+    uint8_t is_waiting;
+    /* hash chain(or free list if the fsnode is unused) */
+    struct emptyfs_fsnode *next;
+    /* backing mount of this fsnode */
+    struct emptyfs_mount *mntp;
+    /* EMPTYFS_INO_NONE if the fsnode is unused */
+    uint64_t ino;
+    /*
+     * the attached vnode
+     * we hold NO reference to this  you must reconfirm its existence each time
+     */
+    vnode_t vp;
+    /* vid of vp when it was attached  used by vnode_getwithvid() */
+    uint32_t vid;
+    /* attribute template  built before vp attached  immutable afterwards */
+    struct emptyfs_attr attr;
+    /* sequential read detector  only image files read ahead  see: emptyfs_vnop_read() */
+    struct emptyfs_ra ra;
+};
+
+/*
+ * Describes the vnode to create if an inode isn't in the hash yet
+ */
+struct emptyfs_fsnode_args {
+    uint64_t ino;
+    enum vtype vtype;
+    /* parent directory and name  both NULL if not created by a lookup */
+    vnode_t dvp;
+    struct componentname *cnp;
+    /*
+     * builds attribute template  only called if a vnode is to be created
+     *  its va_data_size gives the initial UBC size of a VREG vnode
+     * returns errno if the inode is gone(e.g. unlinked meanwhile)
+     */
+    int (*make_attr)(struct emptyfs_mount *, uint64_t, struct emptyfs_attr *);
+};
+
+int emptyfs_fsnode_init(struct emptyfs_mount *);
+void emptyfs_fsnode_fini(struct emptyfs_mount *);
+int emptyfs_fsnode_reset(struct emptyfs_mount *);
+
+int emptyfs_fsnode_get(struct emptyfs_mount *,
+                        const struct emptyfs_fsnode_args *,
+                        vnode_t *);
+void emptyfs_fsnode_detach(struct emptyfs_mount *, vnode_t);
+
+struct emptyfs_fsnode *emptyfs_fsnode_from_vp(vnode_t);
+
+#endif /* __EMPTYFS_FSNODE_H */
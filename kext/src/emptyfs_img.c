@@ -0,0 +1,649 @@
+/*
+ * Created 261018
+ *
+ * Kernel glue of image parser  see: emptyfs_img.h
+ *  metadata is read through buf cache of devvp  file data goes
+ *  straight to devvp via cluster IO  see: emptyfs_vnop_strategy()
+ *  compressed file data is decoded into a per-mount block cache instead
+ *  keyed by run rather than inode  thus files sharing a run(see:
+ *  EMPTYFS_IMG_F_DEDUP) share its decoded blocks too
+ *  with EMPTYFS_IMG_F_VERITY every block is verified on its first read
+ *  file data included  which then takes the buf cache path as well
+ */
+
+#include <sys/vnode.h>
+#include <sys/mount.h>
+#include <sys/buf.h>
+#include <sys/time.h>
+
+#include "emptyfs_img.h"
+#include "emptyfs_bcache.h"
+#include "emptyfs_vt.h"
+#include "emptyfs_fsnode.h"
+#include "emptyfs_vfsops.h"
+#include "emptyfs.h"
+#include "utils.h"
+
+static int img_vt_check(struct emptyfs_mount * __nonnull, uint64_t, const char * __nonnull);
+
+/**
+ * Read image bytes through buf cache of devvp
+ *  an image block is read as a whole  so a later read of it is a cache hit
+ * @verify      verify blocks against the tree if the image has one
+ */
+static int img_bread(
+        struct emptyfs_mount * __nonnull mntp,
+        uint64_t off,
+        void * __nonnull buf,
+        size_t len,
+        int verify)
+{
+    uint32_t devbsize = vfs_devblocksize(mntp->mp);
+    char *dst = (char *) buf;
+    buf_t bp;
+    uint64_t blk;
+    size_t boff, n;
+    int e;
+
+    while (len != 0) {
+        blk = off >> EMPTYFS_IMG_BSHIFT;
+        boff = (size_t) (off & (EMPTYFS_IMG_BSIZE - 1));
+        n = MIN(len, EMPTYFS_IMG_BSIZE - boff);
+
+        bp = NULL;
+        e = buf_meta_bread(mntp->devvp,
+                    (daddr64_t) (blk * (EMPTYFS_IMG_BSIZE / devbsize)),
+                    EMPTYFS_IMG_BSIZE, NOCRED, &bp);
+        if (e) {
+            LOG_ERR("buf_meta_bread() fail  blk: %llu errno: %d", blk, e);
+        } else if (verify && mntp->img_vt != NULL) {
+            e = img_vt_check(mntp, blk, (const char *) buf_dataptr(bp));
+        }
+        if (e == 0) memcpy(dst, (char *) buf_dataptr(bp) + boff, n);
+        /* released even if failed  o.w. the buf leaks busy */
+        if (bp != NULL) buf_brelse(bp);
+        if (e) return e;
+
+        dst += n;
+        off += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/**
+ * emptyfs_img_read_t of the parser  blocks are verified
+ */
+static int img_read(void *ctx, uint64_t off, void *buf, size_t len)
+{
+    return img_bread((struct emptyfs_mount *) ctx, off, buf, len, 1);
+}
+
+/**
+ * emptyfs_img_read_t of the verifier  which verifies tree blocks itself
+ */
+static int img_raw(void *ctx, uint64_t off, void *buf, size_t len)
+{
+    return img_bread((struct emptyfs_mount *) ctx, off, buf, len, 0);
+}
+
+static void *cache_alloc(size_t size)
+{
+    return util_malloc(size, M_WAITOK);
+}
+
+static void cache_free(void *p, size_t size)
+{
+    UNUSED(size);
+    util_mfree(p);
+}
+
+static const struct emptyfs_bcache_ops cache_ops = {
+    .alloc = cache_alloc,
+    .free = cache_free,
+};
+
+/**
+ * Set up decompressed-block cache  only images with compressed files need one
+ */
+static int img_cache_init(struct emptyfs_mount * __nonnull mntp, uint32_t mb)
+{
+    struct emptyfs_bcache *c;
+
+    if (mb == 0) mb = EMPTYFS_IMG_CACHE_MB_DEFAULT;
+
+    mntp->img_cache_lock = lck_mtx_alloc_init(lckgrp, NULL);
+    if (mntp->img_cache_lock == NULL) return ENOMEM;
+
+    c = util_malloc(sizeof(*c), M_WAITOK | M_ZERO);
+    if (c == NULL) return ENOMEM;
+
+    if (emptyfs_bcache_init(c, &cache_ops,
+            (uint32_t) MIN((uint64_t) mb << (20 - EMPTYFS_IMG_BSHIFT), UINT32_MAX),
+            EMPTYFS_IMG_BSIZE) != 0) {
+        util_mfree(c);
+        return ENOMEM;
+    }
+
+    mntp->img_cache = c;
+    return 0;
+}
+
+static void img_cache_fini(struct emptyfs_mount * __nonnull mntp)
+{
+    if (mntp->img_cache != NULL) {
+        LOG_DBG("image cache  hits: %llu misses: %llu evicts: %llu",
+                    mntp->img_cache->hits, mntp->img_cache->misses, mntp->img_cache->evicts);
+        emptyfs_bcache_fini(mntp->img_cache);
+        util_mfree(mntp->img_cache);
+        mntp->img_cache = NULL;
+    }
+
+    if (mntp->img_cache_lock != NULL) {
+        lck_mtx_free(mntp->img_cache_lock, lckgrp);
+        mntp->img_cache_lock = NULL;
+    }
+}
+
+/**
+ * Verify an image block on its first read  see: emptyfs_vt.h
+ *  tree blocks are verified by the walk  the parser never reads them
+ */
+static int img_vt_check(
+        struct emptyfs_mount * __nonnull mntp,
+        uint64_t blk,
+        const char * __nonnull data)
+{
+    struct emptyfs_vt *vt = mntp->img_vt;
+    uint8_t h[EMPTYFS_SHA256_LEN];
+    char *scratch;
+    int e;
+
+    if (blk >= vt->tree_blk || emptyfs_vt_done(vt, blk)) return 0;
+
+    emptyfs_sha256(data, EMPTYFS_IMG_BSIZE, h);
+    vt->nhashed++;
+
+    scratch = util_malloc(EMPTYFS_IMG_BSIZE, M_WAITOK);
+    if (scratch == NULL) return ENOMEM;
+    e = emptyfs_vt_verify(vt, blk, h, scratch);
+    util_mfree(scratch);
+
+    if (e) LOG_ERR("image block %llu fails verification  errno: %d", blk, e);
+    return e;
+}
+
+static void img_vt_fini(struct emptyfs_mount * __nonnull mntp)
+{
+    struct emptyfs_vt *vt = mntp->img_vt;
+
+    if (vt == NULL) return;
+
+    LOG_DBG("image tree  hashed: %llu bad: %llu", vt->nhashed, vt->nbad);
+    if (vt->done != NULL) util_mfree(vt->done);
+    util_mfree(vt);
+    mntp->img_vt = NULL;
+}
+
+static int root_is_zero(const uint8_t * __nonnull root)
+{
+    uint32_t i;
+    for (i = 0; i < EMPTYFS_SHA256_LEN; i++) {
+        if (root[i] != 0) return 0;
+    }
+    return 1;
+}
+
+/**
+ * Set up verification of an image  block 0 is verified right away
+ * @root        root the image must have  all zeros if any
+ * @return      0 if success  EAUTH if the root isn't the one wanted
+ *              errno o.w.  see: emptyfs_vt_open()
+ *
+ * the bitmap takes a bit per image block  i.e. 32 KiB per GiB of image
+ */
+static int img_vt_init(struct emptyfs_mount * __nonnull mntp, const uint8_t * __nonnull root)
+{
+    struct emptyfs_vt *vt;
+    char *scratch;
+    int e;
+
+    if (!(mntp->img->sb.features & EMPTYFS_IMG_F_VERITY)) {
+        if (root_is_zero(root)) return 0;
+        LOG_ERR("image has no Merkle tree  yet a root is wanted");
+        return EAUTH;
+    }
+
+    vt = util_malloc(sizeof(*vt), M_WAITOK | M_ZERO);
+    if (vt == NULL) return ENOMEM;
+
+    e = emptyfs_vt_open(vt, mntp->img);
+    /* emptyfs_vt_open() took the verifying reader of the parser */
+    vt->read = img_raw;
+    if (e) {
+        util_mfree(vt);
+        return e;
+    }
+    if (!root_is_zero(root) && memcmp(root, vt->root, EMPTYFS_SHA256_LEN)) {
+        LOG_ERR("image Merkle root mismatches the one wanted");
+        util_mfree(vt);
+        return EAUTH;
+    }
+
+    vt->done = util_malloc(emptyfs_vt_map_size(vt), M_WAITOK | M_ZERO);
+    scratch = util_malloc(EMPTYFS_IMG_BSIZE, M_WAITOK);
+    if (vt->done == NULL || scratch == NULL) {
+        e = ENOMEM;
+    } else {
+        e = emptyfs_vt_verify_sb(vt, mntp->img, scratch);
+        if (e) LOG_ERR("image superblock fails verification  errno: %d", e);
+    }
+    if (scratch != NULL) util_mfree(scratch);
+
+    /* blocks parsed so far are verified again as they're read */
+    mntp->img_vt = vt;
+    if (e) img_vt_fini(mntp);
+    return e;
+}
+
+/**
+ * Open the image on backing device of a mount
+ * @cache_mb    decompressed-block cache in MiB  zero for default
+ * @root        Merkle root the image must have  all zeros if any(or none)
+ * @return      0 if success  ENOENT if the device carries no image
+ *              errno o.w.  see: emptyfs_img_open() and img_vt_init()
+ *              mntp->img is only set if success
+ */
+int emptyfs_img_mount(
+        struct emptyfs_mount * __nonnull mntp,
+        uint32_t cache_mb,
+        const uint8_t * __nonnull root)
+{
+    struct emptyfs_img *img;
+    uint32_t devbsize;
+    int e;
+
+    kassert_nonnull(mntp);
+    kassert_nonnull(mntp->devvp);
+    kassert_null(mntp->img);
+    kassert_null(mntp->img_cache);
+    kassert_null(mntp->img_vt);
+    kassert_nonnull(root);
+
+    /* an image block must be whole device blocks */
+    devbsize = vfs_devblocksize(mntp->mp);
+    if (devbsize == 0 || devbsize > EMPTYFS_IMG_BSIZE || EMPTYFS_IMG_BSIZE % devbsize) {
+        LOG_ERR("device block size %u unsupported", devbsize);
+        return EINVAL;
+    }
+
+    img = util_malloc(sizeof(*img), M_WAITOK | M_ZERO);
+    if (img == NULL) return ENOMEM;
+
+    e = emptyfs_img_open(img, img_read, mntp);
+    /* the verifier reads through mntp->img */
+    if (e == 0) {
+        mntp->img = img;
+        e = img_vt_init(mntp, root);
+    }
+    if (e == 0 && (img->sb.features & EMPTYFS_IMG_F_LZ)) e = img_cache_init(mntp, cache_mb);
+    if (e) {
+        img_cache_fini(mntp);
+        img_vt_fini(mntp);
+        mntp->img = NULL;
+        util_mfree(img);
+        return e;
+    }
+
+    /* vfsop_root relies on it */
+    kassert(EMPTYFS_IMG_ROOT_INO == EMPTYFS_ROOT_INO);
+
+    LOG_DBG("image ready  blocks: %llu inodes: %llu extents: %llu cache: %u tree: %u",
+                img->sb.nblocks, img->sb.ninodes, img->sb.nextents,
+                mntp->img_cache != NULL ? mntp->img_cache->nslot : 0,
+                mntp->img_vt != NULL ? mntp->img_vt->levels : 0);
+
+    return 0;
+}
+
+/**
+ * Close image of a mount  no vnode may exist
+ *  safe to call on a mount without image
+ */
+void emptyfs_img_unmount(struct emptyfs_mount * __nonnull mntp)
+{
+    kassert_nonnull(mntp);
+
+    if (mntp->img == NULL) return;
+
+    /* the device may be rewritten once we're gone  never serve stale blocks */
+    if (mntp->devvp != NULL) (void) buf_invalidateblks(mntp->devvp, 0, 0, 0);
+
+    img_cache_fini(mntp);
+    img_vt_fini(mntp);
+    util_mfree(mntp->img);
+    mntp->img = NULL;
+}
+
+/**
+ * Override volume attributes built by emptyfs_init_attrs() with the image's
+ *  an image volume is static  thus they're never touched again
+ */
+void emptyfs_img_init_attrs(struct emptyfs_mount * __nonnull mntp)
+{
+    const struct emptyfs_img_sb *sb;
+    struct timespec ts;
+    uuid_string_t uuid;
+    char root[2 * EMPTYFS_SHA256_LEN + 1];
+    uint32_t i;
+
+    kassert_nonnull(mntp);
+    kassert_nonnull(mntp->img);
+    sb = &mntp->img->sb;
+
+    mntp->attr.f_objcount = sb->ninodes;
+    mntp->attr.f_filecount = sb->nfiles;
+    mntp->attr.f_dircount = sb->ndirs;
+    mntp->attr.f_maxobjcount = sb->ninodes;
+
+    kassert(mntp->attr.f_bsize == EMPTYFS_IMG_BSIZE);
+    mntp->attr.f_blocks = sb->nblocks;
+    mntp->attr.f_bfree = 0;
+    mntp->attr.f_bavail = 0;
+    mntp->attr.f_bused = sb->nblocks;
+    mntp->attr.f_files = sb->ninodes;
+    mntp->attr.f_ffree = 0;
+
+    ts.tv_sec = (__typeof(ts.tv_sec)) sb->mtime;
+    ts.tv_nsec = 0;
+    bcopy(&ts, &mntp->attr.f_create_time, sizeof(ts));
+    bcopy(&ts, &mntp->attr.f_modify_time, sizeof(ts));
+
+    /* an image keeps its identity across mounts */
+    kassert(sizeof(mntp->attr.f_uuid) == sizeof(sb->uuid));
+    bcopy(sb->uuid, mntp->attr.f_uuid, sizeof(sb->uuid));
+
+    /* the root names content as UUID names the volume  log both for pinning */
+    format_uuid_string(mntp->attr.f_uuid, uuid);
+    if (mntp->img_vt != NULL) {
+        for (i = 0; i < EMPTYFS_SHA256_LEN; i++)
+            (void) snprintf(root + 2 * i, 3, "%02x", mntp->img_vt->root[i]);
+        LOG_INF("image UUID: %s Merkle root: %s", uuid, root);
+    } else {
+        LOG_DBG("image UUID: %s", uuid);
+    }
+
+    kassert(EMPTYFS_IMG_VOLNAME_MAX <= sizeof(mntp->volname));
+    if (sb->volname[0] != '\0')
+        (void) strlcpy(mntp->volname, sb->volname, sizeof(mntp->volname));
+}
+
+/**
+ * Build attribute template of an image inode
+ *  used when a vnode is attached  and for each entry in vnop_getattrlistbulk
+ * @return      0 if success  errno o.w.(EIO if the inode is corrupt)
+ */
+int emptyfs_img_make_attr(
+        struct emptyfs_mount * __nonnull mntp,
+        uint64_t ino,
+        struct emptyfs_attr * __nonnull t)
+{
+    struct emptyfs_img_inode ip;
+    struct timespec ts;
+    uint64_t alloc;
+    int e;
+
+    kassert_nonnull(mntp);
+    kassert_nonnull(mntp->img);
+    kassert_nonnull(t);
+
+    e = emptyfs_img_iget(mntp->img, ino, &ip);
+    if (e) {
+        LOG_ERR("emptyfs_img_iget() fail  ino: %llu errno: %d", ino, e);
+        return e;
+    }
+
+    t->supported = 0;
+
+    EMPTYFS_ATTR_SET(t, va_rdev, 0);
+    EMPTYFS_ATTR_SET(t, va_nlink, ip.nlink);
+
+    /* no hole in an image  see: emptyfs_img.h */
+    alloc = emptyfs_img_blocks(ip.size) << EMPTYFS_IMG_BSHIFT;
+    EMPTYFS_ATTR_SET(t, va_data_size, ip.size);
+    EMPTYFS_ATTR_SET(t, va_total_size, ip.size);
+    EMPTYFS_ATTR_SET(t, va_data_alloc, alloc);
+    EMPTYFS_ATTR_SET(t, va_total_alloc, alloc);
+    EMPTYFS_ATTR_SET(t, va_iosize, mntp->attr.f_iosize);
+    EMPTYFS_ATTR_SET(t, va_flags, ip.flags);
+
+    EMPTYFS_ATTR_SET(t, va_uid, ip.uid);
+    EMPTYFS_ATTR_SET(t, va_gid, ip.gid);
+    EMPTYFS_ATTR_SET(t, va_mode,
+        (ip.type == EMPTYFS_IMG_DIR ? S_IFDIR : S_IFREG) | (ip.perm & ALLPERMS));
+
+    /* an image only keeps mtime */
+    ts.tv_sec = (__typeof(ts.tv_sec)) ip.mtime;
+    ts.tv_nsec = (__typeof(ts.tv_nsec)) ip.mtime_nsec;
+    EMPTYFS_ATTR_SET(t, va_create_time, ts);
+    EMPTYFS_ATTR_SET(t, va_access_time, ts);
+    EMPTYFS_ATTR_SET(t, va_modify_time, ts);
+    EMPTYFS_ATTR_SET(t, va_change_time, ts);
+
+    EMPTYFS_ATTR_SET(t, va_fileid, ino);
+    EMPTYFS_ATTR_SET(t, va_parentid, ip.parent);
+    EMPTYFS_ATTR_SET(t, va_fsid, mntp->devid);
+
+    return 0;
+}
+
+/**
+ * Get vnode of an image inode(will create if necessary)
+ * @dvp, @cnp   parent directory and name  both NULL if not from a lookup
+ * @return      0 if success  errno o.w.
+ *              resulting vnode has an io refcnt.
+ */
+int emptyfs_img_vget(
+        struct emptyfs_mount * __nonnull mntp,
+        uint64_t ino,
+        vnode_t dvp,
+        struct componentname *cnp,
+        vnode_t * __nonnull vpp)
+{
+    struct emptyfs_fsnode_args args;
+    struct emptyfs_img_inode ip;
+    int e;
+
+    kassert_nonnull(mntp);
+    kassert_nonnull(mntp->img);
+    kassert_nonnull(vpp);
+
+    /* a cache hit in most cases  make_attr reads it again only if attaching */
+    e = emptyfs_img_iget(mntp->img, ino, &ip);
+    if (e) return e;
+
+    args.ino = ino;
+    args.vtype = ip.type == EMPTYFS_IMG_DIR ? VDIR : VREG;
+    args.dvp = dvp;
+    args.cnp = cnp;
+    args.make_attr = emptyfs_img_make_attr;
+
+    return emptyfs_fsnode_get(mntp, &args, vpp);
+}
+
+/**
+ * Get a decoded block of a compressed file  through the block cache
+ * @dst         EMPTYFS_IMG_BSIZE bytes
+ * @zbuf        EMPTYFS_IMG_BSIZE bytes of scratch
+ *
+ * a block is cached by (first block of its run, lblk)  never zero since
+ *  block 0 is superblock  identical files of a deduplicated image hit alike
+ *
+ * decoding runs unlocked  two readers of a cold block may both decode it
+ *  which is cheaper than making one of them sleep on the other
+ */
+static int img_cache_read(
+        struct emptyfs_mount * __nonnull mntp,
+        uint64_t ino,
+        const struct emptyfs_img_inode * __nonnull ip,
+        uint64_t lblk,
+        char * __nonnull dst,
+        char * __nonnull zbuf)
+{
+    struct emptyfs_bcache *c = mntp->img_cache;
+    const char *hit;
+    int e;
+
+    lck_mtx_lock(mntp->img_cache_lock);
+    hit = emptyfs_bcache_get(c, ip->xt, lblk);
+    if (hit != NULL) memcpy(dst, hit, EMPTYFS_IMG_BSIZE);
+    lck_mtx_unlock(mntp->img_cache_lock);
+    if (hit != NULL) return 0;
+
+    e = emptyfs_img_zread(mntp->img, ip, lblk, dst, zbuf);
+    if (e) {
+        LOG_ERR("emptyfs_img_zread() fail  ino: %llu lblk: %llu errno: %d", ino, lblk, e);
+        return e;
+    }
+
+    lck_mtx_lock(mntp->img_cache_lock);
+    emptyfs_bcache_put(c, ip->xt, lblk, dst);
+    lck_mtx_unlock(mntp->img_cache_lock);
+
+    return 0;
+}
+
+/**
+ * Read a file range of a compressed file into a mapped buf
+ * @off         file offset
+ * @done        (OUT) bytes filled  past EOF reads as zeros
+ * @return      0 if success  errno o.w.
+ */
+int emptyfs_img_zstrategy(
+        struct emptyfs_mount * __nonnull mntp,
+        uint64_t ino,
+        const struct emptyfs_img_inode * __nonnull ip,
+        uint64_t off,
+        char * __nonnull addr,
+        size_t count,
+        size_t * __nonnull done)
+{
+    uint64_t nb = emptyfs_img_blocks(ip->size);
+    uint64_t lblk;
+    size_t boff, n;
+    char *blk, *zbuf;
+    int e = 0;
+
+    kassert_nonnull(mntp);
+    kassert_nonnull(mntp->img_cache);
+    kassert_nonnull(ip);
+    kassert_nonnull(addr);
+    kassert_nonnull(done);
+
+    /* both are a block  way too large for a kernel stack */
+    blk = util_malloc(EMPTYFS_IMG_BSIZE, M_WAITOK);
+    zbuf = util_malloc(EMPTYFS_IMG_BSIZE, M_WAITOK);
+    if (blk == NULL || zbuf == NULL) {
+        e = ENOMEM;
+        goto out_free;
+    }
+
+    *done = 0;
+    while (*done < count) {
+        lblk = (off + *done) >> EMPTYFS_IMG_BSHIFT;
+        boff = (size_t) ((off + *done) & (EMPTYFS_IMG_BSIZE - 1));
+        n = MIN(count - *done, EMPTYFS_IMG_BSIZE - boff);
+
+        if (lblk >= nb) {
+            memset(addr + *done, 0, count - *done);
+            *done = count;
+            break;
+        }
+
+        /* cluster IO is page aligned  thus whole blocks are decoded in place */
+        if (n == EMPTYFS_IMG_BSIZE) {
+            e = img_cache_read(mntp, ino, ip, lblk, addr + *done, zbuf);
+        } else {
+            e = img_cache_read(mntp, ino, ip, lblk, blk, zbuf);
+            if (e == 0) memcpy(addr + *done, blk + boff, n);
+        }
+        if (e) break;
+
+        *done += n;
+    }
+
+out_free:
+    if (blk != NULL) util_mfree(blk);
+    if (zbuf != NULL) util_mfree(zbuf);
+    return e;
+}
+
+/**
+ * Read a file range of an image with a Merkle tree into a mapped buf
+ *  data goes through buf cache of devvp like metadata  rather than
+ *  passed down as is  .: no page is ever mapped before its blocks verify
+ * @off         file offset
+ * @done        (OUT) bytes filled  past EOF reads as zeros
+ * @return      0 if success  EIO if a block fails verification  errno o.w.
+ */
+int emptyfs_img_vstrategy(
+        struct emptyfs_mount * __nonnull mntp,
+        uint64_t ino,
+        const struct emptyfs_img_inode * __nonnull ip,
+        uint64_t off,
+        char * __nonnull addr,
+        size_t count,
+        size_t * __nonnull done)
+{
+    uint64_t nb = emptyfs_img_blocks(ip->size);
+    uint64_t lblk, pblk, nblk, bad;
+    size_t boff, n;
+    char *scratch;
+    int e = 0;
+
+    kassert_nonnull(mntp);
+    kassert_nonnull(mntp->img_vt);
+    kassert_nonnull(ip);
+    kassert_nonnull(addr);
+    kassert_nonnull(done);
+
+    scratch = util_malloc(EMPTYFS_IMG_BSIZE, M_WAITOK);
+    if (scratch == NULL) return ENOMEM;
+
+    *done = 0;
+    while (*done < count) {
+        lblk = (off + *done) >> EMPTYFS_IMG_BSHIFT;
+        boff = (size_t) ((off + *done) & (EMPTYFS_IMG_BSIZE - 1));
+
+        if (lblk >= nb) {
+            memset(addr + *done, 0, count - *done);
+            *done = count;
+            break;
+        }
+
+        e = emptyfs_img_bmap(mntp->img, ip, lblk, &pblk, &nblk);
+        if (e) break;
+        n = (size_t) MIN((uint64_t) (count - *done), (nblk << EMPTYFS_IMG_BSHIFT) - boff);
+
+        /* cluster IO is page aligned  thus whole blocks are hashed in place  lanes at a time */
+        if (boff == 0 && n >= EMPTYFS_IMG_BSIZE) {
+            n &= ~((size_t) EMPTYFS_IMG_BSIZE - 1);
+            e = img_raw(mntp, pblk << EMPTYFS_IMG_BSHIFT, addr + *done, n);
+            if (e == 0) {
+                e = emptyfs_vt_verify_run(mntp->img_vt, pblk, n >> EMPTYFS_IMG_BSHIFT,
+                                            addr + *done, scratch, &bad);
+                if (e == EIO) LOG_ERR("image block %llu fails verification  ino: %llu", bad, ino);
+            }
+        } else {
+            n = MIN(n, EMPTYFS_IMG_BSIZE - boff);
+            e = img_read(mntp, (pblk << EMPTYFS_IMG_BSHIFT) + boff, addr + *done, n);
+        }
+        if (e) break;
+
+        *done += n;
+    }
+
+    util_mfree(scratch);
+    return e;
+}
@@ -0,0 +1,760 @@
+/*
+ * Created 261018
+ *
+ * Read-only on-disk image format  and its parser
+ *  an image is what the backing device of a volume carries  see: emptyfs_img.c
+ *  all integers are little-endian  addresses are in EMPTYFS_IMG_BSIZE blocks
+ *
+ * XXX:
+ *  this header is shared with userspace(see: img_emptyfs/)
+ *  .: it must only depend on plain integer types and errno values
+ *  the parser does no IO by itself  every read goes through a callback
+ *  thus the kext reads via buf cache of devvp  userspace via pread(2)
+ *
+ * [layout]
+ *  block 0         superblock  rest of the block is zero
+ *                  but a verity descriptor at EMPTYFS_IMG_VT_OFF if EMPTYFS_IMG_F_VERITY
+ *  itab_blk        inode table  EMPTYFS_IMG_INODE_SIZE bytes per inode
+ *                  entry i is inode number EMPTYFS_IMG_ROOT_INO + i
+ *                  i.e. root directory comes first
+ *  xtab_blk        extent table  extents of files which have more than one
+ *  elsewhere       directory tables and file data  all block aligned
+ *  vt.tree_blk     Merkle tree over all blocks before it  the image ends with it
+ *                  see: emptyfs_vt.h
+ *
+ *  a regular file is a list of extents sorted by logical block
+ *   they cover the file exactly  i.e. there is no hole in an image
+ *   a file of one extent(the usual case  builders lay files out
+ *   contiguously) keeps it inline in the inode  mapping it costs no read
+ *  a compressed file(EMPTYFS_IMG_I_LZ  needs EMPTYFS_IMG_F_LZ) is one run
+ *   index | block data
+ *   index is u64[nblocks + 1]  byte offsets from start of the run
+ *   block i is bytes [index[i], index[i + 1])  of its logical length(4K but
+ *   the last) it's stored as is  shorter it's compressed  see: emptyfs_lz.h
+ *   every block decodes alone  thus random reads stay cheap
+ *  with EMPTYFS_IMG_F_DEDUP data is content-addressed  i.e. a block(or a
+ *   compressed run) is stored once however many files hold it  extents of
+ *   several files(or of one) may point at the same blocks  and inodes of
+ *   identical compressed files at the same run  metadata is never shared
+ *  a directory table is a single run of blocks
+ *   header | fence[ngrp] | dirent[nent] | name records
+ *   dirents are sorted by hash  hash is emptyfs_dirhash_name()
+ *   fence[g] is hash of dirent g * EMPTYFS_IMG_DGRP  a lookup bisects the
+ *   fence  then a group of dirents  then reads name records of the hash
+ *   thus a cold lookup touches about 3 blocks however large the directory
+ *   a name record is [len u8][type u8][name]  not NUL-terminated
+ *   position of a dirent is its readdir position  :. seeking is O(1)
+ */
+
+#ifndef __EMPTYFS_IMG_H
+#define __EMPTYFS_IMG_H
+
+#ifdef KERNEL
+#include <sys/types.h>
+#include <sys/errno.h>
+#include <string.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#endif
+
+#include "emptyfs_dirhash.h"
+#include "emptyfs_lz.h"
+
+/* "EmFS" on disk */
+#define EMPTYFS_IMG_MAGIC           0x53466d45
+#define EMPTYFS_IMG_VERSION         1
+/* EMPTYFS_IMG_F_* bits  unknown ones refuse to mount */
+#define EMPTYFS_IMG_F_LZ            0x00000001  /* some files are compressed */
+#define EMPTYFS_IMG_F_DEDUP         0x00000002  /* file data blocks may be shared */
+#define EMPTYFS_IMG_F_VERITY        0x00000004  /* blocks are verified by a Merkle tree */
+#define EMPTYFS_IMG_FEATURES        \
+    (EMPTYFS_IMG_F_LZ | EMPTYFS_IMG_F_DEDUP | EMPTYFS_IMG_F_VERITY)
+
+#define EMPTYFS_IMG_BSHIFT          12
+#define EMPTYFS_IMG_BSIZE           (1U << EMPTYFS_IMG_BSHIFT)
+
+#define EMPTYFS_IMG_INODE_SIZE      64
+#define EMPTYFS_IMG_ROOT_INO        2
+#define EMPTYFS_IMG_NAME_MAX        255
+#define EMPTYFS_IMG_VOLNAME_MAX     32
+
+/* dirents per fence entry  i.e. a group is 4K of dirents */
+#define EMPTYFS_IMG_DGRP            256
+
+/* keep table offsets far from overflow */
+#define EMPTYFS_IMG_INO_MAX         (1ULL << 40)
+#define EMPTYFS_IMG_XT_MAX          (1ULL << 40)
+/* file blocks are 32-bit  see: struct emptyfs_img_extent */
+#define EMPTYFS_IMG_FILE_MAX        (1ULL << (32 + EMPTYFS_IMG_BSHIFT))
+/* offsets in a directory table are 32-bit */
+#define EMPTYFS_IMG_DIR_MAX         (1ULL << 32)
+
+enum {
+    EMPTYFS_IMG_REG = 1,
+    EMPTYFS_IMG_DIR = 2,
+};
+
+/* emptyfs_img_inode.iflags */
+#define EMPTYFS_IMG_I_INLINE        0x01    /* sole extent is {xt, 0, all blocks} */
+#define EMPTYFS_IMG_I_LZ            0x02    /* compressed run at xt */
+
+struct emptyfs_img_sb {
+    uint32_t magic;         /* EMPTYFS_IMG_MAGIC */
+    uint32_t version;       /* EMPTYFS_IMG_VERSION */
+    uint32_t bshift;        /* EMPTYFS_IMG_BSHIFT  the only one supported */
+    uint32_t features;
+    uint64_t nblocks;       /* image size */
+    uint64_t ninodes;
+    uint64_t ndirs;
+    uint64_t nfiles;        /* ndirs + nfiles == ninodes */
+    uint64_t itab_blk;
+    uint64_t xtab_blk;
+    uint64_t nextents;
+    int64_t mtime;          /* when the image was built  seconds since epoch */
+    uint8_t uuid[16];
+    char volname[EMPTYFS_IMG_VOLNAME_MAX];  /* UTF-8  NUL-padded */
+    uint32_t rsvd;
+    uint32_t cksum;         /* emptyfs_img_sb_cksum() */
+};
+
+/*
+ * Where the Merkle tree is  and its root hash  past the superblock in block 0
+ *  outside of sb.cksum  yet hashed(root zeroed) like any other block
+ *  .: the tree covers the superblock  and a bad root fails verification
+ */
+#define EMPTYFS_IMG_VT_OFF          256
+
+struct emptyfs_img_vt {
+    uint64_t tree_blk;      /* blocks [0, tree_blk) are covered */
+    uint32_t levels;
+    uint32_t rsvd;
+    uint8_t root[32];       /* SHA-256 of the top tree block */
+};
+
+struct emptyfs_img_inode {
+    uint8_t type;           /* EMPTYFS_IMG_REG or EMPTYFS_IMG_DIR */
+    uint8_t iflags;         /* EMPTYFS_IMG_I_* */
+    uint16_t perm;          /* permission bits only */
+    uint32_t nlink;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t flags;         /* chflags(2) flags  opaque to us */
+    uint32_t nxt;           /* extents in extent table  0 if inline(or empty) */
+    uint64_t parent;        /* root is its own parent */
+    uint64_t size;          /* bytes of directory table for a directory */
+    int64_t mtime;
+    uint32_t mtime_nsec;
+    uint32_t rsvd;
+    /*
+     * directory: first block of directory table
+     * inline file: first block of data
+     * compressed file: first block of the run
+     * o.w. index of first extent in extent table
+     */
+    uint64_t xt;
+};
+
+struct emptyfs_img_extent {
+    uint64_t pblk;
+    uint32_t lblk;
+    uint32_t nblk;
+};
+
+struct emptyfs_img_dirhdr {
+    uint32_t nent;
+    uint32_t ngrp;          /* nent / EMPTYFS_IMG_DGRP rounded up */
+    uint32_t names;         /* offset of name records in directory table */
+    uint32_t rsvd;
+};
+
+struct emptyfs_img_dirent {
+    uint32_t hash;
+    uint32_t name;          /* offset of name record  relative to hdr.names */
+    uint64_t ino;
+};
+
+/* compile-time size checks  on-disk layout must never change by accident */
+typedef char emptyfs_img_sb_size[sizeof(struct emptyfs_img_sb) == 136 ? 1 : -1];
+typedef char emptyfs_img_vt_size[sizeof(struct emptyfs_img_vt) == 48 ? 1 : -1];
+typedef char emptyfs_img_inode_size[
+        sizeof(struct emptyfs_img_inode) == EMPTYFS_IMG_INODE_SIZE ? 1 : -1];
+typedef char emptyfs_img_extent_size[sizeof(struct emptyfs_img_extent) == 16 ? 1 : -1];
+typedef char emptyfs_img_dirhdr_size[sizeof(struct emptyfs_img_dirhdr) == 16 ? 1 : -1];
+typedef char emptyfs_img_dirent_size[sizeof(struct emptyfs_img_dirent) == 16 ? 1 : -1];
+
+/* dirents start 16-byte aligned  right after the fence */
+#define EMPTYFS_IMG_DIRENT_OFF(ngrp)    \
+    (((uint64_t) sizeof(struct emptyfs_img_dirhdr) + 4ULL * (ngrp) + 15) & ~15ULL)
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define EMPTYFS_IMG_LE16(x)     __builtin_bswap16(x)
+#define EMPTYFS_IMG_LE32(x)     __builtin_bswap32(x)
+#define EMPTYFS_IMG_LE64(x)     __builtin_bswap64(x)
+#else
+#define EMPTYFS_IMG_LE16(x)     (x)
+#define EMPTYFS_IMG_LE32(x)     (x)
+#define EMPTYFS_IMG_LE64(x)     (x)
+#endif
+
+/*
+ * Convert between on-disk and host byte order in place
+ *  each is an involution  thus builders use them to encode too
+ */
+static inline void emptyfs_img_sb_swab(struct emptyfs_img_sb *sb)
+{
+    sb->magic = EMPTYFS_IMG_LE32(sb->magic);
+    sb->version = EMPTYFS_IMG_LE32(sb->version);
+    sb->bshift = EMPTYFS_IMG_LE32(sb->bshift);
+    sb->features = EMPTYFS_IMG_LE32(sb->features);
+    sb->nblocks = EMPTYFS_IMG_LE64(sb->nblocks);
+    sb->ninodes = EMPTYFS_IMG_LE64(sb->ninodes);
+    sb->ndirs = EMPTYFS_IMG_LE64(sb->ndirs);
+    sb->nfiles = EMPTYFS_IMG_LE64(sb->nfiles);
+    sb->itab_blk = EMPTYFS_IMG_LE64(sb->itab_blk);
+    sb->xtab_blk = EMPTYFS_IMG_LE64(sb->xtab_blk);
+    sb->nextents = EMPTYFS_IMG_LE64(sb->nextents);
+    sb->mtime = (int64_t) EMPTYFS_IMG_LE64((uint64_t) sb->mtime);
+    sb->rsvd = EMPTYFS_IMG_LE32(sb->rsvd);
+    sb->cksum = EMPTYFS_IMG_LE32(sb->cksum);
+}
+
+static inline void emptyfs_img_vt_swab(struct emptyfs_img_vt *vt)
+{
+    vt->tree_blk = EMPTYFS_IMG_LE64(vt->tree_blk);
+    vt->levels = EMPTYFS_IMG_LE32(vt->levels);
+    vt->rsvd = EMPTYFS_IMG_LE32(vt->rsvd);
+}
+
+static inline void emptyfs_img_inode_swab(struct emptyfs_img_inode *ip)
+{
+    ip->perm = EMPTYFS_IMG_LE16(ip->perm);
+    ip->nlink = EMPTYFS_IMG_LE32(ip->nlink);
+    ip->uid = EMPTYFS_IMG_LE32(ip->uid);
+    ip->gid = EMPTYFS_IMG_LE32(ip->gid);
+    ip->flags = EMPTYFS_IMG_LE32(ip->flags);
+    ip->nxt = EMPTYFS_IMG_LE32(ip->nxt);
+    ip->parent = EMPTYFS_IMG_LE64(ip->parent);
+    ip->size = EMPTYFS_IMG_LE64(ip->size);
+    ip->mtime = (int64_t) EMPTYFS_IMG_LE64((uint64_t) ip->mtime);
+    ip->mtime_nsec = EMPTYFS_IMG_LE32(ip->mtime_nsec);
+    ip->rsvd = EMPTYFS_IMG_LE32(ip->rsvd);
+    ip->xt = EMPTYFS_IMG_LE64(ip->xt);
+}
+
+static inline void emptyfs_img_extent_swab(struct emptyfs_img_extent *x)
+{
+    x->pblk = EMPTYFS_IMG_LE64(x->pblk);
+    x->lblk = EMPTYFS_IMG_LE32(x->lblk);
+    x->nblk = EMPTYFS_IMG_LE32(x->nblk);
+}
+
+static inline void emptyfs_img_dirhdr_swab(struct emptyfs_img_dirhdr *h)
+{
+    h->nent = EMPTYFS_IMG_LE32(h->nent);
+    h->ngrp = EMPTYFS_IMG_LE32(h->ngrp);
+    h->names = EMPTYFS_IMG_LE32(h->names);
+    h->rsvd = EMPTYFS_IMG_LE32(h->rsvd);
+}
+
+static inline void emptyfs_img_dirent_swab(struct emptyfs_img_dirent *de)
+{
+    de->hash = EMPTYFS_IMG_LE32(de->hash);
+    de->name = EMPTYFS_IMG_LE32(de->name);
+    de->ino = EMPTYFS_IMG_LE64(de->ino);
+}
+
+/**
+ * @sb          superblock in on-disk byte order
+ * @return      checksum of everything before the cksum field
+ */
+static inline uint32_t emptyfs_img_sb_cksum(const struct emptyfs_img_sb *sb)
+{
+    return emptyfs_dirhash_name((const char *) sb,
+                                __builtin_offsetof(struct emptyfs_img_sb, cksum));
+}
+
+/**
+ * @return      number of blocks covering bytes
+ */
+static inline uint64_t emptyfs_img_blocks(uint64_t bytes)
+{
+    return (bytes + EMPTYFS_IMG_BSIZE - 1) >> EMPTYFS_IMG_BSHIFT;
+}
+
+/**
+ * Read callback  reads exactly len bytes at byte offset off of the image
+ * @return      0 if success  errno o.w.
+ */
+typedef int (*emptyfs_img_read_t)(void *ctx, uint64_t off, void *buf, size_t len);
+
+/*
+ * An opened image  immutable after emptyfs_img_open()
+ *  thus the parser needs no locking
+ */
+struct emptyfs_img {
+    struct emptyfs_img_sb sb;       /* host byte order */
+    emptyfs_img_read_t read;
+    void *ctx;
+};
+
+/*
+ * An opened directory table  all offsets are bytes from image start
+ */
+struct emptyfs_img_dir {
+    uint64_t off;           /* the table */
+    uint64_t size;
+    uint64_t ents;          /* dirent array */
+    uint64_t names;         /* name records */
+    uint32_t nent;
+    uint32_t ngrp;
+};
+
+/**
+ * @return      1 if blocks [blk, blk + n) lie in the image  0 o.w.
+ *              block 0(superblock) never holds anything else
+ */
+static inline int emptyfs_img_range_ok(
+        const struct emptyfs_img_sb *sb,
+        uint64_t blk,
+        uint64_t n)
+{
+    return blk != 0 && blk <= sb->nblocks && n <= sb->nblocks - blk;
+}
+
+static inline int emptyfs_img_ino_ok(const struct emptyfs_img_sb *sb, uint64_t ino)
+{
+    return ino >= EMPTYFS_IMG_ROOT_INO && ino - EMPTYFS_IMG_ROOT_INO < sb->ninodes;
+}
+
+static inline int emptyfs_img_inode_ok(
+        const struct emptyfs_img_sb *sb,
+        const struct emptyfs_img_inode *ip)
+{
+    uint64_t nb = emptyfs_img_blocks(ip->size);
+
+    if (!emptyfs_img_ino_ok(sb, ip->parent)) return 0;
+
+    switch (ip->type) {
+    case EMPTYFS_IMG_DIR:
+        return ip->size >= sizeof(struct emptyfs_img_dirhdr) &&
+                ip->size < EMPTYFS_IMG_DIR_MAX &&
+                emptyfs_img_range_ok(sb, ip->xt, nb);
+    case EMPTYFS_IMG_REG:
+        if (ip->size > EMPTYFS_IMG_FILE_MAX) return 0;
+        /* data blocks are checked as they're read  see: emptyfs_img_zread() */
+        if (ip->iflags & EMPTYFS_IMG_I_LZ) {
+            return !(sb->features & EMPTYFS_IMG_F_LZ) ? 0 :
+                    !(ip->iflags & EMPTYFS_IMG_I_INLINE) && ip->nxt == 0 && nb != 0 &&
+                    emptyfs_img_range_ok(sb, ip->xt, emptyfs_img_blocks((nb + 1) * 8));
+        }
+        if (ip->iflags & EMPTYFS_IMG_I_INLINE)
+            return ip->nxt == 0 && emptyfs_img_range_ok(sb, ip->xt, nb);
+        /* an empty file has no extent */
+        if (nb == 0) return ip->nxt == 0;
+        return ip->nxt != 0 && ip->nxt <= nb && ip->xt <= sb->nextents &&
+                ip->nxt <= sb->nextents - ip->xt;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Get an inode
+ * @return      0 if success  ENOENT if no such inode number
+ *              EIO if the inode is corrupt  o.w. errno of read callback
+ */
+static inline int emptyfs_img_iget(
+        const struct emptyfs_img *img,
+        uint64_t ino,
+        struct emptyfs_img_inode *ip)
+{
+    const struct emptyfs_img_sb *sb = &img->sb;
+    uint64_t off;
+    int e;
+
+    if (!emptyfs_img_ino_ok(sb, ino)) return ENOENT;
+
+    off = (sb->itab_blk << EMPTYFS_IMG_BSHIFT) +
+            (ino - EMPTYFS_IMG_ROOT_INO) * EMPTYFS_IMG_INODE_SIZE;
+    e = img->read(img->ctx, off, ip, sizeof(*ip));
+    if (e) return e;
+
+    emptyfs_img_inode_swab(ip);
+    return emptyfs_img_inode_ok(sb, ip) ? 0 : EIO;
+}
+
+/**
+ * Validate superblock and root directory of an image
+ * @return      0 if success  ENOENT if there is no image at all(no magic)
+ *              EINVAL if the superblock is corrupt
+ *              ENOTSUP if it's a version(or feature) we don't know
+ *              o.w. errno of read callback or emptyfs_img_iget()
+ */
+static inline int emptyfs_img_open(
+        struct emptyfs_img *img,
+        emptyfs_img_read_t read,
+        void *ctx)
+{
+    struct emptyfs_img_sb *sb = &img->sb;
+    struct emptyfs_img_inode root;
+    int e;
+
+    img->read = read;
+    img->ctx = ctx;
+
+    e = read(ctx, 0, sb, sizeof(*sb));
+    if (e) return e;
+
+    if (EMPTYFS_IMG_LE32(sb->magic) != EMPTYFS_IMG_MAGIC) return ENOENT;
+    if (EMPTYFS_IMG_LE32(sb->cksum) != emptyfs_img_sb_cksum(sb)) return EINVAL;
+    emptyfs_img_sb_swab(sb);
+
+    if (sb->version != EMPTYFS_IMG_VERSION) return ENOTSUP;
+    if (sb->features & ~EMPTYFS_IMG_FEATURES) return ENOTSUP;
+    if (sb->bshift != EMPTYFS_IMG_BSHIFT) return ENOTSUP;
+
+    if (sb->ninodes == 0 || sb->ninodes > EMPTYFS_IMG_INO_MAX) return EINVAL;
+    if (sb->ndirs > sb->ninodes || sb->nfiles != sb->ninodes - sb->ndirs) return EINVAL;
+    if (sb->nextents > EMPTYFS_IMG_XT_MAX) return EINVAL;
+    if (!emptyfs_img_range_ok(sb, sb->itab_blk,
+            emptyfs_img_blocks(sb->ninodes * EMPTYFS_IMG_INODE_SIZE))) {
+        return EINVAL;
+    }
+    if (!emptyfs_img_range_ok(sb, sb->xtab_blk,
+            emptyfs_img_blocks(sb->nextents * sizeof(struct emptyfs_img_extent)))) {
+        return EINVAL;
+    }
+
+    sb->volname[EMPTYFS_IMG_VOLNAME_MAX - 1] = '\0';
+
+    e = emptyfs_img_iget(img, EMPTYFS_IMG_ROOT_INO, &root);
+    if (e) return e == ENOENT ? EINVAL : e;
+    if (root.type != EMPTYFS_IMG_DIR || root.parent != EMPTYFS_IMG_ROOT_INO)
+        return EINVAL;
+
+    return 0;
+}
+
+/**
+ * Get extent i of a file  validated against the image
+ */
+static inline int emptyfs_img_xget(
+        const struct emptyfs_img *img,
+        const struct emptyfs_img_inode *ip,
+        uint32_t i,
+        struct emptyfs_img_extent *x)
+{
+    const struct emptyfs_img_sb *sb = &img->sb;
+    uint64_t off;
+    int e;
+
+    off = (sb->xtab_blk << EMPTYFS_IMG_BSHIFT) +
+            (ip->xt + i) * sizeof(struct emptyfs_img_extent);
+    e = img->read(img->ctx, off, x, sizeof(*x));
+    if (e) return e;
+
+    emptyfs_img_extent_swab(x);
+    if (x->nblk == 0 || !emptyfs_img_range_ok(sb, x->pblk, x->nblk)) return EIO;
+    return 0;
+}
+
+/**
+ * Map a logical block of a regular file
+ * @lblk        must be less than emptyfs_img_blocks(ip->size)
+ * @pblk        (OUT) image block holding lblk
+ * @nblk        (OUT) blocks contiguous from there  never past EOF
+ * @return      0 if success  EINVAL if lblk out of range
+ *              EIO if extents are corrupt  o.w. errno of read callback
+ */
+static inline int emptyfs_img_bmap(
+        const struct emptyfs_img *img,
+        const struct emptyfs_img_inode *ip,
+        uint64_t lblk,
+        uint64_t *pblk,
+        uint64_t *nblk)
+{
+    struct emptyfs_img_extent x;
+    uint64_t nb = emptyfs_img_blocks(ip->size);
+    uint32_t lo, hi, mid;
+    int e;
+
+    if (ip->type != EMPTYFS_IMG_REG || lblk >= nb) return EINVAL;
+    /* compressed blocks have no device address */
+    if (ip->iflags & EMPTYFS_IMG_I_LZ) return EINVAL;
+
+    if (ip->iflags & EMPTYFS_IMG_I_INLINE) {
+        *pblk = ip->xt + lblk;
+        *nblk = nb - lblk;
+        return 0;
+    }
+
+    /* last extent starting at or before lblk */
+    lo = 0;
+    hi = ip->nxt;
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        e = emptyfs_img_xget(img, ip, mid, &x);
+        if (e) return e;
+        if (x.lblk <= lblk) lo = mid; else hi = mid;
+    }
+
+    e = emptyfs_img_xget(img, ip, lo, &x);
+    if (e) return e;
+    /* extents must cover the file exactly  see [layout] */
+    if (lblk < x.lblk || lblk - x.lblk >= x.nblk || (uint64_t) x.lblk + x.nblk > nb)
+        return EIO;
+
+    *pblk = x.pblk + (lblk - x.lblk);
+    *nblk = (uint64_t) x.lblk + x.nblk - lblk;
+    return 0;
+}
+
+/**
+ * Read and decode a logical block of a compressed file
+ * @lblk        must be less than emptyfs_img_blocks(ip->size)
+ * @dst         (OUT) EMPTYFS_IMG_BSIZE bytes  tail past EOF is zeroed
+ * @zbuf        EMPTYFS_IMG_BSIZE bytes of scratch
+ * @return      0 if success  EINVAL if lblk out of range
+ *              EIO if the run is corrupt  o.w. errno of read callback
+ */
+static inline int emptyfs_img_zread(
+        const struct emptyfs_img *img,
+        const struct emptyfs_img_inode *ip,
+        uint64_t lblk,
+        char *dst,
+        char *zbuf)
+{
+    uint64_t nb = emptyfs_img_blocks(ip->size);
+    uint64_t run = ip->xt << EMPTYFS_IMG_BSHIFT;
+    uint64_t end = img->sb.nblocks << EMPTYFS_IMG_BSHIFT;
+    uint64_t idx[2];
+    size_t raw, len, out;
+    int e;
+
+    if (!(ip->iflags & EMPTYFS_IMG_I_LZ) || lblk >= nb) return EINVAL;
+
+    e = img->read(img->ctx, run + lblk * 8, idx, sizeof(idx));
+    if (e) return e;
+    idx[0] = EMPTYFS_IMG_LE64(idx[0]);
+    idx[1] = EMPTYFS_IMG_LE64(idx[1]);
+
+    raw = lblk + 1 < nb ? EMPTYFS_IMG_BSIZE :
+            (size_t) (ip->size - (lblk << EMPTYFS_IMG_BSHIFT));
+    if (idx[0] < (nb + 1) * 8 || idx[1] < idx[0] || idx[1] - idx[0] > raw ||
+            idx[1] > end - run) {
+        return EIO;
+    }
+    len = (size_t) (idx[1] - idx[0]);
+
+    if (len == raw) {
+        e = img->read(img->ctx, run + idx[0], dst, raw);
+    } else {
+        e = img->read(img->ctx, run + idx[0], zbuf, len);
+        if (e == 0 && (emptyfs_lz_decompress((const uint8_t *) zbuf, len,
+                        (uint8_t *) dst, raw, &out) != 0 || out != raw)) {
+            e = EIO;
+        }
+    }
+    if (e) return e;
+
+    memset(dst + raw, 0, EMPTYFS_IMG_BSIZE - raw);
+    return 0;
+}
+
+/**
+ * Open directory table of a directory inode
+ * @return      0 if success  ENOTDIR if not a directory
+ *              EIO if the table is corrupt  o.w. errno of read callback
+ */
+static inline int emptyfs_img_opendir(
+        const struct emptyfs_img *img,
+        const struct emptyfs_img_inode *ip,
+        struct emptyfs_img_dir *d)
+{
+    struct emptyfs_img_dirhdr h;
+    int e;
+
+    if (ip->type != EMPTYFS_IMG_DIR) return ENOTDIR;
+
+    d->off = ip->xt << EMPTYFS_IMG_BSHIFT;
+    d->size = ip->size;
+
+    e = img->read(img->ctx, d->off, &h, sizeof(h));
+    if (e) return e;
+    emptyfs_img_dirhdr_swab(&h);
+
+    if (h.ngrp != (uint32_t) (((uint64_t) h.nent + EMPTYFS_IMG_DGRP - 1) / EMPTYFS_IMG_DGRP))
+        return EIO;
+
+    d->ents = EMPTYFS_IMG_DIRENT_OFF(h.ngrp);
+    d->names = h.names;
+    d->nent = h.nent;
+    d->ngrp = h.ngrp;
+
+    if (d->ents + (uint64_t) h.nent * sizeof(struct emptyfs_img_dirent) > d->names ||
+            d->names > d->size) {
+        return EIO;
+    }
+
+    d->ents += d->off;
+    d->names += d->off;
+    return 0;
+}
+
+/**
+ * Get dirent at position idx(must be less than d->nent)
+ */
+static inline int emptyfs_img_dirent_get(
+        const struct emptyfs_img *img,
+        const struct emptyfs_img_dir *d,
+        uint32_t idx,
+        struct emptyfs_img_dirent *de)
+{
+    int e;
+
+    e = img->read(img->ctx, d->ents + (uint64_t) idx * sizeof(*de), de, sizeof(*de));
+    if (e) return e;
+    emptyfs_img_dirent_swab(de);
+
+    /* record header must lie in the table */
+    if (!emptyfs_img_ino_ok(&img->sb, de->ino) ||
+            d->names + de->name + 2 > d->off + d->size) {
+        return EIO;
+    }
+    return 0;
+}
+
+/**
+ * Read name record of a dirent
+ * @name        (OUT) at least EMPTYFS_IMG_NAME_MAX + 1 bytes  NUL-terminated
+ * @namlen      (OUT) length of name
+ * @type        (OUT) EMPTYFS_IMG_REG or EMPTYFS_IMG_DIR
+ */
+static inline int emptyfs_img_name_get(
+        const struct emptyfs_img *img,
+        const struct emptyfs_img_dir *d,
+        const struct emptyfs_img_dirent *de,
+        char *name,
+        uint32_t *namlen,
+        uint32_t *type)
+{
+    uint64_t off = d->names + de->name;
+    uint8_t rec[2];
+    int e;
+
+    e = img->read(img->ctx, off, rec, sizeof(rec));
+    if (e) return e;
+
+    if (rec[0] == 0 || off + 2 + rec[0] > d->off + d->size) return EIO;
+    if (rec[1] != EMPTYFS_IMG_REG && rec[1] != EMPTYFS_IMG_DIR) return EIO;
+
+    e = img->read(img->ctx, off + 2, name, rec[0]);
+    if (e) return e;
+
+    name[rec[0]] = '\0';
+    *namlen = rec[0];
+    *type = rec[1];
+    return 0;
+}
+
+static inline int emptyfs_img_fence_get(
+        const struct emptyfs_img *img,
+        const struct emptyfs_img_dir *d,
+        uint32_t g,
+        uint32_t *hash)
+{
+    uint64_t off = d->off + sizeof(struct emptyfs_img_dirhdr) + 4ULL * g;
+    int e;
+
+    e = img->read(img->ctx, off, hash, sizeof(*hash));
+    if (e == 0) *hash = EMPTYFS_IMG_LE32(*hash);
+    return e;
+}
+
+/**
+ * Look up a name in a directory table  the name needn't be NUL-terminated
+ * @ino         (OUT) inode number if found
+ * @return      0 if found  ENOENT if not
+ *              EIO if the table is corrupt  o.w. errno of read callback
+ *
+ * "." and ".." are never stored  callers resolve them
+ */
+static inline int emptyfs_img_lookup(
+        const struct emptyfs_img *img,
+        const struct emptyfs_img_dir *d,
+        const char *name,
+        size_t len,
+        uint64_t *ino)
+{
+    struct emptyfs_img_dirent de;
+    char buf[EMPTYFS_IMG_NAME_MAX + 1];
+    uint32_t h, f, lo, hi, mid, i;
+    uint32_t namlen, type;
+    int e;
+
+    if (len == 0 || len > EMPTYFS_IMG_NAME_MAX || d->nent == 0) return ENOENT;
+    h = emptyfs_dirhash_name(name, len);
+
+    /* number of groups which start below h */
+    lo = 0;
+    hi = d->ngrp;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        e = emptyfs_img_fence_get(img, d, mid, &f);
+        if (e) return e;
+        if (f < h) lo = mid + 1; else hi = mid;
+    }
+
+    /*
+     * first dirent of hash h(if any) is in the last of those groups
+     *  or it starts the next one  i.e. right past the range below
+     */
+    lo = lo == 0 ? 0 : (lo - 1) * EMPTYFS_IMG_DGRP;
+    hi = d->nent - lo > EMPTYFS_IMG_DGRP ? lo + EMPTYFS_IMG_DGRP : d->nent;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        e = emptyfs_img_dirent_get(img, d, mid, &de);
+        if (e) return e;
+        if (de.hash < h) lo = mid + 1; else hi = mid;
+    }
+
+    for (i = lo; i < d->nent; i++) {
+        e = emptyfs_img_dirent_get(img, d, i, &de);
+        if (e) return e;
+        if (de.hash != h) break;
+
+        e = emptyfs_img_name_get(img, d, &de, buf, &namlen, &type);
+        if (e) return e;
+        if (namlen == len && emptyfs_dirhash_equal(buf, name, len)) {
+            *ino = de.ino;
+            return 0;
+        }
+    }
+
+    return ENOENT;
+}
+
+#ifdef KERNEL
+#include <sys/vnode.h>
+#include "emptyfs_vfsops.h"
+#include "emptyfs_attr.h"
+
+int emptyfs_img_mount(struct emptyfs_mount *, uint32_t, const uint8_t *);
+void emptyfs_img_unmount(struct emptyfs_mount *);
+
+void emptyfs_img_init_attrs(struct emptyfs_mount *);
+int emptyfs_img_make_attr(struct emptyfs_mount *, uint64_t, struct emptyfs_attr *);
+
+int emptyfs_img_vget(struct emptyfs_mount *, uint64_t,
+                        vnode_t, struct componentname *, vnode_t *);
+
+int emptyfs_img_zstrategy(struct emptyfs_mount *, uint64_t,
+                        const struct emptyfs_img_inode *, uint64_t, char *, size_t, size_t *);
+int emptyfs_img_vstrategy(struct emptyfs_mount *, uint64_t,
+                        const struct emptyfs_img_inode *, uint64_t, char *, size_t, size_t *);
+#endif
+
+#endif /* __EMPTYFS_IMG_H */
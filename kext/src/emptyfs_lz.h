@@ -0,0 +1,252 @@
+/*
+ * Created 261018
+ *
+ * A byte-oriented LZ77 block codec  LZ4-like sequence format
+ *  meant for small blocks(image blocks are 4K)  no entropy coding
+ *  thus decoding is a loop of memcpy()s  well below device latency
+ *
+ * [format]
+ *  a block is a list of sequences
+ *   token u8           high nibble: literal length  low nibble: match length - 4
+ *   [255 ... n]        a nibble of 15 continues in bytes  summed up
+ *                      till a byte other than 255
+ *   literals
+ *   offset u16 LE      match distance  1 ~ 65535
+ *   [255 ... n]        extension of match length  as above
+ *  the last sequence ends after its literals  i.e. it has no match
+ *
+ * XXX:
+ *  this header is shared with userspace(see: mkfs_emptyfs/ bench_emptyfs/)
+ *  .: it must only depend on plain integer types
+ *  the decoder runs on untrusted(on-disk) input  every step is bounds-checked
+ *  the encoder is userspace-only in practice  its hash table is too large
+ *  for a kernel stack  callers pass one in
+ */
+
+#ifndef __EMPTYFS_LZ_H
+#define __EMPTYFS_LZ_H
+
+#ifdef KERNEL
+#include <sys/types.h>
+#include <string.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#endif
+
+#define EMPTYFS_LZ_MINMATCH     4
+/* offsets are 16-bit  so are positions in hash table */
+#define EMPTYFS_LZ_MAX_INPUT    65536
+#define EMPTYFS_LZ_HASH_BITS    12
+
+struct emptyfs_lz_enc {
+    uint16_t tab[1U << EMPTYFS_LZ_HASH_BITS];
+};
+
+static inline uint32_t emptyfs_lz_load32(const uint8_t *p)
+{
+    uint32_t w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+static inline uint32_t emptyfs_lz_hash(uint32_t w)
+{
+    /* Knuth's multiplicative hash  byte order doesn't matter here */
+    return (w * 2654435761U) >> (32 - EMPTYFS_LZ_HASH_BITS);
+}
+
+/**
+ * @return      bytes written at *op  0 if it wouldn't fit
+ */
+static inline size_t emptyfs_lz_put_len(uint8_t *op, uint8_t *oend, size_t n)
+{
+    uint8_t *p = op;
+
+    for (; n >= 255; n -= 255) {
+        if (p == oend) return 0;
+        *p++ = 255;
+    }
+    if (p == oend) return 0;
+    *p++ = (uint8_t) n;
+    return (size_t) (p - op);
+}
+
+/**
+ * Emit a sequence  mlen is zero for the last one
+ * @return      new output cursor  NULL if it wouldn't fit
+ */
+static inline uint8_t *emptyfs_lz_put_seq(
+        uint8_t *op,
+        uint8_t *oend,
+        const uint8_t *lit,
+        size_t llen,
+        uint32_t dist,
+        size_t mlen)
+{
+    uint8_t *tok;
+    size_t n, m;
+
+    if (op == oend) return NULL;
+    tok = op++;
+
+    n = llen >= 15 ? 15 : llen;
+    m = mlen == 0 ? 0 : mlen - EMPTYFS_LZ_MINMATCH;
+    m = m >= 15 ? 15 : m;
+    *tok = (uint8_t) ((n << 4) | m);
+
+    if (llen >= 15) {
+        n = emptyfs_lz_put_len(op, oend, llen - 15);
+        if (n == 0) return NULL;
+        op += n;
+    }
+    if ((size_t) (oend - op) < llen) return NULL;
+    memcpy(op, lit, llen);
+    op += llen;
+
+    if (mlen == 0) return op;
+
+    if (oend - op < 2) return NULL;
+    *op++ = (uint8_t) dist;
+    *op++ = (uint8_t) (dist >> 8);
+
+    if (mlen - EMPTYFS_LZ_MINMATCH >= 15) {
+        n = emptyfs_lz_put_len(op, oend, mlen - EMPTYFS_LZ_MINMATCH - 15);
+        if (n == 0) return NULL;
+        op += n;
+    }
+
+    return op;
+}
+
+/**
+ * Compress a block
+ * @n           at most EMPTYFS_LZ_MAX_INPUT
+ * @cap         output capacity  pass n - 1 to only accept a gain
+ * @return      compressed size  0 if it doesn't fit in cap
+ *
+ * greedy parsing  a miss skips faster the longer it lasts
+ *  .: incompressible data costs little
+ */
+static inline size_t emptyfs_lz_compress(
+        struct emptyfs_lz_enc *enc,
+        const uint8_t *src,
+        size_t n,
+        uint8_t *dst,
+        size_t cap)
+{
+    uint8_t *op = dst, *oend = dst + cap;
+    size_t ip = 0, anchor = 0, ref, len;
+    uint32_t h, w;
+
+    if (n > EMPTYFS_LZ_MAX_INPUT) return 0;
+
+    /* stale entries are harmless  every candidate is verified */
+    memset(enc->tab, 0, sizeof(enc->tab));
+
+    while (ip + EMPTYFS_LZ_MINMATCH <= n) {
+        w = emptyfs_lz_load32(src + ip);
+        h = emptyfs_lz_hash(w);
+        ref = enc->tab[h];
+        enc->tab[h] = (uint16_t) ip;
+
+        if (ref >= ip || emptyfs_lz_load32(src + ref) != w) {
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+
+        len = EMPTYFS_LZ_MINMATCH;
+        while (ip + len < n && src[ref + len] == src[ip + len]) len++;
+
+        op = emptyfs_lz_put_seq(op, oend, src + anchor, ip - anchor,
+                                (uint32_t) (ip - ref), len);
+        if (op == NULL) return 0;
+
+        ip += len;
+        anchor = ip;
+        /* let the next match start right behind this one */
+        if (ip - 2 + EMPTYFS_LZ_MINMATCH <= n)
+            enc->tab[emptyfs_lz_hash(emptyfs_lz_load32(src + ip - 2))] = (uint16_t) (ip - 2);
+    }
+
+    op = emptyfs_lz_put_seq(op, oend, src + anchor, n - anchor, 0, 0);
+    return op == NULL ? 0 : (size_t) (op - dst);
+}
+
+/**
+ * @return      0 if success  -1 if input ends midway
+ */
+static inline int emptyfs_lz_get_len(const uint8_t **ipp, const uint8_t *iend, size_t *n)
+{
+    const uint8_t *ip = *ipp;
+    uint8_t b;
+
+    do {
+        if (ip == iend) return -1;
+        b = *ip++;
+        *n += b;
+    } while (b == 255);
+
+    *ipp = ip;
+    return 0;
+}
+
+/**
+ * Decompress a block
+ * @cap         output capacity
+ * @out         (OUT) decompressed size
+ * @return      0 if success  -1 if input is corrupt(or doesn't fit in cap)
+ */
+static inline int emptyfs_lz_decompress(
+        const uint8_t *src,
+        size_t n,
+        uint8_t *dst,
+        size_t cap,
+        size_t *out)
+{
+    const uint8_t *ip = src, *iend = src + n;
+    uint8_t *op = dst, *oend = dst + cap;
+    const uint8_t *ref;
+    size_t llen, mlen, dist;
+    uint8_t tok;
+
+    for (;;) {
+        if (ip == iend) return -1;
+        tok = *ip++;
+
+        llen = tok >> 4;
+        if (llen == 15 && emptyfs_lz_get_len(&ip, iend, &llen) != 0) return -1;
+        if ((size_t) (iend - ip) < llen || (size_t) (oend - op) < llen) return -1;
+        memcpy(op, ip, llen);
+        ip += llen;
+        op += llen;
+
+        /* the last sequence */
+        if (ip == iend) break;
+
+        if (iend - ip < 2) return -1;
+        dist = (size_t) ip[0] | ((size_t) ip[1] << 8);
+        ip += 2;
+        if (dist == 0 || dist > (size_t) (op - dst)) return -1;
+
+        mlen = tok & 15;
+        if (mlen == 15 && emptyfs_lz_get_len(&ip, iend, &mlen) != 0) return -1;
+        mlen += EMPTYFS_LZ_MINMATCH;
+        if ((size_t) (oend - op) < mlen) return -1;
+
+        /* a match may overlap its own output  i.e. a run */
+        ref = op - dist;
+        if (dist >= mlen) {
+            memcpy(op, ref, mlen);
+            op += mlen;
+        } else {
+            while (mlen-- != 0) *op++ = *ref++;
+        }
+    }
+
+    *out = (size_t) (op - dst);
+    return 0;
+}
+
+#endif /* __EMPTYFS_LZ_H */
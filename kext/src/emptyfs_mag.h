@@ -0,0 +1,339 @@
+/*
+ * Created 261018
+ *
+ * Magazine object cache  one cache per object size
+ *  each CPU holds two magazines(loaded and previous) of free objects
+ *  a depot keeps full and empty magazines shared by all CPUs
+ *  the system allocator is only hit when both layers run dry(or overflow)
+ *
+ * see:
+ *  Bonwick, Adams  Magazines and Vmem(USENIX 2001)
+ *  xnu/osfmk/kern/zalloc.c  per-CPU caching of zones
+ *
+ * XXX:
+ *  this header is shared with userspace(see: bench_emptyfs/)
+ *  a kext can't disable preemption  .: per-CPU layer is guarded by a spinlock
+ *  which is uncontended unless a thread migrates midway
+ *  the system allocator is never called with any lock held
+ */
+
+#ifndef __EMPTYFS_MAG_H
+#define __EMPTYFS_MAG_H
+
+#ifdef KERNEL
+#include <sys/types.h>
+#include <kern/locks.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <sched.h>
+#endif
+
+/* objects per magazine  so that a magazine is 256 bytes on LP64 */
+#define EMPTYFS_MAG_ROUNDS      30
+
+/* full magazines a depot may hold  beyond that objects go back to system */
+#define EMPTYFS_MAG_DEPOT_MAX   16
+
+#ifdef KERNEL
+typedef lck_spin_t *emptyfs_mag_lock_t;
+typedef lck_grp_t *emptyfs_mag_grp_t;
+
+static inline int emptyfs_mag_lock_init(emptyfs_mag_lock_t *l, emptyfs_mag_grp_t grp)
+{
+    *l = lck_spin_alloc_init(grp, LCK_ATTR_NULL);
+    return *l != NULL ? 0 : -1;
+}
+
+static inline void emptyfs_mag_lock_destroy(emptyfs_mag_lock_t *l, emptyfs_mag_grp_t grp)
+{
+    if (*l != NULL) lck_spin_free(*l, grp);
+    *l = NULL;
+}
+
+static inline void emptyfs_mag_lock(emptyfs_mag_lock_t *l)
+{
+    lck_spin_lock(*l);
+}
+
+static inline void emptyfs_mag_unlock(emptyfs_mag_lock_t *l)
+{
+    lck_spin_unlock(*l);
+}
+#else
+typedef volatile uint32_t emptyfs_mag_lock_t;
+typedef void *emptyfs_mag_grp_t;
+
+static inline int emptyfs_mag_lock_init(emptyfs_mag_lock_t *l, emptyfs_mag_grp_t grp)
+{
+    (void) grp;
+    *l = 0;
+    return 0;
+}
+
+static inline void emptyfs_mag_lock_destroy(emptyfs_mag_lock_t *l, emptyfs_mag_grp_t grp)
+{
+    (void) l, (void) grp;
+}
+
+static inline void emptyfs_mag_lock(emptyfs_mag_lock_t *l)
+{
+    while (__atomic_exchange_n(l, 1, __ATOMIC_ACQUIRE)) {
+        /* holder may have been preempted  don't burn its time slice */
+        while (__atomic_load_n(l, __ATOMIC_RELAXED)) (void) sched_yield();
+    }
+}
+
+static inline void emptyfs_mag_unlock(emptyfs_mag_lock_t *l)
+{
+    __atomic_store_n(l, 0, __ATOMIC_RELEASE);
+}
+#endif
+
+struct emptyfs_mag {
+    struct emptyfs_mag *next;   /* link in depot */
+    uint32_t n;                 /* number of objects(rounds) held */
+    void *obj[EMPTYFS_MAG_ROUNDS];
+};
+
+/*
+ * Per-CPU layer  cache line aligned so that CPUs never share a line
+ *  either magazine can be NULL before first use
+ */
+struct emptyfs_mag_cpu {
+    emptyfs_mag_lock_t lock;
+    struct emptyfs_mag *loaded;
+    struct emptyfs_mag *prev;
+} __attribute__((aligned(64)));
+
+struct emptyfs_mag_cache {
+    size_t objsz;
+    uint32_t ncpu;
+    struct emptyfs_mag_cpu *cpu;        /* ncpu slots  caller-allocated */
+
+    emptyfs_mag_lock_t depot_lock;
+    struct emptyfs_mag *full;
+    struct emptyfs_mag *empty;
+    uint32_t nfull;
+
+    /* system allocator  flags are opaque(e.g. M_WAITOK in kernel) */
+    void *(*backend_alloc)(size_t, int);
+    void (*backend_free)(void *, size_t);
+    int nowait;         /* flags to allocate magazines without blocking */
+};
+
+static inline void emptyfs_mag_swap(struct emptyfs_mag_cpu *pc)
+{
+    struct emptyfs_mag *m = pc->loaded;
+    pc->loaded = pc->prev;
+    pc->prev = m;
+}
+
+/**
+ * Allocate an object  fall back to system allocator if no cached one
+ * @cpu         index of current CPU(any value is correct  it's a hint)
+ * @flags       passed to backend_alloc()
+ * @return      an object(not zeroed)  NULL if out of memory
+ */
+static inline void *emptyfs_mag_alloc(struct emptyfs_mag_cache *c, uint32_t cpu, int flags)
+{
+    struct emptyfs_mag_cpu *pc = &c->cpu[cpu % c->ncpu];
+    struct emptyfs_mag *m;
+    void *obj;
+
+    emptyfs_mag_lock(&pc->lock);
+    for (;;) {
+        if (pc->loaded != NULL && pc->loaded->n != 0) {
+            obj = pc->loaded->obj[--pc->loaded->n];
+            emptyfs_mag_unlock(&pc->lock);
+            return obj;
+        }
+
+        if (pc->prev != NULL && pc->prev->n != 0) {
+            emptyfs_mag_swap(pc);
+            continue;
+        }
+
+        /* both are empty  trade previous one for a full one in depot */
+        emptyfs_mag_lock(&c->depot_lock);
+        m = c->full;
+        if (m == NULL) {
+            emptyfs_mag_unlock(&c->depot_lock);
+            break;
+        }
+        c->full = m->next;
+        c->nfull--;
+        if (pc->prev != NULL) {
+            pc->prev->next = c->empty;
+            c->empty = pc->prev;
+        }
+        emptyfs_mag_unlock(&c->depot_lock);
+
+        pc->prev = pc->loaded;
+        pc->loaded = m;
+    }
+    emptyfs_mag_unlock(&pc->lock);
+
+    return c->backend_alloc(c->objsz, flags);
+}
+
+/**
+ * Free an object into cache  never blocks
+ * @cpu         index of current CPU(any value is correct  it's a hint)
+ */
+static inline void emptyfs_mag_free(struct emptyfs_mag_cache *c, uint32_t cpu, void *obj)
+{
+    struct emptyfs_mag_cpu *pc = &c->cpu[cpu % c->ncpu];
+    struct emptyfs_mag *m;
+    struct emptyfs_mag *spill;
+    uint32_t i;
+
+    emptyfs_mag_lock(&pc->lock);
+    for (;;) {
+        if (pc->loaded != NULL && pc->loaded->n < EMPTYFS_MAG_ROUNDS) {
+            pc->loaded->obj[pc->loaded->n++] = obj;
+            emptyfs_mag_unlock(&pc->lock);
+            return;
+        }
+
+        if (pc->prev != NULL && pc->prev->n < EMPTYFS_MAG_ROUNDS) {
+            emptyfs_mag_swap(pc);
+            continue;
+        }
+
+        /* both are full  trade previous one for an empty one in depot */
+        emptyfs_mag_lock(&c->depot_lock);
+        m = c->empty;
+        if (m == NULL) {
+            emptyfs_mag_unlock(&c->depot_lock);
+            emptyfs_mag_unlock(&pc->lock);
+
+            m = c->backend_alloc(sizeof(*m), c->nowait);
+            if (m == NULL) {
+                c->backend_free(obj, c->objsz);
+                return;
+            }
+            m->n = 0;
+
+            emptyfs_mag_lock(&c->depot_lock);
+            m->next = c->empty;
+            c->empty = m;
+            emptyfs_mag_unlock(&c->depot_lock);
+
+            /* per-CPU layer may have changed meanwhile  start over */
+            emptyfs_mag_lock(&pc->lock);
+            continue;
+        }
+        c->empty = m->next;
+
+        spill = NULL;
+        if (pc->prev != NULL) {
+            if (c->nfull < EMPTYFS_MAG_DEPOT_MAX) {
+                pc->prev->next = c->full;
+                c->full = pc->prev;
+                c->nfull++;
+            } else {
+                spill = pc->prev;
+            }
+        }
+        emptyfs_mag_unlock(&c->depot_lock);
+
+        pc->prev = pc->loaded;
+        pc->loaded = m;
+
+        if (spill != NULL) {
+            /* depot is saturated  return a magazine worth of objects to system */
+            emptyfs_mag_unlock(&pc->lock);
+            for (i = 0; i < spill->n; i++) c->backend_free(spill->obj[i], c->objsz);
+            spill->n = 0;
+
+            emptyfs_mag_lock(&c->depot_lock);
+            spill->next = c->empty;
+            c->empty = spill;
+            emptyfs_mag_unlock(&c->depot_lock);
+
+            emptyfs_mag_lock(&pc->lock);
+        }
+    }
+}
+
+static inline void emptyfs_mag_destroy(struct emptyfs_mag_cache *c, struct emptyfs_mag *m)
+{
+    uint32_t i;
+
+    if (m == NULL) return;
+    for (i = 0; i < m->n; i++) c->backend_free(m->obj[i], c->objsz);
+    c->backend_free(m, sizeof(*m));
+}
+
+/**
+ * Free all cached objects and magazines  locks are destroyed
+ *  must be called when no one can use the cache
+ */
+static inline void emptyfs_mag_fini(struct emptyfs_mag_cache *c, emptyfs_mag_grp_t grp)
+{
+    struct emptyfs_mag *m;
+    uint32_t i;
+
+    for (i = 0; i < c->ncpu; i++) {
+        emptyfs_mag_destroy(c, c->cpu[i].loaded);
+        emptyfs_mag_destroy(c, c->cpu[i].prev);
+        c->cpu[i].loaded = c->cpu[i].prev = NULL;
+        emptyfs_mag_lock_destroy(&c->cpu[i].lock, grp);
+    }
+
+    while ((m = c->full) != NULL) {
+        c->full = m->next;
+        emptyfs_mag_destroy(c, m);
+    }
+    while ((m = c->empty) != NULL) {
+        c->empty = m->next;
+        emptyfs_mag_destroy(c, m);
+    }
+    c->nfull = 0;
+
+    emptyfs_mag_lock_destroy(&c->depot_lock, grp);
+}
+
+/**
+ * Initialize a cache over caller-allocated(zeroed) per-CPU slots
+ * @return      0 if success  -1 o.w.(cache is left finalized)
+ */
+static inline int emptyfs_mag_init(
+        struct emptyfs_mag_cache *c,
+        size_t objsz,
+        struct emptyfs_mag_cpu *cpu,
+        uint32_t ncpu,
+        void *(*backend_alloc)(size_t, int),
+        void (*backend_free)(void *, size_t),
+        int nowait,
+        emptyfs_mag_grp_t grp)
+{
+    uint32_t i;
+
+    c->objsz = objsz;
+    c->ncpu = ncpu;
+    c->cpu = cpu;
+    c->full = c->empty = NULL;
+    c->nfull = 0;
+    c->backend_alloc = backend_alloc;
+    c->backend_free = backend_free;
+    c->nowait = nowait;
+
+    if (emptyfs_mag_lock_init(&c->depot_lock, grp) != 0) {
+        c->ncpu = 0;
+        return -1;
+    }
+
+    for (i = 0; i < ncpu; i++) {
+        if (emptyfs_mag_lock_init(&cpu[i].lock, grp) != 0) {
+            c->ncpu = i;
+            emptyfs_mag_fini(c, grp);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+#endif /* __EMPTYFS_MAG_H */
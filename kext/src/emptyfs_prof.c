@@ -0,0 +1,124 @@
+/*
+ * Created 261018
+ *
+ * Kernel side of per-op profiling  see: emptyfs_prof.h
+ */
+
+#include <sys/types.h>
+#include <sys/errno.h>
+#include <sys/sysctl.h>
+#include <kern/clock.h>
+
+#include "emptyfs_prof.h"
+#include "utils.h"
+
+/* raw allocation(unaligned) and per-CPU slots carved from it */
+static void *prof_mem = NULL;
+static struct emptyfs_prof_cpu *prof_cpu = NULL;
+static uint32_t prof_ncpu = 0;
+
+uint64_t emptyfs_prof_begin(void)
+{
+    return mach_absolute_time();
+}
+
+void emptyfs_prof_end(uint32_t op, uint64_t t0)
+{
+    uint64_t ns;
+
+    kassert(op < EMPTYFS_PROF_NOP);
+
+    /* profiling disabled  i.e. emptyfs_prof_init() failed */
+    if (unlikely(prof_cpu == NULL)) return;
+
+    absolutetime_to_nanoseconds(mach_absolute_time() - t0, &ns);
+    /* more CPUs than slots is tolerated  some slots get shared */
+    emptyfs_prof_record(&prof_cpu[(uint32_t) cpu_number() % prof_ncpu], op, ns);
+}
+
+/*
+ * Merge all per-CPU slots on read  writes are ignored
+ */
+static int sysctl_prof(SYSCTL_HANDLER_ARGS)
+{
+    int e;
+    struct emptyfs_prof_snap *snap;
+    uint32_t i;
+
+    UNUSED(oidp);
+    UNUSED(arg1);
+    UNUSED(arg2);
+
+    if (prof_cpu == NULL) return ENOENT;
+
+    /* too large for kernel stack */
+    snap = util_malloc(sizeof(*snap), M_WAITOK | M_ZERO);
+    if (snap == NULL) return ENOMEM;
+
+    snap->magic = EMPTYFS_PROF_MAGIC;
+    snap->nop = EMPTYFS_PROF_NOP;
+    snap->nbucket = EMPTYFS_PROF_NBUCKET;
+    snap->ncpu = prof_ncpu;
+    for (i = 0; i < prof_ncpu; i++) emptyfs_prof_merge(&snap->total, &prof_cpu[i]);
+
+    e = SYSCTL_OUT(req, snap, sizeof(*snap));
+    util_mfree(snap);
+    return e;
+}
+
+SYSCTL_DECL(_vfs_generic_emptyfs);
+
+SYSCTL_PROC(_vfs_generic_emptyfs, OID_AUTO, prof,
+        CTLTYPE_OPAQUE | CTLFLAG_RD | CTLFLAG_LOCKED,
+        NULL, 0, sysctl_prof, "S,emptyfs_prof_snap",
+        "per-op call counters and latency histograms");
+
+/**
+ * Must be called after emptyfs_stat_init()  which registers parent node
+ * @return      0 if success  errno o.w.(profiling stays disabled)
+ */
+int emptyfs_prof_init(void)
+{
+    int e;
+    uint32_t ncpu;
+    size_t sz;
+
+    kassert_null(prof_mem);
+
+    e = util_ncpu(&ncpu);
+    if (e != 0) return e;
+
+    /* slack for cache line alignment */
+    sz = (size_t) ncpu * sizeof(*prof_cpu) + __alignof__(*prof_cpu);
+    prof_mem = util_malloc(sz, M_WAITOK | M_ZERO);
+    if (prof_mem == NULL) {
+        LOG_ERR("util_malloc() fail  size: %zu", sz);
+        return ENOMEM;
+    }
+
+    prof_ncpu = ncpu;
+    prof_cpu = (struct emptyfs_prof_cpu *) (((uintptr_t) prof_mem +
+                    __alignof__(*prof_cpu) - 1) & ~(uintptr_t) (__alignof__(*prof_cpu) - 1));
+
+    sysctl_register_oid(&sysctl__vfs_generic_emptyfs_prof);
+
+    LOG_DBG("profiling %u op(s) over %u CPU slot(s)  %zu bytes",
+                EMPTYFS_PROF_NOP, prof_ncpu, sz);
+
+    return 0;
+}
+
+/**
+ * Must be called when no op can be in flight  i.e. after vfs_fsremove()
+ */
+void emptyfs_prof_fini(void)
+{
+    if (prof_mem == NULL) return;
+
+    sysctl_unregister_oid(&sysctl__vfs_generic_emptyfs_prof);
+
+    prof_cpu = NULL;
+    prof_ncpu = 0;
+    util_mfree(prof_mem);
+    prof_mem = NULL;
+}
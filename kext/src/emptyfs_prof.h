@@ -0,0 +1,211 @@
+/*
+ * Created 261018
+ *
+ * Per-op call counters and latency histograms
+ *  every vnop/vfsop is timed by a trampoline  see: EMPTYFS_PROF_CALL
+ *  each CPU has its own slot  thus recording never contends on a cache line
+ *  histograms are log2-bucketed over nanoseconds  bucket b holds [2^(b-1), 2^b)
+ *
+ * XXX:
+ *  this header is shared with userspace(see: emptyfsctl/ bench_emptyfs/)
+ *  .: it must only depend on plain integer types
+ */
+
+#ifndef __EMPTYFS_PROF_H
+#define __EMPTYFS_PROF_H
+
+#ifdef KERNEL
+#include <sys/types.h>
+#include <libkern/OSAtomic.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#endif
+
+/*
+ * X-macro of all profiled ops  append only  indexes are ABI
+ */
+#define EMPTYFS_PROF_OPS(X)                             \
+    X(VNOP_DEFAULT,             "vnop_default")         \
+    X(VNOP_LOOKUP,              "vnop_lookup")          \
+    X(VNOP_OPEN,                "vnop_open")            \
+    X(VNOP_CLOSE,               "vnop_close")           \
+    X(VNOP_GETATTR,             "vnop_getattr")         \
+    X(VNOP_READDIR,             "vnop_readdir")         \
+    X(VNOP_GETATTRLISTBULK,     "vnop_getattrlistbulk") \
+    X(VNOP_RECLAIM,             "vnop_reclaim")         \
+    X(VFSOP_MOUNT,              "vfsop_mount")          \
+    X(VFSOP_START,              "vfsop_start")          \
+    X(VFSOP_UNMOUNT,            "vfsop_unmount")        \
+    X(VFSOP_ROOT,               "vfsop_root")           \
+    X(VFSOP_GETATTR,            "vfsop_getattr")        \
+    X(VNOP_CREATE,              "vnop_create")          \
+    X(VNOP_MKDIR,               "vnop_mkdir")           \
+    X(VNOP_REMOVE,              "vnop_remove")          \
+    X(VNOP_RMDIR,               "vnop_rmdir")           \
+    X(VNOP_RENAME,              "vnop_rename")          \
+    X(VNOP_READ,                "vnop_read")            \
+    X(VNOP_WRITE,               "vnop_write")           \
+    X(VNOP_SETATTR,             "vnop_setattr")         \
+    X(VNOP_FSYNC,               "vnop_fsync")           \
+    X(VNOP_PAGEIN,              "vnop_pagein")          \
+    X(VNOP_PAGEOUT,             "vnop_pageout")         \
+    X(VNOP_BLOCKMAP,            "vnop_blockmap")        \
+    X(VNOP_STRATEGY,            "vnop_strategy")        \
+    X(VNOP_BLKTOOFF,            "vnop_blktooff")        \
+    X(VNOP_OFFTOBLK,            "vnop_offtoblk")
+
+#define EMPTYFS_PROF_ENUM(op, name)     EMPTYFS_PROF_ ## op,
+enum {
+    EMPTYFS_PROF_OPS(EMPTYFS_PROF_ENUM)
+    EMPTYFS_PROF_NOP
+};
+#undef EMPTYFS_PROF_ENUM
+
+/* last bucket also absorbs anything slower than 2^38 ns(about 4.6 minutes) */
+#define EMPTYFS_PROF_NBUCKET    40
+
+/* The fourth largest 32-bit De Bruijn constant */
+#define EMPTYFS_PROF_MAGIC      0x0fb9ac4c
+
+/*
+ * Counters of a CPU  cache line aligned so that CPUs never share a line
+ *  call count of an op is the sum of its histogram
+ */
+struct emptyfs_prof_cpu {
+    uint64_t sum_ns[EMPTYFS_PROF_NOP];
+    uint64_t hist[EMPTYFS_PROF_NOP][EMPTYFS_PROF_NBUCKET];
+} __attribute__((aligned(64)));
+
+/*
+ * What sysctl vfs.generic.emptyfs.prof returns  i.e. all CPUs merged
+ */
+struct emptyfs_prof_snap {
+    uint32_t magic;         /* must be EMPTYFS_PROF_MAGIC */
+    uint32_t nop;           /* EMPTYFS_PROF_NOP */
+    uint32_t nbucket;       /* EMPTYFS_PROF_NBUCKET */
+    uint32_t ncpu;          /* number of per-CPU slots merged */
+    struct emptyfs_prof_cpu total;
+};
+
+#ifdef KERNEL
+#define EMPTYFS_PROF_ADD(p, v)  (void) OSAddAtomic64((SInt64) (v), (volatile SInt64 *) (p))
+#else
+#define EMPTYFS_PROF_ADD(p, v)  (void) __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#endif
+
+static inline const char *emptyfs_prof_name(uint32_t op)
+{
+#define EMPTYFS_PROF_NAME(op, name)     name,
+    static const char * const names[] = {
+        EMPTYFS_PROF_OPS(EMPTYFS_PROF_NAME)
+    };
+#undef EMPTYFS_PROF_NAME
+    return op < EMPTYFS_PROF_NOP ? names[op] : "?";
+}
+
+static inline uint32_t emptyfs_prof_bucket(uint64_t ns)
+{
+    uint32_t b;
+
+    if (ns == 0) return 0;
+    b = 64 - (uint32_t) __builtin_clzll(ns);
+    return b < EMPTYFS_PROF_NBUCKET ? b : EMPTYFS_PROF_NBUCKET - 1;
+}
+
+/**
+ * Record a call  lock-free
+ *  atomics are still needed  :. a thread may migrate or be preempted midway
+ *  they're uncontended though  as the slot is normally only hit by its CPU
+ */
+static inline void emptyfs_prof_record(
+        struct emptyfs_prof_cpu *pc,
+        uint32_t op,
+        uint64_t ns)
+{
+    EMPTYFS_PROF_ADD(&pc->hist[op][emptyfs_prof_bucket(ns)], 1);
+    EMPTYFS_PROF_ADD(&pc->sum_ns[op], ns);
+}
+
+/**
+ * Merge a CPU slot into a total  concurrent recording is tolerated
+ *  i.e. the result is a slightly fuzzy snapshot  never a torn counter
+ */
+static inline void emptyfs_prof_merge(
+        struct emptyfs_prof_cpu *total,
+        const struct emptyfs_prof_cpu *pc)
+{
+    uint32_t op, b;
+
+    for (op = 0; op < EMPTYFS_PROF_NOP; op++) {
+        total->sum_ns[op] += pc->sum_ns[op];
+        for (b = 0; b < EMPTYFS_PROF_NBUCKET; b++)
+            total->hist[op][b] += pc->hist[op][b];
+    }
+}
+
+static inline uint64_t emptyfs_prof_calls(const struct emptyfs_prof_cpu *pc, uint32_t op)
+{
+    uint64_t n = 0;
+    uint32_t b;
+
+    for (b = 0; b < EMPTYFS_PROF_NBUCKET; b++) n += pc->hist[op][b];
+    return n;
+}
+
+/**
+ * Estimate a percentile  linearly interpolated inside its bucket
+ * @ppm         percentile in parts per million  e.g. 999000 for p99.9
+ * @return      latency in nanoseconds  0 if no call recorded
+ */
+static inline uint64_t emptyfs_prof_percentile(
+        const struct emptyfs_prof_cpu *pc,
+        uint32_t op,
+        uint32_t ppm)
+{
+    uint64_t n = emptyfs_prof_calls(pc, op);
+    uint64_t rank;
+    uint64_t seen = 0;
+    uint64_t c, lo, hi;
+    uint32_t b;
+
+    if (n == 0) return 0;
+
+    /* rank of the wanted call  1-based  ceiling of n * ppm / 1e6 */
+    rank = (n / 1000000) * ppm + ((n % 1000000) * ppm + 999999) / 1000000;
+    if (rank == 0) rank = 1;
+
+    for (b = 0; b < EMPTYFS_PROF_NBUCKET; b++) {
+        c = pc->hist[op][b];
+        if (seen + c >= rank) {
+            if (b == 0) return 0;
+            lo = 1ULL << (b - 1);
+            hi = 1ULL << b;
+            return lo + (hi - lo) * (rank - seen) / c;
+        }
+        seen += c;
+    }
+
+    /* unreachable */
+    return 1ULL << (EMPTYFS_PROF_NBUCKET - 1);
+}
+
+#ifdef KERNEL
+int emptyfs_prof_init(void);
+void emptyfs_prof_fini(void);
+
+uint64_t emptyfs_prof_begin(void);
+void emptyfs_prof_end(uint32_t, uint64_t);
+
+/*
+ * Time an expression yielding an int(i.e. errno) as op
+ */
+#define EMPTYFS_PROF_CALL(op, call) ({              \
+    uint64_t _t = emptyfs_prof_begin();             \
+    int _e = (call);                                \
+    emptyfs_prof_end(EMPTYFS_PROF_ ## op, _t);      \
+    _e;                                             \
+})
+#endif
+
+#endif /* __EMPTYFS_PROF_H */
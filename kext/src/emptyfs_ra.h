@@ -0,0 +1,96 @@
+/*
+ * Created 261018
+ *
+ * Per-file sequential read detector  with an adaptive read-ahead window
+ *  a read starting where the last one ended(or at offset 0) is sequential
+ *  any other read drops the window  thus random readers never read ahead
+ *  read-ahead is issued a window at a time  once the reader gets within
+ *  half a window of what's been read ahead  and each batch doubles the
+ *  window(min up to max)  i.e. the device has the next batch in flight
+ *  while the reader consumes the previous one
+ *
+ * XXX:
+ *  this header is shared with userspace(see: bench_emptyfs/)
+ *  .: it must only depend on plain integer types
+ *  it does no locking  concurrent readers of a file may race on it
+ *  which only costs a misguess  never correctness
+ */
+
+#ifndef __EMPTYFS_RA_H
+#define __EMPTYFS_RA_H
+
+#ifdef KERNEL
+#include <sys/types.h>
+#else
+#include <stdint.h>
+#endif
+
+/* read-ahead window cap  in bytes */
+#define EMPTYFS_RA_MAX          (8U << 20)
+
+struct emptyfs_ra {
+    uint64_t next;          /* where a sequential read would start */
+    uint64_t end;           /* read ahead up to here */
+    uint32_t win;           /* next batch size  zero if not sequential */
+    uint32_t nbatch;        /* batches issued since the last reset */
+};
+
+static inline void emptyfs_ra_reset(struct emptyfs_ra *ra)
+{
+    ra->next = 0;
+    ra->end = 0;
+    ra->win = 0;
+    ra->nbatch = 0;
+}
+
+/**
+ * Account a read  and tell what to read ahead after it
+ * @off, @len   the read
+ * @size        file size
+ * @min, @max   window bounds in bytes  e.g. preferred IO size and EMPTYFS_RA_MAX
+ * @ra_off      (OUT) where read-ahead starts
+ * @return      bytes to read ahead  0 if none
+ */
+static inline uint64_t emptyfs_ra_advise(
+        struct emptyfs_ra *ra,
+        uint64_t off,
+        uint64_t len,
+        uint64_t size,
+        uint32_t min,
+        uint32_t max,
+        uint64_t *ra_off)
+{
+    uint64_t end = off + len, want;
+
+    if (min > max) max = min;
+
+    if (off != ra->next) {
+        ra->win = 0;
+        ra->end = 0;
+        ra->nbatch = 0;
+    } else if (ra->win == 0) {
+        ra->win = min;
+    }
+    ra->next = end;
+
+    if (ra->win == 0 || len == 0 || end >= size) return 0;
+
+    /* the reader overtook read-ahead  e.g. reads larger than the window */
+    if (ra->end < end) ra->end = end;
+    /* still more than half a window ahead */
+    if (ra->end - end > ra->win / 2 || ra->end >= size) return 0;
+
+    want = end + ra->win;
+    if (want > size) want = size;
+    if (want <= ra->end) return 0;
+
+    *ra_off = ra->end;
+    want -= ra->end;
+    ra->end += want;
+    ra->nbatch++;
+    ra->win = ra->win > max / 2 ? max : ra->win * 2;
+
+    return want;
+}
+
+#endif /* __EMPTYFS_RA_H */
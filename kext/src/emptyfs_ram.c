@@ -0,0 +1,267 @@
+/*
+ * Created 261018
+ *
+ * Kernel glue of ramfs engine  see: emptyfs_ram.h
+ *  memory comes from util_malloc()  times from nanotime()
+ */
+
+#include <sys/vnode.h>
+#include <sys/mount.h>
+#include <sys/time.h>
+
+#include "emptyfs_ram.h"
+#include "emptyfs_fsnode.h"
+#include "emptyfs_vfsops.h"
+#include "emptyfs.h"
+#include "utils.h"
+
+#define RAM_ROOT_PERM   (S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH)
+
+/* slots are 32-bit  two of them(0 and 1) are never handed out */
+#define RAM_MAX_OBJS    ((uint64_t) UINT32_MAX - EMPTYFS_RAM_ROOT_INO)
+
+static void *ram_alloc(size_t size)
+{
+    return util_malloc(size, M_WAITOK);
+}
+
+static void ram_free(void *p, size_t size)
+{
+    UNUSED(size);
+    util_mfree(p);
+}
+
+static void ram_now(struct emptyfs_ram_ts *ts)
+{
+    struct timespec t;
+    nanotime(&t);
+    ts->sec = t.tv_sec;
+    ts->nsec = t.tv_nsec;
+}
+
+static const struct emptyfs_ram_ops ram_ops = {
+    .alloc = ram_alloc,
+    .free = ram_free,
+    .now = ram_now,
+};
+
+/**
+ * Set up ramfs engine of a mount  root directory is owned by the mounter
+ * @mb          capacity in MiB  zero for EMPTYFS_RAM_MB_DEFAULT
+ * @return      0 if success  errno o.w.
+ *              in latter case emptyfs_ram_unmount() cleans up
+ */
+int emptyfs_ram_mount(
+        struct emptyfs_mount * __nonnull mntp,
+        uint32_t mb,
+        uid_t uid,
+        gid_t gid)
+{
+    int e;
+    uint64_t max;
+
+    kassert_nonnull(mntp);
+    kassert_null(mntp->ram);
+    kassert_null(mntp->ram_lock);
+    kassert_null(mntp->ram_wlock);
+
+    if (mb == 0) mb = EMPTYFS_RAM_MB_DEFAULT;
+    max = (uint64_t) mb * (1024 * 1024 / EMPTYFS_RAM_CHUNK);
+
+    mntp->ram_lock = lck_rw_alloc_init(lckgrp, NULL);
+    if (mntp->ram_lock == NULL) return ENOMEM;
+
+    mntp->ram_wlock = lck_mtx_alloc_init(lckgrp, NULL);
+    if (mntp->ram_wlock == NULL) return ENOMEM;
+
+    mntp->ram = util_malloc(sizeof(*mntp->ram), M_WAITOK | M_ZERO);
+    if (mntp->ram == NULL) return ENOMEM;
+
+    e = emptyfs_ram_init(mntp->ram, &ram_ops, max, RAM_ROOT_PERM, uid, gid);
+    if (e) {
+        util_mfree(mntp->ram);
+        mntp->ram = NULL;
+        return e;
+    }
+
+    /* vfsop_root relies on it */
+    kassert(EMPTYFS_RAM_ROOT_INO == EMPTYFS_ROOT_INO);
+
+    LOG_DBG("ramfs ready  chunks: %llu", max);
+
+    return 0;
+}
+
+/**
+ * Free everything of a ramfs volume  no vnode may exist
+ *  safe to call on a partially set up(or a synthetic) mount
+ */
+void emptyfs_ram_unmount(struct emptyfs_mount * __nonnull mntp)
+{
+    kassert_nonnull(mntp);
+
+    if (mntp->ram != NULL) {
+        emptyfs_ram_fini(mntp->ram);
+        util_mfree(mntp->ram);
+        mntp->ram = NULL;
+    }
+
+    if (mntp->ram_lock != NULL) {
+        lck_rw_free(mntp->ram_lock, lckgrp);
+        mntp->ram_lock = NULL;
+    }
+
+    if (mntp->ram_wlock != NULL) {
+        lck_mtx_free(mntp->ram_wlock, lckgrp);
+        mntp->ram_wlock = NULL;
+    }
+}
+
+static inline struct timespec ram_ts(struct emptyfs_ram_ts ts)
+{
+    struct timespec t;
+    t.tv_sec = (__typeof(t.tv_sec)) ts.sec;
+    t.tv_nsec = (__typeof(t.tv_nsec)) ts.nsec;
+    return t;
+}
+
+/**
+ * Build attributes of a ramfs node  ram_lock must be held
+ *  unlike synthetic ones  they're built on each request :. nodes change
+ */
+void emptyfs_ram_fill_attr(
+        struct emptyfs_mount * __nonnull mntp,
+        const struct emptyfs_ram_node * __nonnull n,
+        struct emptyfs_attr * __nonnull t)
+{
+    uint64_t alloc;
+
+    kassert_nonnull(mntp);
+    kassert_nonnull(n);
+    kassert_nonnull(t);
+
+    t->supported = 0;
+
+    EMPTYFS_ATTR_SET(t, va_rdev, 0);
+    EMPTYFS_ATTR_SET(t, va_nlink, n->nlink);
+
+    alloc = n->type == EMPTYFS_RAM_REG ?
+            n->u.file.nalloc * EMPTYFS_RAM_CHUNK : n->size;
+    EMPTYFS_ATTR_SET(t, va_data_size, n->size);
+    EMPTYFS_ATTR_SET(t, va_total_size, n->size);
+    EMPTYFS_ATTR_SET(t, va_data_alloc, alloc);
+    EMPTYFS_ATTR_SET(t, va_total_alloc, alloc);
+    EMPTYFS_ATTR_SET(t, va_iosize, mntp->attr.f_iosize);
+    EMPTYFS_ATTR_SET(t, va_flags, n->flags);
+
+    EMPTYFS_ATTR_SET(t, va_uid, n->uid);
+    EMPTYFS_ATTR_SET(t, va_gid, n->gid);
+    EMPTYFS_ATTR_SET(t, va_mode,
+        (n->type == EMPTYFS_RAM_DIR ? S_IFDIR : S_IFREG) | (n->perm & ALLPERMS));
+
+    EMPTYFS_ATTR_SET(t, va_create_time, ram_ts(n->btime));
+    EMPTYFS_ATTR_SET(t, va_access_time, ram_ts(n->atime));
+    EMPTYFS_ATTR_SET(t, va_modify_time, ram_ts(n->mtime));
+    EMPTYFS_ATTR_SET(t, va_change_time, ram_ts(n->ctime));
+
+    EMPTYFS_ATTR_SET(t, va_fileid, n->ino);
+    EMPTYFS_ATTR_SET(t, va_parentid, n->parent);
+    EMPTYFS_ATTR_SET(t, va_fsid, mntp->devid);
+}
+
+/**
+ * Fill volume usage attributes  which vary as files come and go
+ */
+void emptyfs_ram_statfs(
+        struct emptyfs_mount * __nonnull mntp,
+        struct vfs_attr * __nonnull attr)
+{
+    const struct emptyfs_ram *ram;
+    uint64_t nobj;
+
+    kassert_nonnull(mntp);
+    kassert_nonnull(mntp->ram);
+    kassert_nonnull(attr);
+
+    emptyfs_ram_lock_shared(mntp);
+    ram = mntp->ram;
+    nobj = ram->ndirs + ram->nfiles;
+
+    VFSATTR_RETURN(attr, f_objcount, nobj);
+    VFSATTR_RETURN(attr, f_filecount, ram->nfiles);
+    VFSATTR_RETURN(attr, f_dircount, ram->ndirs);
+    VFSATTR_RETURN(attr, f_maxobjcount, RAM_MAX_OBJS);
+
+    kassert(mntp->attr.f_bsize == EMPTYFS_RAM_CHUNK);
+    VFSATTR_RETURN(attr, f_blocks, ram->arena.max);
+    VFSATTR_RETURN(attr, f_bfree, ram->arena.max - ram->arena.nused);
+    VFSATTR_RETURN(attr, f_bavail, ram->arena.max - ram->arena.nused);
+    VFSATTR_RETURN(attr, f_bused, ram->arena.nused);
+    VFSATTR_RETURN(attr, f_files, RAM_MAX_OBJS);
+    VFSATTR_RETURN(attr, f_ffree, RAM_MAX_OBJS - nobj);
+    emptyfs_ram_unlock(mntp);
+}
+
+/**
+ * make_attr callback of fsnode layer  see: emptyfs_fsnode_args
+ *  the template is only used to size the vnode  getattr never reads it
+ */
+static int ram_make_attr(
+        struct emptyfs_mount * __nonnull mntp,
+        uint64_t ino,
+        struct emptyfs_attr * __nonnull t)
+{
+    const struct emptyfs_ram_node *n;
+    int e = 0;
+
+    emptyfs_ram_lock_shared(mntp);
+    n = emptyfs_ram_node(mntp->ram, ino);
+    /* unlinked(or freed) meanwhile */
+    if (n == NULL || n->nlink == 0) {
+        e = ENOENT;
+    } else {
+        emptyfs_ram_fill_attr(mntp, n, t);
+    }
+    emptyfs_ram_unlock(mntp);
+
+    return e;
+}
+
+/**
+ * Get vnode of a ramfs inode(will create if necessary)
+ * @dvp, @cnp   parent directory and name  both NULL if not from a lookup
+ * @return      0 if success  errno o.w.(ENOENT if the inode is gone)
+ *              resulting vnode has an io refcnt.
+ *
+ * XXX: ram_lock must NOT be held  see: emptyfs_ram_lock_shared()
+ */
+int emptyfs_ram_vget(
+        struct emptyfs_mount * __nonnull mntp,
+        uint64_t ino,
+        vnode_t dvp,
+        struct componentname *cnp,
+        vnode_t * __nonnull vpp)
+{
+    struct emptyfs_fsnode_args args;
+    const struct emptyfs_ram_node *n;
+    uint32_t type = 0;
+
+    kassert_nonnull(mntp);
+    kassert_nonnull(mntp->ram);
+    kassert_nonnull(vpp);
+
+    emptyfs_ram_lock_shared(mntp);
+    n = emptyfs_ram_node(mntp->ram, ino);
+    if (n != NULL) type = n->type;
+    emptyfs_ram_unlock(mntp);
+
+    if (n == NULL) return ENOENT;
+
+    args.ino = ino;
+    args.vtype = type == EMPTYFS_RAM_DIR ? VDIR : VREG;
+    args.dvp = dvp;
+    args.cnp = cnp;
+    args.make_attr = ram_make_attr;
+
+    return emptyfs_fsnode_get(mntp, &args, vpp);
+}
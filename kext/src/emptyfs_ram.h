@@ -0,0 +1,1130 @@
+/*
+ * Created 261018
+ *
+ * In-memory read/write namespace and data engine(i.e. ramfs mode)
+ *  nodes are indexed by inode number  directories by emptyfs_dirhash
+ *  file data lives in page-aligned chunks carved from arena slabs
+ *  a chunk never written is a hole  which reads as zeros
+ *
+ * Inode numbers are (generation << 32 | slot)  a slot is reused once its
+ *  node freed  yet a stale inode number never resolves to the new node
+ *
+ * XXX:
+ *  this header is shared with userspace(see: bench_emptyfs/)
+ *  .: it must only depend on plain integer types and errno values
+ *  the engine does no locking  callers serialize it(a rwlock per mount)
+ *  lookup  read and readdir paths never write  thus may share the lock
+ */
+
+#ifndef __EMPTYFS_RAM_H
+#define __EMPTYFS_RAM_H
+
+#ifdef KERNEL
+#include <sys/types.h>
+#include <sys/errno.h>
+#include <string.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#endif
+
+#include "emptyfs_dirhash.h"
+
+/* size of a data chunk  also its alignment */
+#define EMPTYFS_RAM_CHUNK           4096
+
+/* chunks per arena slab  i.e. 256K */
+#define EMPTYFS_RAM_SLAB_CHUNKS     64
+
+#define EMPTYFS_RAM_NAME_MAX        255
+
+/* largest file  keeps chunk arrays addressable on 32-bit hosts too */
+#define EMPTYFS_RAM_FILE_MAX        (1ULL << 40)
+
+/* emulated directory entry size  see: EMPTYFS_SYNTH_DIRENT_SIZE */
+#define EMPTYFS_RAM_DIRENT_SIZE     32
+
+#define EMPTYFS_RAM_INO_NONE        0
+/* first slot handed out  .: root always gets inode number 2 */
+#define EMPTYFS_RAM_ROOT_INO        2
+
+enum {
+    EMPTYFS_RAM_REG = 1,
+    EMPTYFS_RAM_DIR = 2,
+};
+
+struct emptyfs_ram_ts {
+    int64_t sec;
+    int64_t nsec;
+};
+
+/*
+ * Memory and clock of the host
+ *  alloc() needn't zero memory  free() gets the size back
+ */
+struct emptyfs_ram_ops {
+    void *(*alloc)(size_t);
+    void (*free)(void *, size_t);
+    void (*now)(struct emptyfs_ram_ts *);
+};
+
+/*
+ * A directory entry  entries are kept in insertion(seq) order
+ *  a removed entry leaves a hole(ino is EMPTYFS_RAM_INO_NONE) until compaction
+ *  seq never changes  .: readdir cookies derived from it stay valid
+ */
+struct emptyfs_ram_dirent {
+    uint64_t ino;
+    uint64_t seq;
+    uint32_t off;       /* name offset in name blob */
+    uint32_t len;
+};
+
+struct emptyfs_ram_dir {
+    struct emptyfs_ram_dirent *ent;
+    uint32_t nent;      /* holes included */
+    uint32_t cap;
+    uint32_t nlive;
+    char *names;        /* name blob  not NUL-terminated */
+    uint32_t namesz;
+    uint32_t namecap;
+    struct emptyfs_dirhash dh;      /* idx is position in ent */
+    uint64_t seq;       /* seq of next entry */
+};
+
+/*
+ * chunk[i] covers [i * CHUNK, (i + 1) * CHUNK)  NULL is a hole
+ *  bytes past size in a chunk are always zero  :. extending needs no work
+ */
+struct emptyfs_ram_file {
+    char **chunk;
+    uint64_t nchunk;    /* capacity of chunk array */
+    uint64_t nalloc;    /* non-NULL chunks */
+};
+
+struct emptyfs_ram_node {
+    uint64_t ino;
+    uint64_t parent;    /* root is its own parent */
+    uint32_t type;      /* EMPTYFS_RAM_REG or EMPTYFS_RAM_DIR */
+    uint32_t perm;      /* permission bits only */
+    uint32_t nlink;     /* zero once unlinked  freed on emptyfs_ram_release() */
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t flags;     /* chflags(2) flags  opaque to us */
+    uint64_t size;
+    struct emptyfs_ram_ts btime;
+    struct emptyfs_ram_ts atime;
+    struct emptyfs_ram_ts mtime;
+    struct emptyfs_ram_ts ctime;
+    union {
+        struct emptyfs_ram_dir dir;
+        struct emptyfs_ram_file file;
+    } u;
+};
+
+struct emptyfs_ram_slot {
+    struct emptyfs_ram_node *node;
+    uint32_t gen;
+    uint32_t next;      /* free slot list  zero terminates */
+};
+
+struct emptyfs_ram_slab {
+    struct emptyfs_ram_slab *next;
+    void *raw;          /* unaligned allocation */
+};
+
+/*
+ * Chunks are never returned to host before fini  freed ones are reused
+ *  .: footprint is bounded by peak usage  which is bounded by max
+ */
+struct emptyfs_ram_arena {
+    struct emptyfs_ram_slab *slabs;
+    void *free;         /* free chunks linked through their first word */
+    uint64_t nslab;
+    uint64_t nused;     /* chunks handed out */
+    uint64_t max;       /* capacity in chunks */
+};
+
+struct emptyfs_ram {
+    struct emptyfs_ram_ops ops;
+    struct emptyfs_ram_slot *slot;
+    uint32_t nslot;     /* capacity of slot array */
+    uint32_t hiwat;     /* slots [0, hiwat) ever used */
+    uint32_t freeslot;
+    uint64_t ndirs;
+    uint64_t nfiles;
+    struct emptyfs_ram_arena arena;
+    char *zero;         /* a zero chunk  backs reads of holes */
+};
+
+typedef int (*emptyfs_ram_xfer_t)(void *, char *, size_t);
+
+/**
+ * Replace an array by a larger(or smaller) copy  new tail zeroed
+ * @return      0 if success  ENOMEM o.w.(array untouched)
+ */
+static inline int emptyfs_ram_resize(
+        struct emptyfs_ram *ram,
+        void **p,
+        size_t oldsz,
+        size_t newsz)
+{
+    char *q;
+
+    q = ram->ops.alloc(newsz);
+    if (q == NULL) return ENOMEM;
+
+    if (*p != NULL) memcpy(q, *p, oldsz < newsz ? oldsz : newsz);
+    if (newsz > oldsz) memset(q + oldsz, 0, newsz - oldsz);
+    if (*p != NULL) ram->ops.free(*p, oldsz);
+    *p = q;
+    return 0;
+}
+
+/**
+ * @return      a chunk(content undefined)  NULL if full or out of memory
+ */
+static inline char *emptyfs_ram_chunk_alloc(struct emptyfs_ram *ram, int *err)
+{
+    struct emptyfs_ram_arena *a = &ram->arena;
+    struct emptyfs_ram_slab *s;
+    char *base;
+    void *c;
+    uint32_t i;
+
+    if (a->nused >= a->max) {
+        *err = ENOSPC;
+        return NULL;
+    }
+
+    if (a->free == NULL) {
+        s = ram->ops.alloc(sizeof(*s));
+        if (s == NULL) goto out_nomem;
+        /* slack for alignment */
+        s->raw = ram->ops.alloc(EMPTYFS_RAM_SLAB_CHUNKS * EMPTYFS_RAM_CHUNK +
+                                    EMPTYFS_RAM_CHUNK - 1);
+        if (s->raw == NULL) {
+            ram->ops.free(s, sizeof(*s));
+            goto out_nomem;
+        }
+
+        base = (char *) (((uintptr_t) s->raw + EMPTYFS_RAM_CHUNK - 1) &
+                            ~(uintptr_t) (EMPTYFS_RAM_CHUNK - 1));
+        for (i = EMPTYFS_RAM_SLAB_CHUNKS; i-- > 0; ) {
+            *(void **) (base + (size_t) i * EMPTYFS_RAM_CHUNK) = a->free;
+            a->free = base + (size_t) i * EMPTYFS_RAM_CHUNK;
+        }
+
+        s->next = a->slabs;
+        a->slabs = s;
+        a->nslab++;
+    }
+
+    c = a->free;
+    a->free = *(void **) c;
+    a->nused++;
+    return c;
+
+out_nomem:
+    *err = ENOMEM;
+    return NULL;
+}
+
+static inline void emptyfs_ram_chunk_free(struct emptyfs_ram *ram, char *c)
+{
+    *(void **) c = ram->arena.free;
+    ram->arena.free = c;
+    ram->arena.nused--;
+}
+
+/**
+ * @return      node of an inode number  NULL if no such(or a stale) one
+ */
+static inline struct emptyfs_ram_node *emptyfs_ram_node(
+        const struct emptyfs_ram *ram,
+        uint64_t ino)
+{
+    uint32_t i = (uint32_t) ino;
+    struct emptyfs_ram_node *n;
+
+    if (i >= ram->hiwat) return NULL;
+    n = ram->slot[i].node;
+    return n != NULL && n->ino == ino ? n : NULL;
+}
+
+/**
+ * @return      directory node of an inode number  NULL if no such one
+ *              *err tells ENOENT from ENOTDIR
+ */
+static inline struct emptyfs_ram_node *emptyfs_ram_dir(
+        const struct emptyfs_ram *ram,
+        uint64_t ino,
+        int *err)
+{
+    struct emptyfs_ram_node *n = emptyfs_ram_node(ram, ino);
+
+    if (n == NULL || n->nlink == 0) {
+        *err = ENOENT;
+        return NULL;
+    }
+    if (n->type != EMPTYFS_RAM_DIR) {
+        *err = ENOTDIR;
+        return NULL;
+    }
+    return n;
+}
+
+static inline int emptyfs_ram_check_name(const char *name, size_t len)
+{
+    (void) name;
+    if (len == 0) return EINVAL;
+    if (len > EMPTYFS_RAM_NAME_MAX) return ENAMETOOLONG;
+    return 0;
+}
+
+/**
+ * @return      position of a name in entries  EMPTYFS_DIRHASH_NONE if not found
+ */
+static inline uint32_t emptyfs_ram_dir_find(
+        const struct emptyfs_ram_dir *d,
+        const char *name,
+        size_t len)
+{
+    if (d->nlive == 0) return EMPTYFS_DIRHASH_NONE;
+    return emptyfs_dirhash_lookup(&d->dh, name, len, emptyfs_dirhash_name(name, len));
+}
+
+/**
+ * Rebuild name hash of live entries over nslot slots
+ * @return      0 if success  ENOMEM o.w.(old hash kept)
+ */
+static inline int emptyfs_ram_dir_rehash(
+        struct emptyfs_ram *ram,
+        struct emptyfs_ram_dir *d,
+        uint32_t nslot)
+{
+    struct emptyfs_dirhash_slot *slot;
+    const struct emptyfs_ram_dirent *de;
+    uint32_t i;
+
+    slot = ram->ops.alloc(nslot * sizeof(*slot));
+    if (slot == NULL) return ENOMEM;
+    memset(slot, 0, nslot * sizeof(*slot));
+
+    if (d->dh.slot != NULL)
+        ram->ops.free(d->dh.slot, (d->dh.mask + 1) * sizeof(*slot));
+
+    emptyfs_dirhash_init(&d->dh, slot, nslot, d->names);
+    for (i = 0; i < d->nent; i++) {
+        de = &d->ent[i];
+        if (de->ino == EMPTYFS_RAM_INO_NONE) continue;
+        (void) emptyfs_dirhash_insert(&d->dh,
+                    emptyfs_dirhash_name(d->names + de->off, de->len),
+                    de->len, de->off, i);
+    }
+
+    return 0;
+}
+
+/**
+ * Append an entry  the name must not exist
+ *  all allocations are done before any change  :. ENOMEM leaves d intact
+ */
+static inline int emptyfs_ram_dir_insert(
+        struct emptyfs_ram *ram,
+        struct emptyfs_ram_dir *d,
+        const char *name,
+        uint32_t len,
+        uint64_t ino)
+{
+    struct emptyfs_ram_dirent *de;
+    uint32_t cap;
+    int e;
+
+    if (d->nent == UINT32_MAX || (uint64_t) d->namesz + len > UINT32_MAX)
+        return ENOSPC;
+
+    if (d->nent == d->cap) {
+        cap = d->cap != 0 ? (d->cap <= UINT32_MAX / 2 ? d->cap * 2 : UINT32_MAX) : 8;
+        e = emptyfs_ram_resize(ram, (void **) &d->ent,
+                    d->cap * sizeof(*d->ent), cap * sizeof(*d->ent));
+        if (e != 0) return e;
+        d->cap = cap;
+    }
+
+    if (d->namesz + len > d->namecap) {
+        cap = d->namecap != 0 ? d->namecap : 256;
+        while (cap < d->namesz + len) cap = cap <= UINT32_MAX / 2 ? cap * 2 : UINT32_MAX;
+        e = emptyfs_ram_resize(ram, (void **) &d->names, d->namecap, cap);
+        if (e != 0) return e;
+        d->namecap = cap;
+        d->dh.names = d->names;
+    }
+
+    if (d->dh.slot == NULL || ((uint64_t) d->dh.count + 1) <<
+            EMPTYFS_DIRHASH_LOAD_SHIFT > (uint64_t) d->dh.mask + 1) {
+        e = emptyfs_ram_dir_rehash(ram, d, emptyfs_dirhash_nslot(d->nlive + 1) << 1);
+        if (e != 0) return e;
+    }
+
+    de = &d->ent[d->nent];
+    de->ino = ino;
+    de->seq = d->seq++;
+    de->off = d->namesz;
+    de->len = len;
+    memcpy(d->names + d->namesz, name, len);
+    d->namesz += len;
+
+    (void) emptyfs_dirhash_insert(&d->dh, emptyfs_dirhash_name(name, len),
+                                    len, de->off, d->nent);
+    d->nent++;
+    d->nlive++;
+    return 0;
+}
+
+/**
+ * Squeeze out holes and dead names  order(thus seq) preserved
+ *  best effort  nothing changes if out of memory
+ */
+static inline void emptyfs_ram_dir_compact(
+        struct emptyfs_ram *ram,
+        struct emptyfs_ram_dir *d)
+{
+    char *names = NULL;
+    uint32_t namesz = 0;
+    uint32_t i, j;
+    char *old = d->names;
+    uint32_t oldcap = d->namecap;
+
+    for (i = 0; i < d->nent; i++) {
+        if (d->ent[i].ino != EMPTYFS_RAM_INO_NONE) namesz += d->ent[i].len;
+    }
+
+    if (namesz != 0) {
+        names = ram->ops.alloc(namesz);
+        if (names == NULL) return;
+    }
+
+    for (i = 0, j = 0; i < d->nent; i++) {
+        if (d->ent[i].ino == EMPTYFS_RAM_INO_NONE) continue;
+        memcpy(names + j, old + d->ent[i].off, d->ent[i].len);
+        d->ent[i].off = j;
+        j += d->ent[i].len;
+    }
+
+    for (i = 0, j = 0; i < d->nent; i++) {
+        if (d->ent[i].ino != EMPTYFS_RAM_INO_NONE) d->ent[j++] = d->ent[i];
+    }
+    d->nent = j;
+    d->names = names;
+    d->namesz = d->namecap = namesz;
+
+    /* hash still indexes old positions  a failed rehash can't be undone */
+    if (emptyfs_ram_dir_rehash(ram, d, emptyfs_dirhash_nslot(d->nlive) << 1) != 0) {
+        d->dh.names = names;
+        for (i = 0; i <= d->dh.mask; i++) d->dh.slot[i].len = 0;
+        d->dh.count = 0;
+        for (i = 0; i < d->nent; i++) {
+            (void) emptyfs_dirhash_insert(&d->dh,
+                        emptyfs_dirhash_name(names + d->ent[i].off, d->ent[i].len),
+                        d->ent[i].len, d->ent[i].off, i);
+        }
+    }
+
+    if (old != NULL) ram->ops.free(old, oldcap);
+}
+
+/**
+ * Turn an entry into a hole  compact once holes outnumber live entries
+ */
+static inline void emptyfs_ram_dir_remove_at(
+        struct emptyfs_ram *ram,
+        struct emptyfs_ram_dir *d,
+        uint32_t i)
+{
+    struct emptyfs_ram_dirent *de = &d->ent[i];
+
+    (void) emptyfs_dirhash_remove(&d->dh, d->names + de->off, de->len,
+                emptyfs_dirhash_name(d->names + de->off, de->len));
+    de->ino = EMPTYFS_RAM_INO_NONE;
+    d->nlive--;
+
+    if (d->nent - d->nlive >= 32 && d->nent - d->nlive > d->nlive)
+        emptyfs_ram_dir_compact(ram, d);
+}
+
+/**
+ * @return      position of first live entry whose seq >= given one
+ *              nent if none
+ */
+static inline uint32_t emptyfs_ram_dir_seek(const struct emptyfs_ram_dir *d, uint64_t seq)
+{
+    uint32_t lo = 0;
+    uint32_t hi = d->nent;
+    uint32_t mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (d->ent[mid].seq < seq) lo = mid + 1;
+        else hi = mid;
+    }
+
+    while (lo < d->nent && d->ent[lo].ino == EMPTYFS_RAM_INO_NONE) lo++;
+    return lo;
+}
+
+static inline void emptyfs_ram_dir_resize(struct emptyfs_ram_node *n)
+{
+    n->size = ((uint64_t) n->u.dir.nlive + 2) * EMPTYFS_RAM_DIRENT_SIZE;
+}
+
+static inline void emptyfs_ram_node_free(struct emptyfs_ram *ram, struct emptyfs_ram_node *n)
+{
+    struct emptyfs_ram_dir *d;
+    struct emptyfs_ram_file *f;
+    uint64_t i;
+
+    if (n->type == EMPTYFS_RAM_DIR) {
+        d = &n->u.dir;
+        if (d->ent != NULL) ram->ops.free(d->ent, d->cap * sizeof(*d->ent));
+        if (d->names != NULL) ram->ops.free(d->names, d->namecap);
+        if (d->dh.slot != NULL)
+            ram->ops.free(d->dh.slot, (d->dh.mask + 1) * sizeof(*d->dh.slot));
+        ram->ndirs--;
+    } else {
+        f = &n->u.file;
+        for (i = 0; i < f->nchunk; i++) {
+            if (f->chunk[i] != NULL) emptyfs_ram_chunk_free(ram, f->chunk[i]);
+        }
+        if (f->chunk != NULL) ram->ops.free(f->chunk, f->nchunk * sizeof(*f->chunk));
+        ram->nfiles--;
+    }
+
+    ram->ops.free(n, sizeof(*n));
+}
+
+/**
+ * Allocate a node and its inode number  not linked into any directory
+ */
+static inline int emptyfs_ram_node_new(
+        struct emptyfs_ram *ram,
+        uint32_t type,
+        uint32_t perm,
+        uint32_t uid,
+        uint32_t gid,
+        uint64_t parent,
+        struct emptyfs_ram_node **np)
+{
+    struct emptyfs_ram_node *n;
+    struct emptyfs_ram_slot *s;
+    uint32_t i;
+    uint32_t cap;
+    int e;
+
+    if (ram->freeslot == 0 && ram->hiwat == ram->nslot) {
+        if (ram->nslot == UINT32_MAX) return ENOSPC;
+        cap = ram->nslot <= UINT32_MAX / 2 ? ram->nslot * 2 : UINT32_MAX;
+        e = emptyfs_ram_resize(ram, (void **) &ram->slot,
+                    ram->nslot * sizeof(*ram->slot), cap * sizeof(*ram->slot));
+        if (e != 0) return e;
+        ram->nslot = cap;
+    }
+
+    n = ram->ops.alloc(sizeof(*n));
+    if (n == NULL) return ENOMEM;
+    memset(n, 0, sizeof(*n));
+
+    if (ram->freeslot != 0) {
+        i = ram->freeslot;
+        ram->freeslot = ram->slot[i].next;
+    } else {
+        i = ram->hiwat++;
+    }
+    s = &ram->slot[i];
+    s->node = n;
+    s->next = 0;
+
+    n->ino = (uint64_t) s->gen << 32 | i;
+    n->parent = parent == EMPTYFS_RAM_INO_NONE ? n->ino : parent;
+    n->type = type;
+    n->perm = perm;
+    n->uid = uid;
+    n->gid = gid;
+    ram->ops.now(&n->btime);
+    n->atime = n->mtime = n->ctime = n->btime;
+
+    if (type == EMPTYFS_RAM_DIR) {
+        n->nlink = 2;
+        emptyfs_ram_dir_resize(n);
+        ram->ndirs++;
+    } else {
+        n->nlink = 1;
+        ram->nfiles++;
+    }
+
+    *np = n;
+    return 0;
+}
+
+/**
+ * Give back a node's slot  a new generation makes old inode number stale
+ */
+static inline void emptyfs_ram_node_unslot(struct emptyfs_ram *ram, struct emptyfs_ram_node *n)
+{
+    uint32_t i = (uint32_t) n->ino;
+
+    ram->slot[i].node = NULL;
+    ram->slot[i].gen++;
+    ram->slot[i].next = ram->freeslot;
+    ram->freeslot = i;
+}
+
+static inline void emptyfs_ram_fini(struct emptyfs_ram *ram)
+{
+    struct emptyfs_ram_slab *s;
+    uint32_t i;
+
+    for (i = 0; i < ram->hiwat; i++) {
+        if (ram->slot[i].node != NULL) emptyfs_ram_node_free(ram, ram->slot[i].node);
+    }
+    if (ram->slot != NULL) ram->ops.free(ram->slot, ram->nslot * sizeof(*ram->slot));
+    ram->slot = NULL;
+    ram->nslot = ram->hiwat = ram->freeslot = 0;
+
+    if (ram->zero != NULL) ram->ops.free(ram->zero, EMPTYFS_RAM_CHUNK);
+    ram->zero = NULL;
+
+    while ((s = ram->arena.slabs) != NULL) {
+        ram->arena.slabs = s->next;
+        ram->ops.free(s->raw, EMPTYFS_RAM_SLAB_CHUNKS * EMPTYFS_RAM_CHUNK +
+                                EMPTYFS_RAM_CHUNK - 1);
+        ram->ops.free(s, sizeof(*s));
+    }
+    ram->arena.free = NULL;
+    ram->arena.nslab = ram->arena.nused = 0;
+}
+
+/**
+ * Initialize an engine holding merely a root directory
+ * @max         capacity in chunks
+ * @return      0 if success  errno o.w.(engine is left finalized)
+ */
+static inline int emptyfs_ram_init(
+        struct emptyfs_ram *ram,
+        const struct emptyfs_ram_ops *ops,
+        uint64_t max,
+        uint32_t perm,
+        uint32_t uid,
+        uint32_t gid)
+{
+    struct emptyfs_ram_node *root;
+    int e;
+
+    memset(ram, 0, sizeof(*ram));
+    ram->ops = *ops;
+    ram->arena.max = max;
+
+    ram->zero = ram->ops.alloc(EMPTYFS_RAM_CHUNK);
+    if (ram->zero == NULL) return ENOMEM;
+    memset(ram->zero, 0, EMPTYFS_RAM_CHUNK);
+
+    ram->nslot = 64;
+    ram->slot = ram->ops.alloc(ram->nslot * sizeof(*ram->slot));
+    if (ram->slot == NULL) {
+        ram->nslot = 0;
+        emptyfs_ram_fini(ram);
+        return ENOMEM;
+    }
+    memset(ram->slot, 0, ram->nslot * sizeof(*ram->slot));
+
+    /* slot 0 is EMPTYFS_RAM_INO_NONE  slot 1 is unused by tradition */
+    ram->hiwat = EMPTYFS_RAM_ROOT_INO;
+    e = emptyfs_ram_node_new(ram, EMPTYFS_RAM_DIR, perm, uid, gid,
+                                EMPTYFS_RAM_INO_NONE, &root);
+    if (e != 0) {
+        emptyfs_ram_fini(ram);
+        return e;
+    }
+
+    return 0;
+}
+
+/**
+ * @return      0 if found  errno o.w.
+ */
+static inline int emptyfs_ram_lookup(
+        const struct emptyfs_ram *ram,
+        uint64_t dino,
+        const char *name,
+        size_t len,
+        uint64_t *inop)
+{
+    const struct emptyfs_ram_node *dn;
+    uint32_t i;
+    int e;
+
+    dn = emptyfs_ram_dir(ram, dino, &e);
+    if (dn == NULL) return e;
+
+    i = emptyfs_ram_dir_find(&dn->u.dir, name, len);
+    if (i == EMPTYFS_DIRHASH_NONE) return ENOENT;
+
+    *inop = dn->u.dir.ent[i].ino;
+    return 0;
+}
+
+/**
+ * Create a regular file or a directory
+ * @inop        (OUT) inode number of new node
+ */
+static inline int emptyfs_ram_create(
+        struct emptyfs_ram *ram,
+        uint64_t dino,
+        const char *name,
+        size_t len,
+        uint32_t type,
+        uint32_t perm,
+        uint32_t uid,
+        uint32_t gid,
+        uint64_t *inop)
+{
+    struct emptyfs_ram_node *dn;
+    struct emptyfs_ram_node *n;
+    int e;
+
+    e = emptyfs_ram_check_name(name, len);
+    if (e != 0) return e;
+
+    dn = emptyfs_ram_dir(ram, dino, &e);
+    if (dn == NULL) return e;
+
+    if (emptyfs_ram_dir_find(&dn->u.dir, name, len) != EMPTYFS_DIRHASH_NONE)
+        return EEXIST;
+    if (type == EMPTYFS_RAM_DIR && dn->nlink == UINT32_MAX) return EMLINK;
+
+    e = emptyfs_ram_node_new(ram, type, perm, uid, gid, dino, &n);
+    if (e != 0) return e;
+
+    /* node slots may have moved  but nodes never do */
+    e = emptyfs_ram_dir_insert(ram, &dn->u.dir, name, (uint32_t) len, n->ino);
+    if (e != 0) {
+        emptyfs_ram_node_unslot(ram, n);
+        emptyfs_ram_node_free(ram, n);
+        return e;
+    }
+
+    if (type == EMPTYFS_RAM_DIR) dn->nlink++;
+    emptyfs_ram_dir_resize(dn);
+    dn->mtime = dn->ctime = n->btime;
+
+    *inop = n->ino;
+    return 0;
+}
+
+/**
+ * Unlink a name  the node is only freed by emptyfs_ram_release()
+ * @ino         expected inode number of the name  so that a racing rename
+ *              is detected  EMPTYFS_RAM_INO_NONE to skip the check
+ * @isdir       rmdir(2) if true  unlink(2) o.w.
+ */
+static inline int emptyfs_ram_unlink(
+        struct emptyfs_ram *ram,
+        uint64_t dino,
+        const char *name,
+        size_t len,
+        uint64_t ino,
+        int isdir)
+{
+    struct emptyfs_ram_node *dn;
+    struct emptyfs_ram_node *n;
+    uint32_t i;
+    int e;
+
+    dn = emptyfs_ram_dir(ram, dino, &e);
+    if (dn == NULL) return e;
+
+    i = emptyfs_ram_dir_find(&dn->u.dir, name, len);
+    if (i == EMPTYFS_DIRHASH_NONE) return ENOENT;
+    if (ino != EMPTYFS_RAM_INO_NONE && dn->u.dir.ent[i].ino != ino) return ENOENT;
+
+    n = emptyfs_ram_node(ram, dn->u.dir.ent[i].ino);
+    if (n == NULL) return ENOENT;
+
+    if (isdir) {
+        if (n->type != EMPTYFS_RAM_DIR) return ENOTDIR;
+        if (n->u.dir.nlive != 0) return ENOTEMPTY;
+    } else if (n->type == EMPTYFS_RAM_DIR) {
+        return EPERM;
+    }
+
+    emptyfs_ram_dir_remove_at(ram, &dn->u.dir, i);
+    if (n->type == EMPTYFS_RAM_DIR) dn->nlink--;
+    emptyfs_ram_dir_resize(dn);
+
+    n->nlink = 0;
+    ram->ops.now(&dn->mtime);
+    dn->ctime = n->ctime = dn->mtime;
+    return 0;
+}
+
+/**
+ * @return      1 if a is b or an ancestor of b  0 o.w.
+ */
+static inline int emptyfs_ram_is_ancestor(
+        const struct emptyfs_ram *ram,
+        uint64_t a,
+        uint64_t b)
+{
+    const struct emptyfs_ram_node *n;
+
+    for (;;) {
+        if (b == a) return 1;
+        n = emptyfs_ram_node(ram, b);
+        if (n == NULL || n->parent == b) return 0;
+        b = n->parent;
+    }
+}
+
+/**
+ * Rename a name  an existing target is replaced(and unlinked)
+ * @fino        expected inode number of source  EMPTYFS_RAM_INO_NONE to skip
+ * @tino        expected inode number of target  EMPTYFS_RAM_INO_NONE if the
+ *              caller believes there is none
+ * @return      0 if success  errno o.w.(nothing changed)
+ */
+static inline int emptyfs_ram_rename(
+        struct emptyfs_ram *ram,
+        uint64_t fdino,
+        const char *fname,
+        size_t flen,
+        uint64_t fino,
+        uint64_t tdino,
+        const char *tname,
+        size_t tlen,
+        uint64_t tino)
+{
+    struct emptyfs_ram_node *fdn;
+    struct emptyfs_ram_node *tdn;
+    struct emptyfs_ram_node *n;
+    struct emptyfs_ram_node *tn = NULL;
+    struct emptyfs_ram_ts now;
+    uint32_t fi, ti;
+    uint64_t cur;
+    int e;
+
+    e = emptyfs_ram_check_name(tname, tlen);
+    if (e != 0) return e;
+
+    fdn = emptyfs_ram_dir(ram, fdino, &e);
+    if (fdn == NULL) return e;
+    tdn = emptyfs_ram_dir(ram, tdino, &e);
+    if (tdn == NULL) return e;
+
+    fi = emptyfs_ram_dir_find(&fdn->u.dir, fname, flen);
+    if (fi == EMPTYFS_DIRHASH_NONE) return ENOENT;
+    if (fino != EMPTYFS_RAM_INO_NONE && fdn->u.dir.ent[fi].ino != fino) return ENOENT;
+    n = emptyfs_ram_node(ram, fdn->u.dir.ent[fi].ino);
+    if (n == NULL) return ENOENT;
+
+    ti = emptyfs_ram_dir_find(&tdn->u.dir, tname, tlen);
+    cur = ti != EMPTYFS_DIRHASH_NONE ? tdn->u.dir.ent[ti].ino : EMPTYFS_RAM_INO_NONE;
+    if (cur != tino) return tino == EMPTYFS_RAM_INO_NONE ? EEXIST : ENOENT;
+    /* no hard links  .: same inode means same entry */
+    if (cur == n->ino) return 0;
+
+    if (cur != EMPTYFS_RAM_INO_NONE) {
+        tn = emptyfs_ram_node(ram, cur);
+        if (tn == NULL) return ENOENT;
+        if (n->type == EMPTYFS_RAM_DIR && tn->type != EMPTYFS_RAM_DIR) return ENOTDIR;
+        if (n->type != EMPTYFS_RAM_DIR && tn->type == EMPTYFS_RAM_DIR) return EISDIR;
+        if (tn->type == EMPTYFS_RAM_DIR && tn->u.dir.nlive != 0) return ENOTEMPTY;
+    }
+
+    if (n->type == EMPTYFS_RAM_DIR && fdn != tdn) {
+        /* a directory can't be moved under itself */
+        if (emptyfs_ram_is_ancestor(ram, n->ino, tdn->ino)) return EINVAL;
+        if (tn == NULL && tdn->nlink == UINT32_MAX) return EMLINK;
+    }
+
+    if (tn != NULL) {
+        /* replaced in place  no allocation  seq(i.e. cookie) kept */
+        tdn->u.dir.ent[ti].ino = n->ino;
+        if (tn->type == EMPTYFS_RAM_DIR) tdn->nlink--;
+        tn->nlink = 0;
+    } else {
+        e = emptyfs_ram_dir_insert(ram, &tdn->u.dir, tname, (uint32_t) tlen, n->ino);
+        if (e != 0) return e;
+        /* insertion never moves existing entries */
+    }
+
+    emptyfs_ram_dir_remove_at(ram, &fdn->u.dir, fi);
+
+    if (n->type == EMPTYFS_RAM_DIR) {
+        fdn->nlink--;
+        tdn->nlink++;
+    }
+    n->parent = tdn->ino;
+    emptyfs_ram_dir_resize(fdn);
+    emptyfs_ram_dir_resize(tdn);
+
+    ram->ops.now(&now);
+    fdn->mtime = fdn->ctime = now;
+    tdn->mtime = tdn->ctime = now;
+    n->ctime = now;
+    if (tn != NULL) tn->ctime = now;
+
+    return 0;
+}
+
+/**
+ * Drop a handle(e.g. a vnode) of a node  frees it if already unlinked
+ *  the caller must guarantee no other handle of it exists
+ */
+static inline void emptyfs_ram_release(struct emptyfs_ram *ram, uint64_t ino)
+{
+    struct emptyfs_ram_node *n = emptyfs_ram_node(ram, ino);
+
+    if (n == NULL || n->nlink != 0) return;
+    emptyfs_ram_node_unslot(ram, n);
+    emptyfs_ram_node_free(ram, n);
+}
+
+/**
+ * Make chunk array cover n chunks
+ */
+static inline int emptyfs_ram_file_reserve(
+        struct emptyfs_ram *ram,
+        struct emptyfs_ram_file *f,
+        uint64_t n)
+{
+    uint64_t cap;
+    int e;
+
+    if (n <= f->nchunk) return 0;
+
+    cap = f->nchunk != 0 ? f->nchunk : 4;
+    while (cap < n) cap <<= 1;
+
+    e = emptyfs_ram_resize(ram, (void **) &f->chunk,
+                (size_t) f->nchunk * sizeof(*f->chunk), (size_t) cap * sizeof(*f->chunk));
+    if (e == 0) f->nchunk = cap;
+    return e;
+}
+
+/**
+ * Read file data  a chunk at a time  holes come from the zero chunk
+ * @xfer        copies len bytes out of buf  returns errno
+ * @done        (OUT) bytes transferred  valid even if failed
+ */
+static inline int emptyfs_ram_read(
+        const struct emptyfs_ram *ram,
+        const struct emptyfs_ram_node *n,
+        uint64_t off,
+        size_t len,
+        emptyfs_ram_xfer_t xfer,
+        void *ctx,
+        size_t *done)
+{
+    const struct emptyfs_ram_file *f = &n->u.file;
+    uint64_t ci;
+    size_t co, k;
+    char *p;
+    int e = 0;
+
+    *done = 0;
+    if (n->type != EMPTYFS_RAM_REG) return EISDIR;
+    if (off >= n->size) return 0;
+    if (len > n->size - off) len = (size_t) (n->size - off);
+
+    while (*done < len) {
+        ci = off / EMPTYFS_RAM_CHUNK;
+        co = (size_t) (off % EMPTYFS_RAM_CHUNK);
+        k = EMPTYFS_RAM_CHUNK - co;
+        if (k > len - *done) k = len - *done;
+
+        p = ci < f->nchunk && f->chunk[ci] != NULL ? f->chunk[ci] : ram->zero;
+        e = xfer(ctx, p + co, k);
+        if (e != 0) break;
+
+        *done += k;
+        off += k;
+    }
+
+    return e;
+}
+
+/**
+ * Measure the run of chunks starting at off which are all holes or all not
+ *  i.e. what a block map reports  bytes past EOF count as a hole
+ * @hole        (OUT) 1 if the run is a hole  0 o.w.
+ * @return      length of the run  at most len
+ */
+static inline uint64_t emptyfs_ram_map(
+        const struct emptyfs_ram_node *n,
+        uint64_t off,
+        uint64_t len,
+        int *hole)
+{
+    const struct emptyfs_ram_file *f = &n->u.file;
+    uint64_t ci = off / EMPTYFS_RAM_CHUNK;
+    uint64_t run = EMPTYFS_RAM_CHUNK - off % EMPTYFS_RAM_CHUNK;
+    int h;
+
+#define RAM_IS_HOLE(i)  \
+    ((i) * EMPTYFS_RAM_CHUNK >= n->size || (i) >= f->nchunk || f->chunk[i] == NULL)
+
+    h = RAM_IS_HOLE(ci);
+    for (ci++; run < len && RAM_IS_HOLE(ci) == h; ci++) run += EMPTYFS_RAM_CHUNK;
+
+#undef RAM_IS_HOLE
+
+    *hole = h;
+    return run < len ? run : len;
+}
+
+/**
+ * Write file data  allocates chunks on demand  file grows as needed
+ * @xfer        copies len bytes into buf  returns errno
+ * @done        (OUT) bytes transferred  valid even if failed(e.g. ENOSPC)
+ */
+static inline int emptyfs_ram_write(
+        struct emptyfs_ram *ram,
+        struct emptyfs_ram_node *n,
+        uint64_t off,
+        size_t len,
+        emptyfs_ram_xfer_t xfer,
+        void *ctx,
+        size_t *done)
+{
+    struct emptyfs_ram_file *f = &n->u.file;
+    uint64_t ci;
+    size_t co, k, z;
+    char *p;
+    int e = 0;
+
+    *done = 0;
+    if (n->type != EMPTYFS_RAM_REG) return EISDIR;
+    if (len == 0) return 0;
+    if (off >= EMPTYFS_RAM_FILE_MAX || len > EMPTYFS_RAM_FILE_MAX - off) return EFBIG;
+
+    e = emptyfs_ram_file_reserve(ram, f, (off + len + EMPTYFS_RAM_CHUNK - 1) / EMPTYFS_RAM_CHUNK);
+    if (e != 0) return e;
+
+    while (*done < len) {
+        ci = off / EMPTYFS_RAM_CHUNK;
+        co = (size_t) (off % EMPTYFS_RAM_CHUNK);
+        k = EMPTYFS_RAM_CHUNK - co;
+        if (k > len - *done) k = len - *done;
+
+        p = f->chunk[ci];
+        if (p == NULL) {
+            p = emptyfs_ram_chunk_alloc(ram, &e);
+            if (p == NULL) break;
+            /* a fully overwritten chunk needs no zeroing */
+            if (k != EMPTYFS_RAM_CHUNK) memset(p, 0, EMPTYFS_RAM_CHUNK);
+            f->chunk[ci] = p;
+            f->nalloc++;
+        }
+
+        e = xfer(ctx, p + co, k);
+        if (e != 0) {
+            /* xfer may have left garbage past EOF  restore the invariant */
+            z = 0;
+            if (n->size > ci * EMPTYFS_RAM_CHUNK) {
+                z = n->size - ci * EMPTYFS_RAM_CHUNK < EMPTYFS_RAM_CHUNK ?
+                    (size_t) (n->size - ci * EMPTYFS_RAM_CHUNK) : EMPTYFS_RAM_CHUNK;
+            }
+            memset(p + z, 0, EMPTYFS_RAM_CHUNK - z);
+            break;
+        }
+
+        *done += k;
+        off += k;
+        if (off > n->size) n->size = off;
+    }
+
+    if (*done != 0) {
+        ram->ops.now(&n->mtime);
+        n->ctime = n->mtime;
+    }
+
+    return e;
+}
+
+/**
+ * Set file size  chunks past it are freed  the tail chunk is zeroed past it
+ */
+static inline int emptyfs_ram_truncate(
+        struct emptyfs_ram *ram,
+        struct emptyfs_ram_node *n,
+        uint64_t size)
+{
+    struct emptyfs_ram_file *f = &n->u.file;
+    uint64_t ci;
+    size_t co;
+
+    if (n->type != EMPTYFS_RAM_REG) return EISDIR;
+    if (size > EMPTYFS_RAM_FILE_MAX) return EFBIG;
+
+    if (size < n->size) {
+        ci = (size + EMPTYFS_RAM_CHUNK - 1) / EMPTYFS_RAM_CHUNK;
+        for (; ci < f->nchunk; ci++) {
+            if (f->chunk[ci] == NULL) continue;
+            emptyfs_ram_chunk_free(ram, f->chunk[ci]);
+            f->chunk[ci] = NULL;
+            f->nalloc--;
+        }
+
+        ci = size / EMPTYFS_RAM_CHUNK;
+        co = (size_t) (size % EMPTYFS_RAM_CHUNK);
+        if (co != 0 && ci < f->nchunk && f->chunk[ci] != NULL)
+            memset(f->chunk[ci] + co, 0, EMPTYFS_RAM_CHUNK - co);
+    }
+
+    n->size = size;
+    ram->ops.now(&n->mtime);
+    n->ctime = n->mtime;
+    return 0;
+}
+
+#ifdef KERNEL
+#include <sys/vnode.h>
+#include <kern/locks.h>
+#include "emptyfs_vfsops.h"
+#include "emptyfs_attr.h"
+
+/*
+ * Namespace lock of a ramfs volume  no-ops on synthetic ones
+ *  XXX: never held across vnode_create()  vnode_put() and alike
+ *  :. they may reclaim a vnode  whose vnop_reclaim takes the lock exclusively
+ */
+static inline void emptyfs_ram_lock_shared(struct emptyfs_mount *mntp)
+{
+    if (mntp->ram != NULL) lck_rw_lock_shared(mntp->ram_lock);
+}
+
+static inline void emptyfs_ram_lock_exclusive(struct emptyfs_mount *mntp)
+{
+    if (mntp->ram != NULL) lck_rw_lock_exclusive(mntp->ram_lock);
+}
+
+static inline void emptyfs_ram_unlock(struct emptyfs_mount *mntp)
+{
+    if (mntp->ram != NULL) lck_rw_done(mntp->ram_lock);
+}
+
+int emptyfs_ram_mount(struct emptyfs_mount *, uint32_t, uid_t, gid_t);
+void emptyfs_ram_unmount(struct emptyfs_mount *);
+
+void emptyfs_ram_fill_attr(struct emptyfs_mount *,
+                            const struct emptyfs_ram_node *,
+                            struct emptyfs_attr *);
+void emptyfs_ram_statfs(struct emptyfs_mount *, struct vfs_attr *);
+
+int emptyfs_ram_vget(struct emptyfs_mount *, uint64_t,
+                        vnode_t, struct componentname *, vnode_t *);
+#endif
+
+#endif /* __EMPTYFS_RAM_H */
@@ -0,0 +1,118 @@
+/*
+ * Created 261018
+ *
+ * Per-CPU reference counter(percpu-ref style)
+ *  get/put touch only a counter slot of current CPU  no shared cache line
+ *  a slot alone may go negative(get on a CPU  put on another)
+ *  only the sum is meaningful  and only read when draining
+ *  once killed  gets fail and puts report that a drainer needs a wakeup
+ *
+ * Q: why not fold slots into a single atomic counter on kill like Linux?
+ *  folding is only safe after all in-flight per-CPU ops are done
+ *  which Linux learns from RCU  unavailable to a kext
+ *  instead each op pairs with kill by a full barrier(Dekker-style)
+ *  :. either the op sees the kill  or the drainer sees the op
+ *
+ * see: linux/include/linux/percpu-refcount.h
+ *
+ * XXX:
+ *  this header is shared with userspace(see: bench_emptyfs/)
+ *  .: it must only depend on plain integer types
+ */
+
+#ifndef __EMPTYFS_REF_H
+#define __EMPTYFS_REF_H
+
+#ifdef KERNEL
+#include <sys/types.h>
+#include <libkern/OSAtomic.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#endif
+
+/* more CPUs than slots is tolerated  some slots get shared */
+#define EMPTYFS_REF_NSLOT       64
+
+/*
+ * An add followed by a load of dead  must not be reordered
+ *  userspace gets it from seq_cst RMW + seq_cst load(no fence on x86)
+ */
+#ifdef KERNEL
+#define EMPTYFS_REF_ADD(p, v)   (void) OSAddAtomic64((SInt64) (v), (volatile SInt64 *) (p))
+#define EMPTYFS_REF_BARRIER()   OSMemoryBarrier()
+#define EMPTYFS_REF_DEAD(r)     ((r)->dead)
+#else
+#define EMPTYFS_REF_ADD(p, v)   (void) __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define EMPTYFS_REF_BARRIER()   ((void) 0)
+#define EMPTYFS_REF_DEAD(r)     __atomic_load_n(&(r)->dead, __ATOMIC_SEQ_CST)
+#endif
+
+struct emptyfs_ref_slot {
+    volatile int64_t cnt;
+} __attribute__((aligned(64)));
+
+/*
+ * All zeros is a live counter with no reference
+ */
+struct emptyfs_ref {
+    struct emptyfs_ref_slot slot[EMPTYFS_REF_NSLOT];
+    volatile uint32_t dead;
+};
+
+/**
+ * @cpu         index of current CPU(any value is correct  it's a hint)
+ * @return      0 if success  -1 if killed
+ *              in latter case the caller must wake up drainer
+ *              :. a drainer may have seen our transient increment
+ */
+static inline int emptyfs_ref_get(struct emptyfs_ref *r, uint32_t cpu)
+{
+    volatile int64_t *cnt = &r->slot[cpu % EMPTYFS_REF_NSLOT].cnt;
+
+    EMPTYFS_REF_ADD(cnt, 1);
+    EMPTYFS_REF_BARRIER();
+    if (__builtin_expect(EMPTYFS_REF_DEAD(r) != 0, 0)) {
+        EMPTYFS_REF_ADD(cnt, -1);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @return      non-zero if killed  i.e. the caller must wake up drainer
+ */
+static inline int emptyfs_ref_put(struct emptyfs_ref *r, uint32_t cpu)
+{
+    EMPTYFS_REF_ADD(&r->slot[cpu % EMPTYFS_REF_NSLOT].cnt, -1);
+    EMPTYFS_REF_BARRIER();
+    return EMPTYFS_REF_DEAD(r) != 0;
+}
+
+/**
+ * Make further gets fail  should be called only once
+ */
+static inline void emptyfs_ref_kill(struct emptyfs_ref *r)
+{
+#ifdef KERNEL
+    r->dead = 1;
+    OSMemoryBarrier();
+#else
+    __atomic_store_n(&r->dead, 1, __ATOMIC_SEQ_CST);
+#endif
+}
+
+/**
+ * @return      number of references held  exact once killed and quiescent
+ *              o.w. merely a snapshot
+ */
+static inline int64_t emptyfs_ref_sum(const struct emptyfs_ref *r)
+{
+    int64_t n = 0;
+    uint32_t i;
+
+    for (i = 0; i < EMPTYFS_REF_NSLOT; i++) n += r->slot[i].cnt;
+    return n;
+}
+
+#endif /* __EMPTYFS_REF_H */
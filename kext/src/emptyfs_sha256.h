@@ -0,0 +1,215 @@
+/*
+ * Created 261018
+ *
+ * SHA-256(FIPS 180-4)  one-shot  plus a multi-buffer kernel hashing
+ *  EMPTYFS_SHA256_LANES equal-length messages at once  a Merkle tree hashes
+ *  lots of blocks of the same size  so lanes are always full but the tail
+ *  each round is the same operation over all lanes  i.e. a lane loop
+ *  which compilers turn into SIMD(SSE2/AVX2/NEON) in userspace
+ *  in a kext(no SIMD)  lanes still run as independent dependency chains
+ *
+ * XXX:
+ *  this header is shared with userspace(see: mkfs_emptyfs/ img_emptyfs/ bench_emptyfs/)
+ *  .: it must only depend on plain integer types
+ */
+
+#ifndef __EMPTYFS_SHA256_H
+#define __EMPTYFS_SHA256_H
+
+#ifdef KERNEL
+#include <sys/types.h>
+#include <string.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#endif
+
+#define EMPTYFS_SHA256_LEN      32
+#define EMPTYFS_SHA256_LANES    4
+
+static const uint32_t emptyfs_sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t emptyfs_sha256_iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+#define EMPTYFS_SHA256_ROR(x, n)    (((x) >> (n)) | ((x) << (32 - (n))))
+
+static inline uint32_t emptyfs_sha256_be32(const uint8_t *p)
+{
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+/**
+ * Compress one 64-byte block into state
+ */
+static inline void emptyfs_sha256_block(uint32_t st[8], const uint8_t *p)
+{
+    uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+    int i;
+
+    for (i = 0; i < 16; i++) w[i] = emptyfs_sha256_be32(p + 4 * i);
+    for (i = 16; i < 64; i++) {
+        w[i] = w[i - 16] + w[i - 7] +
+            (EMPTYFS_SHA256_ROR(w[i - 15], 7) ^ EMPTYFS_SHA256_ROR(w[i - 15], 18) ^ (w[i - 15] >> 3)) +
+            (EMPTYFS_SHA256_ROR(w[i - 2], 17) ^ EMPTYFS_SHA256_ROR(w[i - 2], 19) ^ (w[i - 2] >> 10));
+    }
+
+    a = st[0]; b = st[1]; c = st[2]; d = st[3];
+    e = st[4]; f = st[5]; g = st[6]; h = st[7];
+    for (i = 0; i < 64; i++) {
+        t1 = h + (EMPTYFS_SHA256_ROR(e, 6) ^ EMPTYFS_SHA256_ROR(e, 11) ^ EMPTYFS_SHA256_ROR(e, 25)) +
+                ((e & f) ^ (~e & g)) + emptyfs_sha256_k[i] + w[i];
+        t2 = (EMPTYFS_SHA256_ROR(a, 2) ^ EMPTYFS_SHA256_ROR(a, 13) ^ EMPTYFS_SHA256_ROR(a, 22)) +
+                ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    st[0] += a; st[1] += b; st[2] += c; st[3] += d;
+    st[4] += e; st[5] += f; st[6] += g; st[7] += h;
+}
+
+/**
+ * Final block(s) of a message  i.e. its tail  0x80  zeros  and bit length
+ * @tail        the last len % 64 bytes
+ */
+static inline void emptyfs_sha256_pad(uint8_t pad[128], const uint8_t *tail, size_t len, size_t *npad)
+{
+    size_t r = len & 63, n = r < 56 ? 64 : 128;
+    uint64_t bits = (uint64_t) len << 3;
+    int i;
+
+    memset(pad, 0, 128);
+    memcpy(pad, tail, r);
+    pad[r] = 0x80;
+    for (i = 0; i < 8; i++) pad[n - 1 - i] = (uint8_t) (bits >> (8 * i));
+    *npad = n;
+}
+
+static inline void emptyfs_sha256_out(const uint32_t st[8], uint8_t *out)
+{
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        out[4 * i] = (uint8_t) (st[i] >> 24);
+        out[4 * i + 1] = (uint8_t) (st[i] >> 16);
+        out[4 * i + 2] = (uint8_t) (st[i] >> 8);
+        out[4 * i + 3] = (uint8_t) st[i];
+    }
+}
+
+static inline void emptyfs_sha256(const void *buf, size_t len, uint8_t out[EMPTYFS_SHA256_LEN])
+{
+    const uint8_t *p = (const uint8_t *) buf;
+    uint8_t pad[128];
+    uint32_t st[8];
+    size_t i, npad;
+
+    memcpy(st, emptyfs_sha256_iv, sizeof(st));
+    for (i = 0; i + 64 <= len; i += 64) emptyfs_sha256_block(st, p + i);
+
+    emptyfs_sha256_pad(pad, p + i, len, &npad);
+    for (i = 0; i < npad; i += 64) emptyfs_sha256_block(st, pad + i);
+
+    emptyfs_sha256_out(st, out);
+}
+
+/*
+ * Lane-parallel versions of the above  [i][l] is word i of lane l
+ */
+#define EMPTYFS_SHA256_LOOP(l)      for (l = 0; l < EMPTYFS_SHA256_LANES; l++)
+
+static inline void emptyfs_sha256_block_xn(
+        uint32_t st[8][EMPTYFS_SHA256_LANES],
+        const uint8_t * const p[EMPTYFS_SHA256_LANES])
+{
+    uint32_t w[64][EMPTYFS_SHA256_LANES];
+    uint32_t a[EMPTYFS_SHA256_LANES], b[EMPTYFS_SHA256_LANES], c[EMPTYFS_SHA256_LANES];
+    uint32_t d[EMPTYFS_SHA256_LANES], e[EMPTYFS_SHA256_LANES], f[EMPTYFS_SHA256_LANES];
+    uint32_t g[EMPTYFS_SHA256_LANES], h[EMPTYFS_SHA256_LANES];
+    uint32_t t1, t2;
+    int i, l;
+
+    for (i = 0; i < 16; i++) {
+        EMPTYFS_SHA256_LOOP(l) w[i][l] = emptyfs_sha256_be32(p[l] + 4 * i);
+    }
+    for (i = 16; i < 64; i++) {
+        EMPTYFS_SHA256_LOOP(l) {
+            w[i][l] = w[i - 16][l] + w[i - 7][l] +
+                (EMPTYFS_SHA256_ROR(w[i - 15][l], 7) ^ EMPTYFS_SHA256_ROR(w[i - 15][l], 18) ^
+                    (w[i - 15][l] >> 3)) +
+                (EMPTYFS_SHA256_ROR(w[i - 2][l], 17) ^ EMPTYFS_SHA256_ROR(w[i - 2][l], 19) ^
+                    (w[i - 2][l] >> 10));
+        }
+    }
+
+    EMPTYFS_SHA256_LOOP(l) {
+        a[l] = st[0][l]; b[l] = st[1][l]; c[l] = st[2][l]; d[l] = st[3][l];
+        e[l] = st[4][l]; f[l] = st[5][l]; g[l] = st[6][l]; h[l] = st[7][l];
+    }
+    for (i = 0; i < 64; i++) {
+        EMPTYFS_SHA256_LOOP(l) {
+            t1 = h[l] + (EMPTYFS_SHA256_ROR(e[l], 6) ^ EMPTYFS_SHA256_ROR(e[l], 11) ^
+                    EMPTYFS_SHA256_ROR(e[l], 25)) +
+                    ((e[l] & f[l]) ^ (~e[l] & g[l])) + emptyfs_sha256_k[i] + w[i][l];
+            t2 = (EMPTYFS_SHA256_ROR(a[l], 2) ^ EMPTYFS_SHA256_ROR(a[l], 13) ^
+                    EMPTYFS_SHA256_ROR(a[l], 22)) +
+                    ((a[l] & b[l]) ^ (a[l] & c[l]) ^ (b[l] & c[l]));
+            h[l] = g[l]; g[l] = f[l]; f[l] = e[l]; e[l] = d[l] + t1;
+            d[l] = c[l]; c[l] = b[l]; b[l] = a[l]; a[l] = t1 + t2;
+        }
+    }
+    EMPTYFS_SHA256_LOOP(l) {
+        st[0][l] += a[l]; st[1][l] += b[l]; st[2][l] += c[l]; st[3][l] += d[l];
+        st[4][l] += e[l]; st[5][l] += f[l]; st[6][l] += g[l]; st[7][l] += h[l];
+    }
+}
+
+/**
+ * Hash EMPTYFS_SHA256_LANES messages of the same length at once
+ * @buf         one message per lane
+ * @out         one digest per lane
+ */
+static inline void emptyfs_sha256_xn(
+        const void * const buf[EMPTYFS_SHA256_LANES],
+        size_t len,
+        uint8_t out[EMPTYFS_SHA256_LANES][EMPTYFS_SHA256_LEN])
+{
+    uint8_t pad[EMPTYFS_SHA256_LANES][128];
+    const uint8_t *p[EMPTYFS_SHA256_LANES];
+    uint32_t st[8][EMPTYFS_SHA256_LANES], s1[8];
+    size_t i, npad = 0;
+    int j, l;
+
+    for (j = 0; j < 8; j++) {
+        EMPTYFS_SHA256_LOOP(l) st[j][l] = emptyfs_sha256_iv[j];
+    }
+
+    for (i = 0; i + 64 <= len; i += 64) {
+        EMPTYFS_SHA256_LOOP(l) p[l] = (const uint8_t *) buf[l] + i;
+        emptyfs_sha256_block_xn(st, p);
+    }
+
+    EMPTYFS_SHA256_LOOP(l) emptyfs_sha256_pad(pad[l], (const uint8_t *) buf[l] + i, len, &npad);
+    for (i = 0; i < npad; i += 64) {
+        EMPTYFS_SHA256_LOOP(l) p[l] = pad[l] + i;
+        emptyfs_sha256_block_xn(st, p);
+    }
+
+    EMPTYFS_SHA256_LOOP(l) {
+        for (j = 0; j < 8; j++) s1[j] = st[j][l];
+        emptyfs_sha256_out(s1, out[l]);
+    }
+}
+
+#endif /* __EMPTYFS_SHA256_H */
@@ -0,0 +1,77 @@
+/*
+ * Created 261018
+ */
+
+#include <sys/types.h>
+#include <sys/sysctl.h>
+
+#include "emptyfs_stat.h"
+
+struct emptyfs_stat emptyfs_stat;
+
+/*
+ * VFS name cache hits never reach us  thus they can only be inferred
+ *  i.e. lookups avoided = path lookups issued - delta of `lookup'
+ * see: synth_emptyfs storm subcommand
+ */
+SYSCTL_DECL(_vfs_generic);
+
+SYSCTL_NODE(_vfs_generic, OID_AUTO, emptyfs,
+        CTLFLAG_RW | CTLFLAG_LOCKED, NULL, "emptyfs statistics");
+
+SYSCTL_QUAD(_vfs_generic_emptyfs, OID_AUTO, lookup,
+        CTLFLAG_RD | CTLFLAG_LOCKED,
+        (uint64_t *) &emptyfs_stat.lookup, "calls into vnop_lookup");
+
+SYSCTL_QUAD(_vfs_generic_emptyfs, OID_AUTO, lookup_enoent,
+        CTLFLAG_RD | CTLFLAG_LOCKED,
+        (uint64_t *) &emptyfs_stat.lookup_enoent, "lookups resulting ENOENT");
+
+SYSCTL_QUAD(_vfs_generic_emptyfs, OID_AUTO, cache_enter,
+        CTLFLAG_RD | CTLFLAG_LOCKED,
+        (uint64_t *) &emptyfs_stat.cache_enter, "positive name cache entries added");
+
+SYSCTL_QUAD(_vfs_generic_emptyfs, OID_AUTO, cache_enter_neg,
+        CTLFLAG_RD | CTLFLAG_LOCKED,
+        (uint64_t *) &emptyfs_stat.cache_enter_neg, "negative name cache entries added");
+
+SYSCTL_QUAD(_vfs_generic_emptyfs, OID_AUTO, mnt_pool_hit,
+        CTLFLAG_RD | CTLFLAG_LOCKED,
+        (uint64_t *) &emptyfs_stat.mnt_pool_hit, "mounts served by a pooled mount structure");
+
+SYSCTL_QUAD(_vfs_generic_emptyfs, OID_AUTO, mnt_pool_miss,
+        CTLFLAG_RD | CTLFLAG_LOCKED,
+        (uint64_t *) &emptyfs_stat.mnt_pool_miss, "mounts which built a mount structure");
+
+/*
+ * node must be registered before its children  and unregistered after
+ */
+static struct sysctl_oid *emptyfs_sysctl_oids[] = {
+    &sysctl__vfs_generic_emptyfs,
+    &sysctl__vfs_generic_emptyfs_lookup,
+    &sysctl__vfs_generic_emptyfs_lookup_enoent,
+    &sysctl__vfs_generic_emptyfs_cache_enter,
+    &sysctl__vfs_generic_emptyfs_cache_enter_neg,
+    &sysctl__vfs_generic_emptyfs_mnt_pool_hit,
+    &sysctl__vfs_generic_emptyfs_mnt_pool_miss,
+};
+
+void emptyfs_stat_init(void)
+{
+    size_t i;
+
+    bzero((void *) &emptyfs_stat, sizeof(emptyfs_stat));
+
+    for (i = 0; i < ARRAY_SIZE(emptyfs_sysctl_oids); i++) {
+        sysctl_register_oid(emptyfs_sysctl_oids[i]);
+    }
+}
+
+void emptyfs_stat_fini(void)
+{
+    size_t i = ARRAY_SIZE(emptyfs_sysctl_oids);
+
+    while (i-- != 0) {
+        sysctl_unregister_oid(emptyfs_sysctl_oids[i]);
+    }
+}
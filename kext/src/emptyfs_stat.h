@@ -0,0 +1,35 @@
+/*
+ * Created 261018
+ *
+ * Global statistics of emptyfs
+ *  exported read-only via sysctl vfs.generic.emptyfs.*
+ */
+
+#ifndef __EMPTYFS_STAT_H
+#define __EMPTYFS_STAT_H
+
+#include <libkern/OSAtomic.h>
+#include "utils.h"
+
+struct emptyfs_stat {
+    /* calls into vnop_lookup */
+    volatile uint64_t lookup;
+    /* lookups resulting ENOENT */
+    volatile uint64_t lookup_enoent;
+    /* positive/negative entries we added to VFS name cache */
+    volatile uint64_t cache_enter;
+    volatile uint64_t cache_enter_neg;
+    /* mounts served by a pooled emptyfs_mount  and by a fresh one */
+    volatile uint64_t mnt_pool_hit;
+    volatile uint64_t mnt_pool_miss;
+};
+
+readonly_extern struct emptyfs_stat emptyfs_stat;
+
+#define EMPTYFS_STAT_INC(field) \
+    (void) OSIncrementAtomic64((volatile SInt64 *) &emptyfs_stat.field)
+
+void emptyfs_stat_init(void);
+void emptyfs_stat_fini(void);
+
+#endif /* __EMPTYFS_STAT_H */
@@ -0,0 +1,267 @@
+/*
+ * Created 261018
+ *
+ * Procedural synthetic namespace
+ *  names, inode numbers, sizes and times are all computed from inode number
+ *  thus a synthetic volume costs no per-entry storage at all
+ *
+ * XXX:
+ *  this header is shared with userspace(see: synth_emptyfs/)
+ *  .: it must only depend on plain integer types
+ *
+ * [layout]
+ *  directories form a complete `fanout'-ary tree of `depth' levels
+ *  numbered in level order  i.e. root is directory 0  and children of
+ *  directory k are directories k * fanout + 1 ... k * fanout + fanout
+ *  each directory(leaves included) also holds `files' regular files
+ *  file j lives in directory j / files
+ *
+ *  inode of directory k is ROOT_INO + k
+ *  inode of file j is ROOT_INO + ndirs + j
+ *
+ *  in a directory  sub-directories are named d0, d1, ...
+ *  and regular files are named f0, f1, ...
+ *  readdir lists sub-directories first  followed by regular files
+ */
+
+#ifndef __EMPTYFS_SYNTH_H
+#define __EMPTYFS_SYNTH_H
+
+#ifdef KERNEL
+#include <sys/types.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#endif
+
+#define EMPTYFS_SYNTH_ROOT_INO      2
+/* largest inode number we ever hand out */
+#define EMPTYFS_SYNTH_INO_MAX       (1ULL << 62)
+
+/* "d" or "f" followed by at most 20 decimal digits  plus a NUL */
+#define EMPTYFS_SYNTH_NAME_MAX      22
+
+/* times are spread over about a year since 2017/07/14 */
+#define EMPTYFS_SYNTH_TIME_BASE     1500000000ULL
+#define EMPTYFS_SYNTH_TIME_SPAN     (1ULL << 25)
+/* file sizes are log-uniformly distributed in [0, 2^20) */
+#define EMPTYFS_SYNTH_SIZE_SHIFT    21
+/* nominal size of a directory entry  only used for directory sizes */
+#define EMPTYFS_SYNTH_DIRENT_SIZE   32
+
+struct emptyfs_synth {
+    uint32_t fanout;
+    uint32_t depth;
+    uint32_t files;     /* regular files per directory */
+    uint32_t seed;
+    uint64_t ndirs;     /* directories in total(root included) */
+    uint64_t ninner;    /* directories which have sub-directories */
+    uint64_t nfiles;    /* regular files in total */
+};
+
+/**
+ * @return      0 if success  -1 if the namespace is too large
+ */
+static inline int emptyfs_synth_init(
+        struct emptyfs_synth *sy,
+        uint32_t fanout,
+        uint32_t depth,
+        uint32_t files,
+        uint32_t seed)
+{
+    uint64_t level = 1;
+    uint64_t ndirs = 1;
+    uint32_t i;
+
+    if (fanout == 0) depth = 0;
+
+    for (i = 0; i < depth; i++) {
+        if (level > EMPTYFS_SYNTH_INO_MAX / fanout) return -1;
+        level *= fanout;
+        if (ndirs > EMPTYFS_SYNTH_INO_MAX - level) return -1;
+        ndirs += level;
+    }
+
+    if (files != 0 && ndirs > EMPTYFS_SYNTH_INO_MAX / files) return -1;
+    if (ndirs * files > EMPTYFS_SYNTH_INO_MAX - ndirs - EMPTYFS_SYNTH_ROOT_INO)
+        return -1;
+
+    sy->fanout = fanout;
+    sy->depth = depth;
+    sy->files = files;
+    sy->seed = seed;
+    sy->ndirs = ndirs;
+    sy->ninner = ndirs - level;
+    sy->nfiles = ndirs * files;
+    return 0;
+}
+
+static inline int emptyfs_synth_valid(const struct emptyfs_synth *sy, uint64_t ino)
+{
+    return ino >= EMPTYFS_SYNTH_ROOT_INO &&
+            ino - EMPTYFS_SYNTH_ROOT_INO < sy->ndirs + sy->nfiles;
+}
+
+static inline int emptyfs_synth_isdir(const struct emptyfs_synth *sy, uint64_t ino)
+{
+    return ino - EMPTYFS_SYNTH_ROOT_INO < sy->ndirs;
+}
+
+static inline uint64_t emptyfs_synth_parent(const struct emptyfs_synth *sy, uint64_t ino)
+{
+    uint64_t k = ino - EMPTYFS_SYNTH_ROOT_INO;
+
+    if (k < sy->ndirs) {
+        /* parent of root is itself */
+        return k == 0 ? ino : EMPTYFS_SYNTH_ROOT_INO + (k - 1) / sy->fanout;
+    }
+
+    return EMPTYFS_SYNTH_ROOT_INO + (k - sy->ndirs) / sy->files;
+}
+
+static inline uint32_t emptyfs_synth_nsubdirs(const struct emptyfs_synth *sy, uint64_t dino)
+{
+    return dino - EMPTYFS_SYNTH_ROOT_INO < sy->ninner ? sy->fanout : 0;
+}
+
+/**
+ * @return      number of entries in a directory(excluding "." and "..")
+ */
+static inline uint64_t emptyfs_synth_nentries(const struct emptyfs_synth *sy, uint64_t dino)
+{
+    return (uint64_t) emptyfs_synth_nsubdirs(sy, dino) + sy->files;
+}
+
+/**
+ * @return      inode number of i-th entry of a directory
+ *              i must less than emptyfs_synth_nentries()
+ */
+static inline uint64_t emptyfs_synth_child(
+        const struct emptyfs_synth *sy,
+        uint64_t dino,
+        uint64_t i)
+{
+    uint64_t k = dino - EMPTYFS_SYNTH_ROOT_INO;
+    uint32_t nsub = emptyfs_synth_nsubdirs(sy, dino);
+
+    if (i < nsub) return EMPTYFS_SYNTH_ROOT_INO + k * sy->fanout + 1 + i;
+    return EMPTYFS_SYNTH_ROOT_INO + sy->ndirs + k * sy->files + (i - nsub);
+}
+
+/**
+ * Format name of an inode(root has an empty name)
+ * @buf         at least EMPTYFS_SYNTH_NAME_MAX bytes
+ * @return      length of the name(excluding trailing NUL)
+ */
+static inline size_t emptyfs_synth_name(
+        const struct emptyfs_synth *sy,
+        uint64_t ino,
+        char *buf)
+{
+    uint64_t k = ino - EMPTYFS_SYNTH_ROOT_INO;
+    uint64_t idx;
+    char tmp[20];
+    size_t n = 0;
+    size_t len = 0;
+
+    if (k == 0) {
+        buf[0] = '\0';
+        return 0;
+    }
+
+    if (k < sy->ndirs) {
+        buf[len++] = 'd';
+        idx = (k - 1) % sy->fanout;
+    } else {
+        buf[len++] = 'f';
+        idx = (k - sy->ndirs) % sy->files;
+    }
+
+    do {
+        tmp[n++] = (char) ('0' + idx % 10);
+        idx /= 10;
+    } while (idx != 0);
+
+    while (n != 0) buf[len++] = tmp[--n];
+    buf[len] = '\0';
+
+    return len;
+}
+
+/**
+ * Look up a name in a directory  the name needn't be NUL-terminated
+ * @return      inode number of the entry  0 if not found
+ */
+static inline uint64_t emptyfs_synth_lookup(
+        const struct emptyfs_synth *sy,
+        uint64_t dino,
+        const char *name,
+        size_t len)
+{
+    uint64_t idx = 0;
+    uint64_t lim;
+    uint32_t nsub;
+    size_t i;
+
+    /* no leading zeros  so each entry has exactly one name */
+    if (len < 2 || len > EMPTYFS_SYNTH_NAME_MAX - 1) return 0;
+    if (name[1] == '0' && len != 2) return 0;
+
+    nsub = emptyfs_synth_nsubdirs(sy, dino);
+    if (name[0] == 'd') {
+        lim = nsub;
+    } else if (name[0] == 'f') {
+        lim = sy->files;
+    } else {
+        return 0;
+    }
+
+    for (i = 1; i < len; i++) {
+        if (name[i] < '0' || name[i] > '9') return 0;
+        idx = idx * 10 + (uint64_t) (name[i] - '0');
+        if (idx >= lim) return 0;
+    }
+
+    return emptyfs_synth_child(sy, dino, name[0] == 'd' ? idx : nsub + idx);
+}
+
+/*
+ * splitmix64 finalizer  see: http://xorshift.di.unimi.it/splitmix64.c
+ */
+static inline uint64_t emptyfs_synth_mix(const struct emptyfs_synth *sy, uint64_t ino)
+{
+    uint64_t z = ino + ((uint64_t) sy->seed << 32) + 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t emptyfs_synth_size(const struct emptyfs_synth *sy, uint64_t ino)
+{
+    uint64_t h;
+
+    if (emptyfs_synth_isdir(sy, ino))
+        return (emptyfs_synth_nentries(sy, ino) + 2) * EMPTYFS_SYNTH_DIRENT_SIZE;
+
+    h = emptyfs_synth_mix(sy, ino);
+    return (h >> 8) & ((1ULL << (h % EMPTYFS_SYNTH_SIZE_SHIFT)) - 1);
+}
+
+/**
+ * @return      modification time(in seconds since epoch) of an inode
+ *              creation  change and access time are the same
+ */
+static inline uint64_t emptyfs_synth_mtime(const struct emptyfs_synth *sy, uint64_t ino)
+{
+    return EMPTYFS_SYNTH_TIME_BASE +
+            (emptyfs_synth_mix(sy, ino) >> 40) % EMPTYFS_SYNTH_TIME_SPAN;
+}
+
+static inline uint64_t emptyfs_synth_nlink(const struct emptyfs_synth *sy, uint64_t ino)
+{
+    if (emptyfs_synth_isdir(sy, ino))
+        return 2 + (uint64_t) emptyfs_synth_nsubdirs(sy, ino);
+    return 1;
+}
+
+#endif /* __EMPTYFS_SYNTH_H */
@@ -0,0 +1,185 @@
+/*
+ * Created 261018
+ *
+ * Kernel side of binary trace ring  see: emptyfs_trace.h
+ */
+
+#include <sys/types.h>
+#include <sys/errno.h>
+#include <sys/sysctl.h>
+#include <sys/kauth.h>
+#include <kern/clock.h>
+
+#include "emptyfs_trace.h"
+#include "utils.h"
+
+#define TRACE_MASK      (EMPTYFS_TRACE_NREC - 1)
+
+/*
+ * Ring of a CPU  head sits in its own cache line
+ *  head is the number of records ever reserved  never wraps in practice
+ */
+struct trace_cpu {
+    volatile uint64_t head;
+    uint64_t pad[7];
+    struct emptyfs_trace_rec rec[EMPTYFS_TRACE_NREC];
+} __attribute__((aligned(64)));
+
+/* raw allocation(unaligned) and per-CPU rings carved from it */
+static void *trace_mem = NULL;
+static struct trace_cpu *trace_cpu = NULL;
+static uint32_t trace_ncpu = 0;
+
+/**
+ * Append a record to ring of current CPU  lock-free
+ *  a slot is reserved by an atomic increment  :. a thread preempted or
+ *  migrated midway never corrupts others' records
+ *  seq is zeroed before and set after the payload  readers drop torn records
+ *
+ * XXX:
+ *  two writers a whole ring apart may race on a slot(i.e. the ring lapped
+ *  while one was preempted)  the record may come out torn yet still valid
+ *  we accept it  it's a debugging aid
+ */
+void emptyfs_trace_emit(uint32_t ev, int err, const uint64_t *arg)
+{
+    struct trace_cpu *tc;
+    struct emptyfs_trace_rec *r;
+    uint64_t seq;
+    int cpu;
+    uint32_t i;
+
+    kassert(ev < EMPTYFS_TRACE_NEVENT);
+    kassert_nonnull(arg);
+
+    /* tracing disabled  i.e. emptyfs_trace_init() failed */
+    if (unlikely(trace_cpu == NULL)) return;
+
+    cpu = cpu_number();
+    tc = &trace_cpu[(uint32_t) cpu % trace_ncpu];
+    seq = (uint64_t) OSIncrementAtomic64((volatile SInt64 *) &tc->head);
+    r = &tc->rec[seq & TRACE_MASK];
+
+    r->seq = 0;
+    OSMemoryBarrier();
+    r->ts = mach_absolute_time();
+    r->event = (uint16_t) ev;
+    r->cpu = (uint16_t) cpu;
+    r->err = err;
+    for (i = 0; i < EMPTYFS_TRACE_NARG; i++) r->arg[i] = arg[i];
+    OSMemoryBarrier();
+    r->seq = seq + 1;
+}
+
+/*
+ * Copy out all rings  writes are ignored
+ *  records being written(or torn) go out with zero seq
+ */
+static int sysctl_trace(SYSCTL_HANDLER_ARGS)
+{
+    int e;
+    struct emptyfs_trace_hdr hdr;
+    struct emptyfs_trace_rec *buf;
+    struct emptyfs_trace_rec *r;
+    mach_timebase_info_data_t tb;
+    uint64_t seq;
+    uint32_t c, i;
+
+    UNUSED(oidp);
+    UNUSED(arg1);
+    UNUSED(arg2);
+
+    if (trace_cpu == NULL) return ENOENT;
+
+    /* records carry file names  only superuser may read them */
+    if (!kauth_cred_issuser(kauth_cred_get())) return EPERM;
+
+    clock_timebase_info(&tb);
+    hdr.magic = EMPTYFS_TRACE_MAGIC;
+    hdr.ncpu = trace_ncpu;
+    hdr.nrec = EMPTYFS_TRACE_NREC;
+    hdr.recsz = sizeof(struct emptyfs_trace_rec);
+    hdr.numer = tb.numer;
+    hdr.denom = tb.denom;
+
+    e = SYSCTL_OUT(req, &hdr, sizeof(hdr));
+    if (e != 0) return e;
+
+    /* a ring at a time  too large for kernel stack */
+    buf = util_malloc(sizeof(trace_cpu->rec), M_WAITOK);
+    if (buf == NULL) return ENOMEM;
+
+    for (c = 0; c < trace_ncpu; c++) {
+        for (i = 0; i < EMPTYFS_TRACE_NREC; i++) {
+            r = &trace_cpu[c].rec[i];
+            seq = r->seq;
+            OSMemoryBarrier();
+            buf[i] = *r;
+            OSMemoryBarrier();
+            if (r->seq != seq) buf[i].seq = 0;
+        }
+
+        e = SYSCTL_OUT(req, buf, sizeof(trace_cpu->rec));
+        if (e != 0) break;
+    }
+
+    util_mfree(buf);
+    return e;
+}
+
+SYSCTL_DECL(_vfs_generic_emptyfs);
+
+SYSCTL_PROC(_vfs_generic_emptyfs, OID_AUTO, trace,
+        CTLTYPE_OPAQUE | CTLFLAG_RD | CTLFLAG_LOCKED,
+        NULL, 0, sysctl_trace, "S,emptyfs_trace_hdr",
+        "per-CPU binary trace rings(superuser only)");
+
+/**
+ * Must be called after emptyfs_stat_init()  which registers parent node
+ * @return      0 if success  errno o.w.(tracing stays disabled)
+ */
+int emptyfs_trace_init(void)
+{
+    int e;
+    uint32_t ncpu;
+    size_t sz;
+
+    kassert_null(trace_mem);
+
+    e = util_ncpu(&ncpu);
+    if (e != 0) return e;
+
+    /* slack for cache line alignment */
+    sz = (size_t) ncpu * sizeof(*trace_cpu) + __alignof__(*trace_cpu);
+    trace_mem = util_malloc(sz, M_WAITOK | M_ZERO);
+    if (trace_mem == NULL) {
+        LOG_ERR("util_malloc() fail  size: %zu", sz);
+        return ENOMEM;
+    }
+
+    trace_ncpu = ncpu;
+    trace_cpu = (struct trace_cpu *) (((uintptr_t) trace_mem +
+                    __alignof__(*trace_cpu) - 1) & ~(uintptr_t) (__alignof__(*trace_cpu) - 1));
+
+    sysctl_register_oid(&sysctl__vfs_generic_emptyfs_trace);
+
+    LOG_DBG("tracing %u CPU ring(s) of %u records  %zu bytes",
+                trace_ncpu, EMPTYFS_TRACE_NREC, sz);
+
+    return 0;
+}
+
+/**
+ * Must be called when no op can be in flight  i.e. after vfs_fsremove()
+ */
+void emptyfs_trace_fini(void)
+{
+    if (trace_mem == NULL) return;
+
+    sysctl_unregister_oid(&sysctl__vfs_generic_emptyfs_trace);
+
+    trace_cpu = NULL;
+    trace_ncpu = 0;
+    util_mfree(trace_mem);
+    trace_mem = NULL;
+}
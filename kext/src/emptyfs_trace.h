@@ -0,0 +1,147 @@
+/*
+ * Created 261018
+ *
+ * Binary trace ring
+ *  fixed-size records(event id  timestamp  a few args)  no formatting in kernel
+ *  each CPU has its own ring  writers never take a lock
+ *  enabled per mount by dbg_mode  decoded offline(see: emptyfsctl trace)
+ *
+ * XXX:
+ *  this header is shared with userspace(see: emptyfsctl/)
+ *  .: it must only depend on plain integer types
+ */
+
+#ifndef __EMPTYFS_TRACE_H
+#define __EMPTYFS_TRACE_H
+
+#ifdef KERNEL
+#include <sys/types.h>
+#include <string.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#endif
+
+/*
+ * X-macro of all trace events  append only  ids are ABI
+ *  arg names are only used by decoder  "name" args hold 8 bytes of a name
+ *  vnop_default isn't traced :. it has no vnode  thus no mount to check
+ */
+#define EMPTYFS_TRACE_EVENTS(X)                                                              \
+    X(VNOP_LOOKUP,          "vnop_lookup",          "dino", "ino", "op", "len", "name")      \
+    X(VNOP_OPEN,            "vnop_open",            "ino", "mode", "", "", "")               \
+    X(VNOP_CLOSE,           "vnop_close",           "ino", "fflag", "", "", "")              \
+    X(VNOP_GETATTR,         "vnop_getattr",         "ino", "active", "", "", "")             \
+    X(VNOP_READDIR,         "vnop_readdir",         "ino", "off", "next", "num", "eof")      \
+    X(VNOP_GETATTRLISTBULK, "vnop_getattrlistbulk", "ino", "off", "next", "num", "eof")      \
+    X(VNOP_RECLAIM,         "vnop_reclaim",         "ino", "", "", "", "")                   \
+    X(VNOP_CREATE,          "vnop_create",          "dino", "ino", "mode", "len", "name")    \
+    X(VNOP_MKDIR,           "vnop_mkdir",           "dino", "ino", "mode", "len", "name")    \
+    X(VNOP_REMOVE,          "vnop_remove",          "dino", "ino", "flags", "len", "name")   \
+    X(VNOP_RMDIR,           "vnop_rmdir",           "dino", "ino", "", "len", "name")        \
+    X(VNOP_RENAME,          "vnop_rename",          "fdino", "ino", "tdino", "tino", "name") \
+    X(VNOP_READ,            "vnop_read",            "ino", "off", "len", "done", "size")     \
+    X(VNOP_WRITE,           "vnop_write",           "ino", "off", "len", "done", "size")     \
+    X(VNOP_SETATTR,         "vnop_setattr",         "ino", "active", "size", "mode", "")     \
+    X(VNOP_FSYNC,           "vnop_fsync",           "ino", "waitfor", "", "", "")            \
+    X(VNOP_PAGEIN,          "vnop_pagein",          "ino", "off", "size", "flags", "eof")      \
+    X(VNOP_PAGEOUT,         "vnop_pageout",         "ino", "off", "size", "flags", "eof")      \
+    X(VNOP_BLOCKMAP,        "vnop_blockmap",        "ino", "off", "size", "bpn", "run")      \
+    X(VNOP_STRATEGY,        "vnop_strategy",        "ino", "off", "len", "read", "done")
+
+#define EMPTYFS_TRACE_ENUM(ev, name, a0, a1, a2, a3, a4)    EMPTYFS_TRACE_ ## ev,
+enum {
+    EMPTYFS_TRACE_EVENTS(EMPTYFS_TRACE_ENUM)
+    EMPTYFS_TRACE_NEVENT
+};
+#undef EMPTYFS_TRACE_ENUM
+
+#define EMPTYFS_TRACE_NARG      5
+
+/* records per CPU  must be a power of 2 */
+#define EMPTYFS_TRACE_NREC      1024
+
+/* The fifth largest 32-bit De Bruijn constant */
+#define EMPTYFS_TRACE_MAGIC     0x0fb9ac4d
+
+/*
+ * A record  exactly a cache line
+ *  seq is the 1-based position in ring of its CPU  zero if invalid/torn
+ */
+struct emptyfs_trace_rec {
+    uint64_t seq;
+    uint64_t ts;            /* mach_absolute_time() */
+    uint16_t event;
+    uint16_t cpu;
+    int32_t err;            /* errno returned by the op */
+    uint64_t arg[EMPTYFS_TRACE_NARG];
+};
+
+/*
+ * What sysctl vfs.generic.emptyfs.trace returns
+ *  the header is followed by ncpu * nrec records  CPU by CPU  in ring order
+ *  rings are never consumed  a drainer tells new records by seq
+ */
+struct emptyfs_trace_hdr {
+    uint32_t magic;         /* must be EMPTYFS_TRACE_MAGIC */
+    uint32_t ncpu;
+    uint32_t nrec;          /* EMPTYFS_TRACE_NREC */
+    uint32_t recsz;         /* sizeof(struct emptyfs_trace_rec) */
+    uint32_t numer;         /* mach timebase  ns = ts * numer / denom */
+    uint32_t denom;
+};
+
+static inline const char *emptyfs_trace_name(uint32_t ev)
+{
+#define EMPTYFS_TRACE_NAME(ev, name, a0, a1, a2, a3, a4)    name,
+    static const char * const names[] = {
+        EMPTYFS_TRACE_EVENTS(EMPTYFS_TRACE_NAME)
+    };
+#undef EMPTYFS_TRACE_NAME
+    return ev < EMPTYFS_TRACE_NEVENT ? names[ev] : "?";
+}
+
+/**
+ * @return      name of an arg of an event  "" if the arg is unused
+ */
+static inline const char *emptyfs_trace_argname(uint32_t ev, uint32_t i)
+{
+#define EMPTYFS_TRACE_ARGS(ev, name, a0, a1, a2, a3, a4)    {a0, a1, a2, a3, a4},
+    static const char * const args[][EMPTYFS_TRACE_NARG] = {
+        EMPTYFS_TRACE_EVENTS(EMPTYFS_TRACE_ARGS)
+    };
+#undef EMPTYFS_TRACE_ARGS
+    return ev < EMPTYFS_TRACE_NEVENT && i < EMPTYFS_TRACE_NARG ? args[ev][i] : "";
+}
+
+/**
+ * Pack at most 8 leading bytes of a name into an arg  zero padded
+ *  byte order is kept  so that decoder can memcpy it back
+ */
+static inline uint64_t emptyfs_trace_name8(const char *name, size_t len)
+{
+    uint64_t w = 0;
+    memcpy(&w, name, len < sizeof(w) ? len : sizeof(w));
+    return w;
+}
+
+#ifdef KERNEL
+int emptyfs_trace_init(void);
+void emptyfs_trace_fini(void);
+
+void emptyfs_trace_emit(uint32_t, int, const uint64_t *);
+
+/*
+ * Emit a record if the mount has dbg_mode on  unspecified args are zero
+ *  a disabled trace point costs a load and a branch
+ */
+#define EMPTYFS_TRACE(mntp, ev, err, ...) do {                  \
+    if (unlikely((mntp)->dbg_mode)) {                           \
+        uint64_t _a[EMPTYFS_TRACE_NARG] = {__VA_ARGS__};        \
+        emptyfs_trace_emit(EMPTYFS_TRACE_ ## ev, (err), _a);    \
+    }                                                           \
+} while (0)
+#endif
+
+#endif /* __EMPTYFS_TRACE_H */
@@ -7,10 +7,16 @@
 #include <sys/mount.h>
 #include <sys/kauth.h>
 #include <sys/proc.h>
+#include <sys/ubc.h>
 #include <string.h>
 
 #include "emptyfs_vfsops.h"
 #include "emptyfs_vnops.h"
+#include "emptyfs_fsnode.h"
+#include "emptyfs_prof.h"
+#include "emptyfs_ram.h"
+#include "emptyfs_img.h"
+#include "emptyfs_stat.h"
 #include "emptyfs.h"
 #include "utils.h"
 
@@ -20,17 +26,58 @@ static int emptyfs_vfsop_unmount(struct mount *, int, vfs_context_t);
 static int emptyfs_vfsop_root(struct mount *, struct vnode **, vfs_context_t);
 static int emptyfs_vfsop_getattr(struct mount *, struct vfs_attr *, vfs_context_t);
 
+static int get_root_vnode(struct emptyfs_mount *, vnode_t *);
+
+/*
+ * Timed trampolines  every vfsop in the table below goes through one
+ *  see: emptyfs_prof.h
+ */
+static int emptyfs_vfsop_mount_prof(
+        struct mount *mp,
+        vnode_t devvp,
+        user_addr_t udata,
+        vfs_context_t ctx)
+{
+    return EMPTYFS_PROF_CALL(VFSOP_MOUNT, emptyfs_vfsop_mount(mp, devvp, udata, ctx));
+}
+
+static int emptyfs_vfsop_start_prof(struct mount *mp, int flags, vfs_context_t ctx)
+{
+    return EMPTYFS_PROF_CALL(VFSOP_START, emptyfs_vfsop_start(mp, flags, ctx));
+}
+
+static int emptyfs_vfsop_unmount_prof(struct mount *mp, int flags, vfs_context_t ctx)
+{
+    return EMPTYFS_PROF_CALL(VFSOP_UNMOUNT, emptyfs_vfsop_unmount(mp, flags, ctx));
+}
+
+static int emptyfs_vfsop_root_prof(
+        struct mount *mp,
+        struct vnode **vpp,
+        vfs_context_t ctx)
+{
+    return EMPTYFS_PROF_CALL(VFSOP_ROOT, emptyfs_vfsop_root(mp, vpp, ctx));
+}
+
+static int emptyfs_vfsop_getattr_prof(
+        struct mount *mp,
+        struct vfs_attr *attr,
+        vfs_context_t ctx)
+{
+    return EMPTYFS_PROF_CALL(VFSOP_GETATTR, emptyfs_vfsop_getattr(mp, attr, ctx));
+}
+
 /*
  * a structure that stores function pointers to all VFS routines
  *  these functions operates on the instances of the file system itself
  *  (rather NOT file system vnodes)
  */
 struct vfsops emptyfs_vfsops = {
-    .vfs_mount = emptyfs_vfsop_mount,
-    .vfs_start = emptyfs_vfsop_start,
-    .vfs_unmount = emptyfs_vfsop_unmount,
-    .vfs_root = emptyfs_vfsop_root,
-    .vfs_getattr = emptyfs_vfsop_getattr,
+    .vfs_mount = emptyfs_vfsop_mount_prof,
+    .vfs_start = emptyfs_vfsop_start_prof,
+    .vfs_unmount = emptyfs_vfsop_unmount_prof,
+    .vfs_root = emptyfs_vfsop_root_prof,
+    .vfs_getattr = emptyfs_vfsop_getattr_prof,
 };
 
 /*
@@ -48,89 +95,144 @@ struct emptyfs_mount *emptyfs_mount_from_mp(mount_t __nonnull mp)
 }
 
 #define VFS_ATTR_BLKSZ  4096
+/* even if the device takes more  st_blksize sizes stdio buffers */
+#define VFS_ATTR_IOSZ_MAX   (1U << 20)
 
-/*
- * Initialize `stuct vfs_attr''s f_capabilities and f_attributes
- * TODO: put those attrlist into a solo header
- * see: xnu/bsd/hfs/hfs_attrlist.h
+/**
+ * @return      preferred IO size of backing device  as cluster IO splits at it
+ *              a power-of-two multiple of VFS_ATTR_BLKSZ
+ *
+ * IO attributes of a mount are taken from devvp by VFS before vfsop_mount
+ *  see: vfs_init_io_attributes()  HFS reports the same as its f_iosize
  */
-static void emptyfs_init_volattrs(struct emptyfs_mount * __nonnull mntp)
+static uint32_t emptyfs_dev_iosize(mount_t __nonnull mp)
 {
-    vol_capabilities_attr_t *cap;
-    vol_attributes_attr_t *attr;
+    uint32_t n = cluster_max_io_size(mp, 0);
+    uint32_t sz = VFS_ATTR_BLKSZ;
 
-    kassert_nonnull(mntp);
+    while (sz < VFS_ATTR_IOSZ_MAX && sz * 2 <= n) sz *= 2;
+    return sz;
+}
 
-    cap = &mntp->attr.f_capabilities;
-    attr = &mntp->attr.f_attributes;
+/*
+ * Attributes we support  natively all of them
+ * see: xnu/bsd/hfs/hfs_attrlist.h
+ */
+#define EMPTYFS_VOL_ATTRSET {               \
+    .commonattr = 0                         \
+        | ATTR_CMN_NAME                     \
+        | ATTR_CMN_DEVID                    \
+        | ATTR_CMN_FSID                     \
+        | ATTR_CMN_OBJTYPE                  \
+        | ATTR_CMN_OBJID                    \
+        | ATTR_CMN_PAROBJID     /* Q: Parent object ID? */          \
+        | ATTR_CMN_CRTIME                   \
+        | ATTR_CMN_MODTIME                  \
+        | ATTR_CMN_CHGTIME      /* Same as ATTR_CMN_MODTIME */      \
+        | ATTR_CMN_ACCTIME                  \
+        | ATTR_CMN_OWNERID                  \
+        | ATTR_CMN_GRPID                    \
+        | ATTR_CMN_ACCESSMASK               \
+        | ATTR_CMN_FLAGS,                   \
+    .volattr = 0                            \
+        | ATTR_VOL_FSTYPE                   \
+        | ATTR_VOL_SIZE                     \
+        | ATTR_VOL_SPACEFREE                \
+        | ATTR_VOL_SPACEAVAIL               \
+        | ATTR_VOL_IOBLOCKSIZE              \
+        | ATTR_VOL_OBJCOUNT                 \
+        | ATTR_VOL_FILECOUNT                \
+        | ATTR_VOL_DIRCOUNT                 \
+        | ATTR_VOL_MAXOBJCOUNT              \
+        | ATTR_VOL_MOUNTPOINT               \
+        | ATTR_VOL_NAME                     \
+        | ATTR_VOL_MOUNTFLAGS               \
+        | ATTR_VOL_MOUNTEDDEVICE            \
+        | ATTR_VOL_CAPABILITIES             \
+        | ATTR_VOL_UUID                     \
+        | ATTR_VOL_ATTRIBUTES,              \
+    .dirattr = 0,                           \
+    .fileattr = 0                           \
+        | ATTR_FILE_TOTALSIZE               \
+        | ATTR_FILE_IOBLOCKSIZE             \
+        | ATTR_FILE_DATALENGTH              \
+        | ATTR_FILE_DATAALLOCSIZE,          \
+    .forkattr = 0,                          \
+}
 
-    cap->capabilities[VOL_CAPABILITIES_FORMAT] = 0
-        | VOL_CAP_FMT_NO_ROOT_TIMES
-        | VOL_CAP_FMT_CASE_SENSITIVE
-        | VOL_CAP_FMT_CASE_PRESERVING
-        | VOL_CAP_FMT_FAST_STATFS
-        | VOL_CAP_FMT_2TB_FILESIZE
+/*
+ * VFS attributes every mount starts with  copied in one block
+ *  volume-specific fields are filled by emptyfs_init_attrs()
+ */
+static const struct vfs_attr emptyfs_vfs_attr_tmpl = {
+    .f_bsize = VFS_ATTR_BLKSZ,
+    .f_blocks = 1,
+    .f_bfree = 0,
+    .f_bavail = 0,
+    .f_bused = 1,
+    .f_ffree = 0,
+    .f_fssubtype = 0,
+
+    .f_capabilities = {
+        .capabilities = {
+            [VOL_CAPABILITIES_FORMAT] = 0
+                | VOL_CAP_FMT_NO_ROOT_TIMES
+                | VOL_CAP_FMT_CASE_SENSITIVE
+                | VOL_CAP_FMT_CASE_PRESERVING
+                | VOL_CAP_FMT_FAST_STATFS
+                | VOL_CAP_FMT_2TB_FILESIZE
 #if defined(OS_VER_MIN_REQ) && OS_VER_MIN_REQ >= __MAC_10_12
-        | VOL_CAP_FMT_NO_PERMISSIONS
+                | VOL_CAP_FMT_NO_PERMISSIONS
 #elif defined(OS_VER_MIN_REQ)
 #warning Some volume capabilities may unavailable under macOS target <= 10.12
 #else
 #warning OS_VER_MIN_REQ undefined
 #endif
-        ;
-
-    /* XXX: forcibly mark all capabilities as valid? */
-    cap->valid[VOL_CAPABILITIES_FORMAT] = (__typeof(*(cap->valid))) -1;
-
-    cap->capabilities[VOL_CAPABILITIES_INTERFACES] = VOL_CAP_INT_ATTRLIST;
-    cap->valid[VOL_CAPABILITIES_INTERFACES] = (__typeof(*(cap->valid))) -1;
-
-    attr->validattr.commonattr = 0
-        | ATTR_CMN_NAME
-        | ATTR_CMN_DEVID
-        | ATTR_CMN_FSID
-        | ATTR_CMN_OBJTYPE
-        | ATTR_CMN_OBJID
-        | ATTR_CMN_PAROBJID     /* Q: Parent object ID? */
-        | ATTR_CMN_CRTIME
-        | ATTR_CMN_MODTIME
-        | ATTR_CMN_CHGTIME      /* Same as ATTR_CMN_MODTIME */
-        | ATTR_CMN_ACCTIME
-        | ATTR_CMN_OWNERID
-        | ATTR_CMN_GRPID
-        | ATTR_CMN_ACCESSMASK
-        | ATTR_CMN_FLAGS;
-
-    attr->validattr.dirattr = 0;
-
-    attr->validattr.fileattr = 0
-        | ATTR_FILE_TOTALSIZE
-        | ATTR_FILE_IOBLOCKSIZE
-        | ATTR_FILE_DATALENGTH
-        | ATTR_FILE_DATAALLOCSIZE;
-
-    attr->validattr.forkattr = 0;
-
-    attr->validattr.volattr = 0
-        | ATTR_VOL_FSTYPE
-        | ATTR_VOL_SIZE
-        | ATTR_VOL_SPACEFREE
-        | ATTR_VOL_SPACEAVAIL
-        | ATTR_VOL_IOBLOCKSIZE
-        | ATTR_VOL_OBJCOUNT
-        | ATTR_VOL_FILECOUNT
-        | ATTR_VOL_DIRCOUNT
-        | ATTR_VOL_MAXOBJCOUNT
-        | ATTR_VOL_MOUNTPOINT
-        | ATTR_VOL_NAME
-        | ATTR_VOL_MOUNTFLAGS
-        | ATTR_VOL_MOUNTEDDEVICE
-        | ATTR_VOL_CAPABILITIES
-        | ATTR_VOL_UUID
-        | ATTR_VOL_ATTRIBUTES;
-
-    /* All attributes that we do support  we support natively */
-    bcopy(&attr->validattr, &attr->nativeattr, sizeof(attr->validattr));
+                ,
+            [VOL_CAPABILITIES_INTERFACES] = VOL_CAP_INT_ATTRLIST,
+        },
+        /* XXX: forcibly mark all capabilities as valid? */
+        .valid = {
+            [VOL_CAPABILITIES_FORMAT] = (u_int32_t) -1,
+            [VOL_CAPABILITIES_INTERFACES] = (u_int32_t) -1,
+        },
+    },
+
+    .f_attributes = {
+        .validattr = EMPTYFS_VOL_ATTRSET,
+        .nativeattr = EMPTYFS_VOL_ATTRSET,
+    },
+
+    /* remaining not supported implicitly */
+};
+
+/*
+ * Per-load random base of volume UUIDs  see: emptyfs_mount_uuid()
+ */
+static uuid_t mnt_uuid_base;
+static volatile UInt64 mnt_uuid_seq = 0;
+
+/**
+ * Derive a volume UUID from mnt_uuid_base  cheaper than uuid_generate_random()
+ *  a bijective mix of a sequence number is folded into the random bits
+ *  .: no two mounts of a load share a UUID  and loads are unrelated
+ */
+static void emptyfs_mount_uuid(uuid_t uu)
+{
+    uint64_t x = (uint64_t) OSIncrementAtomic64((volatile SInt64 *) &mnt_uuid_seq);
+    uint32_t i;
+
+    /* splitmix64 finalizer */
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+
+    bcopy(mnt_uuid_base, uu, sizeof(uuid_t));
+    /* byte 6 and 8 carry version and variant of a random UUID  leave them be */
+    for (i = 0; i < 6; i++) uu[i] ^= (uint8_t) (x >> (i * 8));
+    uu[10] ^= (uint8_t) (x >> 48);
+    uu[11] ^= (uint8_t) (x >> 56);
 }
 
 /*
@@ -153,41 +255,144 @@ static void emptyfs_init_attrs(
     kassert_nonnull(cred);
     uid = kauth_cred_getuid(cred);
 
-    mntp->attr.f_objcount = 1;
-    mntp->attr.f_filecount = 0;
-    mntp->attr.f_dircount = 1;
-    mntp->attr.f_maxobjcount = 1;
+    bcopy(&emptyfs_vfs_attr_tmpl, &mntp->attr, sizeof(mntp->attr));
+
+    mntp->attr.f_objcount = mntp->synth.ndirs + mntp->synth.nfiles;
+    mntp->attr.f_filecount = mntp->synth.nfiles;
+    mntp->attr.f_dircount = mntp->synth.ndirs;
+    mntp->attr.f_maxobjcount = mntp->attr.f_objcount;
 
-    mntp->attr.f_bsize = VFS_ATTR_BLKSZ;
-    mntp->attr.f_iosize = VFS_ATTR_BLKSZ;
-    mntp->attr.f_blocks = 1;
-    mntp->attr.f_bfree = 0;
-    mntp->attr.f_bavail = 0;
-    mntp->attr.f_bused = 1;
-    mntp->attr.f_files = 1;
-    mntp->attr.f_ffree = 0;
+    mntp->attr.f_iosize = emptyfs_dev_iosize(mntp->mp);
+    mntp->attr.f_files = mntp->attr.f_objcount;
 
     mntp->attr.f_fsid.val[0] = mntp->devid;
     mntp->attr.f_fsid.val[1] = vfs_typenum(mntp->mp);
     mntp->attr.f_owner = uid;
 
-    emptyfs_init_volattrs(mntp);
-
     nanotime(&ts);
     LOG_DBG("fs ctime mtim atime: %ld", ts.tv_sec + (ts.tv_nsec / 1000000000L));
     bcopy(&ts, &mntp->attr.f_create_time, sizeof(ts));
     bcopy(&ts, &mntp->attr.f_modify_time, sizeof(ts));
     bcopy(&ts, &mntp->attr.f_access_time, sizeof(ts));
 
-    mntp->attr.f_fssubtype = 0;
-
     mntp->attr.f_vol_name = mntp->volname;
 
-    uuid_generate_random(mntp->attr.f_uuid);
+    emptyfs_mount_uuid(mntp->attr.f_uuid);
     format_uuid_string(mntp->attr.f_uuid, uuid);
     LOG_DBG("file system UUID: %s", uuid);
+}
 
-    /* remaining not supported implicitly */
+/*
+ * Pool of idle mount structures
+ *  a pooled one keeps its fsnode hash(shard locks and buckets)
+ *  thus a mount/unmount cycle of a placeholder volume mostly allocates nothing
+ */
+#define EMPTYFS_MNT_POOL_MAX    8
+
+static lck_mtx_t *mnt_pool_lock = NULL;
+static struct emptyfs_mount *mnt_pool = NULL;
+static uint32_t mnt_pool_count = 0;
+
+/**
+ * @return      0 if success  errno o.w.(mounts then bypass the pool)
+ */
+int emptyfs_mount_pool_init(void)
+{
+    kassert_null(mnt_pool);
+
+    uuid_generate_random(mnt_uuid_base);
+    mnt_uuid_seq = 0;
+
+    mnt_pool_lock = lck_mtx_alloc_init(lckgrp, NULL);
+    return mnt_pool_lock != NULL ? 0 : ENOMEM;
+}
+
+/*
+ * XXX: call after vfs_fsremove()  i.e. no volume mounted
+ */
+void emptyfs_mount_pool_fini(void)
+{
+    struct emptyfs_mount *mntp;
+
+    while ((mntp = mnt_pool) != NULL) {
+        mnt_pool = mntp->pool_next;
+        emptyfs_fsnode_fini(mntp);
+        util_mfree(mntp);
+    }
+    mnt_pool_count = 0;
+
+    if (mnt_pool_lock != NULL) {
+        lck_mtx_free(mnt_pool_lock, lckgrp);
+        mnt_pool_lock = NULL;
+    }
+}
+
+/**
+ * @return      a zeroed mount structure with fsnode hash initialized
+ *              NULL if out of memory
+ */
+static struct emptyfs_mount *emptyfs_mount_alloc(void)
+{
+    struct emptyfs_mount *mntp = NULL;
+    struct emptyfs_fsnode_shard *shards;
+
+    if (mnt_pool_lock != NULL) {
+        lck_mtx_lock(mnt_pool_lock);
+        mntp = mnt_pool;
+        if (mntp != NULL) {
+            mnt_pool = mntp->pool_next;
+            mnt_pool_count--;
+        }
+        lck_mtx_unlock(mnt_pool_lock);
+    }
+
+    if (mntp != NULL) {
+        /* all but the fsnode hash starts over */
+        shards = mntp->fsnode_shards;
+        bzero(mntp, sizeof(*mntp));
+        mntp->fsnode_shards = shards;
+        EMPTYFS_STAT_INC(mnt_pool_hit);
+        return mntp;
+    }
+
+    mntp = util_malloc(sizeof(*mntp), M_ZERO);
+    if (mntp == NULL) return NULL;
+
+    if (emptyfs_fsnode_init(mntp) != 0) {
+        util_mfree(mntp);
+        return NULL;
+    }
+
+    EMPTYFS_STAT_INC(mnt_pool_miss);
+    return mntp;
+}
+
+/*
+ * Put a mount structure back to the pool  free it if the pool is full
+ * XXX: call after vflush()  see: emptyfs_fsnode_reset()
+ */
+static void emptyfs_mount_free(struct emptyfs_mount * __nonnull mntp)
+{
+    int pooled = 0;
+
+    kassert_nonnull(mntp);
+
+    if (mnt_pool_lock != NULL && mntp->fsnode_shards != NULL &&
+            emptyfs_fsnode_reset(mntp) == 0) {
+        lck_mtx_lock(mnt_pool_lock);
+        if (mnt_pool_count < EMPTYFS_MNT_POOL_MAX) {
+            mntp->pool_next = mnt_pool;
+            mnt_pool = mntp;
+            mnt_pool_count++;
+            pooled = 1;
+        }
+        lck_mtx_unlock(mnt_pool_lock);
+    }
+
+    if (!pooled) {
+        emptyfs_fsnode_fini(mntp);
+        util_mfree(mntp);
+    }
 }
 
 /*
@@ -233,6 +438,8 @@ static int emptyfs_vfsop_mount(
     struct emptyfs_mnt_args args;
     struct emptyfs_mount *mntp;
     struct vfsstatfs *st;
+    kauth_cred_t cred;
+    uint64_t mntflags;
 
     kassert_nonnull(mp);
     kassert_nonnull(devvp);
@@ -264,10 +471,24 @@ static int emptyfs_vfsop_mount(
         goto out_exit;
     }
 
-    mntp = util_malloc(sizeof(*mntp), M_ZERO);
+    if (args.flags & ~EMPTYFS_MNT_KNOWN_FLAGS) {
+        e = EINVAL;
+        LOG_ERR("unknown mount options from mount(2)  flags: %#x", args.flags);
+        goto out_exit;
+    }
+
+    /* a volume has either namespace  never both */
+    if ((args.flags & EMPTYFS_MNT_RAMFS) && (args.fanout | args.depth | args.files)) {
+        e = EINVAL;
+        LOG_ERR("ramfs mount with synthetic namespace  fanout: %u depth: %u files: %u",
+                    args.fanout, args.depth, args.files);
+        goto out_exit;
+    }
+
+    mntp = emptyfs_mount_alloc();
     if (mntp == NULL) {
         e = ENOMEM;
-        LOG_ERR("util_malloc() fail  errno: %d", e);
+        LOG_ERR("emptyfs_mount_alloc() fail  errno: %d", e);
         goto out_exit;
     }
 
@@ -283,27 +504,50 @@ static int emptyfs_vfsop_mount(
     mntp->devvp = devvp;
     mntp->devid = vnode_specrdev(devvp);
 
-    mntp->mtx_root = lck_mtx_alloc_init(lckgrp, NULL);
-    if (mntp->mtx_root == NULL) {
-        e = ENOMEM;
-        LOG_ERR("lck_mtx_alloc_init() fail  errno: %d", e);
-        goto out_exit;
-    }
-
     mntp->magic = EMPTYFS_MNT_MAGIC;
     mntp->mp = mp;
     mntp->dbg_mode = args.dbg_mode;
+    mntp->flags = args.flags;
     kassert(strlen(EMPTYFS_NAME) < sizeof(mntp->volname));
     (void) strlcpy(mntp->volname, EMPTYFS_NAME, sizeof(mntp->volname));
+
+    if (emptyfs_synth_init(&mntp->synth, args.fanout, args.depth,
+                            args.files, args.seed) != 0) {
+        e = EINVAL;
+        LOG_ERR("synthetic namespace too large  fanout: %u depth: %u files: %u",
+                    args.fanout, args.depth, args.files);
+        goto out_exit;
+    }
+
     /*
-     * make sure that mntp->devid initialized
-     * :. emptyfs_init_attrs() reads it
+     * make sure that mntp->devid and mntp->synth initialized
+     * :. emptyfs_init_attrs() reads them
      */
     emptyfs_init_attrs(mntp, ctx);
 
-    kassert(!mntp->is_root_attaching);
-    kassert(!mntp->is_root_waiting);
-    kassert(mntp->rootvp == NULL);
+    if (args.flags & EMPTYFS_MNT_RAMFS) {
+        cred = vfs_context_ucred(ctx);
+        e = emptyfs_ram_mount(mntp, args.ram_mb,
+                    kauth_cred_getuid(cred), kauth_cred_getgid(cred));
+        if (e) {
+            LOG_ERR("emptyfs_ram_mount() fail  size: %uMB errno: %d", args.ram_mb, e);
+            goto out_exit;
+        }
+        /* usage varies  initial values only seed vfsstatfs below */
+        emptyfs_ram_statfs(mntp, &mntp->attr);
+    } else if ((args.fanout | args.depth | args.files) == 0) {
+        /* neither namespace asked for  serve what the device carries */
+        e = emptyfs_img_mount(mntp, args.cache_mb, args.root);
+        if (e == 0) {
+            emptyfs_img_init_attrs(mntp);
+        } else if (e == ENOENT) {
+            /* a blank device  i.e. an empty root as ever */
+            e = 0;
+        } else {
+            LOG_ERR("emptyfs_img_mount() fail  errno: %d", e);
+            goto out_exit;
+        }
+    }
 
     st = vfs_statfs(mp);
     kassert_nonnull(st);
@@ -320,8 +564,9 @@ static int emptyfs_vfsop_mount(
     st->f_fsid = mntp->attr.f_fsid;
     st->f_owner = mntp->attr.f_owner;
 
-    vfs_setflags(mp, MNT_RDONLY | MNT_NOEXEC | MNT_NOSUID |
-                        MNT_NODEV | MNT_IGNORE_OWNERSHIP);
+    mntflags = MNT_NOEXEC | MNT_NOSUID | MNT_NODEV | MNT_IGNORE_OWNERSHIP;
+    if (mntp->ram == NULL) mntflags |= MNT_RDONLY;
+    vfs_setflags(mp, mntflags);
 
     /* no need to call vnode_setmountedon() :. the system already done that */
 
@@ -331,8 +576,10 @@ static int emptyfs_vfsop_mount(
         LOG_ERR("mount emptyfs success yet force failure  errno: %d", e);
         goto out_exit;
     } else {
-        LOG_INF("mount emptyfs success  rdev: %#x dbg: %d",
-                    mntp->devid, mntp->dbg_mode);
+        LOG_INF("mount emptyfs success  rdev: %#x dbg: %d dirs: %llu files: %llu ramfs: %d image: %d",
+                    mntp->devid, mntp->dbg_mode,
+                    mntp->attr.f_dircount, mntp->attr.f_filecount,
+                    mntp->ram != NULL, mntp->img != NULL);
     }
 
 out_exit:
@@ -357,6 +604,11 @@ out_exit:
  *  if you glue a NULL to vfs_start field  it returns ENOTSUP
  *  and the caller ignores the result
  *
+ * if EMPTYFS_MNT_PINROOT  root vnode is created here  and a usecount keeps it
+ *  o.w. the first access of a fresh volume pays for vnode_create()  and
+ *  concurrent ones wait for it  see: emptyfs_fsnode_get()
+ * failure is harmless  root is then created lazily as ever
+ *
  * @mp      the mount structure reference
  * @flags   unused
  * @ctx     context to authenticate for mount
@@ -372,12 +624,37 @@ static int emptyfs_vfsop_start(
         int flags,
         vfs_context_t ctx)
 {
+    int e;
+    vnode_t vp = NULLVP;
+    struct emptyfs_mount *mntp;
+
     kassert_nonnull(mp);
     kassert_known_flags(flags, 0);
     kassert_nonnull(ctx);
 
     LOG_DBG("mp: %p flags: %#x", mp, flags);
 
+    mntp = emptyfs_mount_from_mp(mp);
+    if (!(mntp->flags & EMPTYFS_MNT_PINROOT)) goto out_exit;
+
+    kassert_null(mntp->root_pin);
+
+    e = get_root_vnode(mntp, &vp);
+    if (e) {
+        LOG_ERR("get_root_vnode() fail  root stays lazy  errno: %d", e);
+        goto out_exit;
+    }
+
+    /* usecount  unlike iocount  may be held indefinitely */
+    e = vnode_ref(vp);
+    if (e) {
+        LOG_ERR("vnode_ref() fail  root stays lazy  errno: %d", e);
+    } else {
+        mntp->root_pin = vp;
+    }
+    (void) vnode_put(vp);
+
+out_exit:
     return 0;
 }
 
@@ -396,6 +673,8 @@ static int emptyfs_vfsop_unmount(
     int e;
     int flush_flags;
     struct emptyfs_mount *mntp;
+    vnode_t pin = NULLVP;
+    uint32_t pin_vid = 0;
 
     kassert_nonnull(mp);
     kassert_known_flags(flags, MNT_FORCE);
@@ -405,35 +684,62 @@ static int emptyfs_vfsop_unmount(
 
     flush_flags = (flags & MNT_FORCE) ? FORCECLOSE : 0;
 
+    mntp = vfs_fsprivate(mp);
+
+    /*
+     * pinned root is busy by our own usecount  flush the rest first
+     *  so that a busy volume keeps its root pinned
+     */
+    if (mntp != NULL && mntp->root_pin != NULLVP) {
+        e = vflush(mp, mntp->root_pin, flush_flags);
+        if (e) {
+            LOG_ERR("vflush() fail  errno: %d", e);
+            goto out_exit;
+        }
+
+        /* root may still be busy by others  vflush() below tells */
+        pin = mntp->root_pin;
+        pin_vid = vnode_vid(pin);
+        vnode_rele(pin);
+        mntp->root_pin = NULLVP;
+    }
+
     e = vflush(mp, NULL, flush_flags);
     if (e) {
         LOG_ERR("vflush() fail  errno: %d", e);
+        /* volume stays mounted  pin its root again unless it's gone */
+        if (pin != NULLVP && vnode_getwithvid(pin, pin_vid) == 0) {
+            if (vnode_ref(pin) == 0) {
+                mntp->root_pin = pin;
+            } else {
+                LOG_ERR("vnode_ref() fail  root goes lazy");
+            }
+            (void) vnode_put(pin);
+        }
         goto out_exit;
     }
 
-    mntp = vfs_fsprivate(mp);
     if (mntp == NULL) goto out_exit;
 
+    /* vflush() above left no vnode  devvp goes after :. its buf cache is purged */
+    emptyfs_img_unmount(mntp);
+
     if (mntp->devvp != NULL) {
         vnode_rele(mntp->devvp);
         mntp->devvp = NULL;
         mntp->devid = 0;
     }
 
-    kassert(!mntp->is_root_attaching);
-    kassert(!mntp->is_root_waiting);
-
-    /*
-     * vflush() call above forces VFS to reclaim any vnode in our volume
-     *  in such case  the root vnode should be NULL
-     */
-    kassert(mntp->rootvp == NULL);
-
-    if (mntp->mtx_root != NULL) lck_mtx_free(mntp->mtx_root, lckgrp);
+    /* vflush() above reclaimed every vnode  no vnode holds a ramfs node any more */
+    emptyfs_ram_unmount(mntp);
 
     mntp->magic = 0;    /* our mount invalidated  reset the magic */
 
-    util_mfree(mntp);
+    /*
+     * ditto  the fsnode hash should be empty
+     *  it's kept along with the structure if pooled
+     */
+    emptyfs_mount_free(mntp);
 
 out_exit:
     return e;
@@ -448,105 +754,17 @@ static int get_root_vnode(
         struct emptyfs_mount * __nonnull mntp,
         vnode_t * __nonnull vpp)
 {
-    int e;
-    int e2;
-    vnode_t vn = NULL;
-    uint32_t vid;
-    struct vnode_fsparam param;
-
     kassert_nonnull(mntp);
     kassert_nonnull(vpp);
     kassert_null(*vpp);
 
-    lck_mtx_lock(mntp->mtx_root);
-
-    do {
-        kassert_null(vn);
-        lck_mtx_assert(mntp->mtx_root, LCK_MTX_ASSERT_OWNED);
-
-        if (mntp->is_root_attaching) {
-            mntp->is_root_waiting = 1;
-            (void) msleep(&mntp->rootvp, mntp->mtx_root, PINOD, NULL, NULL);
-            kassert(mntp->is_root_waiting == 0);
-            e = EAGAIN;
-        } else if (mntp->rootvp == NULLVP) {
-            mntp->is_root_attaching = 1;
-            lck_mtx_unlock(mntp->mtx_root);
-
-            param.vnfs_mp = mntp->mp;
-            param.vnfs_vtype = VDIR;
-            param.vnfs_str = NULL;
-            param.vnfs_dvp = NULL;
-            param.vnfs_fsnode = NULL;
-            param.vnfs_vops = emptyfs_vnop_p;
-            param.vnfs_markroot = 1;
-            param.vnfs_marksystem = 0;
-            param.vnfs_rdev = 0;        /* we don't support VBLK and VCHR */
-            param.vnfs_filesize = 0;    /* nonsense for VDIR */
-            param.vnfs_cnp = NULL;
-            param.vnfs_flags = VNFS_NOCACHE | VNFS_CANTCACHE;   /* no namecache */
-
-            e = vnode_create(VNCREATE_FLAVOR, sizeof(param), &param, &vn);
-            if (e == 0) {
-                kassert_nonnull(vn);
-                LOG_DBG("vnode_create() ok  vn: %p vid: %#x", vn, vnode_vid(vn));
-            } else {
-                kassert_null(vn);
-                LOG_ERR("vnode_create() fail  errno: %d", e);
-            }
-
-            lck_mtx_lock(mntp->mtx_root);
-            if (e == 0) {
-                kassert_null(mntp->rootvp);
-                mntp->rootvp = vn;
-                e2 = vnode_addfsref(vn);
-                kassertf(e2 == 0, "vnode_addfsref() fail  errno: %d", e2);
-
-                kassert(mntp->is_root_attaching);
-                mntp->is_root_attaching = 0;
-                if (mntp->is_root_waiting) {
-                    mntp->is_root_waiting = 0;      /* reset beforehand */
-                    wakeup(&mntp->rootvp);
-                }
-            }
-        } else {
-            /* we already have a root vnode  try get with vnode vid */
-            vn = mntp->rootvp;
-            kassert_nonnull(vn);
-            vid = vnode_vid(vn);
-            lck_mtx_unlock(mntp->mtx_root);
-
-            e = vnode_getwithvid(vn, vid);
-            if (e == 0) {
-                /*
-                 * ok  vnode_getwithvid() has taken an IO refcnt. to the vnode
-                 * this reference prevent from being reclaimed in the interim
-                 */
-            } else {
-                /*
-                 * the vnode has been relaimed  likely between dropping the lock
-                 *  and calling the vnode_getwithvid()
-                 * .: we loop again to get updated vnode root(hopefully)
-                 */
-                LOG_ERR("vnode_getwithvid() fail  errno: %d", e);
-                vn = NULL;                      /* loop invariant */
-                e = EAGAIN;
-            }
-
-            lck_mtx_lock(mntp->mtx_root);       /* loop invariant */
-        }
-    } while (e == EAGAIN);
-
-    lck_mtx_unlock(mntp->mtx_root);
-
-    if (e == 0) {
-        kassert_nonnull(vn);
-        *vpp = vn;
-    } else {
-        kassert_null(vn);
+    if (mntp->ram != NULL) {
+        return emptyfs_ram_vget(mntp, EMPTYFS_ROOT_INO, NULLVP, NULL, vpp);
     }
-
-    return e;
+    if (mntp->img != NULL) {
+        return emptyfs_img_vget(mntp, EMPTYFS_ROOT_INO, NULLVP, NULL, vpp);
+    }
+    return emptyfs_synth_vget(mntp, EMPTYFS_ROOT_INO, NULLVP, NULL, vpp);
 }
 
 /*
@@ -597,6 +815,8 @@ static int emptyfs_vfsop_root(
  * @return  0 :. always success
  *
  * this implementation is trivial :. our file system attributes are static
+ *  (those of an image volume included  see: emptyfs_img_init_attrs())
+ *  except usage of a ramfs volume  which is taken on each call
  */
 static int emptyfs_vfsop_getattr(
         struct mount *mp,
@@ -658,6 +878,9 @@ static int emptyfs_vfsop_getattr(
     /* no support f_quota */
     /* no support f_reserved */
 
+    /* overrides static counts and blocks above */
+    if (mntp->ram != NULL) emptyfs_ram_statfs(mntp, attr);
+
     LOG_DBG("f_active: %#llx f_supported: %#llx",
             attr->f_active, attr->f_supported);
 
@@ -7,6 +7,7 @@
 
 #include <sys/mount.h>
 #include <libkern/locks.h>
+#include "emptyfs_synth.h"
 #include "utils.h"
 
 readonly_extern struct vfsops emptyfs_vfsops;
@@ -16,13 +17,20 @@ readonly_extern struct vfsops emptyfs_vfsops;
 
 #define EMPTYFS_VOLNAME_MAXLEN  32
 
+struct emptyfs_ram;
+struct emptyfs_img;
+struct emptyfs_bcache;
+struct emptyfs_vt;
+
 struct emptyfs_mount {
     /* must be EMPTYFS_MNT_MAGIC */
     uint32_t magic;
     /* backing pointer to the mount_t */
     mount_t mp;
-    /* debug mode passed from mount arguments */
+    /* debug mode passed from mount arguments  non-zero turns on EMPTYFS_TRACE() */
     uint32_t dbg_mode;
+    /* mount options passed from mount arguments  see EMPTYFS_MNT_* */
+    uint32_t flags;
     /* raw dev_t of the device we're mounted on */
     dev_t devid;
     /* backing device vnode of above;  we use a refcnt. on it */
@@ -31,24 +39,39 @@ struct emptyfs_mount {
     char volname[EMPTYFS_VOLNAME_MAXLEN];
     /* pre-calculated volume attributes */
     struct vfs_attr attr;
-
-    /* mutex lock used to protect following fields */
-    lck_mtx_t *mtx_root;
-
-    /* true if someone is attaching a root vnode */
-    uint8_t is_root_attaching;
-    /*
-     * true if someone is waiting for such an attach to complete
-     */
-    uint8_t is_root_waiting;
+    /* synthetic namespace of this volume(immutable after mount) */
+    struct emptyfs_synth synth;
+    /* writable namespace if EMPTYFS_MNT_RAMFS  NULL o.w.  see: emptyfs_ram.h */
+    struct emptyfs_ram *ram;
+    /* guards ram  shared by lookup/read paths  exclusive by mutations */
+    lck_rw_t *ram_lock;
     /*
-     * the root vnode
-     * we hold NO reference to this  you must reconfirm its existence each time
+     * serializes size changes(write  truncate) of ram files
+     *  held across cluster IO  which may page in  thus never taken by paging path
      */
-    vnode_t rootvp;
+    lck_mtx_t *ram_wlock;
+    /* image on devvp if the volume serves one  NULL o.w.  see: emptyfs_img.h */
+    struct emptyfs_img *img;
+    /* decoded blocks of compressed image files  NULL unless EMPTYFS_IMG_F_LZ */
+    struct emptyfs_bcache *img_cache;
+    lck_mtx_t *img_cache_lock;
+    /* verifier of image blocks  NULL unless EMPTYFS_IMG_F_VERITY  see: emptyfs_vt.h */
+    struct emptyfs_vt *img_vt;
+
+    /* fsnode hash  see: emptyfs_fsnode.c */
+    struct emptyfs_fsnode_shard *fsnode_shards;
+
+    /* root vnode we hold a usecount on if EMPTYFS_MNT_PINROOT  NULL o.w. */
+    vnode_t root_pin;
+
+    /* next idle structure in mount pool  see: emptyfs_mount_free() */
+    struct emptyfs_mount *pool_next;
 };
 
 struct emptyfs_mount *emptyfs_mount_from_mp(mount_t);
 
+int emptyfs_mount_pool_init(void);
+void emptyfs_mount_pool_fini(void);
+
 #endif /* __EMPTYFS_VFSOPS_H */
 
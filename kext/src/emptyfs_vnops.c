@@ -7,12 +7,23 @@
  *  o.w. os <= 10.11(El Capitan) may unable to compile
  */
 #include <i386/types.h>
+#include <sys/param.h>
 #include <sys/fcntl.h>
 #include <sys/dirent.h>
+#include <sys/ubc.h>
+#include <sys/buf.h>
 #include <string.h>
 
+#include "emptyfs.h"
 #include "emptyfs_vnops.h"
 #include "emptyfs_vfsops.h"
+#include "emptyfs_fsnode.h"
+#include "emptyfs_stat.h"
+#include "emptyfs_attr.h"
+#include "emptyfs_prof.h"
+#include "emptyfs_trace.h"
+#include "emptyfs_ram.h"
+#include "emptyfs_img.h"
 
 /*
  * this variable will be set when we register VFS plugin via vfs_fsadd()
@@ -44,20 +55,94 @@ static int emptyfs_vnop_open(struct vnop_open_args *);
 static int emptyfs_vnop_close(struct vnop_close_args *);
 static int emptyfs_vnop_getattr(struct vnop_getattr_args *);
 static int emptyfs_vnop_readdir(struct vnop_readdir_args *);
+#if defined(OS_VER_MIN_REQ) && OS_VER_MIN_REQ >= __MAC_10_10
+static int emptyfs_vnop_getattrlistbulk(struct vnop_getattrlistbulk_args *);
+#endif
 static int emptyfs_vnop_reclaim(struct vnop_reclaim_args *);
+static int emptyfs_vnop_create(struct vnop_create_args *);
+static int emptyfs_vnop_mkdir(struct vnop_mkdir_args *);
+static int emptyfs_vnop_remove(struct vnop_remove_args *);
+static int emptyfs_vnop_rmdir(struct vnop_rmdir_args *);
+static int emptyfs_vnop_rename(struct vnop_rename_args *);
+static int emptyfs_vnop_read(struct vnop_read_args *);
+static int emptyfs_vnop_write(struct vnop_write_args *);
+static int emptyfs_vnop_setattr(struct vnop_setattr_args *);
+static int emptyfs_vnop_fsync(struct vnop_fsync_args *);
+static int emptyfs_vnop_pagein(struct vnop_pagein_args *);
+static int emptyfs_vnop_pageout(struct vnop_pageout_args *);
+static int emptyfs_vnop_blockmap(struct vnop_blockmap_args *);
+static int emptyfs_vnop_strategy(struct vnop_strategy_args *);
+static int emptyfs_vnop_blktooff(struct vnop_blktooff_args *);
+static int emptyfs_vnop_offtoblk(struct vnop_offtoblk_args *);
+
+/*
+ * Timed trampolines  every vnop in the table below goes through one
+ *  see: emptyfs_prof.h
+ */
+#define VNOP_PROF(name, op, args_t)                                 \
+    static int emptyfs_vnop_ ## name ## _prof(struct args_t *ap)    \
+    {                                                               \
+        return EMPTYFS_PROF_CALL(op, emptyfs_vnop_ ## name(ap));    \
+    }
 
+VNOP_PROF(default, VNOP_DEFAULT, vnop_generic_args)
+VNOP_PROF(lookup, VNOP_LOOKUP, vnop_lookup_args)
+VNOP_PROF(open, VNOP_OPEN, vnop_open_args)
+VNOP_PROF(close, VNOP_CLOSE, vnop_close_args)
+VNOP_PROF(getattr, VNOP_GETATTR, vnop_getattr_args)
+VNOP_PROF(readdir, VNOP_READDIR, vnop_readdir_args)
+#if defined(OS_VER_MIN_REQ) && OS_VER_MIN_REQ >= __MAC_10_10
+VNOP_PROF(getattrlistbulk, VNOP_GETATTRLISTBULK, vnop_getattrlistbulk_args)
+#endif
+VNOP_PROF(reclaim, VNOP_RECLAIM, vnop_reclaim_args)
+VNOP_PROF(create, VNOP_CREATE, vnop_create_args)
+VNOP_PROF(mkdir, VNOP_MKDIR, vnop_mkdir_args)
+VNOP_PROF(remove, VNOP_REMOVE, vnop_remove_args)
+VNOP_PROF(rmdir, VNOP_RMDIR, vnop_rmdir_args)
+VNOP_PROF(rename, VNOP_RENAME, vnop_rename_args)
+VNOP_PROF(read, VNOP_READ, vnop_read_args)
+VNOP_PROF(write, VNOP_WRITE, vnop_write_args)
+VNOP_PROF(setattr, VNOP_SETATTR, vnop_setattr_args)
+VNOP_PROF(fsync, VNOP_FSYNC, vnop_fsync_args)
+VNOP_PROF(pagein, VNOP_PAGEIN, vnop_pagein_args)
+VNOP_PROF(pageout, VNOP_PAGEOUT, vnop_pageout_args)
+VNOP_PROF(blockmap, VNOP_BLOCKMAP, vnop_blockmap_args)
+VNOP_PROF(strategy, VNOP_STRATEGY, vnop_strategy_args)
+VNOP_PROF(blktooff, VNOP_BLKTOOFF, vnop_blktooff_args)
+VNOP_PROF(offtoblk, VNOP_OFFTOBLK, vnop_offtoblk_args)
 
 /*
  * describes all vnode operations supported by vnodes created by our VFS plugin
  */
 static struct vnodeopv_entry_desc emptyfs_vnopv_entry_desc_list[] = {
-    {&vnop_default_desc, (VNOP_FUNC) emptyfs_vnop_default},
-    {&vnop_lookup_desc, (VNOP_FUNC) emptyfs_vnop_lookup},
-    {&vnop_open_desc, (VNOP_FUNC) emptyfs_vnop_open},
-    {&vnop_close_desc, (VNOP_FUNC) emptyfs_vnop_close},
-    {&vnop_getattr_desc, (VNOP_FUNC) emptyfs_vnop_getattr},
-    {&vnop_readdir_desc, (VNOP_FUNC) emptyfs_vnop_readdir},
-    {&vnop_reclaim_desc, (VNOP_FUNC) emptyfs_vnop_reclaim},
+    {&vnop_default_desc, (VNOP_FUNC) emptyfs_vnop_default_prof},
+    {&vnop_lookup_desc, (VNOP_FUNC) emptyfs_vnop_lookup_prof},
+    {&vnop_open_desc, (VNOP_FUNC) emptyfs_vnop_open_prof},
+    {&vnop_close_desc, (VNOP_FUNC) emptyfs_vnop_close_prof},
+    {&vnop_getattr_desc, (VNOP_FUNC) emptyfs_vnop_getattr_prof},
+    {&vnop_readdir_desc, (VNOP_FUNC) emptyfs_vnop_readdir_prof},
+#if defined(OS_VER_MIN_REQ) && OS_VER_MIN_REQ >= __MAC_10_10
+    /* getattrlistbulk(2) first appeared in macOS 10.10 */
+    {&vnop_getattrlistbulk_desc, (VNOP_FUNC) emptyfs_vnop_getattrlistbulk_prof},
+#endif
+    {&vnop_reclaim_desc, (VNOP_FUNC) emptyfs_vnop_reclaim_prof},
+    /* ramfs only  synthetic volumes are read-only(and have no data) */
+    {&vnop_create_desc, (VNOP_FUNC) emptyfs_vnop_create_prof},
+    {&vnop_mkdir_desc, (VNOP_FUNC) emptyfs_vnop_mkdir_prof},
+    {&vnop_remove_desc, (VNOP_FUNC) emptyfs_vnop_remove_prof},
+    {&vnop_rmdir_desc, (VNOP_FUNC) emptyfs_vnop_rmdir_prof},
+    {&vnop_rename_desc, (VNOP_FUNC) emptyfs_vnop_rename_prof},
+    {&vnop_read_desc, (VNOP_FUNC) emptyfs_vnop_read_prof},
+    {&vnop_write_desc, (VNOP_FUNC) emptyfs_vnop_write_prof},
+    {&vnop_setattr_desc, (VNOP_FUNC) emptyfs_vnop_setattr_prof},
+    {&vnop_fsync_desc, (VNOP_FUNC) emptyfs_vnop_fsync_prof},
+    /* UBC  i.e. cluster IO and mmap(2) of ram and image files */
+    {&vnop_pagein_desc, (VNOP_FUNC) emptyfs_vnop_pagein_prof},
+    {&vnop_pageout_desc, (VNOP_FUNC) emptyfs_vnop_pageout_prof},
+    {&vnop_blockmap_desc, (VNOP_FUNC) emptyfs_vnop_blockmap_prof},
+    {&vnop_strategy_desc, (VNOP_FUNC) emptyfs_vnop_strategy_prof},
+    {&vnop_blktooff_desc, (VNOP_FUNC) emptyfs_vnop_blktooff_prof},
+    {&vnop_offtoblk_desc, (VNOP_FUNC) emptyfs_vnop_offtoblk_prof},
     {NULL, NULL},
 };
 
@@ -87,30 +172,246 @@ struct vnodeopv_desc *emptyfs_vnopv_desc_list[__EFS_VNOPV_SZ] = {
 
 /**
  * Check if a given vnode is valid in our filesystem
- *  in this fs  the only valid vnode is the root vnode
- *  .: it's a trivial implementation
+ *  i.e. it's attached to a fsnode of its mount
  */
 static void assert_valid_vnode(vnode_t vp)
 {
 #ifdef DEBUG
-    int valid;
-    struct emptyfs_mount *mntp;
+    struct emptyfs_fsnode *fn;
 
-    kassert_nonnull(vp);
-
-    mntp = emptyfs_mount_from_mp(vnode_mount(vp));
-
-    lck_mtx_lock(mntp->mtx_root);
-    valid = (vp == mntp->rootvp);
-    lck_mtx_unlock(mntp->mtx_root);
-
-    kassertf(valid, "invalid vnode %p  vid: %#x type: %d",
+    fn = emptyfs_fsnode_from_vp(vp);
+    kassertf(fn->ino != EMPTYFS_INO_NONE, "invalid vnode %p  vid: %#x type: %d",
                         vp, vnode_vid(vp), vnode_vtype(vp));
 #else
     kassert_nonnull(vp);
 #endif
 }
 
+/**
+ * @return      ramfs node of a vnode  ram_lock must be held
+ *
+ * a node outlives its vnode(it's only freed in vnop_reclaim)
+ *  thus it's always there as long as the vnode is in use
+ */
+static struct emptyfs_ram_node *ram_node_of(
+        struct emptyfs_mount * __nonnull mntp,
+        vnode_t __nonnull vp)
+{
+    struct emptyfs_ram_node *n;
+    uint64_t ino = emptyfs_fsnode_from_vp(vp)->ino;
+
+    n = emptyfs_ram_node(mntp->ram, ino);
+    kassertf(n != NULL, "ramfs node of vnode %p missing  ino: %#llx", vp, ino);
+    return n;
+}
+
+/**
+ * Build attribute template of a synthetic inode
+ *  used when a vnode is attached  and for each entry in vnop_getattrlistbulk
+ *  the latter has no vnode at all  thus everything comes from inode number
+ */
+static int synth_make_attr(
+        struct emptyfs_mount * __nonnull mntp,
+        uint64_t ino,
+        struct emptyfs_attr * __nonnull t)
+{
+    const struct emptyfs_synth *sy = &mntp->synth;
+    struct timespec ts;
+    uint64_t size;
+
+    t->supported = 0;
+
+    /*
+     * [sic]
+     * Implementation of stat(2) requires that we support va_rdev
+     *  even on vnodes that aren't device vnode
+     */
+    EMPTYFS_ATTR_SET(t, va_rdev, 0);
+    EMPTYFS_ATTR_SET(t, va_nlink, emptyfs_synth_nlink(sy, ino));
+
+    size = emptyfs_synth_size(sy, ino);
+    EMPTYFS_ATTR_SET(t, va_data_size, size);
+    EMPTYFS_ATTR_SET(t, va_total_size, size);
+    /* we have no storage at all */
+    EMPTYFS_ATTR_SET(t, va_data_alloc, 0);
+    EMPTYFS_ATTR_SET(t, va_total_alloc, 0);
+    EMPTYFS_ATTR_SET(t, va_iosize, mntp->attr.f_iosize);
+    EMPTYFS_ATTR_SET(t, va_flags, 0);
+
+    if (emptyfs_synth_isdir(sy, ino)) {
+        /* umask 0555 */
+        EMPTYFS_ATTR_SET(t, va_mode,
+            S_IFDIR | S_IRUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
+    } else {
+        /* umask 0444 */
+        EMPTYFS_ATTR_SET(t, va_mode, S_IFREG | S_IRUSR | S_IRGRP | S_IROTH);
+    }
+
+    if (ino == EMPTYFS_ROOT_INO) {
+        EMPTYFS_ATTR_SET(t, va_create_time, mntp->attr.f_create_time);
+        EMPTYFS_ATTR_SET(t, va_access_time, mntp->attr.f_access_time);
+        EMPTYFS_ATTR_SET(t, va_modify_time, mntp->attr.f_modify_time);
+        EMPTYFS_ATTR_SET(t, va_change_time, mntp->attr.f_modify_time);
+    } else {
+        ts.tv_sec = (__typeof(ts.tv_sec)) emptyfs_synth_mtime(sy, ino);
+        ts.tv_nsec = 0;
+        EMPTYFS_ATTR_SET(t, va_create_time, ts);
+        EMPTYFS_ATTR_SET(t, va_access_time, ts);
+        EMPTYFS_ATTR_SET(t, va_modify_time, ts);
+        EMPTYFS_ATTR_SET(t, va_change_time, ts);
+    }
+
+    EMPTYFS_ATTR_SET(t, va_fileid, ino);
+    EMPTYFS_ATTR_SET(t, va_parentid, emptyfs_synth_parent(sy, ino));
+    EMPTYFS_ATTR_SET(t, va_fsid, mntp->devid);
+
+    /* synthetic inodes never go away */
+    return 0;
+}
+
+/**
+ * Get vnode of an inode in the synthetic namespace(will create if necessary)
+ * @dvp, @cnp   parent directory and name  both NULL if not from a lookup
+ * @return      0 if success  errno o.w.
+ *              resulting vnode has an io refcnt.
+ */
+int emptyfs_synth_vget(
+        struct emptyfs_mount * __nonnull mntp,
+        uint64_t ino,
+        vnode_t dvp,
+        struct componentname *cnp,
+        vnode_t * __nonnull vpp)
+{
+    struct emptyfs_fsnode_args args;
+
+    kassert_nonnull(mntp);
+    kassert(emptyfs_synth_valid(&mntp->synth, ino));
+    kassert_nonnull(vpp);
+
+    args.ino = ino;
+    args.vtype = emptyfs_synth_isdir(&mntp->synth, ino) ? VDIR : VREG;
+    args.dvp = dvp;
+    args.cnp = cnp;
+    args.make_attr = synth_make_attr;
+
+    return emptyfs_fsnode_get(mntp, &args, vpp);
+}
+
+/**
+ * Get vnode of an inode in whichever namespace the volume has
+ */
+static int ino_vget(
+        struct emptyfs_mount * __nonnull mntp,
+        uint64_t ino,
+        vnode_t dvp,
+        struct componentname *cnp,
+        vnode_t * __nonnull vpp)
+{
+    if (mntp->ram != NULL) return emptyfs_ram_vget(mntp, ino, dvp, cnp, vpp);
+    if (mntp->img != NULL) return emptyfs_img_vget(mntp, ino, dvp, cnp, vpp);
+    return emptyfs_synth_vget(mntp, ino, dvp, cnp, vpp);
+}
+
+/**
+ * Resolve a name in a ramfs directory
+ * @return      inode number  EMPTYFS_INO_NONE if not found
+ */
+static uint64_t ram_resolve(
+        struct emptyfs_mount * __nonnull mntp,
+        vnode_t __nonnull dvp,
+        uint64_t dino,
+        struct componentname * __nonnull cnp)
+{
+    const struct emptyfs_ram_node *dn;
+    uint64_t ino = EMPTYFS_INO_NONE;
+
+    emptyfs_ram_lock_shared(mntp);
+    dn = ram_node_of(mntp, dvp);
+    if (cnp->cn_flags & ISDOTDOT) {
+        ino = dn->parent;
+    } else if (cnp->cn_namelen == 1 && cnp->cn_nameptr[0] == '.') {
+        ino = dino;
+    } else {
+        /* ENOENT leaves ino untouched */
+        (void) emptyfs_ram_lookup(mntp->ram, dino, cnp->cn_nameptr,
+                                    (size_t) cnp->cn_namelen, &ino);
+    }
+    emptyfs_ram_unlock(mntp);
+
+    return ino;
+}
+
+/**
+ * Resolve a name in an image directory
+ * @inop        (OUT) inode number  untouched if not found
+ * @return      0 if success(found or not)  errno o.w.
+ */
+static int img_resolve(
+        struct emptyfs_mount * __nonnull mntp,
+        uint64_t dino,
+        struct componentname * __nonnull cnp,
+        uint64_t * __nonnull inop)
+{
+    struct emptyfs_img_inode dip;
+    struct emptyfs_img_dir d;
+    int e;
+
+    if (cnp->cn_namelen == 1 && cnp->cn_nameptr[0] == '.') {
+        *inop = dino;
+        return 0;
+    }
+
+    e = emptyfs_img_iget(mntp->img, dino, &dip);
+    if (e) return e;
+
+    if (cnp->cn_flags & ISDOTDOT) {
+        *inop = dip.parent;
+        return 0;
+    }
+
+    /* about 3 reads of the directory table  see: emptyfs_img.h */
+    e = emptyfs_img_opendir(mntp->img, &dip, &d);
+    if (e == 0) {
+        e = emptyfs_img_lookup(mntp->img, &d, cnp->cn_nameptr,
+                                (size_t) cnp->cn_namelen, inop);
+    }
+
+    return e == ENOENT ? 0 : e;
+}
+
+/**
+ * Populate VFS name cache with a lookup result
+ *  so that later lookups of the same name never call into us
+ * synthetic namespace is immutable  thus entries never go stale
+ *  they're purged when either vnode is reclaimed  see: emptyfs_vnop_reclaim
+ * ramfs namespace changes  each mutating vnop purges what it invalidates
+ *
+ * @vp      the found vnode  NULLVP if not found
+ * @e       errno of the lookup
+ */
+static void lookup_cache_enter(
+        vnode_t __nonnull dvp,
+        vnode_t vp,
+        struct componentname * __nonnull cnp,
+        int e)
+{
+    /* caller don't want it to be cached */
+    if (!(cnp->cn_flags & MAKEENTRY)) return;
+
+    if (e == 0) {
+        cache_enter(dvp, vp, cnp);
+        EMPTYFS_STAT_INC(cache_enter);
+    } else if (e == ENOENT && cnp->cn_nameiop != CREATE) {
+        /*
+         * [sic] negative entry  i.e. the name doesn't exist
+         *  those `._' AppleDouble lookups would be answered by VFS from now on
+         * CREATE lookups are excluded :. the name is about to exist
+         */
+        cache_enter(dvp, NULLVP, cnp);
+        EMPTYFS_STAT_INC(cache_enter_neg);
+    }
+}
+
 /**
  * Called by VFS to do a directory lookup
  * @desc    (unused) identity which vnode operation(lookup in such case)
@@ -129,13 +430,16 @@ static void assert_valid_vnode(vnode_t vp)
  */
 static int emptyfs_vnop_lookup(struct vnop_lookup_args *ap)
 {
-    int e;
+    int e = 0;
     struct vnodeop_desc *desc;
     vnode_t dvp;
     vnode_t *vpp;
     struct componentname *cnp;
     vfs_context_t ctx;
     vnode_t vp = NULL;
+    struct emptyfs_mount *mntp;
+    uint64_t dino;
+    uint64_t ino = EMPTYFS_INO_NONE;
 
     kassert_nonnull(ap);
     desc = ap->a_desc;
@@ -151,30 +455,64 @@ static int emptyfs_vnop_lookup(struct vnop_lookup_args *ap)
     kassert_nonnull(cnp);
     kassert_nonnull(ctx);
 
-    LOG_DBG("desc: %p dvp: %p %#x vpp: %p %p cnp: %u %#x %s %s",
-            desc, dvp, vnode_vid(dvp), vpp, *vpp,
-            cnp->cn_nameiop, cnp->cn_flags, cnp->cn_pnbuf, cnp->cn_nameptr);
+    EMPTYFS_STAT_INC(lookup);
 
-    /* Trivial implementation */
+    mntp = emptyfs_mount_from_mp(vnode_mount(dvp));
+    dino = emptyfs_fsnode_from_vp(dvp)->ino;
 
-    if (cnp->cn_flags & ISDOTDOT) {
+    if (mntp->ram != NULL) {
+        ino = ram_resolve(mntp, dvp, dino, cnp);
+    } else if (mntp->img != NULL) {
+        e = img_resolve(mntp, dino, cnp, &ino);
+    } else if (cnp->cn_flags & ISDOTDOT) {
         /*
          * Implement lookup for ".."(i.e. parent directory)
-         * Currently this fs only has one vnode(i.e. the root vnode)
-         *  and parent of root vnode is always itself
+         *  parent of root vnode is always itself
          *  it's equals to "." in such case
-         * The implementation is trivial
          */
+        ino = emptyfs_synth_parent(&mntp->synth, dino);
+    } else if (cnp->cn_namelen == 1 && cnp->cn_nameptr[0] == '.') {
+        /* cn_nameptr points into whole path  never rely on NUL termination */
+        ino = dino;
+    } else {
+        /*
+         * synthetic names are resolved arithmetically in O(1)
+         *  directories with stored names go emptyfs_dirhash_lookup()(ramfs)
+         *  or bisect a sorted table(image)
+         */
+        ino = emptyfs_synth_lookup(&mntp->synth, dino,
+                                    cnp->cn_nameptr, cnp->cn_namelen);
+    }
+
+    if (e) {
+        /* a corrupt image  or the device failed us */
+        LOG_ERR("image lookup fail  dino: %llu errno: %d", dino, e);
+    } else if (ino == EMPTYFS_INO_NONE) {
+        EMPTYFS_STAT_INC(lookup_enoent);
+        e = ENOENT;
+    } else if (ino == dino) {
         e = vnode_get(dvp);
         if (e == 0) vp = dvp;
-    } else if (!strcmp(cnp->cn_nameptr, ".")) {
-        /* Ditto */
-        e = vnode_get(dvp);
-        if (e == 0) vp = dvp;
+    } else if (cnp->cn_flags & ISDOTDOT) {
+        /* the parent isn't a child of dvp  don't pass dvp and name along */
+        e = ino_vget(mntp, ino, NULLVP, NULL, &vp);
     } else {
-        LOG_DBG("vnop_lookup() ENOENT  op: %#x flags: %#x name: %s pn: %s",
-            cnp->cn_nameiop, cnp->cn_flags, cnp->cn_nameptr, cnp->cn_pnbuf);
-        e = ENOENT;
+        e = ino_vget(mntp, ino, dvp, cnp, &vp);
+    }
+
+    if (e == ENOENT && mntp->ram != NULL && (cnp->cn_flags & ISLASTCN) &&
+            (cnp->cn_nameiop == CREATE || cnp->cn_nameiop == RENAME)) {
+        /*
+         * [sic] the name is free  tell VFS to go on creating(or renaming to) it
+         *  EJUSTRETURN is never cached  see: lookup_cache_enter()
+         */
+        e = EJUSTRETURN;
+    }
+
+    /* "." and ".." are taken care of by VFS itself */
+    if ((mntp->flags & EMPTYFS_MNT_NAMECACHE) && ino != dino &&
+            !(cnp->cn_flags & ISDOTDOT)) {
+        lookup_cache_enter(dvp, vp, cnp, e);
     }
 
     /*
@@ -189,6 +527,9 @@ static int emptyfs_vnop_lookup(struct vnop_lookup_args *ap)
         kassert_null(*vpp);
     }
 
+    EMPTYFS_TRACE(mntp, VNOP_LOOKUP, e, dino, ino, cnp->cn_nameiop, cnp->cn_namelen,
+                    emptyfs_trace_name8(cnp->cn_nameptr, (size_t) cnp->cn_namelen));
+
     return e;
 }
 
@@ -219,17 +560,19 @@ static int emptyfs_vnop_open(struct vnop_open_args *ap)
     mode = ap->a_mode;
     ctx = ap->a_context;
     kassert_nonnull(desc);
-    kassert(vnode_isdir(vp));
     assert_valid_vnode(vp);
     /* NOTE: there seems too many open flags */
     kassert_known_flags(mode, O_CLOEXEC | O_DIRECTORY | O_EVTONLY |
-                                O_NONBLOCK | O_APPEND | FREAD | FWRITE);
+                                O_NONBLOCK | O_APPEND | FREAD | FWRITE |
+                                O_CREAT | O_TRUNC | O_EXCL | O_NOFOLLOW |
+                                O_SYNC | O_SHLOCK | O_EXLOCK);
     kassert_nonnull(ctx);
 
-    LOG_DBG("desc: %p vp: %p %#x mode: %#x", desc, vp, vnode_vid(vp), mode);
-
     /* Empty implementation */
 
+    EMPTYFS_TRACE(emptyfs_mount_from_mp(vnode_mount(vp)), VNOP_OPEN, 0,
+                    emptyfs_fsnode_from_vp(vp)->ino, (uint32_t) mode);
+
     return 0;
 }
 
@@ -255,16 +598,17 @@ static int emptyfs_vnop_close(struct vnop_close_args *ap)
     fflag = ap->a_fflag;
     ctx = ap->a_context;
     kassert_nonnull(desc);
-    kassert(vnode_isdir(vp));
     assert_valid_vnode(vp);
     /* NOTE: there seems too many open flags */
-    kassert_known_flags(fflag, O_EVTONLY | O_NONBLOCK | O_APPEND | FREAD | FWRITE);
+    kassert_known_flags(fflag, O_EVTONLY | O_NONBLOCK | O_APPEND | O_SYNC |
+                                FREAD | FWRITE);
     kassert_nonnull(ctx);
 
-    LOG_DBG("desc: %p vp: %p %#x fflag: %#x", desc, vp, vnode_vid(vp), fflag);
-
     /* Empty implementation */
 
+    EMPTYFS_TRACE(emptyfs_mount_from_mp(vnode_mount(vp)), VNOP_CLOSE, 0,
+                    emptyfs_fsnode_from_vp(vp)->ino, (uint32_t) fflag);
+
     return 0;
 }
 
@@ -292,6 +636,8 @@ static int emptyfs_vnop_getattr(struct vnop_getattr_args *ap)
     struct vnode_attr *vap;
     vfs_context_t ctx;
     struct emptyfs_mount *mntp;
+    struct emptyfs_fsnode *fn;
+    struct emptyfs_attr attr;
 
     kassert_nonnull(ap);
     desc = ap->a_desc;
@@ -299,38 +645,23 @@ static int emptyfs_vnop_getattr(struct vnop_getattr_args *ap)
     vap = ap->a_vap;
     ctx = ap->a_context;
     kassert_nonnull(desc);
-    /* We have only one vnode(i.e. the root vnode) */
-    kassert(vnode_isdir(vp));
     assert_valid_vnode(vp);
     kassert_nonnull(vap);
     kassert_nonnull(ctx);
 
-    LOG_DBG("desc: %p vp: %p %#x va_active: %#llx va_supported: %#llx",
-            desc, vp, vnode_vid(vp), vap->va_active, vap->va_supported);
-
     mntp = emptyfs_mount_from_mp(vnode_mount(vp));
-
-    /* Trivial implementation */
-
-    /*
-     * [sic]
-     * Implementation of stat(2) requires that we support va_rdev
-     *  even on vnodes that aren't device vnode
-     */
-    VATTR_RETURN(vap, va_rdev, 0);
-    VATTR_RETURN(vap, va_nlink, 2);
-    VATTR_RETURN(vap, va_data_size, sizeof(struct dirent) << 1);
-
-    /* umask 0555 */
-    VATTR_RETURN(vap, va_mode,
-        S_IFDIR | S_IRUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
-    VATTR_RETURN(vap, va_create_time, mntp->attr.f_create_time);
-    VATTR_RETURN(vap, va_access_time, mntp->attr.f_access_time);
-    VATTR_RETURN(vap, va_modify_time, mntp->attr.f_modify_time);
-    VATTR_RETURN(vap, va_change_time, mntp->attr.f_modify_time);
-
-    VATTR_RETURN(vap, va_fileid, 2);
-    VATTR_RETURN(vap, va_fsid, mntp->devid);
+    fn = emptyfs_fsnode_from_vp(vp);
+
+    if (mntp->ram != NULL) {
+        /* ramfs nodes change  thus built on each call */
+        emptyfs_ram_lock_shared(mntp);
+        emptyfs_ram_fill_attr(mntp, ram_node_of(mntp, vp), &attr);
+        emptyfs_ram_unlock(mntp);
+        emptyfs_attr_fill(&attr, vap);
+    } else {
+        /* template was built when the vnode attached  i.e. by make_attr callback */
+        emptyfs_attr_fill(&fn->attr, vap);
+    }
 
 #if 0
     VATTR_RETURN(vap, va_type, XXX);    /* Handled by VFS */
@@ -341,8 +672,7 @@ static int emptyfs_vnop_getattr(struct vnop_getattr_args *ap)
     VATTR_RETURN(vap, va_name, XXX);
 #endif
 
-    LOG_DBG("va_active: %#llx va_supported: %#llx",
-            vap->va_active, vap->va_supported);
+    EMPTYFS_TRACE(mntp, VNOP_GETATTR, 0, fn->ino, vap->va_active);
 
     return 0;
 }
@@ -380,6 +710,251 @@ static int uiomove_atomic(
     return e;
 }
 
+/*
+ * Length of a directory entry record holding a name of `namlen' bytes
+ *  the name is NUL-terminated  and record is padded to alignment of dirent
+ * we never use sizeof(struct dirent)  which always reserves MAXNAMLEN bytes
+ */
+#define DIRENT_RECLEN(namlen)                                   \
+    roundup(__builtin_offsetof(struct dirent, d_name) +         \
+            (namlen) + 1, __alignof__(struct dirent))
+
+/* ditto  for extended(i.e. struct direntry) records */
+#define DIRENTRY_RECLEN(namlen)                                 \
+    roundup(__builtin_offsetof(struct direntry, d_name) +       \
+            (namlen) + 1, __alignof__(struct direntry))
+
+/* Upper bound of readdir staging buffer  more than enough for a syscall */
+#define READDIR_BUFSZ       (64 * 1024)
+
+/*
+ * Seek cookies(i.e. uio offsets) of a directory
+ *  "." is 0  ".." is 1  children follow from READDIR_COOKIE_CHILD
+ *  cookie of a synthetic child is simply its index  see: emptyfs_synth.h
+ *  cookie of a ramfs child is its seq(plus READDIR_COOKIE_CHILD)
+ *  seq never changes  and entries are kept in seq order  see: emptyfs_ram.h
+ *  cookie of an image child is its dirent position  see: emptyfs_img.h
+ * thus resuming at any cookie is O(1)(synthetic  image) or O(log n)(ramfs)
+ *  and an entry removed meanwhile never makes listing skip or repeat others
+ * callers should treat them as opaque  only zero(the beginning) is special
+ */
+#define READDIR_COOKIE_DOT      0
+#define READDIR_COOKIE_DOTDOT   1
+#define READDIR_COOKIE_CHILD    2
+
+/*
+ * Position in a directory of any namespace
+ *  a ramfs one is only valid while ram_lock held
+ */
+struct readdir_cursor {
+    struct emptyfs_mount *mntp;
+    uint64_t dino;
+    uint64_t cookie;        /* cookie of the entry to resolve */
+    uint64_t nent;          /* synthetic and image  number of cookies */
+    uint64_t parent;        /* image only */
+    int error;              /* image only  sticky errno  listing stops at it */
+    const struct emptyfs_ram_node *dn;      /* NULL unless ramfs */
+    const struct emptyfs_img *img;          /* NULL unless image */
+    struct emptyfs_img_dir idir;
+    char name[EMPTYFS_IMG_NAME_MAX + 1];    /* synthetic and image */
+};
+
+/*
+ * A resolved directory entry  name is NOT NUL-terminated
+ */
+struct readdir_ent {
+    const char *name;
+    size_t namlen;
+    uint64_t ino;
+    uint8_t type;           /* DT_DIR or DT_REG */
+    uint64_t next;          /* cookie of the next entry */
+};
+
+/**
+ * @return      0 if success  errno o.w.
+ *              ram_lock must be held on a ramfs volume
+ */
+static int readdir_cursor_init(
+        struct readdir_cursor *c,
+        struct emptyfs_mount *mntp,
+        uint64_t dino,
+        uint64_t cookie)
+{
+    struct emptyfs_img_inode dip;
+    int e;
+
+    c->mntp = mntp;
+    c->dino = dino;
+    c->cookie = cookie;
+    c->nent = 0;
+    c->error = 0;
+    c->dn = NULL;
+    c->img = NULL;
+
+    if (mntp->img != NULL) {
+        c->img = mntp->img;
+        e = emptyfs_img_iget(c->img, dino, &dip);
+        if (e == 0) e = emptyfs_img_opendir(c->img, &dip, &c->idir);
+        if (e) return e;
+        c->parent = dip.parent;
+        c->nent = (uint64_t) c->idir.nent + READDIR_COOKIE_CHILD;
+        return 0;
+    }
+
+    if (mntp->ram == NULL) {
+        kassert(EMPTYFS_SYNTH_NAME_MAX <= sizeof(c->name));
+        c->nent = emptyfs_synth_nentries(&mntp->synth, dino) + READDIR_COOKIE_CHILD;
+        return 0;
+    }
+
+    /*
+     * a removed directory keeps its node(nlink zero) till reclaim
+     *  it has no children  thus merely "." and ".."
+     * no node at all means a stale inode number
+     */
+    c->dn = emptyfs_ram_node(mntp->ram, dino);
+    if (c->dn == NULL) return ENOENT;
+    return c->dn->type == EMPTYFS_RAM_DIR ? 0 : ENOTDIR;
+}
+
+static int readdir_synth_child(struct readdir_cursor *c, struct readdir_ent *ent)
+{
+    const struct emptyfs_synth *sy = &c->mntp->synth;
+
+    if (c->cookie >= c->nent) return 0;
+
+    ent->ino = emptyfs_synth_child(sy, c->dino, c->cookie - READDIR_COOKIE_CHILD);
+    ent->namlen = emptyfs_synth_name(sy, ent->ino, c->name);
+    ent->name = c->name;
+    ent->type = emptyfs_synth_isdir(sy, ent->ino) ? DT_DIR : DT_REG;
+    ent->next = c->cookie + 1;
+    return 1;
+}
+
+static int readdir_img_child(struct readdir_cursor *c, struct readdir_ent *ent)
+{
+    struct emptyfs_img_dirent de;
+    uint32_t namlen, type;
+    int e;
+
+    if (c->cookie >= c->nent) return 0;
+
+    e = emptyfs_img_dirent_get(c->img, &c->idir,
+                    (uint32_t) (c->cookie - READDIR_COOKIE_CHILD), &de);
+    if (e == 0) e = emptyfs_img_name_get(c->img, &c->idir, &de, c->name, &namlen, &type);
+    if (e) {
+        LOG_ERR("image readdir fail  dino: %llu cookie: %llu errno: %d",
+                    c->dino, c->cookie, e);
+        c->error = e;
+        return 0;
+    }
+
+    ent->ino = de.ino;
+    ent->name = c->name;
+    ent->namlen = namlen;
+    ent->type = type == EMPTYFS_IMG_DIR ? DT_DIR : DT_REG;
+    ent->next = c->cookie + 1;
+    return 1;
+}
+
+static int readdir_ram_child(struct readdir_cursor *c, struct readdir_ent *ent)
+{
+    const struct emptyfs_ram_dir *d = &c->dn->u.dir;
+    const struct emptyfs_ram_dirent *de;
+    const struct emptyfs_ram_node *n;
+    uint32_t i;
+
+    /* first live entry at or after the cookie */
+    i = emptyfs_ram_dir_seek(d, c->cookie - READDIR_COOKIE_CHILD);
+    if (i >= d->nent) return 0;
+
+    de = &d->ent[i];
+    n = emptyfs_ram_node(c->mntp->ram, de->ino);
+    ent->ino = de->ino;
+    ent->name = d->names + de->off;
+    ent->namlen = de->len;
+    ent->type = n != NULL && n->type == EMPTYFS_RAM_DIR ? DT_DIR : DT_REG;
+    ent->next = de->seq + 1 + READDIR_COOKIE_CHILD;
+    return 1;
+}
+
+/**
+ * Resolve the directory entry at cursor
+ * @return      1 if resolved  0 if end of directory(or c->error set)
+ */
+static int readdir_cursor_get(struct readdir_cursor *c, struct readdir_ent *ent)
+{
+    switch (c->cookie) {
+    case READDIR_COOKIE_DOT:
+        ent->ino = c->dino;
+        ent->name = ".";
+        break;
+    case READDIR_COOKIE_DOTDOT:
+        if (c->dn != NULL) {
+            ent->ino = c->dn->parent;
+        } else if (c->img != NULL) {
+            ent->ino = c->parent;
+        } else {
+            ent->ino = emptyfs_synth_parent(&c->mntp->synth, c->dino);
+        }
+        ent->name = "..";
+        break;
+    default:
+        if (c->dn != NULL) return readdir_ram_child(c, ent);
+        if (c->img != NULL) return readdir_img_child(c, ent);
+        return readdir_synth_child(c, ent);
+    }
+
+    ent->namlen = strlen(ent->name);
+    ent->type = DT_DIR;
+    ent->next = c->cookie + 1;
+    return 1;
+}
+
+/**
+ * Serialize a directory entry into a zeroed buffer
+ * @extended    true if struct direntry wanted  struct dirent o.w.
+ * @seekoff     cookie of the next entry  only used by struct direntry
+ * @return      record length  0 if there is no room
+ */
+static size_t readdir_pack(
+        char *buf,
+        size_t avail,
+        int extended,
+        uint64_t ino,
+        uint8_t type,
+        const char *name,
+        size_t namlen,
+        uint64_t seekoff)
+{
+    struct dirent *dp;
+    struct direntry *xdp;
+    size_t reclen;
+
+    reclen = extended ? DIRENTRY_RECLEN(namlen) : DIRENT_RECLEN(namlen);
+    if (reclen > avail) return 0;
+
+    /* trailing NUL and paddings already zeroed */
+    if (extended) {
+        xdp = (struct direntry *) buf;
+        xdp->d_ino = ino;
+        xdp->d_seekoff = seekoff;
+        xdp->d_reclen = (__typeof(xdp->d_reclen)) reclen;
+        xdp->d_namlen = (__typeof(xdp->d_namlen)) namlen;
+        xdp->d_type = type;
+        (void) memcpy(xdp->d_name, name, namlen);
+    } else {
+        dp = (struct dirent *) buf;
+        dp->d_fileno = (__typeof(dp->d_fileno)) ino;
+        dp->d_reclen = (__typeof(dp->d_reclen)) reclen;
+        dp->d_type = type;
+        dp->d_namlen = (__typeof(dp->d_namlen)) namlen;
+        (void) memcpy(dp->d_name, name, namlen);
+    }
+
+    return reclen;
+}
+
 /*
  * Called by VFS to iterate contents of a directory
  *  (i.e. backing support of getdirentries syscall)
@@ -387,8 +962,11 @@ static int uiomove_atomic(
  * @vp          the directory we're iterating
  * @uio         destination information for resulting direntries
  * @flags       iteration options
- *              currently there're 4 options  neither of which we support
- *              needed if the file system is to be NFS exported
+ *              VNODE_READDIR_EXTENDED  return struct direntry instead
+ *              VNODE_READDIR_REQSEEKOFF  caller requires seek offsets
+ *              VNODE_READDIR_SEEKOFF32  seek offsets must fit in 32 bits
+ *              VNODE_READDIR_NAMEMAX  names must fit in NAME_MAX
+ *              all needed if the file system is to be NFS exported
  * @eofflag     return a flag to indicate if we reached the last directory entry
  *              should be set to 1 if the end of the directory has been reached
  * @numdirent   return a count of number of directory entries that we've read
@@ -399,6 +977,8 @@ static int uiomove_atomic(
  * The hardest thing to understand about this entry point is the UIO management
  *  there are two tricky aspects
  * For more info you should check sample code func docs
+ *
+ * uio offset is the seek cookie of next entry to return  see READDIR_COOKIE_*
  */
 static int emptyfs_vnop_readdir(struct vnop_readdir_args *ap)
 {
@@ -413,8 +993,17 @@ static int emptyfs_vnop_readdir(struct vnop_readdir_args *ap)
 
     int eof = 0;
     int num = 0;
-    struct dirent di;
-    off_t index;
+    int extended;
+    char *buf = NULL;
+    size_t bufsz;
+    size_t used = 0;
+    size_t reclen;
+    off_t off;
+    uint64_t cookie_max;
+    struct readdir_cursor c;
+    struct readdir_ent ent;
+    struct emptyfs_mount *mntp;
+    uint64_t dino;
 
     static int known_flags = VNODE_READDIR_EXTENDED | VNODE_READDIR_REQSEEKOFF |
                                 VNODE_READDIR_SEEKOFF32 | VNODE_READDIR_NAMEMAX;
@@ -435,51 +1024,68 @@ static int emptyfs_vnop_readdir(struct vnop_readdir_args *ap)
     /* eofflag and numdirent can be NULL */
     kassert_nonnull(ctx);
 
-    LOG_DBG("desc: %p vp: %p %#x flags: %#x uio: "
-            "(isuserspace: %d resid: %lld "
-            "iovcnt: %d offset: %lld "
-            "curriovbase: %llu curriovlen: %llu)",
-            desc, vp, vnode_vid(vp), flags,
-            uio_isuserspace(uio), uio_resid(uio),
-            uio_iovcnt(uio), uio_offset(uio),
-            uio_curriovbase(uio), uio_curriovlen(uio));
+    mntp = emptyfs_mount_from_mp(vnode_mount(vp));
+    dino = emptyfs_fsnode_from_vp(vp)->ino;
+    off = uio_offset(uio);
 
-    /* Trivial implementation */
+    /*
+     * NAMEMAX needs no care :. synthetic names are way shorter than NAME_MAX
+     *  and ramfs names are bounded by EMPTYFS_RAM_NAME_MAX(i.e. NAME_MAX)
+     * REQSEEKOFF needs no care either :. we always hand out exact cookies
+     *  struct direntry carries them in d_seekoff
+     *  for struct dirent  uio offset is advanced exactly past last entry
+     */
+    extended = !!(flags & VNODE_READDIR_EXTENDED);
+    cookie_max = (flags & VNODE_READDIR_SEEKOFF32) ? UINT_MAX : LLONG_MAX;
 
-    if (flags & known_flags) {
-        /* only make sense if backing file system is NFS exported */
+    if (off < 0) {
         e = EINVAL;
-        LOG_DBG("Met NFS-exported readdir flags %#x?  errno: %d",
-                    flags & known_flags, e);
         goto out_exit;
     }
 
-    di.d_fileno = 2;                /* Q: why NOT set dynamically? */
-    di.d_reclen = sizeof(di);
-    di.d_type = DT_DIR;
-
-    kassert(uio_offset(uio) % 7 == 0);
-    index = uio_offset(uio) / 7;
-
-    if (index == 0) {
-        di.d_namlen = (uint8_t) strlen(".");
-        strlcpy(di.d_name, ".", sizeof(di.d_name));
-        e = uiomove_atomic(&di, sizeof(di), uio);
-        if (e == 0) {
-            num++;
-            index++;
+    /*
+     * Entries are packed into a staging buffer  then copied out by a single
+     *  uiomove()  the buffer is zeroed :. never leak kernel heap via paddings
+     * if not even "." fits  nothing is packed  see ENOBUFS swallowing below
+     */
+    bufsz = (size_t) GMIN(uio_resid(uio), (user_ssize_t) READDIR_BUFSZ);
+    if (bufsz >= DIRENT_RECLEN(1)) {
+        buf = util_malloc(bufsz, M_WAITOK | M_ZERO);
+        if (buf == NULL) {
+            e = ENOMEM;
+            goto out_exit;
         }
     }
 
-    if (e == 0 && index == 1) {
-        di.d_namlen = (uint8_t) strlen("..");
-        strlcpy(di.d_name, "..", sizeof(di.d_name));
-        e = uiomove_atomic(&di, sizeof(di), uio);
-        if (e == 0) {
-            num++;
-            index++;
+    /* ram_lock is dropped before uiomove()  which may fault */
+    emptyfs_ram_lock_shared(mntp);
+    /* cookies past the end simply yield EOF */
+    e = readdir_cursor_init(&c, mntp, dino, (uint64_t) off);
+    while (e == 0 && buf != NULL && readdir_cursor_get(&c, &ent)) {
+        /* next cookie must be representable */
+        if (ent.next > cookie_max) {
+            if (num == 0) e = EOVERFLOW;
+            break;
         }
+
+        reclen = readdir_pack(buf + used, bufsz - used, extended, ent.ino,
+                                ent.type, ent.name, ent.namlen, ent.next);
+        if (reclen == 0) break;
+
+        used += reclen;
+        num++;
+        c.cookie = ent.next;
+    }
+    if (e == 0) eof = !readdir_cursor_get(&c, &ent);
+    emptyfs_ram_unlock(mntp);
+
+    /* entries before a corrupt one are still returned  next call gets the error */
+    if (e == 0 && c.error != 0) {
+        if (num == 0) e = c.error;
+        eof = 0;
     }
+    if (e == 0) e = used == 0 ? ENOBUFS : uiomove_atomic(buf, used, uio);
+    if (buf != NULL) util_mfree(buf);
 
     /*
      * If we failed :. there wasn't enough space in user space buffer
@@ -494,91 +1100,1384 @@ static int emptyfs_vnop_readdir(struct vnop_readdir_args *ap)
     }
 
     /* Update uio offset and set EOF flag */
-    uio_setoffset(uio, index * 7);
-    eof = index > 1;
+    uio_setoffset(uio, (off_t) c.cookie);
 
     /* Copy out any info requested by caller */
     if (eofflag != NULL)    *eofflag = eof;
     if (numdirent != NULL)  *numdirent = num;
 
-    LOG_DBG("eofflag: %p %d numdirent: %p %d", eofflag, eof, numdirent, num);
-
 out_exit:
+    EMPTYFS_TRACE(mntp, VNOP_READDIR, e, dino, off, uio_offset(uio), num, eof);
     return e;
 }
 
-/*
- * High-level function to relacim a vnode
+#if defined(OS_VER_MIN_REQ) && OS_VER_MIN_REQ >= __MAC_10_10
+/* see: xnu/bsd/vfs/vfs_vnops.c#vnode_getattr */
+#define UNKNOWN_OWNER       99
+
+/**
+ * Fill owner attributes the way VFS does for MNT_IGNORE_OWNERSHIP volumes
+ *  VFS can't do it for us :. there is no vnode in a bulk listing
  */
-static void detach_root_vnode(struct emptyfs_mount *mntp, vnode_t vp)
+static void bulk_fill_owner(struct vnode_attr * __nonnull vap, vfs_context_t ctx)
 {
-    int e;
-
-    kassert_nonnull(mntp);
-    kassert_nonnull(vp);
-
-    lck_mtx_lock(mntp->mtx_root);
-
-    /*
-     * [sic]
-     * if `is_root_attaching' is set  rootvp will and must be NULL
-     *  if in such case  we just return
-     * that's expected behaviour if the system tries to reclaim the vnode
-     *  while other thread is in process of attaching it
-     */
-    if (mntp->is_root_attaching) {
-        kassert_null(mntp->rootvp);
-    }
-
-    if (mntp->rootvp != NULL) {
-        /* The only possible vnode is the root vnode */
-        kassert(mntp->rootvp == vp);
-
-        e = vnode_removefsref(mntp->rootvp);
-        kassertf(e == 0, "vnode_removefsref() fail  errno: %d", e);
+    kauth_cred_t cred = vfs_context_ucred(ctx);
+    int su = vfs_context_issuser(ctx);
 
-        mntp->rootvp = NULL;
-    } else {
-        /* Do nothing  someone else beat this reclaim */
-    }
-
-    lck_mtx_unlock(mntp->mtx_root);
+    VATTR_RETURN(vap, va_uid, su ? UNKNOWN_OWNER : kauth_cred_getuid(cred));
+    VATTR_RETURN(vap, va_gid, su ? UNKNOWN_OWNER : kauth_cred_getgid(cred));
 }
 
-/**
- * Called by VFS to disassociate a vnode from underlying fsnode
- * [sic] Release filesystem-internal resources for a vnode
+/*
+ * Called by VFS to list directory entries along with their attributes
+ *  (i.e. backing support of getattrlistbulk syscall)
+ * entries are described by inode numbers only  no vnode created for them
  *
- * @vp      the vnode to reclaim
- * @ctx     identity of the calling process
- * @return  always 0(the kernel will panic if fail)
+ * @vp          the directory we're iterating
+ * @alist       requested attributes  already validated by VFS
+ * @vap         scratch attributes  va_active holds what's requested
+ *              va_name(if requested) points to a MAXPATHLEN buffer
+ * @uio         destination of packed entries
+ * @options     FSOPT_* passed through to vfs_attr_pack()
+ * @eofflag     return a flag to indicate if we reached the last directory entry
+ * @actualcount return number of entries packed into uio
+ * @ctx         identity of the calling process
  *
- * trivial reclaim implementation
- *  it's NOT the point where  for example you write the fsnode back to disk
- *  rather you should do this in vnop_inactive entry point
- * in a proper file system  this entry would have to coordinate
- *  with fsnode hash layer
+ * uio offset shares seek cookies with vnop_readdir  see READDIR_COOKIE_*
+ *  "." and ".." are never listed by getattrlistbulk(2)
  */
-static int emptyfs_vnop_reclaim(struct vnop_reclaim_args *ap)
+static int emptyfs_vnop_getattrlistbulk(struct vnop_getattrlistbulk_args *ap)
 {
+    int e = 0;
     struct vnodeop_desc *desc;
     vnode_t vp;
+    struct attrlist *alist;
+    struct vnode_attr *vap;
+    struct uio *uio;
+    uint64_t options;
+    int32_t *eofflag;
+    int32_t *actualcount;
     vfs_context_t ctx;
+
+    int32_t num = 0;
+    int eof = 0;
+    int got = 0;
+    off_t off;
+    user_ssize_t resid;
+    uint64_t va_active;
+    uint64_t cookie;
+    struct readdir_cursor c;
+    struct readdir_ent ent;
     struct emptyfs_mount *mntp;
+    const vol_attributes_attr_t *va;
+    struct emptyfs_attr attr;
+    const struct emptyfs_ram_node *n;
+    uint64_t dino;
 
     kassert_nonnull(ap);
     desc = ap->a_desc;
     vp = ap->a_vp;
+    alist = ap->a_alist;
+    vap = ap->a_vap;
+    uio = ap->a_uio;
+    options = ap->a_options;
+    eofflag = ap->a_eofflag;
+    actualcount = ap->a_actualcount;
     ctx = ap->a_context;
     kassert_nonnull(desc);
+    kassert(vnode_isdir(vp));
     assert_valid_vnode(vp);
+    kassert_nonnull(alist);
+    kassert_nonnull(vap);
+    kassert_nonnull(uio);
+    kassert_nonnull(eofflag);
+    kassert_nonnull(actualcount);
     kassert_nonnull(ctx);
 
-    LOG_DBG("desc: %p vp: %p %#x", desc, vp, vnode_vid(vp));
+    mntp = emptyfs_mount_from_mp(vnode_mount(vp));
+    dino = emptyfs_fsnode_from_vp(vp)->ino;
+    off = uio_offset(uio);
+
+    if (off < 0) {
+        e = EINVAL;
+        goto out_exit;
+    }
+
+    /*
+     * Attributes we never declared in emptyfs_vfs_attr_tmpl won't be
+     *  returned(ATTR_CMN_RETURNED_ATTRS tells caller)  same as getattrlist(2)
+     */
+    va = &mntp->attr.f_attributes;
+    if ((alist->commonattr & ~va->validattr.commonattr) ||
+            (alist->dirattr & ~va->validattr.dirattr) ||
+            (alist->fileattr & ~va->validattr.fileattr)) {
+        LOG_DBG("unsupported attrs: %#x %#x %#x",
+                alist->commonattr & ~va->validattr.commonattr,
+                alist->dirattr & ~va->validattr.dirattr,
+                alist->fileattr & ~va->validattr.fileattr);
+    }
+
+    va_active = vap->va_active;
+
+    /*
+     * ram_lock is taken per entry  and dropped before vfs_attr_pack()
+     *  which copies out to user  i.e. may fault on a mapped ram file
+     * a ramfs cursor is thus re-seeked by cookie each time  as readdir resumes
+     *  image and synthetic directories never change  one cursor serves all
+     */
+    cookie = GMAX((uint64_t) off, (uint64_t) READDIR_COOKIE_CHILD);
+    for (;;) {
+        /* vap is reused  only what we return for this entry may be supported */
+        vap->va_active = va_active;
+        vap->va_supported = 0;
+
+        emptyfs_ram_lock_shared(mntp);
+        /* num is zero only in the first round */
+        if (num == 0 || c.dn != NULL) {
+            e = readdir_cursor_init(&c, mntp, dino, cookie);
+        } else {
+            c.cookie = cookie;
+        }
+        got = e == 0 && readdir_cursor_get(&c, &ent);
+        if (e == 0) e = c.error;
+        if (got && c.img != NULL) {
+            e = emptyfs_img_make_attr(mntp, ent.ino, &attr);
+            got = e == 0;
+        }
+        if (got) {
+            if (c.dn != NULL) {
+                n = emptyfs_ram_node(mntp->ram, ent.ino);
+                kassert_nonnull(n);
+                emptyfs_ram_fill_attr(mntp, n, &attr);
+            } else if (c.img == NULL) {
+                (void) synth_make_attr(mntp, ent.ino, &attr);
+            }
+            emptyfs_attr_fill(&attr, vap);
+            /* ent.name is only valid under the lock */
+            if (VATTR_IS_ACTIVE(vap, va_name)) {
+                kassert_nonnull(vap->va_name);
+                kassert(ent.namlen < MAXPATHLEN);
+                (void) memcpy(vap->va_name, ent.name, ent.namlen);
+                vap->va_name[ent.namlen] = '\0';
+                VATTR_SET_SUPPORTED(vap, va_name);
+            }
+        }
+        emptyfs_ram_unlock(mntp);
+
+        if (!got) {
+            eof = e == 0;
+            /* entries packed before a failure are still returned  like readdir */
+            if (num != 0) e = 0;
+            break;
+        }
+
+        bulk_fill_owner(vap, ctx);
+        VATTR_RETURN(vap, va_objtype, ent.type == DT_DIR ? VDIR : VREG);
+
+        /* a NULL vnode tells vfs_attr_pack() to take everything from vap */
+        resid = uio_resid(uio);
+        e = vfs_attr_pack(NULLVP, uio, alist, options, vap, NULL, ctx);
+        /* either way  the entry doesn't fit */
+        if (e == ENOBUFS || (e == 0 && uio_resid(uio) == resid)) {
+            e = num == 0 ? ERANGE : 0;
+            break;
+        }
+        if (e) {
+            LOG_ERR("vfs_attr_pack() fail  ino: %llu errno: %d", ent.ino, e);
+            break;
+        }
+
+        num++;
+        cookie = ent.next;
+    }
+
+    vap->va_active = va_active;
+    if (e) goto out_exit;
+
+    uio_setoffset(uio, (off_t) cookie);
+    *eofflag = eof;
+    *actualcount = num;
+
+out_exit:
+    EMPTYFS_TRACE(mntp, VNOP_GETATTRLISTBULK, e, dino, off, uio_offset(uio),
+                    num, eof);
+    return e;
+}
+#endif
+
+/**
+ * Create a ramfs node  on behalf of vnop_create and vnop_mkdir
+ * @inop        (OUT) inode number of the new node
+ * @return      0 if success  errno o.w.
+ *              *vpp has an io refcnt. if success
+ *
+ * attributes other than mode and owner(e.g. va_flags) are left unsupported
+ *  VFS then sets them via vnop_setattr  see: xnu/bsd/vfs/vfs_subr.c#vn_create
+ */
+static int ram_create(
+        vnode_t __nonnull dvp,
+        vnode_t * __nonnull vpp,
+        struct componentname * __nonnull cnp,
+        struct vnode_attr * __nonnull vap,
+        vfs_context_t __nonnull ctx,
+        uint32_t type,
+        uint64_t * __nonnull inop)
+{
+    int e;
+    struct emptyfs_mount *mntp;
+    kauth_cred_t cred;
+    uint64_t dino;
+    uint32_t perm;
+    uint32_t uid;
+    uint32_t gid;
+
+    mntp = emptyfs_mount_from_mp(vnode_mount(dvp));
+    if (mntp->ram == NULL) return EROFS;
+
+    dino = emptyfs_fsnode_from_vp(dvp)->ino;
+    cred = vfs_context_ucred(ctx);
+
+    if (VATTR_IS_ACTIVE(vap, va_mode)) {
+        perm = vap->va_mode & ALLPERMS;
+    } else {
+        /* umask 0755 and 0644 */
+        perm = type == EMPTYFS_RAM_DIR ?
+            S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH :
+            S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+    }
+    uid = VATTR_IS_ACTIVE(vap, va_uid) ? vap->va_uid : kauth_cred_getuid(cred);
+    gid = VATTR_IS_ACTIVE(vap, va_gid) ? vap->va_gid : kauth_cred_getgid(cred);
+
+    emptyfs_ram_lock_exclusive(mntp);
+    e = emptyfs_ram_create(mntp->ram, dino, cnp->cn_nameptr,
+                            (size_t) cnp->cn_namelen, type, perm, uid, gid, inop);
+    emptyfs_ram_unlock(mntp);
+    if (e) return e;
+
+    VATTR_SET_SUPPORTED(vap, va_mode);
+    VATTR_SET_SUPPORTED(vap, va_uid);
+    VATTR_SET_SUPPORTED(vap, va_gid);
+
+    /* a negative entry of the name(if any) is stale now */
+    if (mntp->flags & EMPTYFS_MNT_NAMECACHE) cache_purge_negatives(dvp);
+
+    /* XXX: if this fails  the node stays  a later lookup gets it */
+    return emptyfs_ram_vget(mntp, *inop, dvp, cnp, vpp);
+}
+
+/**
+ * Called by VFS to create a regular file
+ * @dvp     directory in which the file is created
+ * @vpp     pointer to a vnode where we return the new file
+ *          the resulting vnode must have an io refcnt.
+ * @cnp     name of the new file
+ * @vap     initial attributes  va_type is always set
+ * @ctx     identity of the calling process
+ * @return  0 if success  errno o.w.
+ *
+ * VFS did a CREATE lookup beforehand  see: emptyfs_vnop_lookup()
+ *  yet the name may have been taken meanwhile  then it's EEXIST
+ */
+static int emptyfs_vnop_create(struct vnop_create_args *ap)
+{
+    int e;
+    struct vnodeop_desc *desc;
+    vnode_t dvp;
+    vnode_t *vpp;
+    struct componentname *cnp;
+    struct vnode_attr *vap;
+    vfs_context_t ctx;
+    vnode_t vp = NULLVP;
+    uint64_t ino = EMPTYFS_INO_NONE;
+
+    kassert_nonnull(ap);
+    desc = ap->a_desc;
+    dvp = ap->a_dvp;
+    vpp = ap->a_vpp;
+    cnp = ap->a_cnp;
+    vap = ap->a_vap;
+    ctx = ap->a_context;
+    kassert_nonnull(desc);
+    kassert(vnode_isdir(dvp));
+    assert_valid_vnode(dvp);
+    kassert_nonnull(vpp);
+    kassert_nonnull(cnp);
+    kassert_nonnull(vap);
+    kassert_nonnull(ctx);
+
+    /* e.g. bind(2) of a UNIX domain socket */
+    if (VATTR_IS_ACTIVE(vap, va_type) && vap->va_type != VREG) {
+        e = ENOTSUP;
+    } else {
+        e = ram_create(dvp, &vp, cnp, vap, ctx, EMPTYFS_RAM_REG, &ino);
+    }
+
+    *vpp = vp;
+
+    EMPTYFS_TRACE(emptyfs_mount_from_mp(vnode_mount(dvp)), VNOP_CREATE, e,
+                    emptyfs_fsnode_from_vp(dvp)->ino, ino,
+                    VATTR_IS_ACTIVE(vap, va_mode) ? vap->va_mode : 0,
+                    cnp->cn_namelen,
+                    emptyfs_trace_name8(cnp->cn_nameptr, (size_t) cnp->cn_namelen));
+
+    return e;
+}
+
+/**
+ * Called by VFS to create a directory
+ *  arguments are the same as vnop_create
+ */
+static int emptyfs_vnop_mkdir(struct vnop_mkdir_args *ap)
+{
+    int e;
+    struct vnodeop_desc *desc;
+    vnode_t dvp;
+    vnode_t *vpp;
+    struct componentname *cnp;
+    struct vnode_attr *vap;
+    vfs_context_t ctx;
+    vnode_t vp = NULLVP;
+    uint64_t ino = EMPTYFS_INO_NONE;
+
+    kassert_nonnull(ap);
+    desc = ap->a_desc;
+    dvp = ap->a_dvp;
+    vpp = ap->a_vpp;
+    cnp = ap->a_cnp;
+    vap = ap->a_vap;
+    ctx = ap->a_context;
+    kassert_nonnull(desc);
+    kassert(vnode_isdir(dvp));
+    assert_valid_vnode(dvp);
+    kassert_nonnull(vpp);
+    kassert_nonnull(cnp);
+    kassert_nonnull(vap);
+    kassert_nonnull(ctx);
+
+    e = ram_create(dvp, &vp, cnp, vap, ctx, EMPTYFS_RAM_DIR, &ino);
+
+    *vpp = vp;
+
+    EMPTYFS_TRACE(emptyfs_mount_from_mp(vnode_mount(dvp)), VNOP_MKDIR, e,
+                    emptyfs_fsnode_from_vp(dvp)->ino, ino,
+                    VATTR_IS_ACTIVE(vap, va_mode) ? vap->va_mode : 0,
+                    cnp->cn_namelen,
+                    emptyfs_trace_name8(cnp->cn_nameptr, (size_t) cnp->cn_namelen));
+
+    return e;
+}
+
+/**
+ * Unlink a ramfs name  on behalf of vnop_remove and vnop_rmdir
+ *  the node itself lives until vp reclaimed  i.e. after its last close
+ */
+static int ram_unlink(
+        struct emptyfs_mount * __nonnull mntp,
+        vnode_t __nonnull dvp,
+        vnode_t __nonnull vp,
+        struct componentname * __nonnull cnp,
+        int isdir)
+{
+    int e;
+
+    if (mntp->ram == NULL) return EROFS;
+
+    emptyfs_ram_lock_exclusive(mntp);
+    /* vp tells which node VFS looked up  a racing rename may have moved it */
+    e = emptyfs_ram_unlink(mntp->ram, emptyfs_fsnode_from_vp(dvp)->ino,
+                            cnp->cn_nameptr, (size_t) cnp->cn_namelen,
+                            emptyfs_fsnode_from_vp(vp)->ino, isdir);
+    emptyfs_ram_unlock(mntp);
+    if (e) return e;
+
+    if (mntp->flags & EMPTYFS_MNT_NAMECACHE) cache_purge(vp);
+    (void) vnode_recycle(vp);
+
+    return 0;
+}
+
+/**
+ * Called by VFS to remove a regular file
+ * @dvp     directory the name lives in
+ * @vp      the file to remove
+ * @cnp     name to remove
+ * @flags   VNODE_REMOVE_*
+ * @ctx     identity of the calling process
+ * @return  0 if success  errno o.w.
+ */
+static int emptyfs_vnop_remove(struct vnop_remove_args *ap)
+{
+    int e;
+    struct vnodeop_desc *desc;
+    vnode_t dvp;
+    vnode_t vp;
+    struct componentname *cnp;
+    int flags;
+    vfs_context_t ctx;
+    struct emptyfs_mount *mntp;
+
+    kassert_nonnull(ap);
+    desc = ap->a_desc;
+    dvp = ap->a_dvp;
+    vp = ap->a_vp;
+    cnp = ap->a_cnp;
+    flags = ap->a_flags;
+    ctx = ap->a_context;
+    kassert_nonnull(desc);
+    assert_valid_vnode(dvp);
+    assert_valid_vnode(vp);
+    kassert_nonnull(cnp);
+    kassert_nonnull(ctx);
+
+    mntp = emptyfs_mount_from_mp(vnode_mount(vp));
+
+    if ((flags & VNODE_REMOVE_NODELETEBUSY) && vnode_isinuse(vp, 0)) {
+        /* [sic] Carbon semantics  i.e. busy files can't be deleted */
+        e = EBUSY;
+    } else {
+        e = ram_unlink(mntp, dvp, vp, cnp, 0);
+    }
+
+    EMPTYFS_TRACE(mntp, VNOP_REMOVE, e,
+                    emptyfs_fsnode_from_vp(dvp)->ino,
+                    emptyfs_fsnode_from_vp(vp)->ino, (uint32_t) flags,
+                    cnp->cn_namelen,
+                    emptyfs_trace_name8(cnp->cn_nameptr, (size_t) cnp->cn_namelen));
+
+    return e;
+}
+
+/**
+ * Called by VFS to remove a directory
+ *  VFS already refused to remove "." ".." and mount points
+ */
+static int emptyfs_vnop_rmdir(struct vnop_rmdir_args *ap)
+{
+    int e;
+    struct vnodeop_desc *desc;
+    vnode_t dvp;
+    vnode_t vp;
+    struct componentname *cnp;
+    vfs_context_t ctx;
+    struct emptyfs_mount *mntp;
+
+    kassert_nonnull(ap);
+    desc = ap->a_desc;
+    dvp = ap->a_dvp;
+    vp = ap->a_vp;
+    cnp = ap->a_cnp;
+    ctx = ap->a_context;
+    kassert_nonnull(desc);
+    assert_valid_vnode(dvp);
+    kassert(vnode_isdir(vp));
+    assert_valid_vnode(vp);
+    kassert_nonnull(cnp);
+    kassert_nonnull(ctx);
+
+    mntp = emptyfs_mount_from_mp(vnode_mount(vp));
+
+    e = ram_unlink(mntp, dvp, vp, cnp, 1);
+
+    EMPTYFS_TRACE(mntp, VNOP_RMDIR, e,
+                    emptyfs_fsnode_from_vp(dvp)->ino,
+                    emptyfs_fsnode_from_vp(vp)->ino, 0,
+                    cnp->cn_namelen,
+                    emptyfs_trace_name8(cnp->cn_nameptr, (size_t) cnp->cn_namelen));
+
+    return e;
+}
+
+/**
+ * Called by VFS to rename a file or directory
+ * @fdvp, @fvp, @fcnp   source directory  vnode and name
+ * @tdvp, @tcnp         target directory and name
+ * @tvp                 existing target  NULLVP if none
+ *                      it's replaced(thus unlinked) if success
+ * @ctx                 identity of the calling process
+ * @return              0 if success  errno o.w.
+ *
+ * the whole rename is atomic  :. done under ram_lock exclusively
+ */
+static int emptyfs_vnop_rename(struct vnop_rename_args *ap)
+{
+    int e;
+    struct vnodeop_desc *desc;
+    vnode_t fdvp;
+    vnode_t fvp;
+    struct componentname *fcnp;
+    vnode_t tdvp;
+    vnode_t tvp;
+    struct componentname *tcnp;
+    vfs_context_t ctx;
+    struct emptyfs_mount *mntp;
+    uint64_t fino;
+    uint64_t tino;
+
+    kassert_nonnull(ap);
+    desc = ap->a_desc;
+    fdvp = ap->a_fdvp;
+    fvp = ap->a_fvp;
+    fcnp = ap->a_fcnp;
+    tdvp = ap->a_tdvp;
+    tvp = ap->a_tvp;
+    tcnp = ap->a_tcnp;
+    ctx = ap->a_context;
+    kassert_nonnull(desc);
+    assert_valid_vnode(fdvp);
+    assert_valid_vnode(fvp);
+    kassert_nonnull(fcnp);
+    assert_valid_vnode(tdvp);
+    /* tvp can be NULL */
+    kassert_nonnull(tcnp);
+    kassert_nonnull(ctx);
+
+    mntp = emptyfs_mount_from_mp(vnode_mount(fvp));
+    fino = emptyfs_fsnode_from_vp(fvp)->ino;
+    tino = tvp != NULLVP ? emptyfs_fsnode_from_vp(tvp)->ino : EMPTYFS_INO_NONE;
+
+    if (mntp->ram == NULL) {
+        e = EROFS;
+        goto out_exit;
+    }
+
+    emptyfs_ram_lock_exclusive(mntp);
+    e = emptyfs_ram_rename(mntp->ram,
+                emptyfs_fsnode_from_vp(fdvp)->ino, fcnp->cn_nameptr,
+                (size_t) fcnp->cn_namelen, fino,
+                emptyfs_fsnode_from_vp(tdvp)->ino, tcnp->cn_nameptr,
+                (size_t) tcnp->cn_namelen, tino);
+    emptyfs_ram_unlock(mntp);
+    if (e) goto out_exit;
+
+    if (mntp->flags & EMPTYFS_MNT_NAMECACHE) {
+        /* fvp's name(and its ".." if a directory) changed */
+        cache_purge(fvp);
+        if (tvp != NULLVP) cache_purge(tvp);
+        cache_purge_negatives(tdvp);
+    }
+
+    if (tvp != NULLVP && tvp != fvp) (void) vnode_recycle(tvp);
+
+out_exit:
+    EMPTYFS_TRACE(mntp, VNOP_RENAME, e,
+                    emptyfs_fsnode_from_vp(fdvp)->ino, fino,
+                    emptyfs_fsnode_from_vp(tdvp)->ino, tino,
+                    emptyfs_trace_name8(tcnp->cn_nameptr, (size_t) tcnp->cn_namelen));
+    return e;
+}
+
+/**
+ * Called by VFS to read a file
+ * @vp      the file to read
+ * @uio     destination  and offset to read at
+ * @ioflag  IO_* flags  passed on to cluster layer
+ * @ctx     identity of the calling process
+ * @return  0 if success(short read included)  errno o.w.
+ *
+ * synthetic files have sizes but no data  :. it's ENOTSUP there as before
+ * ram files are read through UBC  pages missing from it are filled by
+ *  cluster layer via vnop_blockmap and vnop_strategy  i.e. copied from chunks
+ * image files likewise  except their blocks come from devvp
+ *  and they read ahead on their own rather than by cluster layer's heuristic
+ *  a sequential reader gets a window doubling from f_iosize(preferred IO size
+ *  of the device) up to EMPTYFS_RA_MAX  issued as async cluster IO after
+ *  the read  see: emptyfs_ra.h
+ * XXX:
+ *  ram_lock must NOT be held across cluster IO
+ *  a fault on the user buffer may page in(from a ram file) and take it again
+ */
+static int emptyfs_vnop_read(struct vnop_read_args *ap)
+{
+    int e;
+    struct vnodeop_desc *desc;
+    vnode_t vp;
+    struct uio *uio;
+    int ioflag;
+    vfs_context_t ctx;
+    struct emptyfs_mount *mntp;
+    off_t off;
+    user_ssize_t resid;
+    size_t done = 0;
+    uint64_t size = 0;
+    uint64_t ra_off = 0, ra_len = 0;
+
+    kassert_nonnull(ap);
+    desc = ap->a_desc;
+    vp = ap->a_vp;
+    uio = ap->a_uio;
+    ioflag = ap->a_ioflag;
+    ctx = ap->a_context;
+    kassert_nonnull(desc);
+    assert_valid_vnode(vp);
+    kassert_nonnull(uio);
+    kassert_nonnull(ctx);
+
+    mntp = emptyfs_mount_from_mp(vnode_mount(vp));
+    off = uio_offset(uio);
+    resid = uio_resid(uio);
+
+    if (mntp->ram == NULL && mntp->img == NULL) {
+        e = ENOTSUP;
+    } else if (vnode_isdir(vp)) {
+        e = EISDIR;
+    } else if (off < 0) {
+        e = EINVAL;
+    } else {
+        /* UBC size is kept in step with the node  see: emptyfs_vnop_write() */
+        size = (uint64_t) ubc_getsize(vp);
+        if (mntp->img != NULL) {
+            ra_len = emptyfs_ra_advise(&emptyfs_fsnode_from_vp(vp)->ra,
+                        (uint64_t) off, (uint64_t) resid, size, mntp->attr.f_iosize,
+                        MAX(EMPTYFS_RA_MAX, mntp->attr.f_iosize), &ra_off);
+            ioflag |= IO_RAOFF;
+        }
+
+        e = cluster_read(vp, uio, (off_t) size, ioflag);
+        done = (size_t) (resid - uio_resid(uio));
+
+        /* a partial read is still a read */
+        if (done != 0) e = 0;
+
+        /* pages already in UBC are skipped  a failure merely costs a later sync read */
+        if (e == 0 && ra_len != 0)
+            (void) advisory_read(vp, (off_t) size, (off_t) ra_off, (int) ra_len);
+    }
+
+    EMPTYFS_TRACE(mntp, VNOP_READ, e, emptyfs_fsnode_from_vp(vp)->ino,
+                    off, resid, done, size);
+
+    return e;
+}
+
+/**
+ * Set size of a ram file  and UBC size after it
+ *  ram_wlock must be held
+ */
+static int ram_setsize(struct emptyfs_mount *mntp, vnode_t vp, uint64_t size)
+{
+    int e;
+
+    emptyfs_ram_lock_exclusive(mntp);
+    e = emptyfs_ram_truncate(mntp->ram, ram_node_of(mntp, vp), size);
+    emptyfs_ram_unlock(mntp);
+
+    /* a shrink also drops pages past EOF  dirty ones included */
+    if (e == 0) (void) ubc_setsize(vp, (off_t) size);
+
+    return e;
+}
+
+/**
+ * Called by VFS to write a file
+ * @vp      the file to write
+ * @uio     source  and offset to write at
+ * @ioflag  IO_APPEND writes at EOF  others are passed on to cluster layer
+ * @ctx     identity of the calling process
+ * @return  0 if success  errno o.w.
+ *
+ * ram files are written through UBC synchronously(IO_SYNC)
+ *  so chunks stay the only truth  and ENOSPC goes to the writer
+ *  rather than getting lost in a later pageout
+ * the file is extended before cluster IO :. vnop_strategy never writes past EOF
+ *  if the write fails  the extension is undone(like IO_UNIT of HFS)
+ */
+static int emptyfs_vnop_write(struct vnop_write_args *ap)
+{
+    int e;
+    struct vnodeop_desc *desc;
+    vnode_t vp;
+    struct uio *uio;
+    int ioflag;
+    vfs_context_t ctx;
+    struct emptyfs_mount *mntp;
+    off_t off;
+    user_ssize_t resid;
+    size_t done = 0;
+    uint64_t osize = 0;
+    uint64_t size = 0;
+
+    kassert_nonnull(ap);
+    desc = ap->a_desc;
+    vp = ap->a_vp;
+    uio = ap->a_uio;
+    ioflag = ap->a_ioflag;
+    ctx = ap->a_context;
+    kassert_nonnull(desc);
+    assert_valid_vnode(vp);
+    kassert_nonnull(uio);
+    kassert_nonnull(ctx);
+
+    mntp = emptyfs_mount_from_mp(vnode_mount(vp));
+    off = uio_offset(uio);
+    resid = uio_resid(uio);
+
+    if (mntp->ram == NULL) {
+        e = EROFS;
+        goto out_exit;
+    }
+
+    if (vnode_isdir(vp)) {
+        e = EISDIR;
+        goto out_exit;
+    }
+
+    lck_mtx_lock(mntp->ram_wlock);
+
+    emptyfs_ram_lock_shared(mntp);
+    osize = size = ram_node_of(mntp, vp)->size;
+    emptyfs_ram_unlock(mntp);
+
+    /* EOF is only stable under ram_wlock */
+    if (ioflag & IO_APPEND) {
+        off = (off_t) osize;
+        uio_setoffset(uio, off);
+    }
+
+    if (off < 0) {
+        e = EINVAL;
+        goto out_unlock;
+    }
+
+    if ((uint64_t) off >= EMPTYFS_RAM_FILE_MAX ||
+            (uint64_t) resid > EMPTYFS_RAM_FILE_MAX - (uint64_t) off) {
+        e = EFBIG;
+        goto out_unlock;
+    }
+
+    if ((uint64_t) off + (uint64_t) resid > osize) {
+        size = (uint64_t) off + (uint64_t) resid;
+        e = ram_setsize(mntp, vp, size);
+        if (e) goto out_unlock;
+    }
+
+    e = cluster_write(vp, uio, (off_t) osize, (off_t) size, 0, 0, ioflag | IO_SYNC);
+    done = (size_t) (resid - uio_resid(uio));
+
+    if (e != 0) {
+        /* pages the failed push left dirty must not be pushed later */
+        (void) ubc_msync(vp, off, off + resid, NULL, UBC_INVALIDATE);
+        if (size != osize) {
+            (void) ram_setsize(mntp, vp, osize);
+            size = osize;
+        }
+        uio_setoffset(uio, off);
+        uio_setresid(uio, resid);
+        done = 0;
+    }
+
+out_unlock:
+    lck_mtx_unlock(mntp->ram_wlock);
+
+out_exit:
+    EMPTYFS_TRACE(mntp, VNOP_WRITE, e, emptyfs_fsnode_from_vp(vp)->ino,
+                    off, resid, done, size);
+    return e;
+}
+
+static inline struct emptyfs_ram_ts ram_ts_from(struct timespec t)
+{
+    struct emptyfs_ram_ts ts;
+    ts.sec = t.tv_sec;
+    ts.nsec = t.tv_nsec;
+    return ts;
+}
+
+/**
+ * Called by VFS to set attributes of a vnode
+ *  (i.e. backing support of truncate chmod chown chflags utimes syscalls)
+ *
+ * @vp      the vnode whose attributes to set
+ * @vap     attributes to set  those we set must be marked supported
+ *          VFS already did permission checks for all of them
+ * @ctx     identity of the calling process
+ * @return  0 if success  errno o.w.
+ */
+static int emptyfs_vnop_setattr(struct vnop_setattr_args *ap)
+{
+    int e = 0;
+    struct vnodeop_desc *desc;
+    vnode_t vp;
+    struct vnode_attr *vap;
+    vfs_context_t ctx;
+    struct emptyfs_mount *mntp;
+    struct emptyfs_ram_node *n;
+    struct timespec now;
+    uint64_t supported;
+    uint64_t osize = 0;
+    uint64_t size = 0;
+    int sizing;
+
+    kassert_nonnull(ap);
+    desc = ap->a_desc;
+    vp = ap->a_vp;
+    vap = ap->a_vap;
+    ctx = ap->a_context;
+    kassert_nonnull(desc);
+    assert_valid_vnode(vp);
+    kassert_nonnull(vap);
+    kassert_nonnull(ctx);
+
+    mntp = emptyfs_mount_from_mp(vnode_mount(vp));
+
+    if (mntp->ram == NULL) {
+        e = EROFS;
+        goto out_exit;
+    }
+
+    nanotime(&now);
+    supported = vap->va_supported;
+
+    /* size changes are serialized with writers  see: emptyfs_vnop_write() */
+    sizing = VATTR_IS_ACTIVE(vap, va_data_size);
+    if (sizing) lck_mtx_lock(mntp->ram_wlock);
+
+    emptyfs_ram_lock_exclusive(mntp);
+    n = ram_node_of(mntp, vp);
+    osize = size = n->size;
+
+    if (VATTR_IS_ACTIVE(vap, va_data_size)) {
+        e = emptyfs_ram_truncate(mntp->ram, n, vap->va_data_size);
+        if (e) goto out_unlock;
+        size = n->size;
+        VATTR_SET_SUPPORTED(vap, va_data_size);
+    }
+
+    if (VATTR_IS_ACTIVE(vap, va_mode)) {
+        n->perm = vap->va_mode & ALLPERMS;
+        VATTR_SET_SUPPORTED(vap, va_mode);
+    }
+
+    if (VATTR_IS_ACTIVE(vap, va_uid)) {
+        n->uid = vap->va_uid;
+        VATTR_SET_SUPPORTED(vap, va_uid);
+    }
+
+    if (VATTR_IS_ACTIVE(vap, va_gid)) {
+        n->gid = vap->va_gid;
+        VATTR_SET_SUPPORTED(vap, va_gid);
+    }
+
+    if (VATTR_IS_ACTIVE(vap, va_flags)) {
+        n->flags = vap->va_flags;
+        VATTR_SET_SUPPORTED(vap, va_flags);
+    }
+
+    if (VATTR_IS_ACTIVE(vap, va_create_time)) {
+        n->btime = ram_ts_from(vap->va_create_time);
+        VATTR_SET_SUPPORTED(vap, va_create_time);
+    }
+
+    if (VATTR_IS_ACTIVE(vap, va_access_time)) {
+        n->atime = ram_ts_from(vap->va_access_time);
+        VATTR_SET_SUPPORTED(vap, va_access_time);
+    }
+
+    if (VATTR_IS_ACTIVE(vap, va_modify_time)) {
+        n->mtime = ram_ts_from(vap->va_modify_time);
+        VATTR_SET_SUPPORTED(vap, va_modify_time);
+    }
+
+    /* any attribute change is an inode change */
+    if (vap->va_supported != supported) n->ctime = ram_ts_from(now);
+
+out_unlock:
+    emptyfs_ram_unlock(mntp);
+
+    /* a shrink also drops pages past EOF  dirty ones included */
+    if (size != osize) (void) ubc_setsize(vp, (off_t) size);
+    if (sizing) lck_mtx_unlock(mntp->ram_wlock);
+
+out_exit:
+    EMPTYFS_TRACE(mntp, VNOP_SETATTR, e, emptyfs_fsnode_from_vp(vp)->ino,
+                    vap->va_active, size,
+                    VATTR_IS_ACTIVE(vap, va_mode) ? vap->va_mode : 0);
+    return e;
+}
+
+/**
+ * Called by VFS to flush a file to storage
+ *  chunks are our storage  write(2) already went to them synchronously
+ *  only pages dirtied via mmap(2) are left to push
+ *  it must succeed otherwise  o.w. fsync(2)(e.g. in editors) fails with ENOTSUP
+ */
+static int emptyfs_vnop_fsync(struct vnop_fsync_args *ap)
+{
+    int e = 0;
+    struct vnodeop_desc *desc;
+    vnode_t vp;
+    int waitfor;
+    vfs_context_t ctx;
+    struct emptyfs_mount *mntp;
+
+    kassert_nonnull(ap);
+    desc = ap->a_desc;
+    vp = ap->a_vp;
+    waitfor = ap->a_waitfor;
+    ctx = ap->a_context;
+    kassert_nonnull(desc);
+    assert_valid_vnode(vp);
+    kassert_nonnull(ctx);
+
+    mntp = emptyfs_mount_from_mp(vnode_mount(vp));
+
+    if (mntp->ram != NULL && vnode_isreg(vp)) {
+        e = ubc_msync(vp, 0, ubc_getsize(vp), NULL,
+                        UBC_PUSHDIRTY | (waitfor == MNT_WAIT ? UBC_SYNC : 0));
+    }
+
+    EMPTYFS_TRACE(mntp, VNOP_FSYNC, e,
+                    emptyfs_fsnode_from_vp(vp)->ino, (uint32_t) waitfor);
+
+    return e;
+}
+
+/**
+ * Called by VM to fill pages of a file(e.g. on a fault of mmap(2))
+ * @vp          the file to page in
+ * @pl          the UPL to fill  we must commit or abort it unless UPL_NOCOMMIT
+ * @pl_offset   offset into the UPL
+ * @f_offset    file offset of the first page
+ * @size        bytes to page in
+ * @flags       UPL_* flags
+ * @ctx         identity of the calling process
+ * @return      0 if success  errno o.w.
+ *
+ * cluster layer does the real work  see: emptyfs_vnop_strategy()
+ */
+static int emptyfs_vnop_pagein(struct vnop_pagein_args *ap)
+{
+    int e;
+    struct vnodeop_desc *desc;
+    vnode_t vp;
+    upl_t pl;
+    upl_offset_t pl_offset;
+    off_t f_offset;
+    size_t size;
+    int flags;
+    vfs_context_t ctx;
+    struct emptyfs_mount *mntp;
+    off_t filesize;
+
+    kassert_nonnull(ap);
+    desc = ap->a_desc;
+    vp = ap->a_vp;
+    pl = ap->a_pl;
+    pl_offset = ap->a_pl_offset;
+    f_offset = ap->a_f_offset;
+    size = ap->a_size;
+    flags = ap->a_flags;
+    ctx = ap->a_context;
+    kassert_nonnull(desc);
+    assert_valid_vnode(vp);
+    /* we never set VFC_VFSVNOP_PAGEINV2  .: VM always supplies the UPL */
+    kassert_nonnull(pl);
+    UNUSED(ctx);
+
+    mntp = emptyfs_mount_from_mp(vnode_mount(vp));
+    filesize = ubc_getsize(vp);
+
+    if (mntp->ram == NULL && mntp->img == NULL) {
+        /* synthetic files have no data  see: emptyfs_vnop_read() */
+        if (!(flags & UPL_NOCOMMIT)) {
+            (void) ubc_upl_abort_range(pl, pl_offset, size,
+                            UPL_ABORT_FREE_ON_EMPTY | UPL_ABORT_ERROR);
+        }
+        e = ENOTSUP;
+    } else {
+        e = cluster_pagein(vp, pl, pl_offset, f_offset, (int) size, filesize, flags);
+    }
+
+    EMPTYFS_TRACE(mntp, VNOP_PAGEIN, e, emptyfs_fsnode_from_vp(vp)->ino,
+                    f_offset, size, (uint32_t) flags, filesize);
+
+    return e;
+}
+
+/**
+ * Called by VM to write dirty pages of a file back(e.g. pages of mmap(2))
+ *  parameters are the same as emptyfs_vnop_pagein()
+ *  pages past EOF are never written  see: emptyfs_vnop_strategy()
+ */
+static int emptyfs_vnop_pageout(struct vnop_pageout_args *ap)
+{
+    int e;
+    struct vnodeop_desc *desc;
+    vnode_t vp;
+    upl_t pl;
+    upl_offset_t pl_offset;
+    off_t f_offset;
+    size_t size;
+    int flags;
+    vfs_context_t ctx;
+    struct emptyfs_mount *mntp;
+    off_t filesize;
+
+    kassert_nonnull(ap);
+    desc = ap->a_desc;
+    vp = ap->a_vp;
+    pl = ap->a_pl;
+    pl_offset = ap->a_pl_offset;
+    f_offset = ap->a_f_offset;
+    size = ap->a_size;
+    flags = ap->a_flags;
+    ctx = ap->a_context;
+    kassert_nonnull(desc);
+    assert_valid_vnode(vp);
+    /* we never set VFC_VFSVNOP_PAGEOUTV2  .: VM always supplies the UPL */
+    kassert_nonnull(pl);
+    UNUSED(ctx);
+
+    mntp = emptyfs_mount_from_mp(vnode_mount(vp));
+    filesize = ubc_getsize(vp);
+
+    if (mntp->ram == NULL) {
+        /* a read-only volume can't have dirty pages  yet never leak a UPL */
+        if (!(flags & UPL_NOCOMMIT))
+            (void) ubc_upl_abort_range(pl, pl_offset, size, UPL_ABORT_FREE_ON_EMPTY);
+        e = EROFS;
+    } else {
+        e = cluster_pageout(vp, pl, pl_offset, f_offset, (int) size, filesize, flags);
+    }
+
+    EMPTYFS_TRACE(mntp, VNOP_PAGEOUT, e, emptyfs_fsnode_from_vp(vp)->ino,
+                    f_offset, size, (uint32_t) flags, filesize);
+
+    return e;
+}
+
+/**
+ * Map a file range of an image onto devvp
+ * @bpn, @poff  (OUT) device block and offset into it  as devvp strategy wants
+ * @run         (OUT) bytes contiguous on devvp  at most size
+ *
+ * compressed blocks have no device address  they're mapped as ram chunks
+ *  i.e. by file offset  vnop_strategy decodes them
+ *  so are all blocks of an image with a Merkle tree  which vnop_strategy verifies
+ */
+static int img_blockmap(
+        struct emptyfs_mount * __nonnull mntp,
+        vnode_t __nonnull vp,
+        off_t foffset,
+        size_t size,
+        daddr64_t * __nonnull bpn,
+        int * __nonnull poff,
+        uint64_t * __nonnull run)
+{
+    struct emptyfs_img_inode ip;
+    uint32_t devbsize = vfs_devblocksize(vnode_mount(vp));
+    uint64_t pblk, nblk, boff, doff;
+    int e;
+
+    e = emptyfs_img_iget(mntp->img, emptyfs_fsnode_from_vp(vp)->ino, &ip);
+    if (e == 0 && ((ip.iflags & EMPTYFS_IMG_I_LZ) || mntp->img_vt != NULL)) {
+        *bpn = foffset / devbsize;
+        *poff = 0;
+        *run = size;
+        return 0;
+    }
+    if (e == 0) {
+        e = emptyfs_img_bmap(mntp->img, &ip,
+                    (uint64_t) foffset >> EMPTYFS_IMG_BSHIFT, &pblk, &nblk);
+    }
+    if (e) return e;
+
+    boff = (uint64_t) foffset & (EMPTYFS_IMG_BSIZE - 1);
+    doff = (pblk << EMPTYFS_IMG_BSHIFT) + boff;
+    *bpn = (daddr64_t) (doff / devbsize);
+    *poff = (int) (doff % devbsize);
+    *run = MIN((nblk << EMPTYFS_IMG_BSHIFT) - boff, (uint64_t) size);
+    return 0;
+}
+
+/**
+ * Called by cluster layer to map a file range onto device blocks
+ *  chunks have no device address  thus a block number is merely
+ *  the file offset in units of device block size  vnop_strategy maps it back
+ *  image blocks do have one(but compressed ones)  an image is never written
+ *  nor has a hole
+ *
+ * @vp          the file to map
+ * @foffset     file offset to map
+ * @size        bytes wanted
+ * @bpn         (OUT) block number  -1 if a hole(cluster layer zero-fills it)
+ * @run         (OUT) bytes mapped contiguously from foffset
+ * @poff        (OUT) offset into the block  always 0 but on an image
+ * @flags       VNODE_READ or VNODE_WRITE
+ * @return      0 if success  errno o.w.
+ *
+ * holes are only reported to reads  and only in whole pages
+ *  :. cluster layer zero-fills a page at a time  which may be larger than a chunk
+ */
+static int emptyfs_vnop_blockmap(struct vnop_blockmap_args *ap)
+{
+    int e = 0;
+    struct vnodeop_desc *desc;
+    vnode_t vp;
+    off_t foffset;
+    size_t size;
+    int flags;
+    vfs_context_t ctx;
+    struct emptyfs_mount *mntp;
+    uint64_t run = 0;
+    daddr64_t bpn = -1;
+    int poff = 0;
+    int hole = 0;
+
+    kassert_nonnull(ap);
+    desc = ap->a_desc;
+    vp = ap->a_vp;
+    foffset = ap->a_foffset;
+    size = ap->a_size;
+    flags = ap->a_flags;
+    ctx = ap->a_context;
+    kassert_nonnull(desc);
+    assert_valid_vnode(vp);
+    kassert(foffset >= 0);
+    UNUSED(ctx);
+
+    mntp = emptyfs_mount_from_mp(vnode_mount(vp));
+
+    if (mntp->img != NULL) {
+        e = (flags & VNODE_WRITE) ? EROFS :
+                img_blockmap(mntp, vp, foffset, size, &bpn, &poff, &run);
+        if (e) goto out_exit;
+    } else if (mntp->ram == NULL) {
+        e = ENOTSUP;
+        goto out_exit;
+    } else {
+        run = size;
+        if (!(flags & VNODE_WRITE)) {
+            emptyfs_ram_lock_shared(mntp);
+            run = emptyfs_ram_map(ram_node_of(mntp, vp), (uint64_t) foffset, size, &hole);
+            emptyfs_ram_unlock(mntp);
+
+            if (hole && (foffset & PAGE_MASK) == 0 && run >= PAGE_SIZE) {
+                run = trunc_page_64(run);
+            } else {
+                /* vnop_strategy reads a hole as zeros anyway */
+                hole = 0;
+            }
+        }
+
+        if (!hole) bpn = foffset / vfs_devblocksize(vnode_mount(vp));
+    }
+
+    if (ap->a_bpn != NULL) *ap->a_bpn = bpn;
+    if (ap->a_run != NULL) *ap->a_run = (size_t) run;
+    if (ap->a_poff != NULL) *(int *) ap->a_poff = poff;
+
+out_exit:
+    EMPTYFS_TRACE(mntp, VNOP_BLOCKMAP, e, emptyfs_fsnode_from_vp(vp)->ino,
+                    foffset, size, bpn, run);
+
+    return e;
+}
+
+/**
+ * memcpy() as an emptyfs_ram_xfer_t  ctx is a cursor into a mapped buf
+ */
+static int ram_copyout(void *ctx, char *buf, size_t len)
+{
+    char **cur = (char **) ctx;
+    memcpy(*cur, buf, len);
+    *cur += len;
+    return 0;
+}
+
+static int ram_copyin(void *ctx, char *buf, size_t len)
+{
+    char **cur = (char **) ctx;
+    memcpy(buf, *cur, len);
+    *cur += len;
+    return 0;
+}
+
+/**
+ * Called by cluster layer to do IO of a buf
+ *  chunks are our "device"  so IO is a copy between them and the buf
+ * @bp      the buf  completed by buf_biodone() before return
+ * @return  always 0  the result goes to the buf
+ *
+ * a page straddling EOF is written up to EOF only
+ *  thus a pageout racing with a truncate never resurrects data(or size)
+ *
+ * image files are on devvp already  vnop_blockmap gave device blocks
+ *  so the buf is merely passed down  devvp completes it
+ *  but compressed ones  which are decoded into the buf like ram chunks
+ *  and those of an image with a Merkle tree  which are verified into it
+ */
+static int emptyfs_vnop_strategy(struct vnop_strategy_args *ap)
+{
+    int e;
+    buf_t bp;
+    vnode_t vp;
+    struct emptyfs_mount *mntp;
+    struct emptyfs_ram_node *n;
+    struct emptyfs_img_inode ip;
+    caddr_t addr = NULL;
+    char *cur;
+    uint64_t off;
+    size_t count, len;
+    size_t done = 0;
+    int rd;
+
+    kassert_nonnull(ap);
+    bp = ap->a_bp;
+    kassert_nonnull(bp);
+    vp = buf_vnode(bp);
+    assert_valid_vnode(vp);
+
+    mntp = emptyfs_mount_from_mp(vnode_mount(vp));
+    off = (uint64_t) buf_blkno(bp) * (uint64_t) vfs_devblocksize(vnode_mount(vp));
+    count = buf_count(bp);
+    rd = (buf_flags(bp) & B_READ) != 0;
+
+    if (mntp->img != NULL) {
+        e = emptyfs_img_iget(mntp->img, emptyfs_fsnode_from_vp(vp)->ino, &ip);
+        if (e) goto out_done;
+
+        if (!(ip.iflags & EMPTYFS_IMG_I_LZ) && mntp->img_vt == NULL) {
+            /* off is a device offset here  and nothing is done yet */
+            EMPTYFS_TRACE(mntp, VNOP_STRATEGY, 0, emptyfs_fsnode_from_vp(vp)->ino,
+                            off, count, (uint32_t) rd, 0);
+            return buf_strategy(mntp->devvp, ap);
+        }
+
+        /* vnop_blockmap refused writes */
+        kassert(rd);
+    } else if (mntp->ram == NULL) {
+        e = ENOTSUP;
+        goto out_done;
+    }
+
+    e = buf_map(bp, &addr);
+    if (e) goto out_done;
+    cur = (char *) addr;
+
+    if (mntp->img != NULL && (ip.iflags & EMPTYFS_IMG_I_LZ)) {
+        e = emptyfs_img_zstrategy(mntp, emptyfs_fsnode_from_vp(vp)->ino, &ip,
+                                    off, (char *) addr, count, &done);
+    } else if (mntp->img != NULL) {
+        e = emptyfs_img_vstrategy(mntp, emptyfs_fsnode_from_vp(vp)->ino, &ip,
+                                    off, (char *) addr, count, &done);
+    } else if (rd) {
+        emptyfs_ram_lock_shared(mntp);
+        e = emptyfs_ram_read(mntp->ram, ram_node_of(mntp, vp), off, count,
+                                ram_copyout, &cur, &done);
+        emptyfs_ram_unlock(mntp);
+
+        /* past EOF reads as zeros */
+        if (e == 0) {
+            memset((char *) addr + done, 0, count - done);
+            done = count;
+        }
+    } else {
+        emptyfs_ram_lock_exclusive(mntp);
+        n = ram_node_of(mntp, vp);
+        len = off >= n->size ? 0 : (size_t) MIN(count, n->size - off);
+        e = emptyfs_ram_write(mntp->ram, n, off, len, ram_copyin, &cur, &done);
+        emptyfs_ram_unlock(mntp);
+
+        if (e == 0) done = count;
+    }
+
+    (void) buf_unmap(bp);
+
+out_done:
+    EMPTYFS_TRACE(mntp, VNOP_STRATEGY, e, emptyfs_fsnode_from_vp(vp)->ino,
+                    off, count, (uint32_t) rd, done);
+
+    buf_seterror(bp, e);
+    buf_setresid(bp, (uint32_t) (count - done));
+    buf_biodone(bp);
+
+    return 0;
+}
+
+/**
+ * Called by UBC to convert a logical block number to file offset
+ *  a logical block is a chunk
+ */
+static int emptyfs_vnop_blktooff(struct vnop_blktooff_args *ap)
+{
+    vnode_t vp;
+    daddr64_t lblkno;
+
+    kassert_nonnull(ap);
+    vp = ap->a_vp;
+    lblkno = ap->a_lblkno;
+    assert_valid_vnode(vp);
+    kassert_nonnull(ap->a_offset);
+
+    *ap->a_offset = (off_t) lblkno * EMPTYFS_RAM_CHUNK;
+
+    return 0;
+}
+
+/**
+ * Called by UBC to convert a file offset to logical block number
+ */
+static int emptyfs_vnop_offtoblk(struct vnop_offtoblk_args *ap)
+{
+    vnode_t vp;
+    off_t offset;
+
+    kassert_nonnull(ap);
+    vp = ap->a_vp;
+    offset = ap->a_offset;
+    assert_valid_vnode(vp);
+    kassert_nonnull(ap->a_lblkno);
+
+    *ap->a_lblkno = (daddr64_t) (offset / EMPTYFS_RAM_CHUNK);
+
+    return 0;
+}
+
+/**
+ * Called by VFS to disassociate a vnode from underlying fsnode
+ * [sic] Release filesystem-internal resources for a vnode
+ *
+ * @vp      the vnode to reclaim
+ * @ctx     identity of the calling process
+ * @return  always 0(the kernel will panic if fail)
+ *
+ * trivial reclaim implementation
+ *  it's NOT the point where  for example you write the fsnode back to disk
+ *  rather you should do this in vnop_inactive entry point
+ * this entry coordinates with fsnode hash layer  see: emptyfs_fsnode.c
+ */
+static int emptyfs_vnop_reclaim(struct vnop_reclaim_args *ap)
+{
+    struct vnodeop_desc *desc;
+    vnode_t vp;
+    vfs_context_t ctx;
+    struct emptyfs_mount *mntp;
+    uint64_t ino;
+
+    kassert_nonnull(ap);
+    desc = ap->a_desc;
+    vp = ap->a_vp;
+    ctx = ap->a_context;
+    kassert_nonnull(desc);
+    assert_valid_vnode(vp);
+    kassert_nonnull(ctx);
 
-    /* do reclaim as if we have a fsnoe hash layer */
     mntp = emptyfs_mount_from_mp(vnode_mount(vp));
-    detach_root_vnode(mntp, vp);
+    ino = emptyfs_fsnode_from_vp(vp)->ino;
+
+    EMPTYFS_TRACE(mntp, VNOP_RECLAIM, 0, ino);
+
+    /* drop name cache entries naming vp  and negative ones under it */
+    if (mntp->flags & EMPTYFS_MNT_NAMECACHE) cache_purge(vp);
+
+    /* an unlinked ramfs node dies with its(sole) vnode */
+    if (mntp->ram != NULL) {
+        emptyfs_ram_lock_exclusive(mntp);
+        emptyfs_ram_release(mntp->ram, ino);
+        emptyfs_ram_unlock(mntp);
+    }
+
+    emptyfs_fsnode_detach(mntp, vp);
 
     return 0;
 }
@@ -14,5 +14,10 @@ readonly_extern struct vnodeopv_desc *emptyfs_vnopv_desc_list[__EFS_VNOPV_SZ];
 
 extern int (**emptyfs_vnop_p)(void *);
 
+struct emptyfs_mount;
+
+int emptyfs_synth_vget(struct emptyfs_mount *, uint64_t,
+                        vnode_t, struct componentname *, vnode_t *);
+
 #endif /* __EMPTYFS_VNOPS_H */
 
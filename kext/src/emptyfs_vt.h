@@ -0,0 +1,274 @@
+/*
+ * Created 261018
+ *
+ * Merkle tree of an image(EMPTYFS_IMG_F_VERITY)  and its lazy verifier
+ *  a leaf is SHA-256 of an image block  EMPTYFS_VT_ARITY hashes fill a tree
+ *  block  level 0 holds hashes of image blocks [0, tree_blk)  level k + 1
+ *  those of level k blocks  up to a level of one block  whose hash is root
+ *  levels are laid out bottom up from tree_blk  a level's last block is
+ *  zero padded  block 0 is hashed with the root in it zeroed
+ *
+ *  nothing is hashed at mount but block 0  a block is verified on its
+ *  first read  walking up the tree until a block verified before(or root)
+ *  every block on the way is then marked in a bitmap  thus a later read of
+ *  any of them costs a bit test  and a cold read costs about one hash
+ *
+ * XXX:
+ *  this header is shared with userspace(see: mkfs_emptyfs/ img_emptyfs/ bench_emptyfs/)
+ *  .: it must only depend on plain integer types and errno values
+ *  the bitmap is updated atomically  it needs no lock  two readers of a
+ *  cold block may both verify it  which is merely wasted work
+ *  a marked block is trusted as long as the mount lasts  i.e. it assumes
+ *  the device isn't rewritten under a mount  as the rest of the image code does
+ */
+
+#ifndef __EMPTYFS_VT_H
+#define __EMPTYFS_VT_H
+
+#include "emptyfs_img.h"
+#include "emptyfs_sha256.h"
+
+#define EMPTYFS_VT_ARITY        (EMPTYFS_IMG_BSIZE / EMPTYFS_SHA256_LEN)
+/* 128^8 blocks  far past what a 64-bit image can address */
+#define EMPTYFS_VT_LEVELS_MAX   8
+
+typedef char emptyfs_vt_root_size[
+        sizeof(((struct emptyfs_img_vt *) 0)->root) == EMPTYFS_SHA256_LEN ? 1 : -1];
+
+struct emptyfs_vt {
+    uint64_t tree_blk;
+    uint64_t nblk;                                  /* tree blocks */
+    uint32_t levels;
+    uint64_t lvl_blk[EMPTYFS_VT_LEVELS_MAX];        /* first block of a level */
+    uint64_t lvl_n[EMPTYFS_VT_LEVELS_MAX];          /* blocks of a level */
+    uint8_t root[EMPTYFS_SHA256_LEN];
+    uint8_t *done;          /* bit per image block  emptyfs_vt_map_size() bytes */
+    emptyfs_img_read_t read;
+    void *ctx;
+    /* stats  updated racily */
+    uint64_t nhashed;       /* blocks hashed by emptyfs_vt_verify*() */
+    uint64_t nbad;
+};
+
+/**
+ * Lay a tree out
+ * @tree_blk    blocks it covers  its first block
+ * @return      0 if success  EINVAL if too many levels
+ */
+static inline int emptyfs_vt_geom(struct emptyfs_vt *vt, uint64_t tree_blk)
+{
+    uint64_t n = tree_blk;
+    uint32_t k = 0;
+
+    if (tree_blk == 0) return EINVAL;
+
+    vt->tree_blk = tree_blk;
+    vt->nblk = 0;
+    do {
+        if (k == EMPTYFS_VT_LEVELS_MAX) return EINVAL;
+        n = (n + EMPTYFS_VT_ARITY - 1) / EMPTYFS_VT_ARITY;
+        vt->lvl_blk[k] = tree_blk + vt->nblk;
+        vt->lvl_n[k] = n;
+        vt->nblk += n;
+        k++;
+    } while (n > 1);
+    vt->levels = k;
+
+    return 0;
+}
+
+static inline size_t emptyfs_vt_map_size(const struct emptyfs_vt *vt)
+{
+    return (size_t) ((vt->tree_blk + vt->nblk + 7) / 8);
+}
+
+static inline int emptyfs_vt_done(const struct emptyfs_vt *vt, uint64_t blk)
+{
+    return (__atomic_load_n(&vt->done[blk >> 3], __ATOMIC_RELAXED) >> (blk & 7)) & 1;
+}
+
+static inline void emptyfs_vt_mark(struct emptyfs_vt *vt, uint64_t blk)
+{
+    (void) __atomic_fetch_or(&vt->done[blk >> 3], (uint8_t) (1U << (blk & 7)), __ATOMIC_RELAXED);
+}
+
+/**
+ * Hash block 0  i.e. zero the root in it first
+ * @blk0        EMPTYFS_IMG_BSIZE bytes  root is zeroed in place
+ */
+static inline void emptyfs_vt_hash0(char *blk0, uint8_t out[EMPTYFS_SHA256_LEN])
+{
+    memset(blk0 + EMPTYFS_IMG_VT_OFF + __builtin_offsetof(struct emptyfs_img_vt, root),
+            0, EMPTYFS_SHA256_LEN);
+    emptyfs_sha256(blk0, EMPTYFS_IMG_BSIZE, out);
+}
+
+/**
+ * Verify an image block against the tree  by its hash
+ * @blk         less than vt->tree_blk
+ * @hash        SHA-256 of its content(see: emptyfs_vt_hash0() for block 0)
+ * @scratch     EMPTYFS_IMG_BSIZE bytes
+ * @return      0 if verified  EIO if tampered(or corrupt)
+ *              o.w. errno of read callback
+ *
+ * tree blocks are read unverified  then verified by the walk itself
+ */
+static inline int emptyfs_vt_verify(
+        struct emptyfs_vt *vt,
+        uint64_t blk,
+        const uint8_t *hash,
+        char *scratch)
+{
+    uint64_t path[EMPTYFS_VT_LEVELS_MAX + 1];
+    uint8_t h[EMPTYFS_SHA256_LEN];
+    uint64_t item = blk, pblk;
+    uint32_t k, np = 0;
+    int e;
+
+    if (blk >= vt->tree_blk) return EINVAL;
+
+    path[np++] = blk;
+    for (k = 0; ; k++) {
+        /* item is the top block */
+        if (k == vt->levels) {
+            if (memcmp(hash, vt->root, EMPTYFS_SHA256_LEN)) goto out_bad;
+            break;
+        }
+
+        pblk = vt->lvl_blk[k] + item / EMPTYFS_VT_ARITY;
+        e = vt->read(vt->ctx, pblk << EMPTYFS_IMG_BSHIFT, scratch, EMPTYFS_IMG_BSIZE);
+        if (e) return e;
+        if (memcmp(hash, scratch + (item % EMPTYFS_VT_ARITY) * EMPTYFS_SHA256_LEN,
+                    EMPTYFS_SHA256_LEN)) {
+            goto out_bad;
+        }
+        if (emptyfs_vt_done(vt, pblk)) break;
+
+        path[np++] = pblk;
+        emptyfs_sha256(scratch, EMPTYFS_IMG_BSIZE, h);
+        hash = h;
+        item /= EMPTYFS_VT_ARITY;
+    }
+
+    /* the chain reached a trusted block  so every block on it is trusted */
+    while (np != 0) emptyfs_vt_mark(vt, path[--np]);
+    return 0;
+
+out_bad:
+    vt->nbad++;
+    return EIO;
+}
+
+/**
+ * Verify a run of image blocks  in memory
+ * @blk         first one  blocks [blk, blk + n) must be less than vt->tree_blk
+ * @data        their content  n * EMPTYFS_IMG_BSIZE bytes
+ * @bad         (OUT) first bad block if EIO
+ * @return      see: emptyfs_vt_verify()
+ *
+ * blocks not verified yet are hashed EMPTYFS_SHA256_LANES at a time
+ *  block 0 must have its root zeroed  see: emptyfs_vt_hash0()
+ */
+static inline int emptyfs_vt_verify_run(
+        struct emptyfs_vt *vt,
+        uint64_t blk,
+        uint64_t n,
+        const char *data,
+        char *scratch,
+        uint64_t *bad)
+{
+    const void *p[EMPTYFS_SHA256_LANES];
+    uint8_t h[EMPTYFS_SHA256_LANES][EMPTYFS_SHA256_LEN];
+    uint64_t b[EMPTYFS_SHA256_LANES];
+    uint64_t i;
+    int l, nl = 0;
+    int e;
+
+    if (blk > vt->tree_blk || n > vt->tree_blk - blk) return EINVAL;
+
+    for (i = 0; i < n || nl != 0; i++) {
+        if (i < n) {
+            if (emptyfs_vt_done(vt, blk + i)) continue;
+            b[nl] = blk + i;
+            p[nl] = data + (size_t) i * EMPTYFS_IMG_BSIZE;
+            if (++nl < EMPTYFS_SHA256_LANES) continue;
+            emptyfs_sha256_xn(p, EMPTYFS_IMG_BSIZE, h);
+        } else {
+            /* a tail of fewer blocks than lanes */
+            for (l = 0; l < nl; l++) emptyfs_sha256(p[l], EMPTYFS_IMG_BSIZE, h[l]);
+        }
+
+        vt->nhashed += (uint64_t) nl;
+        for (l = 0; l < nl; l++) {
+            e = emptyfs_vt_verify(vt, b[l], h[l], scratch);
+            if (e) {
+                *bad = b[l];
+                return e;
+            }
+        }
+        nl = 0;
+    }
+
+    return 0;
+}
+
+/**
+ * Set a verifier up for an opened image  nothing is verified yet
+ *  the caller then allocates vt->done  and calls emptyfs_vt_verify_sb()
+ * @img         opened with EMPTYFS_IMG_F_VERITY
+ * @return      0 if success  EINVAL if the descriptor is corrupt
+ *              o.w. errno of read callback
+ */
+static inline int emptyfs_vt_open(struct emptyfs_vt *vt, const struct emptyfs_img *img)
+{
+    struct emptyfs_img_vt d;
+    int e;
+
+    memset(vt, 0, sizeof(*vt));
+    vt->read = img->read;
+    vt->ctx = img->ctx;
+
+    e = img->read(img->ctx, EMPTYFS_IMG_VT_OFF, &d, sizeof(d));
+    if (e) return e;
+    emptyfs_img_vt_swab(&d);
+
+    if (emptyfs_vt_geom(vt, d.tree_blk) != 0 || d.levels != vt->levels) return EINVAL;
+    /* the tree ends the image  and covers everything else */
+    if (d.tree_blk >= img->sb.nblocks || img->sb.nblocks - d.tree_blk != vt->nblk)
+        return EINVAL;
+    memcpy(vt->root, d.root, sizeof(vt->root));
+
+    return 0;
+}
+
+/**
+ * Verify block 0  i.e. the superblock parsed is trusted afterwards
+ * @scratch     EMPTYFS_IMG_BSIZE bytes
+ * @return      see: emptyfs_vt_verify()
+ */
+static inline int emptyfs_vt_verify_sb(
+        struct emptyfs_vt *vt,
+        const struct emptyfs_img *img,
+        char *scratch)
+{
+    struct emptyfs_img_sb sb;
+    uint8_t h[EMPTYFS_SHA256_LEN];
+    int e;
+
+    e = img->read(img->ctx, 0, scratch, EMPTYFS_IMG_BSIZE);
+    if (e) return e;
+
+    /* the one parsed must be the one hashed  volname was NUL-terminated */
+    sb = img->sb;
+    emptyfs_img_sb_swab(&sb);
+    if (memcmp(scratch, &sb, __builtin_offsetof(struct emptyfs_img_sb, volname))) {
+        vt->nbad++;
+        return EIO;
+    }
+
+    emptyfs_vt_hash0(scratch, h);
+    vt->nhashed++;
+    return emptyfs_vt_verify(vt, 0, h, scratch);
+}
+
+#endif /* __EMPTYFS_VT_H */
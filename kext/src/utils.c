@@ -6,36 +6,141 @@
 #include <libkern/OSAtomic.h>
 #include <mach-o/loader.h>
 #include <sys/vnode.h>
+#include <sys/sysctl.h>
+#include <kern/sched_prim.h>
 
 #include "utils.h"
+#include "emptyfs_mag.h"
+#include "emptyfs_ref.h"
+
+/*
+ * Leak accounting  i.e. number of live util_malloc() objects
+ *  sharded per CPU once util_mcache_init() done  so that no line bounces
+ *  a shard alone may go negative(allocated on a CPU  freed on another)
+ *  only the sum is meaningful
+ */
+struct mstat_cpu {
+    volatile SInt64 cnt;
+} __attribute__((aligned(64)));
+
+static volatile SInt64 mstat_cnt = 0;
+static struct mstat_cpu *mstat_cpu = NULL;
+
+/*
+ * Size classes served by magazine caches  16 bytes up to 1KB(header included)
+ *  larger objects go to _MALLOC() directly
+ */
+#define MCACHE_MIN_SHIFT    4
+#define MCACHE_NCLASS       7
+#define MCACHE_LARGE        ((uint32_t) -1)
+
+/*
+ * Prepended to each util_malloc() object  keeps 16-byte alignment
+ */
+struct mhdr {
+    uint32_t cls;       /* size class  MCACHE_LARGE if not cached */
+    uint32_t pad;
+    uint64_t size;      /* size requested by caller */
+};
+
+static struct emptyfs_mag_cache mcache[MCACHE_NCLASS];
+static void *mcache_mem = NULL;     /* per-CPU slots and mstat shards */
+static uint32_t mcache_ncpu = 0;
+static lck_grp_t *mcache_grp = NULL;
+
+/**
+ * @return      sum of mstat shards
+ *              racy  yet a double free keeps it negative across re-reads
+ */
+static SInt64 mstat_sum(const struct mstat_cpu *mc, uint32_t n)
+{
+    SInt64 sum = 0;
+    uint32_t i;
+
+    for (i = 0; i < n; i++) sum += mc[i].cnt;
+    return sum;
+}
 
 static void util_mstat(int opt)
 {
-    static volatile SInt64 cnt = 0;
+    struct mstat_cpu *mc = mstat_cpu;
+    uint32_t n = mcache_ncpu;
+    int sharded = mc != NULL && n != 0;
+    volatile SInt64 *cnt = sharded ? &mc[(uint32_t) cpu_number() % n].cnt : &mstat_cnt;
+    SInt64 v;
+
     switch (opt) {
     case 0:
-        if (OSDecrementAtomic64(&cnt) > 0) return;
+        /* OSDecrementAtomic64() returns the old value */
+        v = OSDecrementAtomic64(cnt) - 1;
+        if (v >= 0) return;
+        /* a shard alone may go negative  the sum must not  re-read once if so */
+        if (sharded && ((v = mstat_sum(mc, n)) >= 0 || (v = mstat_sum(mc, n)) >= 0)) return;
         break;
     case 1:
-        if (OSIncrementAtomic64(&cnt) >= 0) return;
+        v = OSIncrementAtomic64(cnt) + 1;
+        if (v > 0 || sharded) return;
         break;
     default:
-        if (cnt == 0) return;
+        /* shards were folded back by util_mcache_fini() */
+        kassert_null(mstat_cpu);
+        v = mstat_cnt;
+        if (v == 0) return;
         break;
     }
 #ifdef DEBUG
-    panicf("FIXME: potential memleak  opt: %d cnt: %lld", opt, cnt);
+    panicf("FIXME: potential memleak  opt: %d cnt: %lld", opt, v);
 #else
-    LOG_BUG("FIXME: potential memleak  opt: %d cnt: %lld", opt, cnt);
+    LOG_BUG("FIXME: potential memleak  opt: %d cnt: %lld", opt, v);
 #endif
 }
 
-void *util_malloc(size_t size, int flags)
+static void *mcache_backend_alloc(size_t size, int flags)
 {
     /* _MALLOC `type' parameter is a joke */
-    void *addr = _MALLOC(size, M_TEMP, flags);
-    if (likely(addr != NULL)) util_mstat(1);
-    return addr;
+    return _MALLOC(size, M_TEMP, flags);
+}
+
+static void mcache_backend_free(void *addr, size_t size)
+{
+    UNUSED(size);
+    _FREE(addr, M_TEMP);
+}
+
+/**
+ * @return      size class of an object of total size sz  MCACHE_LARGE if none
+ */
+static inline uint32_t mcache_class(size_t sz)
+{
+    uint32_t cls = 0;
+
+    while (cls < MCACHE_NCLASS && ((size_t) 1 << (cls + MCACHE_MIN_SHIFT)) < sz) cls++;
+    return cls < MCACHE_NCLASS ? cls : MCACHE_LARGE;
+}
+
+void *util_malloc(size_t size, int flags)
+{
+    struct mhdr *h;
+    uint32_t cls;
+
+    /* _MALLOC() returns NULL for zero size  keep that */
+    if (unlikely(size == 0 || size > (size_t) -1 - sizeof(*h))) return NULL;
+
+    cls = mcache_ncpu != 0 ? mcache_class(size + sizeof(*h)) : MCACHE_LARGE;
+    if (cls != MCACHE_LARGE) {
+        /* cached objects are dirty  zero them ourselves */
+        h = emptyfs_mag_alloc(&mcache[cls], (uint32_t) cpu_number(), flags & ~M_ZERO);
+    } else {
+        h = _MALLOC(size + sizeof(*h), M_TEMP, flags & ~M_ZERO);
+    }
+    if (unlikely(h == NULL)) return NULL;
+
+    h->cls = cls;
+    h->size = size;
+    if (flags & M_ZERO) memset(h + 1, 0, size);
+
+    util_mstat(1);
+    return h + 1;
 }
 
 /**
@@ -53,13 +158,13 @@ void *util_malloc(size_t size, int flags)
  *
  * NOTE:
  *  You should generally avoid allocate zero-length(new buffer size)
- *  the behaviour is implementation-defined(_MALLOC return NULL in such case)
+ *  the behaviour is implementation-defined(util_malloc return NULL in such case)
  *
  * See:
  *  xnu/bsd/kern/kern_malloc.c@_REALLOC
  *  wiki.sei.cmu.edu/confluence/display/c/MEM04-C.+Beware+of+zero-length+allocations
  */
-static void *util_realloc2(void *addr0, size_t sz0, size_t sz1, int flags)
+void *util_realloc(void *addr0, size_t sz0, size_t sz1, int flags)
 {
     void *addr1;
 
@@ -69,41 +174,63 @@ static void *util_realloc2(void *addr0, size_t sz0, size_t sz1, int flags)
      */
     if (addr0 == NULL) {
         kassert(sz0 == 0);
-        addr1 = _MALLOC(sz1, M_TEMP, flags);
-        goto out_exit;
+        return util_malloc(sz1, flags);
     }
 
-    if (unlikely(sz1 == sz0)) {
-        addr1 = addr0;
-        goto out_exit;
-    }
+    kassert(((struct mhdr *) addr0 - 1)->size == sz0);
+    if (unlikely(sz1 == sz0)) return addr0;
 
-    addr1 = _MALLOC(sz1, M_TEMP, flags);
-    if (unlikely(addr1 == NULL))
-        goto out_exit;
+    /* If failed  addr0 is left untouched */
+    addr1 = util_malloc(sz1, flags);
+    if (unlikely(addr1 == NULL)) return NULL;
 
     memcpy(addr1, addr0, MIN(sz0, sz1));
-    _FREE(addr0, M_TEMP);
+    util_mfree(addr0);
 
-out_exit:
     return addr1;
 }
 
-void *util_realloc(void *addr0, size_t sz0, size_t sz1, int flags)
+void util_mfree(void *addr)
 {
-    void *addr1 = util_realloc2(addr0, sz0, sz1, flags);
-    /*
-     * If addr0 is notnull yet addr1 null  the reference shouldn't change
-     *  since addr0 won't be free in such case
-     */
-    if (!addr0 && addr1) util_mstat(1);
-    return addr1;
+    struct mhdr *h;
+
+    if (addr == NULL) return;
+
+    h = (struct mhdr *) addr - 1;
+    kassertf(h->cls < MCACHE_NCLASS || h->cls == MCACHE_LARGE,
+                "bad size class  addr: %p cls: %#x", addr, h->cls);
+
+    util_mstat(0);
+
+    if (h->cls != MCACHE_LARGE && mcache_ncpu != 0) {
+        emptyfs_mag_free(&mcache[h->cls], (uint32_t) cpu_number(), h);
+    } else {
+        /* class objects outliving caches were _MALLOC()ed all the same */
+        _FREE(h, M_TEMP);
+    }
 }
 
-void util_mfree(void *addr)
+/**
+ * Get number of CPU slots a per-CPU structure should have
+ *  i.e. upper bound of cpu_number() + 1  even if some CPUs are offline
+ * @return      0 if success  errno o.w.
+ */
+int util_ncpu(uint32_t *ncpu)
 {
-    if (addr != NULL) util_mstat(0);
-    _FREE(addr, M_TEMP);
+    int e;
+    int n = 0;
+    size_t len = sizeof(n);
+
+    kassert_nonnull(ncpu);
+
+    e = sysctlbyname("hw.logicalcpu_max", &n, &len, NULL, 0);
+    if (e != 0 || n <= 0) {
+        LOG_ERR("sysctlbyname() hw.logicalcpu_max fail  errno: %d ncpu: %d", e, n);
+        return e != 0 ? e : EINVAL;
+    }
+
+    *ncpu = (uint32_t) n;
+    return 0;
 }
 
 /* XXX: call when all memory freed */
@@ -112,64 +239,140 @@ void util_massert(void)
     util_mstat(2);
 }
 
-/*
- * kcb stands for kernel callbacks  a global refcnt used in kext
+/**
+ * Put per-CPU magazine caches in front of _MALLOC()
+ *  util_malloc() works before(and after) this  just uncached
+ * @grp     lock group of cache spinlocks  must outlive util_mcache_fini()
+ * @return  0 if success  errno o.w.(allocation stays uncached)
  */
-static int kcb(int opt)
+int util_mcache_init(lck_grp_t *grp)
 {
-    static volatile SInt i = 0;
-    static struct timespec ts = {0, 1e+6};  /* 100ms */
-    SInt rd;
+    int e;
+    uint32_t ncpu;
+    uint32_t i;
+    size_t sz;
+    struct emptyfs_mag_cpu *pc;
 
-    switch (opt) {
-    case 0:
-        do {
-            if ((rd = i) < 0) break;
-        } while (!OSCompareAndSwap(rd, rd + 1, &i));
-        return rd;
+    kassert_nonnull(grp);
+    kassert_null(mcache_mem);
 
-    case 1:
-        rd = OSDecrementAtomic(&i);
-        kassert(rd > 0);
-        return rd;
-
-    case 2:
-        do {
-            while (i > 0) msleep((void *) &i, NULL, PWAIT, NULL, &ts);
-        } while (!OSCompareAndSwap(0, (UInt32) -1, &i));
-        break;
+    e = util_ncpu(&ncpu);
+    if (e != 0) return e;
 
-    default:
-        panicf("invalid option  opt: %d", i);
+    /* slack for cache line alignment */
+    sz = (size_t) ncpu * (MCACHE_NCLASS * sizeof(*pc) + sizeof(*mstat_cpu)) + __alignof__(*pc);
+    mcache_mem = _MALLOC(sz, M_TEMP, M_WAITOK | M_ZERO);
+    if (mcache_mem == NULL) {
+        LOG_ERR("_MALLOC() fail  size: %zu", sz);
+        return ENOMEM;
+    }
+
+    pc = (struct emptyfs_mag_cpu *) (((uintptr_t) mcache_mem +
+                __alignof__(*pc) - 1) & ~(uintptr_t) (__alignof__(*pc) - 1));
+
+    for (i = 0; i < MCACHE_NCLASS; i++) {
+        if (emptyfs_mag_init(&mcache[i], (size_t) 1 << (i + MCACHE_MIN_SHIFT),
+                    pc + (size_t) i * ncpu, ncpu, mcache_backend_alloc,
+                    mcache_backend_free, M_NOWAIT, grp) != 0) {
+            LOG_ERR("lck_spin_alloc_init() fail  class: %u", i);
+            while (i-- > 0) emptyfs_mag_fini(&mcache[i], grp);
+            _FREE(mcache_mem, M_TEMP);
+            mcache_mem = NULL;
+            return ENOMEM;
+        }
     }
 
-    return i;
+    mcache_grp = grp;
+    /* publish last  callers test mcache_ncpu */
+    OSMemoryBarrier();
+    mcache_ncpu = ncpu;
+    mstat_cpu = (struct mstat_cpu *) (pc + (size_t) MCACHE_NCLASS * ncpu);
+
+    LOG_DBG("magazine caches  %u class(es) over %u CPU(s)  %zu bytes",
+                MCACHE_NCLASS, ncpu, sz);
+
+    return 0;
+}
+
+/**
+ * Must be called when no one can allocate  i.e. right before util_massert()
+ */
+void util_mcache_fini(void)
+{
+    uint32_t ncpu;
+    uint32_t i;
+
+    if (mcache_mem == NULL) return;
+
+    ncpu = mcache_ncpu;
+    mcache_ncpu = 0;
+    for (i = 0; i < ncpu; i++) (void) OSAddAtomic64(mstat_cpu[i].cnt, &mstat_cnt);
+    mstat_cpu = NULL;
+
+    for (i = 0; i < MCACHE_NCLASS; i++) emptyfs_mag_fini(&mcache[i], mcache_grp);
+
+    _FREE(mcache_mem, M_TEMP);
+    mcache_mem = NULL;
+    mcache_grp = NULL;
 }
 
+/*
+ * kcb stands for kernel callbacks  a global refcnt used in kext
+ *  per-CPU  so that callbacks on different CPUs never contend
+ *  see: emptyfs_ref.h
+ */
+static struct emptyfs_ref kcb;
+
 /**
  * Increase refcnt of activated kext callbacks
- * @return      refcnt before get  -1 if failed to get(must check)
+ * @return      0 if success  -1 if failed to get(must check)
  */
 int util_get_kcb(void)
 {
-    return kcb(0);
+    if (likely(emptyfs_ref_get(&kcb, (uint32_t) cpu_number()) == 0)) return 0;
+    /* drainer may be waiting on our transient increment */
+    thread_wakeup((event_t) &kcb);
+    return -1;
 }
 
 /**
  * Decrease refcnt of activated kext callbacks
- * @return      refcnt before put
+ * @return      always 0
  */
 int util_put_kcb(void)
 {
-    return kcb(1);
+    if (unlikely(emptyfs_ref_put(&kcb, (uint32_t) cpu_number()))) {
+        /* invalidated  this may be the final put */
+        thread_wakeup((event_t) &kcb);
+    }
+    return 0;
+}
+
+/**
+ * @return      a snapshot of refcnt  -1 if invalidated
+ */
+int util_read_kcb(void)
+{
+    return kcb.dead ? -1 : (int) emptyfs_ref_sum(&kcb);
 }
 
 /**
  * Invalidate further kcb operations(should call only once)
+ *  and wait for all references to go  woken up by puts  never polls
  */
 void util_invalidate_kcb(void)
 {
-    (void) kcb(2);
+    emptyfs_ref_kill(&kcb);
+
+    for (;;) {
+        /* wait is asserted before checking  :. no wakeup is lost */
+        (void) assert_wait((event_t) &kcb, THREAD_UNINT);
+        if (emptyfs_ref_sum(&kcb) == 0) {
+            (void) clear_wait(current_thread(), THREAD_AWAKENED);
+            break;
+        }
+        (void) thread_block(THREAD_CONTINUE_NULL);
+    }
 }
 
 #define UUID_STR_BUFSZ      sizeof(uuid_string_t)
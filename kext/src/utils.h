@@ -13,6 +13,8 @@
 #include <sys/malloc.h>
 #include <kern/debug.h>
 #include <libkern/libkern.h>
+#include <libkern/OSAtomic.h>
+#include <kern/locks.h>
 
 #ifndef __kext_makefile__
 #define KEXTNAME_S "emptyfs"
@@ -22,6 +24,9 @@
  * __ENVIRONMENT_MAC_OS_X_VERSION_MIN_REQUIRED__ is a compiler-predefined macro
  */
 #define OS_VER_MIN_REQ      __ENVIRONMENT_MAC_OS_X_VERSION_MIN_REQUIRED__
+#ifndef __MAC_10_10
+#define __MAC_10_10         101000
+#endif
 #ifndef __MAC_10_12
 #define __MAC_10_12         101200
 #endif
@@ -141,11 +146,68 @@
  */
 #define QSTRLEN(s)          (sizeof(s) - 1)
 
+/*
+ * Sequence counter  lets readers snapshot a few words without any lock
+ *  an odd value indicates a write in progress
+ * writers must be serialized by other means(typically a mutex)
+ *
+ * Example:
+ *  do {
+ *      seq = util_seq_read_begin(&s);
+ *      ... copy out protected fields ...
+ *  } while (util_seq_read_retry(&s, seq));
+ *
+ * see: linux/include/linux/seqlock.h
+ */
+typedef volatile uint32_t util_seq_t;
+
+static inline uint32_t util_seq_read_begin(util_seq_t *s)
+{
+    uint32_t seq = *s;
+    OSMemoryBarrier();
+    return seq;
+}
+
+/**
+ * @return      non-zero if the snapshot taken since util_seq_read_begin()
+ *              is inconsistent(i.e. a writer was in progress or intervened)
+ */
+static inline int util_seq_read_retry(util_seq_t *s, uint32_t seq)
+{
+    OSMemoryBarrier();
+    return (seq & 1) || *s != seq;
+}
+
+static inline void util_seq_write_begin(util_seq_t *s)
+{
+    kassert(!(*s & 1));
+    (*s)++;
+    OSMemoryBarrier();
+}
+
+static inline void util_seq_write_end(util_seq_t *s)
+{
+    OSMemoryBarrier();
+    (*s)++;
+    kassert(!(*s & 1));
+}
+
+/*
+ * cpu_number() is exported  yet not declared in Kernel.framework
+ * see: xnu/osfmk/kern/cpu_number.h
+ */
+extern int cpu_number(void);
+
+int util_ncpu(uint32_t *);
+
 void *util_malloc(size_t, int);
 void *util_realloc(void *, size_t, size_t, int);
 void util_mfree(void *);
 void util_massert(void);
 
+int util_mcache_init(lck_grp_t *);
+void util_mcache_fini(void);
+
 int util_get_kcb(void);
 int util_put_kcb(void);
 int util_read_kcb(void);
@@ -0,0 +1,1733 @@
+/*
+ * Created 261018
+ *
+ * Build a read-only emptyfs image out of a directory tree
+ *  format see: kext/src/emptyfs_img.h  it runs on Linux as well
+ *
+ * [pipeline]
+ *  walk        walker threads scan directories off a shared stack
+ *              hard links are merged by (st_dev, st_ino)
+ *  number      inode numbers are assigned breadth-first  names sorted
+ *              thus output never depends on thread scheduling
+ *  prep        prep threads claim inodes in number order  read files
+ *              and hash names into sorted directory tables
+ *  write       the main thread writes them in number order  back to back
+ *              i.e. every file is a single(inline) extent
+ *              or a compressed run if -z and it saves a block at least
+ *
+ *  with -d prep threads also hash each file block(or compressed run)
+ *  the writer looks hashes up in a table of what it has written  a hit is
+ *  compared byte for byte with the image  then referenced instead of
+ *  written again  thus a file becomes a list of extents  and output stays
+ *  independent of thread scheduling  the extent table goes past the data
+ *
+ *  prep and write overlap  bytes in flight between them are bounded
+ *  the inode a writer waits for is never held back by the bound
+ *  .: it can't deadlock  a file too large for the bound is copied by
+ *  the writer itself  and never compressed
+ *
+ *  [verity]   with -M hasher threads read the image back once it's laid
+ *              out  and hash its blocks into a Merkle tree appended to it
+ *              see: emptyfs_vt.h  block 0 is hashed as it's about to be
+ *              written  only its root is filled in afterwards
+ *
+ *  superblock is written last  an interrupted build leaves no magic
+ *  behind  which mounts as an empty root rather than a broken image
+ */
+
+#define _XOPEN_SOURCE   700
+/* fstatat(2) and st_flags aren't in old POSIX */
+#define _DEFAULT_SOURCE
+#define _DARWIN_C_SOURCE
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "emptyfs_img.h"
+#include "emptyfs_vt.h"
+
+#define MKFS_EMPTYFS_VERSION    "0.1"
+
+#define LOG(fmt, ...)       printf("mkfs_emptyfs: " fmt "\n", ##__VA_ARGS__)
+#define LOG_ERR(fmt, ...)   fprintf(stderr, "mkfs_emptyfs: [ERR] " fmt "\n", ##__VA_ARGS__)
+
+#define ASSERT_NONNULL(p)   assert(p != NULL)
+
+#define MKFS_THREADS_MAX    256
+/* bytes in flight between prep and write stages  in MiB */
+#define MKFS_BUDGET_DEFAULT 256
+/* writer copies a file itself if it's larger than this fraction of budget */
+#define MKFS_STREAM_SHIFT   3
+#define MKFS_COPY_BUFSZ     (1024 * 1024)
+#define MKFS_HLINK_BUCKETS  65536
+/* initial slots of a dedup table  grows at half load */
+#define MKFS_DEDUP_SLOTS    65536
+/* blocks a hasher reads back at a time  see [verity] */
+#define MKFS_VT_CHUNK       (MKFS_COPY_BUFSZ >> EMPTYFS_IMG_BSHIFT)
+
+#ifdef __APPLE__
+#define ST_MTIM(st)         ((st)->st_mtimespec)
+#define ST_FLAGS(st)        ((st)->st_flags)
+#else
+#define ST_MTIM(st)         ((st)->st_mtim)
+#define ST_FLAGS(st)        0
+#endif
+
+struct mk_ino;
+
+struct mk_ent {
+    char *name;
+    uint32_t len;
+    uint32_t hash;          /* filled by prep stage */
+    struct mk_ino *ip;
+};
+
+enum {
+    MK_PENDING = 0,
+    MK_READY,
+    MK_STREAM,              /* writer copies it */
+};
+
+struct mk_ino {
+    char *path;             /* in source tree  first link if hard-linked */
+    uint8_t type;           /* EMPTYFS_IMG_REG or EMPTYFS_IMG_DIR */
+    uint16_t perm;
+    uint32_t nlink;         /* links found in source tree */
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t flags;
+    int64_t mtime;
+    uint32_t mtime_nsec;
+    uint64_t size;
+    uint64_t ino;           /* zero until numbered */
+    struct mk_ino *parent;
+
+    /* directory only */
+    struct mk_ent *ents;
+    uint32_t nent;
+    uint32_t cap;
+    uint32_t nsubdir;
+
+    /* hard link table */
+    dev_t sdev;
+    ino_t sino;
+    struct mk_ino *hnext;
+
+    /* prep -> write  protected by pipe.mtx */
+    int state;
+    void *buf;              /* whole blocks  zero padded */
+    uint64_t cost;          /* bytes charged against budget */
+    uint64_t xt;            /* first block in image */
+    int lz;                 /* buf is a compressed run */
+    uint64_t nblk;          /* blocks of the run */
+    uint32_t nxt;           /* extents in extent table  0 if inline */
+    uint64_t *bhash;        /* per block of buf  if -d and not lz */
+    uint64_t rhash;         /* of the run  if -d and lz */
+};
+
+static int nthreads;
+static int compress;
+static int dedup;
+static int verity;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static double mib(uint64_t bytes)
+{
+    return (double) bytes / (1024.0 * 1024.0);
+}
+
+static double per_sec(double n, double sec)
+{
+    return sec > 0 ? n / sec : 0;
+}
+
+static __attribute__((noreturn)) void usage(char *argv0)
+{
+    ASSERT_NONNULL(argv0);
+    fprintf(stderr,
+            "usage:\n\t"
+            "%s [-t n] [-m n] [-z] [-d] [-M] [-V volname] [-T mtime] srcdir image\n\t"
+            "%s -v\n\n\t"
+            "-t n       threads per stage(default: online CPUs)\n\t"
+            "-m n       MiB in flight between readers and writer(default %d)\n\t"
+            "-z         compress files block by block(needs a kext which knows it)\n\t"
+            "-d         store identical blocks(and compressed files) once  ditto\n\t"
+            "-M         append a Merkle tree  reads are verified against it  ditto\n\t"
+            "-V name    volume name(at most %d bytes)\n\t"
+            "-T secs    image build time  for reproducible images(default now)\n\t"
+            "-v         print version\n\t"
+            "-h         print this help\n\n\t"
+            "srcdir     directory tree to copy  symlinks and special files are skipped\n\t"
+            "image      output file(or device)\n\n",
+            basename(argv0), basename(argv0), MKFS_BUDGET_DEFAULT,
+            EMPTYFS_IMG_VOLNAME_MAX - 1);
+    exit(1);
+}
+
+static uint32_t parse_u32(char *argv0, const char *arg)
+{
+    unsigned long n;
+    char *end;
+
+    ASSERT_NONNULL(argv0);
+    ASSERT_NONNULL(arg);
+
+    errno = 0;
+    n = strtoul(arg, &end, 0);
+    if (errno != 0 || end == arg || *end != '\0' || n > UINT32_MAX) {
+        LOG_ERR("bad numeric argument: %s", arg);
+        usage(argv0);
+    }
+
+    return (uint32_t) n;
+}
+
+static void *xmalloc(size_t size)
+{
+    void *p = malloc(size);
+    if (p == NULL) {
+        LOG_ERR("malloc(3) fail  size: %zu", size);
+        exit(1);
+    }
+    return p;
+}
+
+static char *path_join(const char *dir, const char *name)
+{
+    size_t a = strlen(dir), b = strlen(name);
+    char *p = xmalloc(a + b + 2);
+
+    memcpy(p, dir, a);
+    p[a] = '/';
+    memcpy(p + a + 1, name, b + 1);
+    return p;
+}
+
+/**
+ * @return      bytes read(less than len only at EOF)  -1 o.w.
+ */
+static ssize_t read_full(int fd, void *buf, size_t len)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < len) {
+        n = read(fd, (char *) buf + done, len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        done += (size_t) n;
+    }
+
+    return (ssize_t) done;
+}
+
+static int write_full(int fd, const void *buf, size_t len, uint64_t off)
+{
+    ssize_t n;
+
+    while (len != 0) {
+        n = pwrite(fd, buf, len, (off_t) off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return errno;
+        buf = (const char *) buf + n;
+        off += (uint64_t) n;
+        len -= (size_t) n;
+    }
+
+    return 0;
+}
+
+/*
+ * [walk]
+ */
+
+struct walk {
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    struct mk_ino **stack;      /* directories not scanned yet */
+    size_t nstack;
+    size_t cap;
+    int idle;
+    int done;
+    struct mk_ino *hlink[MKFS_HLINK_BUCKETS];
+
+    /* all protected by mtx */
+    uint64_t ndirs;
+    uint64_t nfiles;            /* unique inodes  i.e. hard links merged */
+    uint64_t nlinks;            /* dirents */
+    uint64_t nskip;
+    uint64_t nerr;
+};
+
+static struct walk walk = {
+    .mtx = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static struct mk_ino *ino_new(char *path, const struct stat *st)
+{
+    struct mk_ino *ip = calloc(1, sizeof(*ip));
+
+    if (ip == NULL) {
+        LOG_ERR("calloc(3) fail  size: %zu", sizeof(*ip));
+        exit(1);
+    }
+
+    ip->path = path;
+    ip->type = S_ISDIR(st->st_mode) ? EMPTYFS_IMG_DIR : EMPTYFS_IMG_REG;
+    ip->perm = (uint16_t) (st->st_mode & 07777);
+    ip->nlink = 1;
+    ip->uid = (uint32_t) st->st_uid;
+    ip->gid = (uint32_t) st->st_gid;
+    ip->flags = (uint32_t) ST_FLAGS(st);
+    ip->mtime = (int64_t) ST_MTIM(st).tv_sec;
+    ip->mtime_nsec = (uint32_t) ST_MTIM(st).tv_nsec;
+    ip->size = ip->type == EMPTYFS_IMG_REG ? (uint64_t) st->st_size : 0;
+    ip->sdev = st->st_dev;
+    ip->sino = st->st_ino;
+    return ip;
+}
+
+static void walk_push(struct mk_ino *dp)
+{
+    (void) pthread_mutex_lock(&walk.mtx);
+    if (walk.nstack == walk.cap) {
+        walk.cap = walk.cap ? walk.cap * 2 : 1024;
+        walk.stack = realloc(walk.stack, walk.cap * sizeof(*walk.stack));
+        if (walk.stack == NULL) {
+            LOG_ERR("realloc(3) fail  size: %zu", walk.cap * sizeof(*walk.stack));
+            exit(1);
+        }
+    }
+    walk.stack[walk.nstack++] = dp;
+    walk.ndirs++;
+    (void) pthread_cond_signal(&walk.cond);
+    (void) pthread_mutex_unlock(&walk.mtx);
+}
+
+/**
+ * Find or insert a multiply-linked file
+ * @return      the inode already known  NULL if ip was inserted
+ */
+static struct mk_ino *hlink_get(struct mk_ino *ip)
+{
+    uint64_t k = ((uint64_t) ip->sdev * 0x9e3779b97f4a7c15ULL) ^ (uint64_t) ip->sino;
+    struct mk_ino **b = &walk.hlink[(k ^ (k >> 29)) % MKFS_HLINK_BUCKETS];
+    struct mk_ino *p;
+
+    for (p = *b; p != NULL; p = p->hnext) {
+        if (p->sdev == ip->sdev && p->sino == ip->sino) return p;
+    }
+
+    ip->hnext = *b;
+    *b = ip;
+    return NULL;
+}
+
+static void ent_add(struct mk_ino *dp, const char *name, size_t len, struct mk_ino *ip)
+{
+    struct mk_ent *e;
+
+    if (dp->nent == dp->cap) {
+        dp->cap = dp->cap ? dp->cap * 2 : 8;
+        dp->ents = realloc(dp->ents, dp->cap * sizeof(*dp->ents));
+        if (dp->ents == NULL) {
+            LOG_ERR("realloc(3) fail  size: %zu", dp->cap * sizeof(*dp->ents));
+            exit(1);
+        }
+    }
+
+    e = &dp->ents[dp->nent++];
+    e->name = xmalloc(len + 1);
+    memcpy(e->name, name, len + 1);
+    e->len = (uint32_t) len;
+    e->hash = 0;
+    e->ip = ip;
+}
+
+/**
+ * Scan a directory  only the calling walker touches dp
+ * @return      number of errors
+ */
+static uint64_t walk_dir(struct mk_ino *dp)
+{
+    uint64_t nerr = 0, nskip = 0, nfiles = 0, nlinks = 0;
+    struct mk_ino *ip, *old;
+    struct dirent *de;
+    struct stat st;
+    size_t len;
+    DIR *d;
+
+    d = opendir(dp->path);
+    if (d == NULL) {
+        LOG_ERR("opendir(3) fail  path: %s errno: %d", dp->path, errno);
+        return 1;
+    }
+
+    while ((errno = 0, de = readdir(d)) != NULL) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+
+        len = strlen(de->d_name);
+        if (len > EMPTYFS_IMG_NAME_MAX) {
+            LOG_ERR("name too long  dir: %s", dp->path);
+            nerr++;
+            continue;
+        }
+
+        if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            LOG_ERR("fstatat(2) fail  path: %s/%s errno: %d", dp->path, de->d_name, errno);
+            nerr++;
+            continue;
+        }
+
+        if (!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode)) {
+            LOG("skipped %s/%s  not a regular file or directory", dp->path, de->d_name);
+            nskip++;
+            continue;
+        }
+
+        if (S_ISREG(st.st_mode) && (uint64_t) st.st_size > EMPTYFS_IMG_FILE_MAX) {
+            LOG_ERR("file too large  path: %s/%s", dp->path, de->d_name);
+            nerr++;
+            continue;
+        }
+
+        if (dp->nent == UINT32_MAX) {
+            LOG_ERR("too many entries  dir: %s", dp->path);
+            nerr++;
+            break;
+        }
+
+        ip = ino_new(path_join(dp->path, de->d_name), &st);
+        nlinks++;
+
+        if (S_ISDIR(st.st_mode)) {
+            dp->nsubdir++;
+            ent_add(dp, de->d_name, len, ip);
+            walk_push(ip);
+            continue;
+        }
+
+        old = NULL;
+        if (st.st_nlink > 1) {
+            (void) pthread_mutex_lock(&walk.mtx);
+            old = hlink_get(ip);
+            if (old != NULL) old->nlink++;
+            (void) pthread_mutex_unlock(&walk.mtx);
+        }
+
+        if (old != NULL) {
+            free(ip->path);
+            free(ip);
+            ip = old;
+        } else {
+            nfiles++;
+        }
+        ent_add(dp, de->d_name, len, ip);
+    }
+
+    if (errno != 0) {
+        LOG_ERR("readdir(3) fail  path: %s errno: %d", dp->path, errno);
+        nerr++;
+    }
+    (void) closedir(d);
+
+    (void) pthread_mutex_lock(&walk.mtx);
+    walk.nfiles += nfiles;
+    walk.nlinks += nlinks;
+    walk.nskip += nskip;
+    (void) pthread_mutex_unlock(&walk.mtx);
+
+    return nerr;
+}
+
+static void *walk_main(void *arg)
+{
+    struct mk_ino *dp;
+    uint64_t nerr;
+
+    (void) arg;
+
+    (void) pthread_mutex_lock(&walk.mtx);
+    for (;;) {
+        while (walk.nstack == 0 && !walk.done) {
+            /* the last one going idle ends the walk  nobody can push any more */
+            if (++walk.idle == nthreads) {
+                walk.done = 1;
+                (void) pthread_cond_broadcast(&walk.cond);
+            } else {
+                (void) pthread_cond_wait(&walk.cond, &walk.mtx);
+            }
+            walk.idle--;
+        }
+        if (walk.nstack == 0) break;
+
+        dp = walk.stack[--walk.nstack];
+        (void) pthread_mutex_unlock(&walk.mtx);
+
+        nerr = walk_dir(dp);
+
+        (void) pthread_mutex_lock(&walk.mtx);
+        walk.nerr += nerr;
+    }
+    (void) pthread_mutex_unlock(&walk.mtx);
+
+    return NULL;
+}
+
+/*
+ * [number]
+ */
+
+static int ent_cmp_name(const void *a, const void *b)
+{
+    return strcmp(((const struct mk_ent *) a)->name, ((const struct mk_ent *) b)->name);
+}
+
+/**
+ * Number inodes breadth-first  children of a directory by name
+ * @return      inodes indexed by number minus EMPTYFS_IMG_ROOT_INO
+ */
+static struct mk_ino **number(struct mk_ino *root, uint64_t n)
+{
+    struct mk_ino **inos = xmalloc(n * sizeof(*inos));
+    struct mk_ino *dp, *ip;
+    uint64_t i, cnt = 0;
+    uint32_t j;
+
+    root->ino = EMPTYFS_IMG_ROOT_INO;
+    root->parent = root;
+    inos[cnt++] = root;
+
+    for (i = 0; i < cnt; i++) {
+        dp = inos[i];
+        if (dp->type != EMPTYFS_IMG_DIR) continue;
+
+        dp->nlink = 2 + dp->nsubdir;
+        qsort(dp->ents, dp->nent, sizeof(*dp->ents), ent_cmp_name);
+        for (j = 0; j < dp->nent; j++) {
+            ip = dp->ents[j].ip;
+            if (ip->ino != 0) continue;     /* hard link seen already */
+            assert(cnt < n);
+            ip->ino = EMPTYFS_IMG_ROOT_INO + cnt;
+            ip->parent = dp;
+            inos[cnt++] = ip;
+        }
+    }
+
+    assert(cnt == n);
+    return inos;
+}
+
+/*
+ * [prep]
+ */
+
+struct pipe {
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    struct mk_ino **inos;
+    uint64_t n;
+    uint64_t next;              /* next inode to claim */
+    uint64_t wnext;             /* next inode writer takes */
+    uint64_t inflight;          /* bytes */
+    uint64_t budget;
+    int failed;
+
+    /* all protected by mtx */
+    uint64_t nread;
+    uint64_t bread;
+    double tread;               /* summed over threads */
+    uint64_t nhashed;
+    uint64_t nents;
+    double thash;
+    uint64_t nzip;              /* files stored compressed */
+    uint64_t bzip_in;
+    uint64_t bzip_out;
+    double tzip;
+    uint64_t bhashed;           /* bytes hashed for dedup */
+    double tdedup;
+    double t0;
+    double t1;                  /* when the last prep thread finished */
+};
+
+static struct pipe pipe_ = {
+    .mtx = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static int ent_cmp_hash(const void *a, const void *b)
+{
+    const struct mk_ent *x = a, *y = b;
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
+
+static uint64_t dir_size(const struct mk_ino *dp)
+{
+    uint64_t size = EMPTYFS_IMG_DIRENT_OFF((dp->nent + EMPTYFS_IMG_DGRP - 1) / EMPTYFS_IMG_DGRP);
+    uint32_t i;
+
+    size += (uint64_t) dp->nent * sizeof(struct emptyfs_img_dirent);
+    for (i = 0; i < dp->nent; i++) size += 2 + dp->ents[i].len;
+    return size;
+}
+
+/**
+ * Encode directory table  see [layout] in emptyfs_img.h
+ *  dirents of equal hash are sorted by name  for reproducibility only
+ */
+static int dir_encode(struct mk_ino *dp)
+{
+    uint32_t ngrp = (uint32_t) (((uint64_t) dp->nent + EMPTYFS_IMG_DGRP - 1) / EMPTYFS_IMG_DGRP);
+    uint64_t ents = EMPTYFS_IMG_DIRENT_OFF(ngrp);
+    uint64_t names = ents + (uint64_t) dp->nent * sizeof(struct emptyfs_img_dirent);
+    struct emptyfs_img_dirhdr h;
+    struct emptyfs_img_dirent de;
+    uint64_t off = 0;
+    uint32_t i, fence;
+    char *p;
+
+    for (i = 0; i < dp->nent; i++)
+        dp->ents[i].hash = emptyfs_dirhash_name(dp->ents[i].name, dp->ents[i].len);
+    qsort(dp->ents, dp->nent, sizeof(*dp->ents), ent_cmp_hash);
+
+    dp->size = dir_size(dp);
+    if (dp->size >= EMPTYFS_IMG_DIR_MAX) {
+        LOG_ERR("directory too large  path: %s", dp->path);
+        return EFBIG;
+    }
+
+    p = calloc(emptyfs_img_blocks(dp->size), EMPTYFS_IMG_BSIZE);
+    if (p == NULL) return ENOMEM;
+
+    h.nent = dp->nent;
+    h.ngrp = ngrp;
+    h.names = (uint32_t) names;
+    h.rsvd = 0;
+    emptyfs_img_dirhdr_swab(&h);
+    memcpy(p, &h, sizeof(h));
+
+    for (i = 0; i < dp->nent; i++) {
+        const struct mk_ent *e = &dp->ents[i];
+
+        if (i % EMPTYFS_IMG_DGRP == 0) {
+            fence = EMPTYFS_IMG_LE32(e->hash);
+            memcpy(p + sizeof(h) + 4 * (i / EMPTYFS_IMG_DGRP), &fence, sizeof(fence));
+        }
+
+        de.hash = e->hash;
+        de.name = (uint32_t) off;
+        de.ino = e->ip->ino;
+        emptyfs_img_dirent_swab(&de);
+        memcpy(p + ents + (uint64_t) i * sizeof(de), &de, sizeof(de));
+
+        p[names + off] = (char) e->len;
+        p[names + off + 1] = (char) e->ip->type;
+        memcpy(p + names + off + 2, e->name, e->len);
+        off += 2 + e->len;
+    }
+
+    dp->buf = p;
+    return 0;
+}
+
+/**
+ * Read len bytes of a file  it must not shrink since walked
+ */
+static int file_read_fd(const struct mk_ino *ip, int fd, char *buf, uint64_t len)
+{
+    ssize_t n;
+
+    n = read_full(fd, buf, (size_t) len);
+    if (n < 0) {
+        LOG_ERR("read(2) fail  path: %s errno: %d", ip->path, errno);
+        return EIO;
+    }
+    if ((uint64_t) n != len) {
+        LOG_ERR("file shrank during build  path: %s", ip->path);
+        return EAGAIN;
+    }
+
+    return 0;
+}
+
+static int file_check_eof(const struct mk_ino *ip, int fd)
+{
+    char c;
+
+    if (read_full(fd, &c, 1) != 0) {
+        LOG_ERR("file grew during build  path: %s", ip->path);
+        return EAGAIN;
+    }
+    return 0;
+}
+
+static int file_read(struct mk_ino *ip)
+{
+    char *p;
+    int fd;
+    int e;
+
+    if (ip->size == 0) return 0;
+
+    p = calloc(emptyfs_img_blocks(ip->size), EMPTYFS_IMG_BSIZE);
+    if (p == NULL) return ENOMEM;
+
+    fd = open(ip->path, O_RDONLY);
+    if (fd < 0) {
+        LOG_ERR("open(2) fail  path: %s errno: %d", ip->path, errno);
+        free(p);
+        return EIO;
+    }
+
+    e = file_read_fd(ip, fd, p, ip->size);
+    if (e == 0) e = file_check_eof(ip, fd);
+    (void) close(fd);
+
+    if (e) {
+        free(p);
+        return e;
+    }
+
+    ip->buf = p;
+    return 0;
+}
+
+/**
+ * Compress a file read by file_read() block by block
+ *  see [layout] in emptyfs_img.h  kept as is unless it saves a block
+ * @return      0 if success  errno o.w.
+ */
+static int file_zip(struct mk_ino *ip, struct emptyfs_lz_enc *enc)
+{
+    uint64_t nb = emptyfs_img_blocks(ip->size);
+    uint64_t hdr = (nb + 1) * 8, off = hdr, i, x;
+    size_t raw, n;
+    const uint8_t *src;
+    uint8_t *run;
+
+    /* compressed blocks never grow  so the run is at most index larger */
+    run = calloc(emptyfs_img_blocks(hdr + ip->size), EMPTYFS_IMG_BSIZE);
+    if (run == NULL) return ENOMEM;
+
+    for (i = 0; i < nb; i++) {
+        x = EMPTYFS_IMG_LE64(off);
+        memcpy(run + i * 8, &x, 8);
+
+        src = (const uint8_t *) ip->buf + (i << EMPTYFS_IMG_BSHIFT);
+        raw = i + 1 < nb ? EMPTYFS_IMG_BSIZE : (size_t) (ip->size - (i << EMPTYFS_IMG_BSHIFT));
+        n = emptyfs_lz_compress(enc, src, raw, run + off, raw - 1);
+        if (n == 0) {
+            /* no gain  stored as is */
+            memcpy(run + off, src, raw);
+            n = raw;
+        }
+        off += n;
+    }
+    x = EMPTYFS_IMG_LE64(off);
+    memcpy(run + nb * 8, &x, 8);
+
+    if (emptyfs_img_blocks(off) >= nb) {
+        free(run);
+        return 0;
+    }
+
+    free(ip->buf);
+    ip->buf = run;
+    ip->lz = 1;
+    ip->nblk = emptyfs_img_blocks(off);
+    return 0;
+}
+
+static uint64_t dd_rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t dd_round(uint64_t acc, uint64_t w)
+{
+    return dd_rotl(acc + w * 0xc2b2ae3d27d4eb4fULL, 31) * 0x9e3779b97f4a7c15ULL;
+}
+
+/**
+ * 64-bit hash of whole blocks  four independent lanes(as xxHash64)
+ *  .: it runs at memory speed  a collision costs only a compare
+ */
+static uint64_t dd_hash(const void *buf, size_t len)
+{
+    const uint8_t *p = (const uint8_t *) buf;
+    uint64_t a = 0x60ea27eeadc0b5d6ULL, b = 0xc2b2ae3d27d4eb4fULL;
+    uint64_t c = 0, d = 0x61c8864e7a143579ULL, w[4], h;
+    size_t i;
+
+    assert(len % 32 == 0);
+    for (i = 0; i < len; i += 32) {
+        memcpy(w, p + i, sizeof(w));
+        a = dd_round(a, EMPTYFS_IMG_LE64(w[0]));
+        b = dd_round(b, EMPTYFS_IMG_LE64(w[1]));
+        c = dd_round(c, EMPTYFS_IMG_LE64(w[2]));
+        d = dd_round(d, EMPTYFS_IMG_LE64(w[3]));
+    }
+
+    h = dd_rotl(a, 1) + dd_rotl(b, 7) + dd_rotl(c, 12) + dd_rotl(d, 18) + len;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/**
+ * Hash what the writer will dedup  see [pipeline]
+ */
+static int file_hash(struct mk_ino *ip)
+{
+    uint64_t nb = emptyfs_img_blocks(ip->size), i;
+
+    if (ip->lz) {
+        ip->rhash = dd_hash(ip->buf, (size_t) (ip->nblk << EMPTYFS_IMG_BSHIFT));
+        return 0;
+    }
+
+    ip->bhash = malloc(nb * sizeof(*ip->bhash));
+    if (ip->bhash == NULL) return ENOMEM;
+    for (i = 0; i < nb; i++)
+        ip->bhash[i] = dd_hash((const char *) ip->buf + (i << EMPTYFS_IMG_BSHIFT), EMPTYFS_IMG_BSIZE);
+    return 0;
+}
+
+static void *prep_main(void *arg)
+{
+    struct emptyfs_lz_enc enc;
+    struct mk_ino *ip;
+    uint64_t i, cost;
+    double t, tz = 0, td = 0;
+    int stream;
+    int e;
+
+    (void) arg;
+
+    (void) pthread_mutex_lock(&pipe_.mtx);
+    while (!pipe_.failed && pipe_.next < pipe_.n) {
+        i = pipe_.next++;
+        ip = pipe_.inos[i];
+
+        if (ip->type == EMPTYFS_IMG_DIR) {
+            stream = 0;
+            cost = dir_size(ip);
+        } else {
+            stream = ip->size > (pipe_.budget >> MKFS_STREAM_SHIFT);
+            cost = stream ? 0 : ip->size;
+        }
+
+        /* see [pipeline] */
+        while (!pipe_.failed && i != pipe_.wnext && pipe_.inflight + cost > pipe_.budget)
+            (void) pthread_cond_wait(&pipe_.cond, &pipe_.mtx);
+        if (pipe_.failed) break;
+
+        pipe_.inflight += cost;
+        ip->cost = cost;
+        (void) pthread_mutex_unlock(&pipe_.mtx);
+
+        t = now_sec();
+        if (ip->type == EMPTYFS_IMG_DIR) {
+            e = dir_encode(ip);
+        } else {
+            e = stream ? 0 : file_read(ip);
+            if (e == 0 && compress && ip->buf != NULL) {
+                tz = now_sec();
+                e = file_zip(ip, &enc);
+                tz = now_sec() - tz;
+            }
+            if (e == 0 && dedup && ip->buf != NULL) {
+                td = now_sec();
+                e = file_hash(ip);
+                td = now_sec() - td;
+            }
+        }
+        t = now_sec() - t;
+
+        (void) pthread_mutex_lock(&pipe_.mtx);
+        if (ip->type == EMPTYFS_IMG_DIR) {
+            pipe_.nhashed++;
+            pipe_.nents += ip->nent;
+            pipe_.thash += t;
+        } else if (!stream) {
+            pipe_.nread++;
+            pipe_.bread += ip->size;
+            if (compress && ip->buf != NULL) {
+                pipe_.bzip_in += ip->size;
+                pipe_.bzip_out += ip->lz ? ip->nblk << EMPTYFS_IMG_BSHIFT :
+                                            emptyfs_img_blocks(ip->size) << EMPTYFS_IMG_BSHIFT;
+                pipe_.nzip += (uint64_t) ip->lz;
+                pipe_.tzip += tz;
+                t -= tz;
+            }
+            if (dedup && ip->buf != NULL) {
+                pipe_.bhashed += ip->lz ? ip->nblk << EMPTYFS_IMG_BSHIFT :
+                                            emptyfs_img_blocks(ip->size) << EMPTYFS_IMG_BSHIFT;
+                pipe_.tdedup += td;
+                t -= td;
+            }
+            pipe_.tread += t;
+        }
+
+        if (e) {
+            pipe_.failed = 1;
+        } else {
+            ip->state = stream ? MK_STREAM : MK_READY;
+        }
+        (void) pthread_cond_broadcast(&pipe_.cond);
+    }
+    pipe_.t1 = now_sec();
+    (void) pthread_mutex_unlock(&pipe_.mtx);
+
+    return NULL;
+}
+
+/*
+ * [write]
+ */
+
+/*
+ * What the writer has written by content hash  see [pipeline]
+ *  open addressing  pblk zero(superblock) marks a free slot
+ */
+struct dd_ent {
+    uint64_t hash;
+    uint64_t pblk;
+    uint64_t nblk;
+};
+
+struct dd_tab {
+    struct dd_ent *ent;
+    uint64_t mask;
+    uint64_t n;
+};
+
+struct writer {
+    int fd;
+    uint64_t cursor;            /* next free block */
+    char *copybuf;
+    uint64_t bytes;
+    uint64_t nstream;
+    double tstall;              /* waiting for prep */
+    double t0;
+    double t1;
+
+    /* -d only */
+    char *cmpbuf;               /* image bytes a dedup hit is compared with */
+    struct dd_tab blks;
+    struct dd_tab runs;         /* compressed runs */
+    struct emptyfs_img_extent *xt;  /* extent table  host byte order */
+    uint64_t nxt;
+    uint64_t xcap;
+    struct emptyfs_img_extent xcur; /* extent being extended */
+    uint64_t nshared;           /* blocks referenced rather than written */
+    uint64_t nrshared;          /* runs ditto */
+    uint64_t bsaved;
+
+    /* -M only */
+    struct emptyfs_vt vt;
+    double tvt;
+};
+
+static void dd_init(struct dd_tab *t)
+{
+    t->ent = calloc(MKFS_DEDUP_SLOTS, sizeof(*t->ent));
+    if (t->ent == NULL) {
+        LOG_ERR("calloc(3) fail  slots: %d", MKFS_DEDUP_SLOTS);
+        exit(1);
+    }
+    t->mask = MKFS_DEDUP_SLOTS - 1;
+    t->n = 0;
+}
+
+static void dd_insert(struct dd_tab *t, uint64_t hash, uint64_t pblk, uint64_t nblk)
+{
+    struct dd_ent *old = t->ent;
+    uint64_t n = t->mask + 1, i;
+
+    if (2 * (t->n + 1) > n) {
+        t->ent = calloc(2 * n, sizeof(*t->ent));
+        if (t->ent == NULL) {
+            LOG_ERR("calloc(3) fail  slots: %" PRIu64, 2 * n);
+            exit(1);
+        }
+        t->mask = 2 * n - 1;
+        t->n = 0;
+        for (i = 0; i < n; i++) {
+            if (old[i].pblk != 0) dd_insert(t, old[i].hash, old[i].pblk, old[i].nblk);
+        }
+        free(old);
+    }
+
+    for (i = hash & t->mask; t->ent[i].pblk != 0; i = (i + 1) & t->mask) continue;
+    t->ent[i].hash = hash;
+    t->ent[i].pblk = pblk;
+    t->ent[i].nblk = nblk;
+    t->n++;
+}
+
+/**
+ * @pend        blocks from pstart on  which aren't written yet
+ * @return      1 if nblk blocks at pblk hold data  0 if not  -1 if read fails
+ */
+static int dd_same(
+        struct writer *w,
+        uint64_t pblk,
+        uint64_t nblk,
+        const char *data,
+        const char *pend,
+        uint64_t pstart)
+{
+    uint64_t len = nblk << EMPTYFS_IMG_BSHIFT, off = 0;
+    size_t n;
+
+    if (pend != NULL && pblk >= pstart)
+        return !memcmp(pend + ((pblk - pstart) << EMPTYFS_IMG_BSHIFT), data, (size_t) len);
+
+    while (off < len) {
+        n = len - off > MKFS_COPY_BUFSZ ? MKFS_COPY_BUFSZ : (size_t) (len - off);
+        if (pread(w->fd, w->cmpbuf, n, (off_t) ((pblk << EMPTYFS_IMG_BSHIFT) + off)) != (ssize_t) n) {
+            LOG_ERR("pread(2) fail  blk: %" PRIu64 " errno: %d", pblk, errno);
+            return -1;
+        }
+        if (memcmp(w->cmpbuf, data + off, n)) return 0;
+        off += n;
+    }
+
+    return 1;
+}
+
+/**
+ * Find an identical copy of data in the image
+ * @pblk        (OUT) its first block  0 if none
+ * @return      0 if success  errno o.w.
+ */
+static int dd_find(
+        struct writer *w,
+        const struct dd_tab *t,
+        uint64_t hash,
+        const char *data,
+        uint64_t nblk,
+        const char *pend,
+        uint64_t pstart,
+        uint64_t *pblk)
+{
+    const struct dd_ent *x;
+    uint64_t i;
+    int r;
+
+    for (i = hash & t->mask; t->ent[i].pblk != 0; i = (i + 1) & t->mask) {
+        x = &t->ent[i];
+        if (x->hash != hash || x->nblk != nblk) continue;
+
+        r = dd_same(w, x->pblk, nblk, data, pend, pstart);
+        if (r < 0) return EIO;
+        if (r) {
+            *pblk = x->pblk;
+            return 0;
+        }
+    }
+
+    *pblk = 0;
+    return 0;
+}
+
+static void xt_flush(struct writer *w)
+{
+    if (w->xcur.nblk == 0) return;
+
+    if (w->nxt == w->xcap) {
+        w->xcap = w->xcap != 0 ? w->xcap * 2 : 1024;
+        w->xt = realloc(w->xt, w->xcap * sizeof(*w->xt));
+        if (w->xt == NULL) {
+            LOG_ERR("realloc(3) fail  extents: %" PRIu64, w->xcap);
+            exit(1);
+        }
+    }
+    w->xt[w->nxt++] = w->xcur;
+    w->xcur.nblk = 0;
+}
+
+/*
+ * Map the next logical block of a file  extending the last extent if it can
+ */
+static void xt_add(struct writer *w, uint64_t lblk, uint64_t pblk)
+{
+    if (w->xcur.nblk != 0 && w->xcur.pblk + w->xcur.nblk == pblk && w->xcur.nblk < UINT32_MAX) {
+        w->xcur.nblk++;
+        return;
+    }
+
+    xt_flush(w);
+    w->xcur.pblk = pblk;
+    w->xcur.lblk = (uint32_t) lblk;
+    w->xcur.nblk = 1;
+}
+
+/**
+ * Close extents of a file started at extent table index first
+ *  a file of a single extent keeps it inline  as without -d
+ */
+static int xt_end(struct writer *w, struct mk_ino *ip, uint64_t first)
+{
+    xt_flush(w);
+
+    if (w->nxt - first == 1) {
+        ip->xt = w->xt[first].pblk;
+        ip->nxt = 0;
+        w->nxt = first;
+        return 0;
+    }
+
+    if (w->nxt - first > UINT32_MAX || w->nxt > EMPTYFS_IMG_XT_MAX) {
+        LOG_ERR("too many extents  path: %s", ip->path);
+        return EFBIG;
+    }
+    ip->xt = first;
+    ip->nxt = (uint32_t) (w->nxt - first);
+    return 0;
+}
+
+/**
+ * Write nb blocks of a file from logical block lblk on  those already in
+ *  the image are referenced instead  see [pipeline]
+ * @buf         new blocks are packed to its front
+ * @hash        per block  NULL to hash here
+ */
+static int write_blocks(
+        struct writer *w,
+        uint64_t lblk,
+        char *buf,
+        uint64_t nb,
+        const uint64_t *hash)
+{
+    uint64_t pstart = w->cursor, k = 0, i, pblk, h;
+    char *src;
+    int e;
+
+    for (i = 0; i < nb; i++) {
+        src = buf + (i << EMPTYFS_IMG_BSHIFT);
+        h = hash != NULL ? hash[i] : dd_hash(src, EMPTYFS_IMG_BSIZE);
+
+        e = dd_find(w, &w->blks, h, src, 1, buf, pstart, &pblk);
+        if (e) return e;
+
+        if (pblk == 0) {
+            pblk = pstart + k;
+            if (k != i) memcpy(buf + (k << EMPTYFS_IMG_BSHIFT), src, EMPTYFS_IMG_BSIZE);
+            dd_insert(&w->blks, h, pblk, 1);
+            k++;
+        } else {
+            w->nshared++;
+            w->bsaved += EMPTYFS_IMG_BSIZE;
+        }
+        xt_add(w, lblk + i, pblk);
+    }
+
+    if (k != 0) {
+        e = write_full(w->fd, buf, (size_t) (k << EMPTYFS_IMG_BSHIFT), pstart << EMPTYFS_IMG_BSHIFT);
+        if (e) {
+            LOG_ERR("pwrite(2) fail  errno: %d", e);
+            return e;
+        }
+    }
+    w->cursor += k;
+    w->bytes += k << EMPTYFS_IMG_BSHIFT;
+    return 0;
+}
+
+/**
+ * Copy a file too large to be buffered  see: prep_main()
+ */
+static int file_stream(struct writer *w, struct mk_ino *ip)
+{
+    uint64_t left = ip->size, off = w->cursor << EMPTYFS_IMG_BSHIFT;
+    size_t n, pad;
+    int fd;
+    int e = 0;
+
+    fd = open(ip->path, O_RDONLY);
+    if (fd < 0) {
+        LOG_ERR("open(2) fail  path: %s errno: %d", ip->path, errno);
+        return EIO;
+    }
+
+    while (e == 0 && left != 0) {
+        n = left > MKFS_COPY_BUFSZ ? MKFS_COPY_BUFSZ : (size_t) left;
+        e = file_read_fd(ip, fd, w->copybuf, n);
+        if (e) break;
+
+        /* pad the last block */
+        pad = (size_t) (emptyfs_img_blocks(n) << EMPTYFS_IMG_BSHIFT) - n;
+        memset(w->copybuf + n, 0, pad);
+
+        if (dedup) {
+            /* chunks are whole blocks but the last */
+            e = write_blocks(w, (ip->size - left) >> EMPTYFS_IMG_BSHIFT,
+                                w->copybuf, emptyfs_img_blocks(n), NULL);
+        } else {
+            e = write_full(w->fd, w->copybuf, n + pad, off);
+            off += n + pad;
+        }
+        left -= n;
+    }
+    if (e == 0) e = file_check_eof(ip, fd);
+
+    (void) close(fd);
+    return e;
+}
+
+/**
+ * Write a file with -d  see [pipeline]
+ *  a compressed run is shared as a whole  or written as a whole
+ */
+static int write_dedup(struct writer *w, struct mk_ino *ip)
+{
+    uint64_t first = w->nxt, pblk;
+    int e;
+
+    if (ip->lz) {
+        e = dd_find(w, &w->runs, ip->rhash, ip->buf, ip->nblk, NULL, 0, &pblk);
+        if (e) return e;
+
+        if (pblk != 0) {
+            ip->xt = pblk;
+            w->nrshared++;
+            w->bsaved += ip->nblk << EMPTYFS_IMG_BSHIFT;
+            return 0;
+        }
+
+        ip->xt = w->cursor;
+        e = write_full(w->fd, ip->buf, (size_t) (ip->nblk << EMPTYFS_IMG_BSHIFT),
+                        w->cursor << EMPTYFS_IMG_BSHIFT);
+        if (e) {
+            LOG_ERR("pwrite(2) fail  errno: %d", e);
+            return e;
+        }
+        dd_insert(&w->runs, ip->rhash, ip->xt, ip->nblk);
+        w->cursor += ip->nblk;
+        w->bytes += ip->nblk << EMPTYFS_IMG_BSHIFT;
+        return 0;
+    }
+
+    if (ip->state == MK_STREAM) {
+        e = file_stream(w, ip);
+    } else {
+        e = write_blocks(w, 0, ip->buf, emptyfs_img_blocks(ip->size), ip->bhash);
+    }
+    if (e == 0) e = xt_end(w, ip, first);
+    return e;
+}
+
+/**
+ * Write inodes in number order as prep threads make them ready
+ * @return      0 if success  errno o.w.
+ */
+static int write_data(struct writer *w)
+{
+    struct mk_ino *ip;
+    uint64_t i, nb;
+    double t;
+    int e = 0;
+
+    w->t0 = now_sec();
+
+    for (i = 0; e == 0 && i < pipe_.n; i++) {
+        ip = pipe_.inos[i];
+
+        (void) pthread_mutex_lock(&pipe_.mtx);
+        if (!pipe_.failed && ip->state == MK_PENDING) {
+            t = now_sec();
+            while (!pipe_.failed && ip->state == MK_PENDING)
+                (void) pthread_cond_wait(&pipe_.cond, &pipe_.mtx);
+            w->tstall += now_sec() - t;
+        }
+        if (pipe_.failed) e = EIO;
+        (void) pthread_mutex_unlock(&pipe_.mtx);
+        if (e) break;
+
+        nb = ip->lz ? ip->nblk : emptyfs_img_blocks(ip->size);
+        w->nstream += ip->state == MK_STREAM;
+
+        if (dedup && ip->type == EMPTYFS_IMG_REG && nb != 0) {
+            e = write_dedup(w, ip);
+        } else {
+            ip->xt = nb != 0 ? w->cursor : 0;
+
+            if (ip->state == MK_STREAM) {
+                e = file_stream(w, ip);
+            } else if (nb != 0) {
+                e = write_full(w->fd, ip->buf, (size_t) (nb << EMPTYFS_IMG_BSHIFT),
+                                w->cursor << EMPTYFS_IMG_BSHIFT);
+                if (e) LOG_ERR("pwrite(2) fail  errno: %d", e);
+            }
+
+            w->cursor += nb;
+            w->bytes += nb << EMPTYFS_IMG_BSHIFT;
+        }
+
+        free(ip->buf);
+        ip->buf = NULL;
+        free(ip->bhash);
+        ip->bhash = NULL;
+
+        (void) pthread_mutex_lock(&pipe_.mtx);
+        pipe_.inflight -= ip->cost;
+        pipe_.wnext = i + 1;
+        if (e) pipe_.failed = 1;
+        (void) pthread_cond_broadcast(&pipe_.cond);
+        (void) pthread_mutex_unlock(&pipe_.mtx);
+    }
+
+    w->t1 = now_sec();
+    return e;
+}
+
+static void start_threads(pthread_t *thr, void *(*fn)(void *))
+{
+    int i;
+    int e;
+
+    for (i = 0; i < nthreads; i++) {
+        e = pthread_create(&thr[i], NULL, fn, NULL);
+        if (e) {
+            LOG_ERR("pthread_create() fail  errno: %d", e);
+            exit(1);
+        }
+    }
+}
+
+static void join_threads(pthread_t *thr)
+{
+    int i;
+    for (i = 0; i < nthreads; i++) (void) pthread_join(thr[i], NULL);
+}
+
+/*
+ * [verity]
+ */
+
+struct vt_job {
+    int fd;
+    uint64_t next;              /* next block to claim  atomically */
+    uint64_t end;
+    uint8_t *out;               /* hash of block i at i * EMPTYFS_SHA256_LEN */
+    int err;
+};
+
+static struct vt_job vt_job;
+
+/**
+ * Hash n blocks  EMPTYFS_SHA256_LANES at a time
+ */
+static void vt_hash_blocks(const char *data, uint64_t n, uint8_t *out)
+{
+    const void *p[EMPTYFS_SHA256_LANES];
+    uint8_t h[EMPTYFS_SHA256_LANES][EMPTYFS_SHA256_LEN];
+    uint64_t i = 0;
+    int l;
+
+    for (; n - i >= EMPTYFS_SHA256_LANES; i += EMPTYFS_SHA256_LANES) {
+        for (l = 0; l < EMPTYFS_SHA256_LANES; l++)
+            p[l] = data + ((i + (uint64_t) l) << EMPTYFS_IMG_BSHIFT);
+        emptyfs_sha256_xn(p, EMPTYFS_IMG_BSIZE, h);
+        memcpy(out + i * EMPTYFS_SHA256_LEN, h, sizeof(h));
+    }
+    for (; i < n; i++)
+        emptyfs_sha256(data + (i << EMPTYFS_IMG_BSHIFT), EMPTYFS_IMG_BSIZE, out + i * EMPTYFS_SHA256_LEN);
+}
+
+static void *vt_main(void *arg)
+{
+    char *buf = xmalloc(MKFS_COPY_BUFSZ);
+    uint64_t blk, n;
+    ssize_t len;
+
+    (void) arg;
+
+    for (;;) {
+        blk = __atomic_fetch_add(&vt_job.next, MKFS_VT_CHUNK, __ATOMIC_RELAXED);
+        if (blk >= vt_job.end || __atomic_load_n(&vt_job.err, __ATOMIC_RELAXED)) break;
+        n = vt_job.end - blk < MKFS_VT_CHUNK ? vt_job.end - blk : MKFS_VT_CHUNK;
+
+        len = pread(vt_job.fd, buf, (size_t) (n << EMPTYFS_IMG_BSHIFT),
+                    (off_t) (blk << EMPTYFS_IMG_BSHIFT));
+        if (len != (ssize_t) (n << EMPTYFS_IMG_BSHIFT)) {
+            LOG_ERR("pread(2) fail  blk: %" PRIu64 " errno: %d", blk, errno);
+            __atomic_store_n(&vt_job.err, EIO, __ATOMIC_RELAXED);
+            break;
+        }
+        vt_hash_blocks(buf, n, vt_job.out + blk * EMPTYFS_SHA256_LEN);
+    }
+
+    free(buf);
+    return NULL;
+}
+
+/**
+ * Hash the image into a tree at w->cursor  and write it
+ * @blk0        block 0 as it'll be written  its descriptor is filled here
+ */
+static int write_tree(struct writer *w, char *blk0)
+{
+    pthread_t thr[MKFS_THREADS_MAX];
+    struct emptyfs_vt *vt = &w->vt;
+    struct emptyfs_img_vt d;
+    char b0[EMPTYFS_IMG_BSIZE];
+    char *lvl, *next;
+    uint64_t n;
+    uint32_t k;
+    int e;
+
+    w->tvt = now_sec();
+
+    memset(&d, 0, sizeof(d));
+    d.tree_blk = vt->tree_blk;
+    d.levels = vt->levels;
+    emptyfs_img_vt_swab(&d);
+    memcpy(blk0 + EMPTYFS_IMG_VT_OFF, &d, sizeof(d));
+
+    /* level 0  block 0 isn't in the image yet */
+    lvl = calloc(vt->lvl_n[0], EMPTYFS_IMG_BSIZE);
+    if (lvl == NULL) {
+        LOG_ERR("calloc(3) fail  blocks: %" PRIu64, vt->lvl_n[0]);
+        exit(1);
+    }
+    memcpy(b0, blk0, sizeof(b0));
+    emptyfs_vt_hash0(b0, (uint8_t *) lvl);
+
+    vt_job.fd = w->fd;
+    vt_job.next = 1;
+    vt_job.end = vt->tree_blk;
+    vt_job.out = (uint8_t *) lvl;
+    vt_job.err = 0;
+    start_threads(thr, vt_main);
+    join_threads(thr);
+    e = vt_job.err;
+
+    /* upper levels are 1/128 of the one below  not worth threads */
+    for (k = 0; e == 0; k++) {
+        n = vt->lvl_n[k];
+        e = write_full(w->fd, lvl, (size_t) (n << EMPTYFS_IMG_BSHIFT),
+                        vt->lvl_blk[k] << EMPTYFS_IMG_BSHIFT);
+        if (e || k + 1 == vt->levels) break;
+
+        next = calloc(vt->lvl_n[k + 1], EMPTYFS_IMG_BSIZE);
+        if (next == NULL) {
+            LOG_ERR("calloc(3) fail  blocks: %" PRIu64, vt->lvl_n[k + 1]);
+            exit(1);
+        }
+        vt_hash_blocks(lvl, n, (uint8_t *) next);
+        free(lvl);
+        lvl = next;
+    }
+
+    if (e == 0) {
+        emptyfs_sha256(lvl, EMPTYFS_IMG_BSIZE, vt->root);
+        memcpy(blk0 + EMPTYFS_IMG_VT_OFF + __builtin_offsetof(struct emptyfs_img_vt, root),
+                vt->root, sizeof(vt->root));
+    }
+    free(lvl);
+
+    w->tvt = now_sec() - w->tvt;
+    return e;
+}
+
+static void inode_encode(const struct mk_ino *ip, struct emptyfs_img_inode *d)
+{
+    memset(d, 0, sizeof(*d));
+    d->type = ip->type;
+    /* laid out back to back  see [pipeline] */
+    if (ip->lz) {
+        d->iflags = EMPTYFS_IMG_I_LZ;
+    } else if (ip->type == EMPTYFS_IMG_REG && ip->size != 0 && ip->nxt == 0) {
+        d->iflags = EMPTYFS_IMG_I_INLINE;
+    }
+    d->perm = ip->perm;
+    d->nlink = ip->nlink;
+    d->uid = ip->uid;
+    d->gid = ip->gid;
+    d->flags = ip->flags;
+    d->nxt = ip->nxt;
+    d->parent = ip->parent->ino;
+    d->size = ip->size;
+    d->mtime = ip->mtime;
+    d->mtime_nsec = ip->mtime_nsec;
+    d->xt = ip->xt;
+    emptyfs_img_inode_swab(d);
+}
+
+/**
+ * Write inode table and superblock  i.e. the image becomes valid
+ */
+static int write_meta(
+        struct writer *w,
+        uint64_t itab_blk,
+        const char *volname,
+        int64_t mtime)
+{
+    uint8_t blk[EMPTYFS_IMG_BSIZE];
+    struct emptyfs_img_inode *d = (struct emptyfs_img_inode *) blk;
+    const uint64_t per = EMPTYFS_IMG_BSIZE / EMPTYFS_IMG_INODE_SIZE;
+    const uint64_t xper = EMPTYFS_IMG_BSIZE / sizeof(struct emptyfs_img_extent);
+    struct emptyfs_img_extent *x = (struct emptyfs_img_extent *) blk;
+    struct emptyfs_img_sb sb;
+    uint64_t i, xtab_blk;
+    int fd;
+    int e;
+
+    /* an empty extent table sits right past inodes  a nonempty one past data */
+    xtab_blk = w->nxt != 0 ? w->cursor : itab_blk + emptyfs_img_blocks(pipe_.n * EMPTYFS_IMG_INODE_SIZE);
+    for (i = 0; i < w->nxt; i += xper) {
+        uint64_t j, n = w->nxt - i < xper ? w->nxt - i : xper;
+
+        memset(blk, 0, sizeof(blk));
+        for (j = 0; j < n; j++) {
+            x[j] = w->xt[i + j];
+            emptyfs_img_extent_swab(&x[j]);
+        }
+        e = write_full(w->fd, blk, sizeof(blk), (xtab_blk + i / xper) << EMPTYFS_IMG_BSHIFT);
+        if (e) return e;
+    }
+    if (w->nxt != 0) w->cursor += emptyfs_img_blocks(w->nxt * sizeof(*x));
+
+    for (i = 0; i < pipe_.n; i += per) {
+        uint64_t j, n = pipe_.n - i < per ? pipe_.n - i : per;
+
+        memset(blk, 0, sizeof(blk));
+        for (j = 0; j < n; j++) inode_encode(pipe_.inos[i + j], &d[j]);
+        e = write_full(w->fd, blk, sizeof(blk), (itab_blk + i / per) << EMPTYFS_IMG_BSHIFT);
+        if (e) return e;
+    }
+
+    memset(&sb, 0, sizeof(sb));
+    sb.magic = EMPTYFS_IMG_MAGIC;
+    sb.version = EMPTYFS_IMG_VERSION;
+    sb.bshift = EMPTYFS_IMG_BSHIFT;
+    /* an image without compressed(or shared) data mounts on older kexts */
+    sb.features = pipe_.nzip != 0 ? EMPTYFS_IMG_F_LZ : 0;
+    if (w->nshared != 0 || w->nrshared != 0) sb.features |= EMPTYFS_IMG_F_DEDUP;
+    if (verity) {
+        /* the tree covers everything written so far  and ends the image */
+        if (emptyfs_vt_geom(&w->vt, w->cursor) != 0) return EFBIG;
+        sb.features |= EMPTYFS_IMG_F_VERITY;
+        w->cursor += w->vt.nblk;
+    }
+    sb.nblocks = w->cursor;
+    sb.ninodes = pipe_.n;
+    sb.ndirs = walk.ndirs;
+    sb.nfiles = walk.nfiles;
+    sb.itab_blk = itab_blk;
+    sb.xtab_blk = xtab_blk;
+    sb.nextents = w->nxt;
+    sb.mtime = mtime;
+    (void) strncpy(sb.volname, volname, sizeof(sb.volname) - 1);
+
+    /* a random(version 4) UUID  an image keeps it for its lifetime */
+    fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0 || read_full(fd, sb.uuid, sizeof(sb.uuid)) != (ssize_t) sizeof(sb.uuid)) {
+        LOG_ERR("cannot read /dev/urandom  errno: %d", errno);
+        if (fd >= 0) (void) close(fd);
+        return EIO;
+    }
+    (void) close(fd);
+    sb.uuid[6] = (uint8_t) ((sb.uuid[6] & 0x0f) | 0x40);
+    sb.uuid[8] = (uint8_t) ((sb.uuid[8] & 0x3f) | 0x80);
+
+    emptyfs_img_sb_swab(&sb);
+    sb.cksum = EMPTYFS_IMG_LE32(emptyfs_img_sb_cksum(&sb));
+
+    memset(blk, 0, sizeof(blk));
+    memcpy(blk, &sb, sizeof(sb));
+    if (verity) {
+        e = write_tree(w, (char *) blk);
+        if (e) return e;
+    }
+    return write_full(w->fd, blk, sizeof(blk), 0);
+}
+
+int main(int argc, char *argv[])
+{
+    pthread_t thr[MKFS_THREADS_MAX];
+    const char *volname = "";
+    int64_t mtime = (int64_t) time(NULL);
+    uint32_t budget = MKFS_BUDGET_DEFAULT;
+    struct writer w;
+    struct mk_ino *root;
+    struct stat st;
+    uint64_t itab_blk;
+    double t0, twalk;
+    int ch;
+    int e;
+
+    nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+    while ((ch = getopt(argc, argv, "t:m:zdMV:T:vh")) != -1) {
+        switch (ch) {
+        case 't':
+            nthreads = (int) parse_u32(argv[0], optarg);
+            break;
+        case 'm':
+            budget = parse_u32(argv[0], optarg);
+            break;
+        case 'z':
+            compress = 1;
+            break;
+        case 'd':
+            dedup = 1;
+            break;
+        case 'M':
+            verity = 1;
+            break;
+        case 'V':
+            volname = optarg;
+            if (strlen(volname) >= EMPTYFS_IMG_VOLNAME_MAX) usage(argv[0]);
+            break;
+        case 'T':
+            mtime = (int64_t) parse_u32(argv[0], optarg);
+            break;
+        case 'v':
+            fprintf(stderr, "%s version %s\nbuilt date %s %s\n\n",
+                    basename(argv[0]), MKFS_EMPTYFS_VERSION, __DATE__, __TIME__);
+            exit(0);
+        case 'h':
+        case '?':
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (argc - optind != 2) usage(argv[0]);
+    if (nthreads < 1) nthreads = 1;
+    if (nthreads > MKFS_THREADS_MAX) nthreads = MKFS_THREADS_MAX;
+    if (budget == 0) usage(argv[0]);
+
+    if (stat(argv[optind], &st) != 0 || !S_ISDIR(st.st_mode)) {
+        LOG_ERR("not a directory: %s", argv[optind]);
+        exit(1);
+    }
+
+    /* [walk] */
+    t0 = now_sec();
+    root = ino_new(strdup(argv[optind]), &st);
+    walk_push(root);
+    start_threads(thr, walk_main);
+    join_threads(thr);
+    twalk = now_sec() - t0;
+
+    LOG("walk:  %" PRIu64 " dirs %" PRIu64 " files %" PRIu64 " skipped in %.3fs  %.0f entries/s",
+            walk.ndirs, walk.nfiles, walk.nskip, twalk,
+            per_sec((double) walk.nlinks + 1, twalk));
+
+    if (walk.nerr != 0) {
+        LOG_ERR("%" PRIu64 " error(s) while walking  no image written", walk.nerr);
+        exit(1);
+    }
+
+    /* [number] */
+    pipe_.n = walk.ndirs + walk.nfiles;
+    if (pipe_.n > EMPTYFS_IMG_INO_MAX) {
+        LOG_ERR("too many inodes: %" PRIu64, pipe_.n);
+        exit(1);
+    }
+    pipe_.inos = number(root, pipe_.n);
+    pipe_.budget = (uint64_t) budget << 20;
+
+    memset(&w, 0, sizeof(w));
+    /* dedup hits are compared with what's written  and a tree hashes it */
+    w.fd = open(argv[optind+1], (dedup || verity ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC, 0644);
+    if (w.fd < 0) {
+        LOG_ERR("open(2) fail  path: %s errno: %d", argv[optind+1], errno);
+        exit(1);
+    }
+    w.copybuf = xmalloc(MKFS_COPY_BUFSZ);
+    if (dedup) {
+        w.cmpbuf = xmalloc(MKFS_COPY_BUFSZ);
+        dd_init(&w.blks);
+        dd_init(&w.runs);
+    }
+
+    /* block 0 is superblock  inode table follows  data after that */
+    itab_blk = 1;
+    w.cursor = itab_blk + emptyfs_img_blocks(pipe_.n * EMPTYFS_IMG_INODE_SIZE);
+
+    /* [prep] and [write] */
+    pipe_.t0 = now_sec();
+    start_threads(thr, prep_main);
+    e = write_data(&w);
+    join_threads(thr);
+
+    if (e == 0) e = write_meta(&w, itab_blk, volname, mtime);
+    /* a device is as large as it is */
+    if (e == 0 && fstat(w.fd, &st) == 0 && S_ISREG(st.st_mode) &&
+            ftruncate(w.fd, (off_t) (w.cursor << EMPTYFS_IMG_BSHIFT)) != 0) {
+        e = errno;
+    }
+    if (e == 0 && fsync(w.fd) != 0) e = errno;
+    (void) close(w.fd);
+
+    if (e) {
+        LOG_ERR("cannot build %s  errno: %d", argv[optind+1], e);
+        exit(1);
+    }
+
+    LOG("read:  %" PRIu64 " files %.1f MiB in %.3fs  %.1f MiB/s  %.1f MiB/s per thread",
+            pipe_.nread, mib(pipe_.bread), pipe_.t1 - pipe_.t0,
+            per_sec(mib(pipe_.bread), pipe_.t1 - pipe_.t0), per_sec(mib(pipe_.bread), pipe_.tread));
+    if (compress) {
+        LOG("zip:   %" PRIu64 " files %.1f MiB -> %.1f MiB(%.2fx)  %.1f MiB/s per thread",
+                pipe_.nzip, mib(pipe_.bzip_in), mib(pipe_.bzip_out),
+                pipe_.bzip_out != 0 ? (double) pipe_.bzip_in / (double) pipe_.bzip_out : 0,
+                per_sec(mib(pipe_.bzip_in), pipe_.tzip));
+    }
+    if (dedup) {
+        LOG("dedup: %" PRIu64 " blocks %" PRIu64 " runs shared  %.1f MiB saved  "
+                "%.1f MiB/s hashed per thread",
+                w.nshared, w.nrshared, mib(w.bsaved), per_sec(mib(pipe_.bhashed), pipe_.tdedup));
+    }
+    if (verity) {
+        char root[2 * EMPTYFS_SHA256_LEN + 1];
+        int i;
+
+        for (i = 0; i < EMPTYFS_SHA256_LEN; i++)
+            (void) snprintf(root + 2 * i, 3, "%02x", w.vt.root[i]);
+        LOG("tree:  %" PRIu64 " blocks %.1f MiB hashed in %.3fs  %.1f MiB/s  %u level(s) %" PRIu64
+                " block(s)  root %s",
+                w.vt.tree_blk, mib(w.vt.tree_blk << EMPTYFS_IMG_BSHIFT), w.tvt,
+                per_sec(mib(w.vt.tree_blk << EMPTYFS_IMG_BSHIFT), w.tvt),
+                w.vt.levels, w.vt.nblk, root);
+    }
+    LOG("hash:  %" PRIu64 " dirs %" PRIu64 " entries  %.0f entries/s per thread",
+            pipe_.nhashed, pipe_.nents, per_sec((double) pipe_.nents, pipe_.thash));
+    LOG("write: %.1f MiB(%" PRIu64 " streamed) in %.3fs  %.1f MiB/s  stalled %.3fs",
+            mib(w.bytes), w.nstream, w.t1 - w.t0, per_sec(mib(w.bytes), w.t1 - w.t0), w.tstall);
+    LOG("%s: %" PRIu64 " blocks %" PRIu64 " inodes  %d thread(s)  total %.3fs",
+            argv[optind+1], w.cursor, pipe_.n, nthreads, now_sec() - t0);
+
+    return 0;
+}
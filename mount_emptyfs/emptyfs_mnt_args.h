@@ -9,14 +9,32 @@
 /* The largest 32-bit De Bruijn constant */
 #define EMPTYFS_MNTARG_MAGIC        0x0fb9ac52
 
+/* mount options  see: kext/src/emptyfs.h */
+#define EMPTYFS_MNT_NAMECACHE       0x00000001
+#define EMPTYFS_MNT_RAMFS           0x00000002
+#define EMPTYFS_MNT_PINROOT         0x00000004
+
 struct emptyfs_mnt_args {
 #ifndef KERNEL
     /* block special device to mount  example: /dev/disk0s1 */
     const char *fspec;
 #endif
     uint32_t magic;         /* must be EMPTYFS_MNTARG_MAGIC */
-    uint32_t dbg_mode;      /* enable debug for verbose output */
+    uint32_t dbg_mode;      /* enable debug  i.e. binary tracing of vnops */
     uint32_t force_fail;    /* if non-zero  mount(2) will always fail */
+    /*
+     * synthetic namespace  all zeros gives an empty root directory
+     * see: emptyfs_synth.h
+     */
+    uint32_t fanout;        /* sub-directories per directory */
+    uint32_t depth;         /* levels of sub-directories */
+    uint32_t files;         /* regular files per directory */
+    uint32_t seed;          /* perturbs file sizes and times */
+    uint32_t flags;         /* mount options  see EMPTYFS_MNT_* */
+    uint32_t ram_mb;        /* ramfs capacity in MiB  zero for default */
+    uint32_t cache_mb;      /* decompressed-block cache of an image in MiB  zero for default */
+    /* Merkle root an image must carry  all zeros accepts any(or none) */
+    uint8_t root[32];
 };
 
 #endif
@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <libgen.h>
@@ -31,15 +32,27 @@ static __dead2 void usage(char * __nonnull argv0)
     ASSERT_NONNULL(argv0);
     fprintf(stderr,
             "usage:\n\t"
-            "%s [-d | -f] specrdev fsnode\n\t"
+            "%s [-d | -f] [-c] [-P] [-F n] [-L n] [-N n] [-S n] specrdev fsnode\n\t"
+            "%s [-d | -f] [-c] [-P] -r [-s n] specrdev fsnode\n\t"
+            "%s [-d | -f] [-c] [-P] [-C n] [-R root] specrdev fsnode\n\t"
             "%s -v\n\n\t"
-            "-d, --debug-mode   mount in debug mode(verbose output)\n\t"
+            "-d, --debug-mode   mount in debug mode(trace vnops  see: emptyfsctl trace)\n\t"
             "-f, --force-fail   force mount failure\n\t"
+            "-c, --namecache    enable VFS name cache(incl. negative entries)\n\t"
+            "-P, --pin-root     create root vnode at mount  keep it till unmount\n\t"
+            "-F, --fanout n     sub-directories per directory\n\t"
+            "-L, --depth n      levels of sub-directories\n\t"
+            "-N, --files n      regular files per directory\n\t"
+            "-S, --seed n       seed of synthetic file sizes and times\n\t"
+            "-r, --ramfs        writable in-memory volume(no synthetic namespace)\n\t"
+            "-s, --size n       ramfs capacity in MiB(default 1024)\n\t"
+            "-C, --cache n      decompressed-block cache of an image in MiB(default 16)\n\t"
+            "-R, --root hex     Merkle root the image must have(see: mkfs_emptyfs -M)\n\t"
             "-v, --version      print version\n\t"
             "-h, --help         print this help\n\t"
             "specrdev           special raw device\n\t"
             "fsnode             file-system node\n\n",
-            basename(argv0), basename(argv0));
+            basename(argv0), basename(argv0), basename(argv0), basename(argv0));
     exit(1);
 }
 
@@ -56,18 +69,63 @@ static __dead2 void version(char * __nonnull argv0)
     exit(0);
 }
 
+/**
+ * Parse a 32-bit unsigned integer option argument
+ */
+static uint32_t parse_u32(char * __nonnull argv0, const char * __nonnull arg)
+{
+    unsigned long n;
+    char *end;
+
+    ASSERT_NONNULL(argv0);
+    ASSERT_NONNULL(arg);
+
+    errno = 0;
+    n = strtoul(arg, &end, 0);
+    if (errno != 0 || end == arg || *end != '\0' || n > UINT32_MAX) {
+        LOG_ERR("bad numeric argument: %s", arg);
+        usage(argv0);
+    }
+
+    return (uint32_t) n;
+}
+
+/**
+ * Parse a hex-encoded Merkle root  i.e. 64 hex digits
+ */
+static void parse_root(char * __nonnull argv0, const char * __nonnull arg, uint8_t root[32])
+{
+    unsigned int x;
+    int i;
+
+    ASSERT_NONNULL(argv0);
+    ASSERT_NONNULL(arg);
+
+    if (strlen(arg) != 64 || strspn(arg, "0123456789abcdefABCDEF") != 64) {
+        LOG_ERR("bad Merkle root: %s", arg);
+        usage(argv0);
+    }
+
+    for (i = 0; i < 32; i++) {
+        (void) sscanf(arg + 2 * i, "%2x", &x);
+        root[i] = (uint8_t) x;
+    }
+}
+
+/**
+ * @mnt_args    mount arguments  except fspec and magic which filled here
+ */
 static int do_mount(
         const char * __nonnull fspec,
         const char * __nonnull mp,
-        uint32_t dbg_mode,
-        uint32_t force_fail)
+        struct emptyfs_mnt_args * __nonnull mnt_args)
 {
     int e;
-    struct emptyfs_mnt_args mnt_args;
     char realmp[MAXPATHLEN];
 
     ASSERT_NONNULL(fspec);
     ASSERT_NONNULL(mp);
+    ASSERT_NONNULL(mnt_args);
 
     /*
      * [sic]
@@ -82,13 +140,11 @@ static int do_mount(
     }
 
 #ifndef KERNEL
-    mnt_args.fspec = fspec;
+    mnt_args->fspec = fspec;
 #endif
-    mnt_args.magic = EMPTYFS_MNTARG_MAGIC;
-    mnt_args.dbg_mode = dbg_mode;
-    mnt_args.force_fail = force_fail;
+    mnt_args->magic = EMPTYFS_MNTARG_MAGIC;
 
-    e = mount(EMPTYFS_NAME, realmp, 0, &mnt_args);
+    e = mount(EMPTYFS_NAME, realmp, 0, mnt_args);
     if (e == -1) {
         LOG_ERR("mount(2) fail  fspec: %s mp: %s errno: %d",
                     fspec, realmp, errno);
@@ -104,9 +160,20 @@ int main(int argc, char *argv[])
     int idx;
     int dbg_mode = 0;
     int force_fail = 0;
+    struct emptyfs_mnt_args mnt_args = {0};
     struct option opt[] = {
         {"debug-mode", no_argument, &dbg_mode, 1},
         {"force-fail", no_argument, &force_fail, 1},
+        {"namecache", no_argument, NULL, 'c'},
+        {"pin-root", no_argument, NULL, 'P'},
+        {"fanout", required_argument, NULL, 'F'},
+        {"depth", required_argument, NULL, 'L'},
+        {"files", required_argument, NULL, 'N'},
+        {"seed", required_argument, NULL, 'S'},
+        {"ramfs", no_argument, NULL, 'r'},
+        {"size", required_argument, NULL, 's'},
+        {"cache", required_argument, NULL, 'C'},
+        {"root", required_argument, NULL, 'R'},
         {"version", no_argument, NULL, 'v'},
         {"help", no_argument, NULL, 'h'},
         {NULL, no_argument, NULL, 0},
@@ -114,14 +181,47 @@ int main(int argc, char *argv[])
     char *fspec;
     char *mp;
 
-    while ((ch = getopt_long(argc, argv, "dfvh", opt, &idx)) != -1) {
+    while ((ch = getopt_long(argc, argv, "dfcPF:L:N:S:rs:C:R:vh", opt, &idx)) != -1) {
         switch (ch) {
+        case 0:
+            /* long option which sets a flag */
+            break;
         case 'd':
             dbg_mode = 1;
             break;
         case 'f':
             force_fail = 1;
             break;
+        case 'c':
+            mnt_args.flags |= EMPTYFS_MNT_NAMECACHE;
+            break;
+        case 'P':
+            mnt_args.flags |= EMPTYFS_MNT_PINROOT;
+            break;
+        case 'F':
+            mnt_args.fanout = parse_u32(argv[0], optarg);
+            break;
+        case 'L':
+            mnt_args.depth = parse_u32(argv[0], optarg);
+            break;
+        case 'N':
+            mnt_args.files = parse_u32(argv[0], optarg);
+            break;
+        case 'S':
+            mnt_args.seed = parse_u32(argv[0], optarg);
+            break;
+        case 'r':
+            mnt_args.flags |= EMPTYFS_MNT_RAMFS;
+            break;
+        case 's':
+            mnt_args.ram_mb = parse_u32(argv[0], optarg);
+            break;
+        case 'C':
+            mnt_args.cache_mb = parse_u32(argv[0], optarg);
+            break;
+        case 'R':
+            parse_root(argv[0], optarg, mnt_args.root);
+            break;
         case 'v':
             version(argv[0]);
         case 'h':
@@ -137,7 +237,13 @@ int main(int argc, char *argv[])
 
     LOG_DBG("dbg_mode: %d force_fail: %d fspec: %s mp: %s",
                 dbg_mode, force_fail, fspec, mp);
+    LOG_DBG("fanout: %u depth: %u files: %u seed: %u",
+                mnt_args.fanout, mnt_args.depth, mnt_args.files, mnt_args.seed);
+    LOG_DBG("flags: %#x ram_mb: %u", mnt_args.flags, mnt_args.ram_mb);
+
+    mnt_args.dbg_mode = dbg_mode;
+    mnt_args.force_fail = force_fail;
 
-    return do_mount(fspec, mp, dbg_mode, force_fail);
+    return do_mount(fspec, mp, &mnt_args);
 }
 
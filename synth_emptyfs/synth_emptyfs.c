@@ -0,0 +1,482 @@
+/*
+ * Created 261018
+ *
+ * Userspace generator/checker of emptyfs synthetic namespace
+ *  it shares emptyfs_synth.h with the kext  thus a mounted emptyfs volume
+ *  can be checked against the very same computation on any POSIX system
+ */
+
+#define _XOPEN_SOURCE   700
+/* d_type and DT_* aren't POSIX */
+#define _DEFAULT_SOURCE
+#define _DARWIN_C_SOURCE
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#ifdef __APPLE__
+#include <sys/sysctl.h>
+#endif
+
+#include "emptyfs_synth.h"
+
+#define SYNTH_EMPTYFS_VERSION   "0.1"
+
+#define LOG(fmt, ...)       printf("synth_emptyfs: " fmt "\n", ##__VA_ARGS__)
+#define LOG_ERR(fmt, ...)   fprintf(stderr, "synth_emptyfs: [ERR] " fmt "\n", ##__VA_ARGS__)
+
+#define ASSERT_NONNULL(p)   assert(p != NULL)
+
+#ifndef PATH_MAX
+#define PATH_MAX            1024
+#endif
+
+static __attribute__((noreturn)) void usage(char *argv0)
+{
+    ASSERT_NONNULL(argv0);
+    fprintf(stderr,
+            "usage:\n\t"
+            "%s [-F n] [-L n] [-N n] [-S n] list\n\t"
+            "%s [-F n] [-L n] [-N n] [-S n] gen dir\n\t"
+            "%s [-F n] [-L n] [-N n] [-S n] [-i] check dir\n\t"
+            "%s [-r n] bench dir\n\t"
+            "%s [-r n] storm dir\n\n\t"
+            "-F n       sub-directories per directory\n\t"
+            "-L n       levels of sub-directories\n\t"
+            "-N n       regular files per directory\n\t"
+            "-S n       seed of file sizes and times\n\t"
+            "-i         also check inode numbers(only valid on emptyfs)\n\t"
+            "-r n       rounds of bench or storm(default: 1)\n\t"
+            "-v         print version\n\t"
+            "-h         print this help\n\n\t"
+            "list       print expected namespace\n\t"
+            "gen        materialize expected namespace under an empty dir\n\t"
+            "check      verify a directory tree against expected namespace\n\t"
+            "bench      measure readdir(3) throughput(entries/sec) of a tree\n\t"
+            "storm      lstat(2) nonexistent `._' names  like Finder does\n\n",
+            basename(argv0), basename(argv0), basename(argv0),
+            basename(argv0), basename(argv0));
+    exit(1);
+}
+
+static uint32_t parse_u32(char *argv0, const char *arg)
+{
+    unsigned long n;
+    char *end;
+
+    errno = 0;
+    n = strtoul(arg, &end, 0);
+    if (errno != 0 || end == arg || *end != '\0' || n > UINT32_MAX) {
+        LOG_ERR("bad numeric argument: %s", arg);
+        usage(argv0);
+    }
+
+    return (uint32_t) n;
+}
+
+/**
+ * @return      length of the resulting path  -1 if too long
+ */
+static int join_path(char *buf, size_t len, const char *dir, const char *name)
+{
+    int n = snprintf(buf, PATH_MAX, "%.*s/%s", (int) len, dir, name);
+    return n < 0 || n >= PATH_MAX ? -1 : n;
+}
+
+static void do_list(const struct emptyfs_synth *sy, uint64_t dino, const char *path)
+{
+    char sub[PATH_MAX];
+    char name[EMPTYFS_SYNTH_NAME_MAX];
+    uint64_t n = emptyfs_synth_nentries(sy, dino);
+    uint64_t i;
+    uint64_t ino;
+
+    for (i = 0; i < n; i++) {
+        ino = emptyfs_synth_child(sy, dino, i);
+        (void) emptyfs_synth_name(sy, ino, name);
+        if (join_path(sub, strlen(path), path, name) < 0) continue;
+
+        printf("%" PRIu64 " %c %" PRIu64 " %" PRIu64 " %s\n",
+                ino, emptyfs_synth_isdir(sy, ino) ? 'd' : 'f',
+                emptyfs_synth_size(sy, ino), emptyfs_synth_mtime(sy, ino), sub);
+
+        if (emptyfs_synth_isdir(sy, ino)) do_list(sy, ino, sub);
+    }
+}
+
+static int set_mtime(const char *path, uint64_t t)
+{
+    struct timeval tv[2];
+
+    tv[0].tv_sec = tv[1].tv_sec = (time_t) t;
+    tv[0].tv_usec = tv[1].tv_usec = 0;
+    return utimes(path, tv);
+}
+
+/**
+ * @return      number of errors
+ */
+static unsigned long do_gen(const struct emptyfs_synth *sy, uint64_t dino, const char *path)
+{
+    unsigned long err = 0;
+    char sub[PATH_MAX];
+    char name[EMPTYFS_SYNTH_NAME_MAX];
+    uint64_t n = emptyfs_synth_nentries(sy, dino);
+    uint64_t i;
+    uint64_t ino;
+    int fd;
+
+    for (i = 0; i < n; i++) {
+        ino = emptyfs_synth_child(sy, dino, i);
+        (void) emptyfs_synth_name(sy, ino, name);
+        if (join_path(sub, strlen(path), path, name) < 0) {
+            LOG_ERR("path too long: %s/%s", path, name);
+            err++;
+            continue;
+        }
+
+        if (emptyfs_synth_isdir(sy, ino)) {
+            if (mkdir(sub, 0755) != 0) {
+                LOG_ERR("mkdir(2) fail  path: %s errno: %d", sub, errno);
+                err++;
+                continue;
+            }
+            err += do_gen(sy, ino, sub);
+        } else {
+            fd = open(sub, O_WRONLY | O_CREAT | O_EXCL, 0644);
+            if (fd < 0) {
+                LOG_ERR("open(2) fail  path: %s errno: %d", sub, errno);
+                err++;
+                continue;
+            }
+            /* sparse  we only care about its size */
+            if (ftruncate(fd, (off_t) emptyfs_synth_size(sy, ino)) != 0) {
+                LOG_ERR("ftruncate(2) fail  path: %s errno: %d", sub, errno);
+                err++;
+            }
+            (void) close(fd);
+        }
+
+        /* directory mtime must be set after its content populated */
+        if (set_mtime(sub, emptyfs_synth_mtime(sy, ino)) != 0) {
+            LOG_ERR("utimes(2) fail  path: %s errno: %d", sub, errno);
+            err++;
+        }
+    }
+
+    return err;
+}
+
+static unsigned long check_entry(
+        const struct emptyfs_synth *sy,
+        uint64_t ino,
+        const char *path,
+        int check_ino)
+{
+    unsigned long err = 0;
+    struct stat st;
+    int isdir = emptyfs_synth_isdir(sy, ino);
+
+    if (lstat(path, &st) != 0) {
+        LOG_ERR("lstat(2) fail  path: %s errno: %d", path, errno);
+        return 1;
+    }
+
+    if (isdir ? !S_ISDIR(st.st_mode) : !S_ISREG(st.st_mode)) {
+        LOG_ERR("%s: type mismatch  mode: %#o", path, (unsigned) st.st_mode);
+        err++;
+    }
+
+    if (!isdir && (uint64_t) st.st_size != emptyfs_synth_size(sy, ino)) {
+        LOG_ERR("%s: size mismatch  %" PRIu64 " vs %" PRIu64,
+                path, (uint64_t) st.st_size, emptyfs_synth_size(sy, ino));
+        err++;
+    }
+
+    if ((uint64_t) st.st_mtime != emptyfs_synth_mtime(sy, ino)) {
+        LOG_ERR("%s: mtime mismatch  %" PRIu64 " vs %" PRIu64,
+                path, (uint64_t) st.st_mtime, emptyfs_synth_mtime(sy, ino));
+        err++;
+    }
+
+    if (check_ino && (uint64_t) st.st_ino != ino) {
+        LOG_ERR("%s: inode mismatch  %" PRIu64 " vs %" PRIu64,
+                path, (uint64_t) st.st_ino, ino);
+        err++;
+    }
+
+    return err;
+}
+
+/**
+ * @return      number of mismatches
+ */
+static unsigned long do_check(
+        const struct emptyfs_synth *sy,
+        uint64_t dino,
+        const char *path,
+        int check_ino)
+{
+    unsigned long err = 0;
+    char sub[PATH_MAX];
+    DIR *d;
+    struct dirent *de;
+    uint64_t n = 0;
+    uint64_t ino;
+    size_t len;
+
+    d = opendir(path);
+    if (d == NULL) {
+        LOG_ERR("opendir(3) fail  path: %s errno: %d", path, errno);
+        return 1;
+    }
+
+    /* names are unique  .: matching count plus all names valid means equal */
+    while ((de = readdir(d)) != NULL) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+
+        len = strlen(de->d_name);
+        ino = emptyfs_synth_lookup(sy, dino, de->d_name, len);
+        if (ino == 0) {
+            LOG_ERR("%s/%s: unexpected entry", path, de->d_name);
+            err++;
+            continue;
+        }
+        n++;
+
+        if (join_path(sub, strlen(path), path, de->d_name) < 0) {
+            LOG_ERR("path too long: %s/%s", path, de->d_name);
+            err++;
+            continue;
+        }
+
+        err += check_entry(sy, ino, sub, check_ino);
+        if (emptyfs_synth_isdir(sy, ino)) err += do_check(sy, ino, sub, check_ino);
+    }
+
+    (void) closedir(d);
+
+    if (n != emptyfs_synth_nentries(sy, dino)) {
+        LOG_ERR("%s: %" PRIu64 " entries  expected %" PRIu64,
+                path, n, emptyfs_synth_nentries(sy, dino));
+        err++;
+    }
+
+    return err;
+}
+
+/**
+ * Walk a directory tree by readdir(3) only  no stat(2) involved
+ * @return      number of errors
+ */
+static unsigned long do_walk(const char *path, uint64_t *nent)
+{
+    unsigned long err = 0;
+    char sub[PATH_MAX];
+    DIR *d;
+    struct dirent *de;
+
+    d = opendir(path);
+    if (d == NULL) {
+        LOG_ERR("opendir(3) fail  path: %s errno: %d", path, errno);
+        return 1;
+    }
+
+    while ((de = readdir(d)) != NULL) {
+        (*nent)++;
+        if (de->d_type != DT_DIR) continue;
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+
+        if (join_path(sub, strlen(path), path, de->d_name) < 0) {
+            LOG_ERR("path too long: %s/%s", path, de->d_name);
+            err++;
+            continue;
+        }
+
+        err += do_walk(sub, nent);
+    }
+
+    (void) closedir(d);
+    return err;
+}
+
+static double now_sec(void)
+{
+    struct timeval tv;
+    (void) gettimeofday(&tv, NULL);
+    return (double) tv.tv_sec + (double) tv.tv_usec / 1e6;
+}
+
+/**
+ * @return      number of errors
+ */
+static unsigned long do_bench(const char *path, uint32_t rounds)
+{
+    unsigned long err = 0;
+    uint64_t nent = 0;
+    uint32_t i;
+    double t;
+
+    t = now_sec();
+    for (i = 0; i < rounds; i++) err += do_walk(path, &nent);
+    t = now_sec() - t;
+
+    LOG("bench: %u round(s) %" PRIu64 " entries in %.3fs  %.0f entries/sec",
+            rounds, nent, t, t > 0 ? (double) nent / t : 0.0);
+
+    return err;
+}
+
+/* distinct nonexistent names per storm round */
+#define STORM_NAMES     64
+
+/**
+ * @return      calls into vnop_lookup so far  0 if unavailable
+ */
+static uint64_t kernel_lookups(void)
+{
+    uint64_t n = 0;
+#ifdef __APPLE__
+    size_t len = sizeof(n);
+    if (sysctlbyname("vfs.generic.emptyfs.lookup", &n, &len, NULL, 0) != 0) n = 0;
+#endif
+    return n;
+}
+
+/**
+ * @return      number of errors
+ */
+static unsigned long do_storm(const char *path, uint32_t rounds)
+{
+    unsigned long err = 0;
+    char sub[PATH_MAX];
+    char name[32];
+    struct stat st;
+    uint64_t n = 0;
+    uint64_t k0, k1;
+    uint32_t i, j;
+    double t;
+
+    k0 = kernel_lookups();
+    t = now_sec();
+    for (i = 0; i < rounds; i++) {
+        for (j = 0; j < STORM_NAMES; j++) {
+            (void) snprintf(name, sizeof(name), "._d%u", j);
+            if (join_path(sub, strlen(path), path, name) < 0) {
+                LOG_ERR("path too long: %s/%s", path, name);
+                return 1;
+            }
+
+            n++;
+            if (lstat(sub, &st) == 0) {
+                LOG_ERR("%s: unexpected entry", sub);
+                err++;
+            } else if (errno != ENOENT) {
+                LOG_ERR("lstat(2) fail  path: %s errno: %d", sub, errno);
+                err++;
+            }
+        }
+    }
+    t = now_sec() - t;
+    k1 = kernel_lookups();
+
+    LOG("storm: %" PRIu64 " lookups in %.3fs  %.0f lookups/sec",
+            n, t, t > 0 ? (double) n / t : 0.0);
+    /* other processes may look up the volume meanwhile  thus it's an estimate */
+    if (k1 != 0) {
+        LOG("storm: %" PRIu64 " reached emptyfs  %" PRIu64 " avoided by name cache",
+                k1 - k0, n > k1 - k0 ? n - (k1 - k0) : 0);
+    }
+
+    return err;
+}
+
+int main(int argc, char *argv[])
+{
+    int ch;
+    uint32_t fanout = 0;
+    uint32_t depth = 0;
+    uint32_t files = 0;
+    uint32_t seed = 0;
+    int check_ino = 0;
+    uint32_t rounds = 1;
+    struct emptyfs_synth sy;
+    const char *cmd;
+    unsigned long err;
+
+    while ((ch = getopt(argc, argv, "F:L:N:S:ir:vh")) != -1) {
+        switch (ch) {
+        case 'F':
+            fanout = parse_u32(argv[0], optarg);
+            break;
+        case 'L':
+            depth = parse_u32(argv[0], optarg);
+            break;
+        case 'N':
+            files = parse_u32(argv[0], optarg);
+            break;
+        case 'S':
+            seed = parse_u32(argv[0], optarg);
+            break;
+        case 'i':
+            check_ino = 1;
+            break;
+        case 'r':
+            rounds = parse_u32(argv[0], optarg);
+            break;
+        case 'v':
+            fprintf(stderr, "%s version %s\nbuilt date %s %s\n\n",
+                    basename(argv[0]), SYNTH_EMPTYFS_VERSION, __DATE__, __TIME__);
+            exit(0);
+        case 'h':
+        case '?':
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (optind >= argc) usage(argv[0]);
+    cmd = argv[optind];
+
+    if (emptyfs_synth_init(&sy, fanout, depth, files, seed) != 0) {
+        LOG_ERR("namespace too large  fanout: %u depth: %u files: %u",
+                    fanout, depth, files);
+        exit(1);
+    }
+
+    if (!strcmp(cmd, "list") && argc - optind == 1) {
+        do_list(&sy, EMPTYFS_SYNTH_ROOT_INO, ".");
+        return 0;
+    }
+
+    if (argc - optind != 2) usage(argv[0]);
+
+    /* neither depends on expected namespace */
+    if (!strcmp(cmd, "bench")) return do_bench(argv[optind+1], rounds) != 0;
+    if (!strcmp(cmd, "storm")) return do_storm(argv[optind+1], rounds) != 0;
+
+    if (!strcmp(cmd, "gen")) {
+        err = do_gen(&sy, EMPTYFS_SYNTH_ROOT_INO, argv[optind+1]);
+    } else if (!strcmp(cmd, "check")) {
+        /* times and inode of root are mount-specific  skip them */
+        err = do_check(&sy, EMPTYFS_SYNTH_ROOT_INO, argv[optind+1], check_ino);
+    } else {
+        usage(argv[0]);
+    }
+
+    LOG("%s: %" PRIu64 " dirs %" PRIu64 " files  %lu error(s)",
+            cmd, sy.ndirs, sy.nfiles, err);
+
+    return err != 0;
+}